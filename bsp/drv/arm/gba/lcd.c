@@ -83,6 +83,8 @@ static struct wscons_video_ops wscons_lcd_ops = {
 	lcd_eraserows,		/* eraserows */
 	lcd_set_attr,		/* set_attr */
 	lcd_get_cursor,		/* get_cursor */
+	NULL,			/* putrow */
+	NULL,			/* scroll */
 };
 
 static void
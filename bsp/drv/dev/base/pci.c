@@ -138,6 +138,21 @@ void write_pci_io_bar(struct pci_device *v, int bar_number, uint32_t val) {
   write_pci_raw_bar(v, bar_number, (val & (~0x3)) | 0x1);
 }
 
+/* The low four bits of a memory BAR hold its type and prefetch flag.
+   Only 32-bit BARs are handled. */
+uint32_t read_pci_mem_bar(struct pci_device *v, int bar_number) {
+  return read_pci_raw_bar(v, bar_number) & (~0xf);
+}
+
+/* Returns a kernel pointer to the registers at addr, or NULL if they
+   lie outside the window the HAL maps for us. */
+void *pci_mem_map(uint32_t addr, size_t size) {
+  if (addr < PCI_MEM_BASE || size > PCI_MEM_SIZE ||
+      addr - PCI_MEM_BASE > PCI_MEM_SIZE - size)
+    return NULL;
+  return (void *) addr;
+}
+
 static void probe_pci(void) {
   int bus = 0; /* for now */
   int dev;
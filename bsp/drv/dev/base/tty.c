@@ -58,6 +58,9 @@
 #define	FREAD		0x0001
 #define	FWRITE		0x0002
 
+/* Bytes moved per copyin/copyout in read and write */
+#define TTY_CHUNK	64
+
 static void tty_output(int c, struct tty *tp);
 
 /* default control characters */
@@ -113,6 +116,54 @@ tty_putc(int c, struct tty_queue *tq)
 	splx(s);
 }
 
+/*
+ * Get up to n characters from a queue into buf.
+ * Returns the number of characters taken.
+ */
+int
+tty_getbuf(struct tty_queue *tq, char *buf, int n)
+{
+	int s, len, done;
+
+	s = splhigh();
+	if (n > tq->tq_count)
+		n = tq->tq_count;
+	for (done = 0; done < n; done += len) {
+		len = TTYQ_SIZE - tq->tq_head;
+		if (len > n - done)
+			len = n - done;
+		memcpy(buf + done, &tq->tq_buf[tq->tq_head], (size_t)len);
+		tq->tq_head = (tq->tq_head + len) & (TTYQ_SIZE - 1);
+	}
+	tq->tq_count -= n;
+	splx(s);
+	return n;
+}
+
+/*
+ * Put up to n characters from buf into a queue.
+ * Returns the number of characters stored.
+ */
+static int
+tty_putbuf(const char *buf, int n, struct tty_queue *tq)
+{
+	int s, len, done;
+
+	s = splhigh();
+	if (n > TTYQ_SIZE - tq->tq_count)
+		n = TTYQ_SIZE - tq->tq_count;
+	for (done = 0; done < n; done += len) {
+		len = TTYQ_SIZE - tq->tq_tail;
+		if (len > n - done)
+			len = n - done;
+		memcpy(&tq->tq_buf[tq->tq_tail], buf + done, (size_t)len);
+		tq->tq_tail = (tq->tq_tail + len) & (TTYQ_SIZE - 1);
+	}
+	tq->tq_count += n;
+	splx(s);
+	return n;
+}
+
 /*
  * Remove the last character in a queue and return it.
  */
@@ -394,6 +445,45 @@ tty_input(int c, struct tty *tp)
 	tty_start(tp);
 }
 
+/*
+ * Process a burst of characters received on a tty.
+ * In raw mode, where tty_input() would only queue them, the
+ * whole burst is stored at once and the reader is woken up
+ * once.  Characters that do not fit into the raw queue are
+ * dropped.  This may be called with interrupt level.
+ */
+void
+tty_input_buf(const char *buf, int n, struct tty *tp)
+{
+	unsigned char *cc;
+	int i;
+
+	cc = tp->t_cc;
+	if ((tp->t_lflag & (ICANON | ISIG | ECHO)) ||
+	    (tp->t_iflag & (IGNCR | ICRNL | INLCR | IXON)))
+		goto slow;
+#if defined(DEBUG) && defined(CONFIG_KD)
+	for (i = 0; i < n; i++) {
+		if ((u_char)buf[i] == cc[VDDB])
+			goto slow;
+	}
+#endif
+	pm_notify(PME_USER_ACTIVITY);
+
+	tty_putbuf(buf, n, &tp->t_rawq);
+	sched_wakeup(&tp->t_input);
+
+	if ((tp->t_state & TS_TTSTOP) && (tp->t_iflag & IXANY) == 0 &&
+	    cc[VSTART] != cc[VSTOP])
+		return;
+	tp->t_state &= ~TS_TTSTOP;
+	tty_start(tp);
+	return;
+ slow:
+	for (i = 0; i < n; i++)
+		tty_input((int)(u_char)buf[i], tp);
+}
+
 /*
  * Output a single character on a tty, doing output processing
  * as needed (expanding tabs, newline processing, etc.).
@@ -454,7 +544,8 @@ tty_read(struct tty *tp, char *buf, size_t *nbyte)
 {
 	unsigned char *cc;
 	struct tty_queue *qp;
-	int rc, tmp;
+	char kbuf[TTY_CHUNK];
+	int rc, tmp, n, i, eol;
 	u_char c;
 	size_t count = 0;
 	tcflag_t lflag;
@@ -473,18 +564,38 @@ tty_read(struct tty *tp, char *buf, size_t *nbyte)
 			return EINTR;
 		}
 	}
-	while (count < *nbyte) {
-		if ((tmp = tty_getc(qp)) == -1)
-			break;
-		c = (u_char)tmp;
-		if (c == cc[VEOF] && (lflag & ICANON))
+	eol = 0;
+	while (count < *nbyte && !eol) {
+		n = TTY_CHUNK;
+		if (*nbyte - count < TTY_CHUNK)
+			n = (int)(*nbyte - count);
+
+		if (!(lflag & ICANON))
+			n = tty_getbuf(qp, kbuf, n);
+		else {
+			/* Stop at the end of a line */
+			for (i = 0; i < n; ) {
+				if ((tmp = tty_getc(qp)) == -1)
+					break;
+				c = (u_char)tmp;
+				if (c == cc[VEOF]) {
+					eol = 1;
+					break;
+				}
+				kbuf[i++] = (char)c;
+				if (c == '\n' || c == cc[VEOL]) {
+					eol = 1;
+					break;
+				}
+			}
+			n = i;
+		}
+		if (n == 0)
 			break;
-		count++;
-		if (copyout(&c, buf, 1))
+		if (copyout(kbuf, buf, (size_t)n))
 			return EFAULT;
-		if ((lflag & ICANON) && (c == '\n' || c == cc[VEOL]))
-			break;
-		buf++;
+		buf += n;
+		count += n;
 	}
 	*nbyte = count;
 	return 0;
@@ -497,26 +608,37 @@ int
 tty_write(struct tty *tp, char *buf, size_t *nbyte)
 {
 	size_t remain, count = 0;
-	u_char c;
+	char kbuf[TTY_CHUNK];
+	int n, i;
 
 	DPRINTF(("tty_write\n"));
 
 	remain = *nbyte;
 	while (remain > 0) {
-		if (tp->t_outq.tq_count > TTYQ_HIWAT) {
-			tty_start(tp);
-			if (tp->t_outq.tq_count <= TTYQ_HIWAT)
+		n = TTY_CHUNK;
+		if (remain < TTY_CHUNK)
+			n = (int)remain;
+		if (copyin(buf, kbuf, (size_t)n))
+			return EFAULT;
+
+		for (i = 0; i < n; ) {
+			if (tp->t_outq.tq_count > TTYQ_HIWAT) {
+				tty_start(tp);
+				if (tp->t_outq.tq_count <= TTYQ_HIWAT)
+					continue;
+				tp->t_state |= TS_ASLEEP;
+				sched_sleep(&tp->t_output);
 				continue;
-			tp->t_state |= TS_ASLEEP;
-			sched_sleep(&tp->t_output);
-			continue;
+			}
+			/* No output processing in raw mode */
+			if (!(tp->t_lflag & ICANON))
+				i += tty_putbuf(&kbuf[i], n - i, &tp->t_outq);
+			else
+				tty_output((int)(u_char)kbuf[i++], tp);
 		}
-		if (copyin(buf, &c, 1))
-			return EFAULT;
-		tty_output((int)c, tp);
-		buf++;
-		remain--;
-		count++;
+		buf += n;
+		remain -= n;
+		count += n;
 	}
 	tty_start(tp);
 	*nbyte = count;
@@ -611,9 +733,29 @@ void
 tty_attach(struct tty *tp)
 {
 	struct bootinfo *bi;
+	size_t size;
+	paddr_t pa;
+	char *buf;
+
+	/*
+	 * Allocate the three queue buffers in one chunk.  Large
+	 * queues do not fit in kmem, so use pages for them.
+	 */
+	size = 3 * TTYQ_SIZE;
+	if (size <= PAGE_SIZE / 2)
+		buf = kmem_alloc(size);
+	else {
+		pa = page_alloc(round_page(size));
+		buf = (pa == 0) ? NULL : ptokv(pa);
+	}
+	if (buf == NULL)
+		panic("tty_attach: no memory");
 
 	/* Initialize tty */
 	memset(tp, 0, sizeof(struct tty));
+	tp->t_rawq.tq_buf = buf;
+	tp->t_canq.tq_buf = buf + TTYQ_SIZE;
+	tp->t_outq.tq_buf = buf + 2 * TTYQ_SIZE;
 	memcpy(&tp->t_termios.c_cc, ttydefchars, sizeof(ttydefchars));
 
 	event_init(&tp->t_input, "TTY input");
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * virtio.c - virtio PCI transport and virtqueues
+ */
+
+/*
+ * Only the legacy interface is implemented: the registers sit in
+ * I/O BAR 0 and each queue is one physically contiguous split ring
+ * whose size the device chooses.  That is what QEMU's virtio PCI
+ * devices present by default on a PC machine.
+ */
+
+#include <driver.h>
+#include <pci.h>
+#include <virtio.h>
+
+/* Legacy register offsets in BAR 0 */
+#define VIO_HOST_FEATURES	0x00
+#define VIO_GUEST_FEATURES	0x04
+#define VIO_QUEUE_PFN		0x08
+#define VIO_QUEUE_SIZE		0x0c
+#define VIO_QUEUE_SEL		0x0e
+#define VIO_QUEUE_NOTIFY	0x10
+#define VIO_STATUS		0x12
+#define VIO_ISR			0x13
+#define VIO_CONFIG		0x14	/* device config, without MSI-X */
+
+/* Device status */
+#define STATUS_ACK		0x01
+#define STATUS_DRIVER		0x02
+#define STATUS_DRIVER_OK	0x04
+#define STATUS_FAILED		0x80
+
+/*
+ * x86 keeps stores in order, so it is enough to stop the compiler
+ * from moving ring accesses across the index updates.
+ */
+#define virtio_barrier()	__asm__ __volatile__("" ::: "memory")
+
+#define VRING_ROUND(x)	(((x) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1))
+
+/*
+ * Reset the device and negotiate features.  The device is left
+ * waiting for its queues; call virtio_ready() once they are set.
+ */
+int
+virtio_attach(struct virtio_dev *vd, struct pci_device *v, uint32_t wanted)
+{
+	uint32_t bar;
+
+	bar = read_pci_raw_bar(v, 0);
+	if (!(bar & 1))
+		return ENXIO;		/* not a legacy device */
+
+	vd->pci = v;
+	vd->iobase = (int)(bar & ~3);
+	write_pci_command(v, read_pci_command(v) |
+			  PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+	bus_write_8(vd->iobase + VIO_STATUS, 0);
+	bus_write_8(vd->iobase + VIO_STATUS, STATUS_ACK);
+	bus_write_8(vd->iobase + VIO_STATUS, STATUS_ACK | STATUS_DRIVER);
+
+	vd->features = bus_read_32(vd->iobase + VIO_HOST_FEATURES) & wanted;
+	bus_write_32(vd->iobase + VIO_GUEST_FEATURES, vd->features);
+	return 0;
+}
+
+void
+virtio_ready(struct virtio_dev *vd)
+{
+
+	bus_write_8(vd->iobase + VIO_STATUS,
+		    STATUS_ACK | STATUS_DRIVER | STATUS_DRIVER_OK);
+}
+
+/*
+ * Give up on a device.  The reset stops it from touching the
+ * queue memory, which the caller may free afterwards.
+ */
+void
+virtio_fail(struct virtio_dev *vd)
+{
+
+	bus_write_8(vd->iobase + VIO_STATUS, 0);
+	bus_write_8(vd->iobase + VIO_STATUS, STATUS_FAILED);
+}
+
+/*
+ * Read and acknowledge the interrupt status.  Zero means the
+ * interrupt was not ours.
+ */
+int
+virtio_intr(struct virtio_dev *vd)
+{
+
+	return bus_read_8(vd->iobase + VIO_ISR);
+}
+
+uint8_t
+virtio_cfg_read8(struct virtio_dev *vd, int off)
+{
+
+	return bus_read_8(vd->iobase + VIO_CONFIG + off);
+}
+
+uint16_t
+virtio_cfg_read16(struct virtio_dev *vd, int off)
+{
+
+	return bus_read_16(vd->iobase + VIO_CONFIG + off);
+}
+
+uint32_t
+virtio_cfg_read32(struct virtio_dev *vd, int off)
+{
+
+	return bus_read_32(vd->iobase + VIO_CONFIG + off);
+}
+
+/*
+ * Set up queue "num" of the device.  The descriptor table and the
+ * available ring share the first pages, and the used ring starts
+ * on the next 4K boundary.
+ */
+int
+virtq_init(struct virtio_dev *vd, struct virtq *vq, int num)
+{
+	size_t usedoff;
+	paddr_t base;
+	int size;
+
+	bus_write_16(vd->iobase + VIO_QUEUE_SEL, (uint16_t)num);
+	size = bus_read_16(vd->iobase + VIO_QUEUE_SIZE);
+	if (size == 0 || (size & (size - 1)) != 0)
+		return ENXIO;
+
+	usedoff = VRING_ROUND(sizeof(struct vring_desc) * size +
+			      sizeof(uint16_t) * (3 + size));
+	vq->memsz = usedoff + VRING_ROUND(sizeof(uint16_t) * 3 +
+					  sizeof(struct vring_used_elem) * size);
+	if (PAGE_SIZE < VRING_ALIGN)
+		vq->memsz += VRING_ALIGN;
+	if ((vq->mem = page_alloc(vq->memsz)) == 0)
+		return ENOMEM;
+	base = VRING_ROUND(vq->mem);
+	memset(ptokv(vq->mem), 0, vq->memsz);
+
+	vq->vd = vd;
+	vq->num = num;
+	vq->size = size;
+	vq->desc = ptokv(base);
+	vq->avail = (struct vring_avail *)(vq->desc + size);
+	vq->used = ptokv(base + usedoff);
+	vq->lastused = 0;
+
+	bus_write_32(vd->iobase + VIO_QUEUE_PFN, (uint32_t)(base / VRING_ALIGN));
+	return 0;
+}
+
+/*
+ * Make the chain starting at descriptor "head" available to the
+ * device.  The device is not told until virtq_notify(), so several
+ * chains can be handed over with one notification.
+ */
+void
+virtq_submit(struct virtq *vq, int head)
+{
+
+	vq->avail->ring[vq->avail->idx & (vq->size - 1)] = (uint16_t)head;
+	virtio_barrier();
+	vq->avail->idx++;
+}
+
+void
+virtq_notify(struct virtq *vq)
+{
+
+	virtio_barrier();
+	if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY))
+		bus_write_16(vq->vd->iobase + VIO_QUEUE_NOTIFY,
+			     (uint16_t)vq->num);
+}
+
+/*
+ * Take the next finished chain off the used ring.  Returns its
+ * head, or -1 if there is none.
+ */
+int
+virtq_dequeue(struct virtq *vq, uint32_t *len)
+{
+	volatile struct vring_used_elem *e;
+
+	if (vq->lastused == vq->used->idx)
+		return -1;
+	virtio_barrier();
+	e = &vq->used->ring[vq->lastused & (vq->size - 1)];
+	vq->lastused++;
+	if (len != NULL)
+		*len = e->len;
+	return (int)e->id;
+}
+
+/*
+ * Wait up to "msec" for a finished chain, for use before the
+ * interrupt is attached.
+ */
+int
+virtq_poll(struct virtq *vq, uint32_t *len, int msec)
+{
+	int i, head;
+
+	for (i = 0; i < msec * 10; i++) {
+		if ((head = virtq_dequeue(vq, len)) >= 0)
+			return head;
+		delay_usec(100);
+	}
+	return -1;
+}
@@ -61,6 +61,11 @@ struct wscons_softc {
 	int		nrows;		/* number of rows */
 	int		ncols;		/* number of cols */
 	int		attr;		/* current attribute */
+	u_short		*text;		/* copy of the screen */
+	short		*dirty_lo;	/* first changed col in a row */
+	short		*dirty_hi;	/* last changed col + 1 */
+	int		top;		/* text row shown at the top */
+	int		scroll;		/* rows not scrolled on screen yet */
 	struct esc_state esc;		/* escape state */
 	struct wscons_video_ops *vid_ops; /* video operations */
 	struct wscons_kbd_ops   *kbd_ops; /* keyboard operations */
@@ -107,6 +112,11 @@ static struct consdev wsconsdev = {
 
 static const u_short ansi_colors[] = {0, 4, 2, 6, 1, 5, 3, 7};
 
+/*
+ * Map a screen row to its row in the text buffer.
+ */
+#define TEXT_ROW(sc, r)	(((sc)->top + (r)) % (sc)->nrows)
+
 /*
  * Pointer to the wscons state. There can be only one instance.
  */
@@ -137,10 +147,95 @@ wscons_ioctl(device_t dev, u_long cmd, void *arg)
 	return tty_ioctl(tty, cmd, arg);
 }
 
+/*
+ * Mark cells of a screen row as changed.
+ */
+static void
+wscons_touch(struct wscons_softc *sc, int row, int col, int n)
+{
+	int i = TEXT_ROW(sc, row);
+
+	if (col < sc->dirty_lo[i])
+		sc->dirty_lo[i] = (short)col;
+	if (col + n > sc->dirty_hi[i])
+		sc->dirty_hi[i] = (short)(col + n);
+}
+
+/*
+ * Blank screen rows with the current attribute.
+ */
+static void
+wscons_fill(struct wscons_softc *sc, int row, int nrows)
+{
+	u_short *p;
+	u_short blank = (u_short)(' ' | (sc->attr << 8));
+	int col;
+
+	for (; nrows > 0; row++, nrows--) {
+		p = sc->text + TEXT_ROW(sc, row) * sc->ncols;
+		for (col = 0; col < sc->ncols; col++)
+			*p++ = blank;
+		wscons_touch(sc, row, 0, sc->ncols);
+	}
+}
+
+/*
+ * Bring the screen up to date with the text buffer.
+ *
+ * Output only goes to the text buffer, so that a burst of lines
+ * costs one scroll of the screen, and only the changed cells are
+ * drawn.  This is called once per output batch.
+ */
 static void
-wscons_move_cursor(struct wscons_softc *sc)
+wscons_update(struct wscons_softc *sc)
 {
 	struct wscons_video_ops *vops = sc->vid_ops;
+	u_short *cells;
+	int row, col, i, n, attr, redraw;
+
+	if ((n = sc->scroll) > 0) {
+		sc->scroll = 0;
+		redraw = 1;
+		if (n < sc->nrows) {
+			if (vops->scroll != NULL)
+				redraw = vops->scroll(sc->vid_aux, n);
+			else {
+				vops->copyrows(sc->vid_aux, n, 0,
+					       sc->nrows - n);
+				redraw = 0;
+			}
+		}
+		if (redraw) {
+			for (row = 0; row < sc->nrows; row++)
+				wscons_touch(sc, row, 0, sc->ncols);
+		}
+	}
+
+	attr = sc->attr;
+	for (row = 0; row < sc->nrows; row++) {
+		i = TEXT_ROW(sc, row);
+		col = sc->dirty_lo[i];
+		n = sc->dirty_hi[i] - col;
+		if (n <= 0)
+			continue;
+		sc->dirty_lo[i] = (short)sc->ncols;
+		sc->dirty_hi[i] = 0;
+
+		cells = sc->text + i * sc->ncols + col;
+		if (vops->putrow != NULL) {
+			vops->putrow(sc->vid_aux, row, col, cells, n);
+			continue;
+		}
+		for (; n > 0; col++, n--, cells++) {
+			if ((*cells >> 8) != attr) {
+				attr = *cells >> 8;
+				vops->set_attr(sc->vid_aux, attr);
+			}
+			vops->putc(sc->vid_aux, row, col, *cells & 0xff);
+		}
+	}
+	if (attr != sc->attr)
+		vops->set_attr(sc->vid_aux, sc->attr);
 
 	vops->cursor(sc->vid_aux, sc->row, sc->col);
 }
@@ -156,21 +251,21 @@ wscons_set_attr(struct wscons_softc *sc)
 static void
 wscons_clear(struct wscons_softc *sc)
 {
-	struct wscons_video_ops *vops = sc->vid_ops;
 
-	vops->eraserows(sc->vid_aux, 0, sc->nrows);
+	wscons_fill(sc, 0, sc->nrows);
+	sc->scroll = 0;
 	sc->col = 0;
 	sc->row = 0;
-	wscons_move_cursor(sc);
 }
 
 static void
 wscons_scrollup(struct wscons_softc *sc)
 {
-	struct wscons_video_ops *vops = sc->vid_ops;
 
-	vops->copyrows(sc->vid_aux, 1, 0, sc->nrows - 1);
-	vops->eraserows(sc->vid_aux, sc->nrows - 1, 1);
+	sc->top = (sc->top + 1) % sc->nrows;
+	if (sc->scroll < sc->nrows)
+		sc->scroll++;
+	wscons_fill(sc, sc->nrows - 1, 1);
 }
 
 static void
@@ -207,7 +302,6 @@ static int
 wscons_check_escape(struct wscons_softc *sc, char c)
 {
 	struct esc_state *esc = &sc->esc;
-	int move = 0;
 	int val;
 	u_short color;
 
@@ -261,7 +355,6 @@ wscons_check_escape(struct wscons_softc *sc, char c)
 			sc->col = esc->saved_col;
 			sc->row = esc->saved_row;
 			printf("TTY: restore %d %d\n", sc->col, sc->row);
-			wscons_move_cursor(sc);
 			break;
 		case 'K':	/* Clear to end of line */
 			break;
@@ -273,25 +366,21 @@ wscons_check_escape(struct wscons_softc *sc, char c)
 			sc->row -= esc->arg1;
 			if (sc->row < 0)
 				sc->row = 0;
-			move = 1;
 			break;
 		case 'B':	/* Move cursor down # lines */
 			sc->row += esc->arg1;
 			if (sc->row >= sc->nrows)
 				sc->row = sc->nrows - 1;
-			move = 1;
 			break;
 		case 'C':	/* Move cursor forward # spaces */
 			sc->col += esc->arg1;
 			if (sc->col >= sc->ncols)
 				sc->col = sc->ncols - 1;
-			move = 1;
 			break;
 		case 'D':	/* Move cursor back # spaces */
 			sc->col -= esc->arg1;
 			if (sc->col < 0)
 				sc->col = 0;
-			move = 1;
 			break;
 		case ';':
 			if (esc->argc == 1)
@@ -329,8 +418,6 @@ wscons_check_escape(struct wscons_softc *sc, char c)
 			break;
 
 		}
-		if (move)
-			wscons_move_cursor(sc);
 		goto reset;
 	case 6:
 		switch (c) {
@@ -342,7 +429,6 @@ wscons_check_escape(struct wscons_softc *sc, char c)
 				sc->row = sc->nrows - 1;
 			if (sc->col >= sc->ncols)
 				sc->col = sc->ncols - 1;
-			wscons_move_cursor(sc);
 			break;
 		case 'R':
 			/* XXX */
@@ -363,7 +449,6 @@ static void
 wscons_putc(int c)
 {
 	struct wscons_softc *sc = wscons_softc;
-	struct wscons_video_ops *vops = sc->vid_ops;
 
 	if (wscons_check_escape(sc, c))
 		return;
@@ -382,7 +467,9 @@ wscons_putc(int c)
 		return;
 	}
 
-	vops->putc(sc->vid_aux, sc->row, sc->col, c);
+	sc->text[TEXT_ROW(sc, sc->row) * sc->ncols + sc->col] =
+	    (u_short)((c & 0xff) | (sc->attr << 8));
+	wscons_touch(sc, sc->row, sc->col, 1);
 
 	sc->col++;
 	if (sc->col >= sc->ncols) {
@@ -407,7 +494,7 @@ wscons_start(struct tty *tp)
 	while ((c = tty_getc(&tp->t_outq)) >= 0)
 		wscons_putc(c);
 
-	wscons_move_cursor(sc);
+	wscons_update(sc);
 	tty_done(tp);
 }
 
@@ -426,7 +513,7 @@ wscons_cnputc(device_t dev, int c)
 	struct wscons_softc *sc = wscons_softc;
 
 	wscons_putc(c);
-	wscons_move_cursor(sc);
+	wscons_update(sc);
 }
 
 static void
@@ -450,12 +537,26 @@ void
 wscons_attach_video(struct wscons_video_ops *ops, void *aux)
 {
 	struct wscons_softc *sc = wscons_softc;
-	int diag = 0;
+	int row, diag = 0;
 
 	sc->vid_ops = ops;
 	sc->vid_aux = aux;
 	ops->get_cursor(aux, &sc->col, &sc->row);
 
+	/*
+	 * Start the text buffer with what is on the screen, so
+	 * that a redraw keeps the boot messages.  If the screen
+	 * can not be read, clear it to match the buffer.
+	 */
+	if (ops->getrow != NULL) {
+		for (row = 0; row < sc->nrows; row++)
+			ops->getrow(aux, row, 0, sc->text +
+				    TEXT_ROW(sc, row) * sc->ncols, sc->ncols);
+	} else {
+		ops->set_attr(aux, sc->attr);
+		ops->eraserows(aux, 0, sc->nrows);
+	}
+
 #ifdef CONFIG_DIAG_SCREEN
 	diag = 1;
 #endif
@@ -478,6 +579,9 @@ wscons_init(struct driver *self)
 	struct bootinfo *bi;
 	struct wscons_softc *sc;
 	device_t dev;
+	size_t size;
+	paddr_t pa;
+	int i;
 
 	dev = device_create(self, "tty", D_CHR|D_TTY);
 
@@ -494,5 +598,23 @@ wscons_init(struct driver *self)
 	machine_bootinfo(&bi);
 	sc->nrows = bi->video.text_y;
 	sc->ncols = bi->video.text_x;
+
+	/*
+	 * Allocate the text buffer and the dirty spans.
+	 */
+	size = (size_t)sc->nrows * (sc->ncols + 2) * sizeof(u_short);
+	if ((pa = page_alloc(round_page(size))) == 0)
+		panic("wscons_init: no memory");
+	sc->text = ptokv(pa);
+	sc->dirty_lo = (short *)(sc->text + sc->nrows * sc->ncols);
+	sc->dirty_hi = sc->dirty_lo + sc->nrows;
+	for (i = 0; i < sc->nrows * sc->ncols; i++)
+		sc->text[i] = (u_short)(' ' | (sc->attr << 8));
+	for (i = 0; i < sc->nrows; i++) {
+		sc->dirty_lo[i] = (short)sc->ncols;
+		sc->dirty_hi[i] = 0;
+	}
+	sc->top = 0;
+	sc->scroll = 0;
 	return 0;
 }
@@ -0,0 +1,1039 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ahci.c - AHCI SATA controller
+ */
+
+/*
+ * Every port with a disk has its own request queue.  If the disk
+ * and the HBA support native command queuing (NCQ), the queue keeps
+ * one chain of requests in each command slot, up to 32 at a time,
+ * and the disk completes them in whatever order suits it.  Other
+ * disks get one command at a time.
+ *
+ * The ISR only acknowledges the port interrupts; completions are
+ * reaped by the IST, which checks every slot in flight, so a burst
+ * of completions costs a single thread wakeup.  If the HBA supports
+ * command completion coalescing, it is enabled as well, so that it
+ * raises one interrupt per AHCI_CCC_COUNT completions (or after
+ * AHCI_CCC_TIMEOUT msec) instead of one each.
+ *
+ * Disks and partitions get the same names as with the hdd driver.
+ */
+
+#include <driver.h>
+#include <pci.h>
+#include <blkq.h>
+#include <disklabel.h>
+
+/* #define DEBUG_AHCI 1 */
+
+#ifdef DEBUG_AHCI
+#define DPRINTF(a)	printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define SECTOR_SIZE	512
+
+#define AHCI_MAXPORTS	32
+#define AHCI_MAXSLOTS	32
+#define AHCI_NPRD	56	/* PRD entries per command table */
+#define AHCI_MAXBLKS	128	/* sectors per command */
+#define AHCI_TIMEOUT	5000	/* msec for each command */
+
+/* Command completion coalescing */
+#define AHCI_CCC_COUNT	8	/* completions per interrupt */
+#define AHCI_CCC_TIMEOUT 1	/* msec */
+
+#define SLOT(n)		((uint32_t)1 << (n))
+
+/* Generic host control registers */
+#define HBA_CAP		0x00	/* capabilities */
+#define HBA_GHC		0x04	/* global host control */
+#define HBA_IS		0x08	/* interrupt status */
+#define HBA_PI		0x0c	/* ports implemented */
+#define HBA_VS		0x10	/* version */
+#define HBA_CCC_CTL	0x14	/* completion coalescing control */
+#define HBA_CCC_PORTS	0x18	/* completion coalescing ports */
+#define HBA_REGSIZE	0x1100
+
+#define CAP_NP(x)	(((x) & 0x1f) + 1)		/* number of ports */
+#define CAP_CCCS	0x00000080			/* coalescing supported */
+#define CAP_NCS(x)	((((x) >> 8) & 0x1f) + 1)	/* command slots */
+#define CAP_SNCQ	0x40000000			/* NCQ supported */
+
+#define GHC_HR		0x00000001	/* HBA reset */
+#define GHC_IE		0x00000002	/* interrupt enable */
+#define GHC_AE		0x80000000	/* AHCI enable */
+
+#define CCC_EN		0x00000001
+#define CCC_INT(x)	(((x) >> 3) & 0x1f)	/* interrupt used by CCC */
+#define CCC_CC(n)	((uint32_t)(n) << 8)
+#define CCC_TV(ms)	((uint32_t)(ms) << 16)
+
+/* Port registers */
+#define PORT_REG(n, r)	(0x100 + (n) * 0x80 + (r))
+#define PX_CLB		0x00	/* command list base */
+#define PX_CLBU		0x04
+#define PX_FB		0x08	/* received FIS base */
+#define PX_FBU		0x0c
+#define PX_IS		0x10	/* interrupt status */
+#define PX_IE		0x14	/* interrupt enable */
+#define PX_CMD		0x18	/* command and status */
+#define PX_TFD		0x20	/* task file data */
+#define PX_SIG		0x24	/* device signature */
+#define PX_SSTS		0x28	/* SATA status */
+#define PX_SERR		0x30	/* SATA error */
+#define PX_SACT		0x34	/* SATA active (NCQ tags) */
+#define PX_CI		0x38	/* command issue */
+
+#define CMD_ST		0x0001	/* start */
+#define CMD_SUD		0x0002	/* spin-up device */
+#define CMD_POD		0x0004	/* power on device */
+#define CMD_FRE		0x0010	/* FIS receive enable */
+#define CMD_FR		0x4000	/* FIS receive running */
+#define CMD_CR		0x8000	/* command list running */
+
+#define IS_DHRS		0x00000001	/* D2H register FIS */
+#define IS_PSS		0x00000002	/* PIO setup FIS */
+#define IS_DSS		0x00000004	/* DMA setup FIS */
+#define IS_SDBS		0x00000008	/* set device bits FIS */
+#define IS_IFS		0x08000000	/* interface fatal error */
+#define IS_HBDS		0x10000000	/* host bus data error */
+#define IS_HBFS		0x20000000	/* host bus fatal error */
+#define IS_TFES		0x40000000	/* task file error */
+#define IS_DONE		(IS_DHRS | IS_PSS | IS_DSS | IS_SDBS)
+#define IS_ERROR	(IS_IFS | IS_HBDS | IS_HBFS | IS_TFES)
+
+#define TFD_ERR		0x01
+#define TFD_DRQ		0x08
+#define TFD_BSY		0x80
+
+#define SSTS_DET(x)	((x) & 0xf)
+#define DET_PHY		3		/* device present, phy up */
+#define SIG_ATA		0x00000101	/* plain ATA disk */
+
+/* ATA commands */
+#define ATA_READ_DMA		0xc8
+#define ATA_WRITE_DMA		0xca
+#define ATA_READ_DMA_EXT	0x25
+#define ATA_WRITE_DMA_EXT	0x35
+#define ATA_READ_FPDMA		0x60	/* NCQ */
+#define ATA_WRITE_FPDMA		0x61	/* NCQ */
+#define ATA_IDENTIFY		0xec
+#define ATA_READ_LOG_EXT	0x2f
+
+#define LOG_NCQ_ERROR		0x10	/* NCQ command error log */
+#define NCQ_ERR_NQ		0x80	/* error was not for a queued command */
+#define NCQ_ERR_TAG(x)		((x) & 0x1f)
+
+#define FIS_H2D		0x27	/* register FIS, host to device */
+#define FIS_LEN		5	/* in dwords */
+
+/*
+ * Command header, one per slot in the command list
+ */
+struct ahci_cmdhdr {
+	uint32_t	flags;		/* PRDTL, W, CFL */
+	uint32_t	prdbc;		/* bytes transferred */
+	uint32_t	ctba;		/* command table base */
+	uint32_t	ctbau;
+	uint32_t	reserved[4];
+};
+
+#define CH_WRITE	0x40
+#define CH_PRDTL(n)	((uint32_t)(n) << 16)
+
+struct ahci_prd {
+	uint32_t	dba;		/* data base address */
+	uint32_t	dbau;
+	uint32_t	reserved;
+	uint32_t	dbc;		/* byte count - 1 */
+};
+
+/*
+ * Command table, one per slot (1K with AHCI_NPRD entries)
+ */
+struct ahci_cmdtbl {
+	uint8_t		cfis[64];	/* command FIS */
+	uint8_t		acmd[16];	/* ATAPI command */
+	uint8_t		reserved[48];
+	struct ahci_prd	prd[AHCI_NPRD];
+};
+
+/*
+ * Layout of the first page of a port's DMA memory.  The command
+ * tables follow in the next pages.
+ */
+#define PM_CMDLIST	0		/* 1K, 1K aligned */
+#define PM_RFIS		0x400		/* 256 bytes, 256 aligned */
+#define PM_SCRATCH	0x800		/* one sector for probing */
+
+struct ahci_softc;
+
+struct ahci_port {
+	struct ahci_softc *sc;		/* controller */
+	int		num;		/* port number */
+	char		devname[MAXDEVNAME]; /* "hdXdY" */
+	int		lba48;		/* 48-bit commands */
+	int		ncq;		/* native command queuing in use */
+	int		nslots;		/* command slots in use */
+	u_long		nsects;		/* capacity */
+	paddr_t		mem;		/* DMA memory */
+	size_t		memsz;
+	struct ahci_cmdhdr *cmdlist;	/* command list */
+	struct ahci_cmdtbl *cmdtbl;	/* command tables */
+	uint32_t	issued;		/* slots in flight */
+	uint32_t	is;		/* interrupt status from ISR */
+	struct blkreq	*slot[AHCI_MAXSLOTS]; /* chain in each slot */
+	u_long		expire[AHCI_MAXSLOTS]; /* deadline in ticks */
+	struct blkq	q;		/* request queue */
+	timer_t		tmr;		/* watchdog */
+};
+
+struct ahci_softc {
+	char		devname[MAXDEVNAME]; /* "hdX" */
+	struct pci_device *pci;		/* PCI function */
+	volatile uint8_t *regs;		/* HBA registers */
+	uint32_t	cap;		/* capabilities */
+	uint32_t	ccc;		/* IS bit of coalesced interrupt */
+	irq_t		irq;		/* interrupt handle */
+	struct ahci_port *port[AHCI_MAXPORTS];
+};
+
+/*
+ * Device private data: a whole disk or one partition of it.
+ */
+struct ahci_unit {
+	struct ahci_port *port;
+	u_long		start;		/* first sector */
+	u_long		nsects;		/* number of sectors */
+};
+
+static int	ahci_read(device_t, char *, size_t *, int);
+static int	ahci_write(device_t, char *, size_t *, int);
+static int	ahci_init(struct driver *);
+
+static struct devops ahci_devops = {
+	/* open */	no_open,
+	/* close */	no_close,
+	/* read */	ahci_read,
+	/* write */	ahci_write,
+	/* ioctl */	no_ioctl,
+	/* devctl */	no_devctl,
+};
+
+struct driver ahci_driver = {
+	/* name */	"ahci",
+	/* devops */	&ahci_devops,
+	/* devsz */	sizeof(struct ahci_unit),
+	/* flags */	0,
+	/* probe */	NULL,
+	/* init */	ahci_init,
+	/* shutdown */	NULL,
+};
+
+static uint32_t
+hba_read(struct ahci_softc *sc, int reg)
+{
+
+	return *(volatile uint32_t *)(sc->regs + reg);
+}
+
+static void
+hba_write(struct ahci_softc *sc, int reg, uint32_t val)
+{
+
+	*(volatile uint32_t *)(sc->regs + reg) = val;
+}
+
+static uint32_t
+port_read(struct ahci_port *p, int reg)
+{
+
+	return hba_read(p->sc, PORT_REG(p->num, reg));
+}
+
+static void
+port_write(struct ahci_port *p, int reg, uint32_t val)
+{
+
+	hba_write(p->sc, PORT_REG(p->num, reg), val);
+}
+
+/*
+ * Poll a register until the masked bits read "val".
+ * Returns -1 after about "msec" milliseconds.
+ */
+static int
+hba_wait(struct ahci_softc *sc, int reg, uint32_t mask, uint32_t val,
+	 int msec)
+{
+	int i;
+
+	for (i = 0; i < msec * 10; i++) {
+		if ((hba_read(sc, reg) & mask) == val)
+			return 0;
+		delay_usec(100);
+	}
+	return -1;
+}
+
+/*
+ * Build a register FIS for a read/write command.  A negative tag
+ * asks for a non-queued command.
+ */
+static void
+ahci_fis(struct ahci_port *p, uint8_t *fis, int cmd, u_long lba,
+	 u_long count, int tag)
+{
+
+	memset(fis, 0, 20);
+	fis[0] = FIS_H2D;
+	fis[1] = 0x80;			/* command register update */
+	fis[4] = (uint8_t)lba;
+	fis[5] = (uint8_t)(lba >> 8);
+	fis[6] = (uint8_t)(lba >> 16);
+	fis[7] = 0x40;			/* LBA mode */
+
+	if (tag >= 0) {
+		fis[2] = (cmd == IO_READ) ? ATA_READ_FPDMA : ATA_WRITE_FPDMA;
+		fis[3] = (uint8_t)count;	/* count goes in features */
+		fis[11] = (uint8_t)(count >> 8);
+		fis[12] = (uint8_t)(tag << 3);
+	} else if (p->lba48) {
+		fis[2] = (cmd == IO_READ) ? ATA_READ_DMA_EXT :
+		    ATA_WRITE_DMA_EXT;
+		fis[12] = (uint8_t)count;
+		fis[13] = (uint8_t)(count >> 8);
+	} else {
+		fis[2] = (cmd == IO_READ) ? ATA_READ_DMA : ATA_WRITE_DMA;
+		fis[7] |= (uint8_t)((lba >> 24) & 0x0f);
+		fis[12] = (uint8_t)count;
+		return;
+	}
+	fis[8] = (uint8_t)(lba >> 24);
+}
+
+/*
+ * Fill in a command slot for a chain of requests.
+ */
+static void
+ahci_load(struct ahci_port *p, int tag, struct blkreq *r, int cmd,
+	  u_long blkno)
+{
+	struct ahci_cmdtbl *tbl = &p->cmdtbl[tag];
+	struct ahci_prd *prd = tbl->prd;
+	u_long nblks = 0;
+	int i, n = 0;
+
+	for (; r != NULL; r = r->next) {
+		for (i = 0; i < r->nsegs; i++) {
+			ASSERT(n < AHCI_NPRD);
+			prd[n].dba = (uint32_t)r->segs[i].addr;
+			prd[n].dbau = 0;
+			prd[n].reserved = 0;
+			prd[n].dbc = (uint32_t)(r->segs[i].len - 1);
+			n++;
+		}
+		nblks += r->nblks;
+	}
+	ahci_fis(p, tbl->cfis, cmd, blkno, nblks, p->ncq ? tag : -1);
+	p->cmdlist[tag].flags = CH_PRDTL(n) | FIS_LEN |
+	    (cmd == IO_WRITE ? CH_WRITE : 0);
+	p->cmdlist[tag].prdbc = 0;
+}
+
+static void ahci_timeout(void *);
+static int ahci_poll(struct ahci_port *, int, u_long);
+
+/*
+ * Arm the watchdog for the oldest command in flight.
+ */
+static void
+ahci_arm(struct ahci_port *p)
+{
+	u_long now = timer_ticks();
+	long left, min = 0;
+	int tag, found = 0;
+
+	for (tag = 0; tag < p->nslots; tag++) {
+		if (!(p->issued & SLOT(tag)))
+			continue;
+		left = (long)(p->expire[tag] - now);
+		if (!found || left < min)
+			min = left;
+		found = 1;
+	}
+	if (min < 1)
+		min = 1;
+	timer_callout(&p->tmr, hztoms((u_long)min), ahci_timeout, p);
+}
+
+/*
+ * Issue the command loaded in a slot.
+ */
+static void
+ahci_issue(struct ahci_port *p, int tag)
+{
+
+	p->expire[tag] = timer_ticks() + mstohz(AHCI_TIMEOUT);
+	if (p->ncq)
+		port_write(p, PX_SACT, SLOT(tag));
+	port_write(p, PX_CI, SLOT(tag));
+}
+
+/*
+ * Start a chain of requests from the queue in a free slot.
+ * Called by the queue at splhigh.
+ */
+static void
+ahci_start(struct blkq *q, struct blkreq *r)
+{
+	struct ahci_port *p = q->priv;
+	int tag;
+
+	for (tag = 0; tag < p->nslots; tag++) {
+		if (!(p->issued & SLOT(tag)))
+			break;
+	}
+	ASSERT(tag < p->nslots);
+
+	ahci_load(p, tag, r, r->cmd, (u_long)r->blkno);
+	p->slot[tag] = r;
+	/* An older command keeps the watchdog if there is one. */
+	if (p->issued == 0)
+		timer_callout(&p->tmr, AHCI_TIMEOUT, ahci_timeout, p);
+	p->issued |= SLOT(tag);
+	ahci_issue(p, tag);
+}
+
+/*
+ * Complete the chains in the "done" slots.  The chains are taken
+ * out of their slots first, since finishing one may start new
+ * commands in the slots that have just been freed.
+ */
+static void
+ahci_finish(struct ahci_port *p, uint32_t done, int error)
+{
+	struct blkreq *r[AHCI_MAXSLOTS];
+	int tag;
+
+	for (tag = 0; tag < p->nslots; tag++) {
+		r[tag] = NULL;
+		if (done & SLOT(tag)) {
+			r[tag] = p->slot[tag];
+			p->slot[tag] = NULL;
+		}
+	}
+	p->issued &= ~done;
+	if (p->issued == 0)
+		timer_stop(&p->tmr);
+	else
+		ahci_arm(p);
+
+	for (tag = 0; tag < p->nslots; tag++) {
+		if (r[tag] != NULL)
+			blkq_end(&p->q, r[tag], error);
+	}
+}
+
+/*
+ * Stop and restart the command engine of a port.  This clears
+ * CI and SACT.
+ */
+static int
+ahci_port_stop(struct ahci_port *p)
+{
+	struct ahci_softc *sc = p->sc;
+
+	port_write(p, PX_CMD, port_read(p, PX_CMD) & ~CMD_ST);
+	return hba_wait(sc, PORT_REG(p->num, PX_CMD), CMD_CR, 0, 500);
+}
+
+/*
+ * Stop receiving FISes.
+ */
+static int
+ahci_fis_stop(struct ahci_port *p)
+{
+	struct ahci_softc *sc = p->sc;
+
+	port_write(p, PX_CMD, port_read(p, PX_CMD) & ~CMD_FRE);
+	return hba_wait(sc, PORT_REG(p->num, PX_CMD), CMD_FR, 0, 500);
+}
+
+static void
+ahci_port_start(struct ahci_port *p)
+{
+	struct ahci_softc *sc = p->sc;
+
+	hba_wait(sc, PORT_REG(p->num, PX_TFD), TFD_BSY | TFD_DRQ, 0, 1000);
+	port_write(p, PX_CMD, port_read(p, PX_CMD) | CMD_ST);
+}
+
+/*
+ * Find the queued command which failed from the NCQ error log.
+ * Reading the log also clears the error state of the disk, which
+ * does not accept queued commands until then.  Returns the tag,
+ * or -1 if the log can not tell.
+ */
+static int
+ahci_ncq_error(struct ahci_port *p)
+{
+	uint8_t *log;
+
+	if (ahci_poll(p, ATA_READ_LOG_EXT, LOG_NCQ_ERROR) != 0)
+		return -1;
+	log = ptokv(p->mem + PM_SCRATCH);
+	if (log[0] & NCQ_ERR_NQ)
+		return -1;
+	return NCQ_ERR_TAG(log[0]);
+}
+
+/*
+ * Recover from an error or a timeout.  Commands the disk had
+ * already finished complete normally.  When an NCQ command fails,
+ * the disk aborts all the others; the failed one is found from
+ * the error log and the others are issued again.  Otherwise,
+ * every command still in flight is failed.
+ */
+static void
+ahci_recover(struct ahci_port *p, int timedout)
+{
+	uint32_t busy, failed, retry;
+	int tag;
+
+	busy = port_read(p, PX_CI) | port_read(p, PX_SACT);
+	failed = p->issued & busy;
+	retry = 0;
+	printf("%s: %s, status 0x%08x tfd 0x%02x, active 0x%08x\n",
+	       p->devname, timedout ? "timeout" : "I/O error", p->is,
+	       port_read(p, PX_TFD) & 0xff, failed);
+
+	ahci_port_stop(p);
+	port_write(p, PX_SERR, 0xffffffff);
+	port_write(p, PX_IS, 0xffffffff);
+	p->is = 0;
+	ahci_port_start(p);
+
+	if (p->ncq && !timedout && failed != 0) {
+		tag = ahci_ncq_error(p);
+		if (tag >= 0 && (failed & SLOT(tag))) {
+			retry = failed & ~SLOT(tag);
+			failed = SLOT(tag);
+		}
+	}
+
+	ahci_finish(p, p->issued & ~(failed | retry), 0);
+	ahci_finish(p, failed, EIO);
+
+	/*
+	 * The log was read through slot 0, so the slots are
+	 * loaded again before they are issued.
+	 */
+	for (tag = 0; tag < p->nslots; tag++) {
+		if (!(retry & SLOT(tag)))
+			continue;
+		ahci_load(p, tag, p->slot[tag], p->slot[tag]->cmd,
+			  (u_long)p->slot[tag]->blkno);
+		ahci_issue(p, tag);
+	}
+	if (retry != 0)
+		ahci_arm(p);
+}
+
+static void
+ahci_timeout(void *arg)
+{
+	struct ahci_port *p = arg;
+	u_long now;
+	int tag, s;
+
+	s = splhigh();
+	now = timer_ticks();
+	for (tag = 0; tag < p->nslots; tag++) {
+		if ((p->issued & SLOT(tag)) &&
+		    (long)(now - p->expire[tag]) >= 0)
+			break;
+	}
+	if (tag < p->nslots)
+		ahci_recover(p, 1);
+	else if (p->issued != 0)
+		ahci_arm(p);
+	splx(s);
+}
+
+/*
+ * Interrupt service routine.  Acknowledge the port interrupts,
+ * remembering any error for the IST.
+ */
+static int
+ahci_isr(void *arg)
+{
+	struct ahci_softc *sc = arg;
+	struct ahci_port *p;
+	uint32_t is, pis;
+	int i;
+
+	if ((is = hba_read(sc, HBA_IS)) == 0)
+		return INT_DONE;
+
+	for (i = 0; i < AHCI_MAXPORTS; i++) {
+		if (!(is & SLOT(i)) || (p = sc->port[i]) == NULL)
+			continue;
+		pis = port_read(p, PX_IS);
+		port_write(p, PX_IS, pis);
+		p->is |= pis;
+	}
+	hba_write(sc, HBA_IS, is);
+	return INT_CONTINUE;
+}
+
+/*
+ * Interrupt service thread.  Reap every finished command.
+ */
+static void
+ahci_ist(void *arg)
+{
+	struct ahci_softc *sc = arg;
+	struct ahci_port *p;
+	uint32_t busy;
+	int i, s;
+
+	s = splhigh();
+	for (i = 0; i < AHCI_MAXPORTS; i++) {
+		if ((p = sc->port[i]) == NULL)
+			continue;
+		if (p->is & IS_ERROR) {
+			ahci_recover(p, 0);
+			continue;
+		}
+		p->is = 0;
+		if (p->issued == 0)
+			continue;
+		busy = port_read(p, PX_CI) | port_read(p, PX_SACT);
+		if (p->issued & ~busy)
+			ahci_finish(p, p->issued & ~busy, 0);
+	}
+	splx(s);
+}
+
+/*
+ * Run a command in slot 0 by polling.  This is used before
+ * interrupts are enabled, and to read the error log during
+ * recovery.  The data goes to the port's scratch sector.
+ */
+static int
+ahci_poll(struct ahci_port *p, int cmd, u_long blkno)
+{
+	struct ahci_softc *sc = p->sc;
+	struct ahci_cmdtbl *tbl = &p->cmdtbl[0];
+
+	tbl->prd[0].dba = (uint32_t)(p->mem + PM_SCRATCH);
+	tbl->prd[0].dbau = 0;
+	tbl->prd[0].reserved = 0;
+	tbl->prd[0].dbc = SECTOR_SIZE - 1;
+
+	if (cmd == ATA_IDENTIFY) {
+		memset(tbl->cfis, 0, 20);
+		tbl->cfis[0] = FIS_H2D;
+		tbl->cfis[1] = 0x80;
+		tbl->cfis[2] = ATA_IDENTIFY;
+	} else if (cmd == ATA_READ_LOG_EXT) {
+		/* One sector of the log page given in "blkno" */
+		memset(tbl->cfis, 0, 20);
+		tbl->cfis[0] = FIS_H2D;
+		tbl->cfis[1] = 0x80;
+		tbl->cfis[2] = ATA_READ_LOG_EXT;
+		tbl->cfis[4] = (uint8_t)blkno;
+		tbl->cfis[12] = 1;
+	} else
+		ahci_fis(p, tbl->cfis, IO_READ, blkno, 1, -1);
+	p->cmdlist[0].flags = CH_PRDTL(1) | FIS_LEN;
+	p->cmdlist[0].prdbc = 0;
+
+	port_write(p, PX_IS, 0xffffffff);
+	port_write(p, PX_CI, SLOT(0));
+	if (hba_wait(sc, PORT_REG(p->num, PX_CI), SLOT(0), 0, 1000) ||
+	    (port_read(p, PX_IS) & IS_ERROR) ||
+	    (port_read(p, PX_TFD) & TFD_ERR)) {
+		printf("%s: command 0x%02x failed, tfd 0x%02x\n",
+		       p->devname, cmd, port_read(p, PX_TFD) & 0xff);
+		ahci_port_stop(p);
+		port_write(p, PX_SERR, 0xffffffff);
+		port_write(p, PX_IS, 0xffffffff);
+		ahci_port_start(p);
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Decode IDENTIFY DEVICE data.
+ */
+static void
+ahci_identify(struct ahci_port *p, const uint16_t *id)
+{
+	struct ahci_softc *sc = p->sc;
+	char model[41];
+	uint32_t hi;
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		model[i * 2] = (char)(id[27 + i] >> 8);
+		model[i * 2 + 1] = (char)id[27 + i];
+	}
+	model[40] = '\0';
+	for (i = 39; i >= 0 && model[i] == ' '; i--)
+		model[i] = '\0';
+
+	p->lba48 = (id[83] & 0x0400) != 0;
+	if (p->lba48) {
+		p->nsects = id[100] | ((u_long)id[101] << 16);
+		hi = id[102] | ((uint32_t)id[103] << 16);
+	} else {
+		p->nsects = id[60] | ((u_long)id[61] << 16);
+		hi = 0;
+	}
+	/* Block numbers are ints. */
+	if (hi != 0 || p->nsects > 0x7fffffff)
+		p->nsects = 0x7fffffff;
+
+	p->ncq = 0;
+	p->nslots = 1;
+	if ((sc->cap & CAP_SNCQ) && (id[76] & 0x0100)) {
+		p->ncq = 1;
+		p->nslots = (id[75] & 0x1f) + 1;
+		if (p->nslots > CAP_NCS(sc->cap))
+			p->nslots = CAP_NCS(sc->cap);
+	}
+
+	printf("%s: %s, %lu sectors, %s, %d slot%s\n", p->devname, model,
+	       p->nsects, p->ncq ? "NCQ" : (p->lba48 ? "LBA48" : "LBA28"),
+	       p->nslots, p->nslots > 1 ? "s" : "");
+}
+
+static device_t
+ahci_mkdev(struct driver *self, struct ahci_port *p, const char *name,
+	   u_long start, u_long nsects)
+{
+	struct ahci_unit *u;
+	device_t dev;
+
+	dev = device_create(self, name, D_BLK | D_PROT);
+	u = device_private(dev);
+	u->port = p;
+	u->start = start;
+	u->nsects = nsects;
+	return dev;
+}
+
+/*
+ * Register the partitions of the DOS disklabel.
+ */
+static void
+ahci_partitions(struct driver *self, struct ahci_port *p)
+{
+	struct mbr_part mbr[MBR_NPART];
+	char name[MAXDEVNAME];
+	int i;
+
+	if (ahci_poll(p, IO_READ, 0) != 0 ||
+	    mbr_read(ptokv(p->mem + PM_SCRATCH), mbr) != 0)
+		return;
+
+	for (i = 0; i < MBR_NPART; i++) {
+		if (mbr[i].type == 0)
+			continue;
+		if (mbr[i].start >= p->nsects ||
+		    mbr[i].nsects > p->nsects - mbr[i].start) {
+			printf("%s: partition %d beyond end of disk\n",
+			       p->devname, i);
+			continue;
+		}
+		disk_partname(name, p->devname, i);
+		ahci_mkdev(self, p, name, mbr[i].start, mbr[i].nsects);
+		printf(" - partition %s, type 0x%02x, 0x%08x size 0x%08x\n",
+		       name, mbr[i].type, mbr[i].start, mbr[i].nsects);
+	}
+}
+
+/*
+ * Set up a port and the disk on it.
+ */
+static struct ahci_port *
+ahci_port_init(struct driver *self, struct ahci_softc *sc, int num)
+{
+	struct ahci_port *p;
+	paddr_t tbl;
+	int i, nslots;
+
+	/* Give the link a moment to come back after the HBA reset. */
+	if (hba_wait(sc, PORT_REG(num, PX_SSTS), 0xf, DET_PHY, 10) != 0)
+		return NULL;
+	if (num > 9) {
+		printf("%s: no name for port %d\n", sc->devname, num);
+		return NULL;
+	}
+
+	if ((p = kmem_alloc(sizeof(*p))) == NULL)
+		return NULL;
+	memset(p, 0, sizeof(*p));
+	p->sc = sc;
+	p->num = num;
+	strlcpy(p->devname, sc->devname, MAXDEVNAME);
+	p->devname[3] = 'd';
+	p->devname[4] = (char)('0' + num);
+	p->devname[5] = '\0';
+
+	nslots = CAP_NCS(sc->cap);
+	p->memsz = PAGE_SIZE + nslots * sizeof(struct ahci_cmdtbl);
+	if ((p->mem = page_alloc(p->memsz)) == 0) {
+		kmem_free(p);
+		return NULL;
+	}
+	memset(ptokv(p->mem), 0, p->memsz);
+	p->cmdlist = ptokv(p->mem + PM_CMDLIST);
+	p->cmdtbl = ptokv(p->mem + PAGE_SIZE);
+	for (i = 0; i < nslots; i++) {
+		tbl = p->mem + PAGE_SIZE + i * sizeof(struct ahci_cmdtbl);
+		p->cmdlist[i].ctba = (uint32_t)tbl;
+		p->cmdlist[i].ctbau = 0;
+	}
+
+	/* The port must be idle while its memory is set up. */
+	if (ahci_port_stop(p) != 0 || ahci_fis_stop(p) != 0) {
+		printf("%s: port %d does not stop\n", sc->devname, num);
+		goto fail;
+	}
+
+	port_write(p, PX_CLB, (uint32_t)(p->mem + PM_CMDLIST));
+	port_write(p, PX_CLBU, 0);
+	port_write(p, PX_FB, (uint32_t)(p->mem + PM_RFIS));
+	port_write(p, PX_FBU, 0);
+	port_write(p, PX_IE, 0);
+	port_write(p, PX_SERR, 0xffffffff);
+	port_write(p, PX_IS, 0xffffffff);
+	port_write(p, PX_CMD,
+		   port_read(p, PX_CMD) | CMD_FRE | CMD_SUD | CMD_POD);
+	ahci_port_start(p);
+
+	/* The signature arrives with the disk's first register FIS. */
+	if (port_read(p, PX_SIG) != SIG_ATA) {
+		DPRINTF(("ahci: port %d is not an ATA disk\n", num));
+		goto fail;
+	}
+	if (ahci_poll(p, ATA_IDENTIFY, 0) != 0)
+		goto fail;
+	ahci_identify(p, ptokv(p->mem + PM_SCRATCH));
+
+	blkq_init(&p->q, SECTOR_SIZE, AHCI_MAXBLKS, ahci_start, p);
+	p->q.depth = p->nslots;
+	p->q.maxsegs = AHCI_NPRD;
+
+	ahci_mkdev(self, p, p->devname, 0, p->nsects);
+	ahci_partitions(self, p);
+	return p;
+
+ fail:
+	/* Make sure the HBA no longer uses the memory. */
+	ahci_port_stop(p);
+	if (ahci_fis_stop(p) != 0)
+		return NULL;
+	page_free(p->mem, p->memsz);
+	kmem_free(p);
+	return NULL;
+}
+
+static void
+ahci_attach(struct driver *self, struct pci_device *v)
+{
+	struct ahci_softc *sc;
+	struct ahci_port *p;
+	uint32_t bar, pi, ports, ctl;
+	int i;
+
+	bar = read_pci_mem_bar(v, 5);
+	if ((sc = kmem_alloc(sizeof(*sc))) == NULL)
+		return;
+	memset(sc, 0, sizeof(*sc));
+	if ((sc->regs = pci_mem_map(bar, HBA_REGSIZE)) == NULL) {
+		printf("ahci: registers at 0x%08x are not mapped\n", bar);
+		kmem_free(sc);
+		return;
+	}
+	sc->pci = v;
+	write_pci_command(v, read_pci_command(v) |
+			  PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+
+	/* Reset the HBA, and switch it to AHCI mode. */
+	hba_write(sc, HBA_GHC, GHC_AE);
+	hba_write(sc, HBA_GHC, GHC_AE | GHC_HR);
+	if (hba_wait(sc, HBA_GHC, GHC_HR, 0, 1000) != 0) {
+		printf("ahci: reset failed\n");
+		kmem_free(sc);
+		return;
+	}
+	hba_write(sc, HBA_GHC, GHC_AE);
+
+	sc->cap = hba_read(sc, HBA_CAP);
+	pi = hba_read(sc, HBA_PI);
+	disk_ctlrname(sc->devname);
+	printf("device %d.%d.%d = %s (AHCI, %d ports, %d slots%s)\n",
+	       v->bus, v->slot, v->function, sc->devname,
+	       CAP_NP(sc->cap), CAP_NCS(sc->cap),
+	       (sc->cap & CAP_SNCQ) ? ", NCQ" : "");
+
+	ports = 0;
+	for (i = 0; i < AHCI_MAXPORTS; i++) {
+		if (!(pi & SLOT(i)))
+			continue;
+		if ((p = ahci_port_init(self, sc, i)) != NULL) {
+			sc->port[i] = p;
+			ports |= SLOT(i);
+		}
+	}
+	if (ports == 0)
+		return;
+
+	/*
+	 * Coalesce the completion interrupts of all our ports.  The
+	 * ports then only interrupt by themselves on errors.
+	 */
+	if (sc->cap & CAP_CCCS) {
+		ctl = hba_read(sc, HBA_CCC_CTL);
+		hba_write(sc, HBA_CCC_CTL, ctl & ~CCC_EN);
+		hba_write(sc, HBA_CCC_PORTS, ports);
+		hba_write(sc, HBA_CCC_CTL, CCC_CC(AHCI_CCC_COUNT) |
+			  CCC_TV(AHCI_CCC_TIMEOUT) | CCC_EN);
+		sc->ccc = SLOT(CCC_INT(ctl));
+	}
+
+	/* PCI interrupts are level triggered. */
+	sc->irq = irq_attach(read_pci_interrupt_line(v), IPL_BLOCK, 1,
+			     ahci_isr, ahci_ist, sc);
+	for (i = 0; i < AHCI_MAXPORTS; i++) {
+		if ((p = sc->port[i]) == NULL)
+			continue;
+		port_write(p, PX_IS, 0xffffffff);
+		port_write(p, PX_IE, sc->ccc ? IS_ERROR : IS_DONE | IS_ERROR);
+	}
+	hba_write(sc, HBA_IS, 0xffffffff);
+	hba_write(sc, HBA_GHC, GHC_AE | GHC_IE);
+}
+
+/*
+ * The HBA only moves whole words, so a transfer to an odd
+ * address goes through a bounce page.
+ */
+static int
+ahci_bounce(struct ahci_port *p, int cmd, char *buf, size_t *nbyte,
+	    int blkno)
+{
+	size_t done, len;
+	paddr_t pa;
+	char *kbuf;
+	int error = 0;
+
+	if ((pa = page_alloc(PAGE_SIZE)) == 0)
+		return ENOMEM;
+	kbuf = ptokv(pa);
+	for (done = 0; done < *nbyte; done += len) {
+		len = *nbyte - done;
+		if (len > PAGE_SIZE)
+			len = PAGE_SIZE;
+		if (cmd == IO_WRITE && copyin(buf + done, kbuf, len)) {
+			error = EFAULT;
+			break;
+		}
+		error = blkq_rw(&p->q, p, cmd, kbuf, &len,
+				blkno + (int)(done / SECTOR_SIZE));
+		if (error)
+			break;
+		if (cmd == IO_READ && copyout(kbuf, buf + done, len)) {
+			error = EFAULT;
+			break;
+		}
+	}
+	page_free(pa, PAGE_SIZE);
+	*nbyte = done;
+	return error;
+}
+
+static int
+ahci_rw(device_t dev, int cmd, char *buf, size_t *nbyte, int blkno)
+{
+	struct ahci_unit *u = device_private(dev);
+	u_long nsects = *nbyte / SECTOR_SIZE;
+
+	DPRINTF(("ahci_rw: cmd=%d buf=%x nbyte=%d blkno=%x\n",
+		 cmd, buf, *nbyte, blkno));
+
+	if (blkno < 0 || (u_long)blkno > u->nsects ||
+	    nsects > u->nsects - (u_long)blkno)
+		return EIO;
+
+	*nbyte = nsects * SECTOR_SIZE;
+	blkno += (int)u->start;
+	if ((vaddr_t)buf & 1)
+		return ahci_bounce(u->port, cmd, buf, nbyte, blkno);
+	return blkq_rw(&u->port->q, u->port, cmd, buf, nbyte, blkno);
+}
+
+static int
+ahci_read(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+
+	return ahci_rw(dev, IO_READ, buf, nbyte, blkno);
+}
+
+static int
+ahci_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+
+	return ahci_rw(dev, IO_WRITE, buf, nbyte, blkno);
+}
+
+static int
+ahci_init(struct driver *self)
+{
+	struct pci_device *v;
+	size_t i;
+
+	for (i = 0; i < pci_device_count; i++) {
+		v = &pci_devices[i];
+		if (v->class_code == PCI_CLASS_STORAGE &&
+		    v->subclass == 6 && v->prog_if == 1)	/* SATA, AHCI */
+			ahci_attach(self, v);
+	}
+	return 0;
+}
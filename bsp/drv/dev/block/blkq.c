@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * blkq.c - block I/O request queue
+ */
+
+/*
+ * The block drivers (ramdisk, fdd, hdd) share this queue.  Each
+ * driver supplies a start routine that begins the transfer of a
+ * chain of requests, and calls blkq_done() when it completes.
+ *
+ * Requests are kept in two queues: sorted by block number for
+ * the elevator, and in arrival order for the deadline check.  At
+ * dispatch time, the requests that continue the chosen one on the
+ * disk are chained to it, so that several small transfers issued
+ * by different threads go to the device as one.
+ */
+
+#include <driver.h>
+#include <blkq.h>
+
+/* #define DEBUG_BLKQ 1 */
+
+#ifdef DEBUG_BLKQ
+#define DPRINTF(a)	printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * Context of a synchronous blkq_rw() call.
+ */
+struct blkwait {
+	int		pending;	/* requests not yet done */
+	struct event	event;		/* completion event */
+};
+
+void
+blkq_init(struct blkq *q, size_t bsize, u_long maxblks,
+	  void (*start)(struct blkq *, struct blkreq *), void *priv)
+{
+
+	queue_init(&q->sorted);
+	queue_init(&q->fifo);
+	q->active = NULL;
+	q->depth = 1;
+	q->busy = 0;
+	q->dispatching = 0;
+	q->headpos = 0;
+	q->bsize = bsize;
+	q->maxblks = maxblks;
+	q->maxsegs = 0;
+	q->start = start;
+	q->priv = priv;
+}
+
+/*
+ * Translate a buffer into physically contiguous segments.
+ * This must be called in the context of the task owning the
+ * buffer, unless it is a kernel buffer.
+ */
+int
+blkreq_map(struct blkreq *r, char *buf, size_t len)
+{
+
+	ASSERT(len <= BLK_MAXBYTES);
+
+	r->nsegs = 0;
+	return dma_segs(buf, len, r->segs, BLK_MAXSEGS, &r->nsegs);
+}
+
+/*
+ * Insert a request in block order, behind any request for
+ * the same block.
+ */
+static void
+blkq_insert(struct blkq *q, struct blkreq *r)
+{
+	struct blkreq *p;
+	queue_t qp;
+
+	for (qp = queue_last(&q->sorted); !queue_end(&q->sorted, qp);
+	     qp = queue_prev(qp)) {
+		p = queue_entry(qp, struct blkreq, link);
+		if (p->blkno <= r->blkno)
+			break;
+	}
+	queue_insert(qp, &r->link);
+}
+
+/*
+ * Choose the next request to serve.  The oldest request wins if
+ * its deadline has passed.  Otherwise, take the first request at
+ * or beyond the head position, wrapping around to the lowest block.
+ */
+static struct blkreq *
+blkq_pick(struct blkq *q)
+{
+	struct blkreq *r;
+	queue_t qp;
+
+	r = queue_entry(queue_first(&q->fifo), struct blkreq, fifo);
+	if ((long)(timer_ticks() - r->expire) >= 0) {
+		DPRINTF(("blkq: deadline blkno=%d\n", r->blkno));
+		return r;
+	}
+
+	for (qp = queue_first(&q->sorted); !queue_end(&q->sorted, qp);
+	     qp = queue_next(qp)) {
+		r = queue_entry(qp, struct blkreq, link);
+		if (r->blkno >= q->headpos)
+			return r;
+	}
+	return queue_entry(queue_first(&q->sorted), struct blkreq, link);
+}
+
+static void
+blkq_take(struct blkreq *r)
+{
+
+	queue_remove(&r->link);
+	queue_remove(&r->fifo);
+	r->next = NULL;
+}
+
+/*
+ * Chain the pending requests that continue "r" on the same unit
+ * in the same direction, up to maxblks blocks (and maxsegs
+ * segments) in total.  "qp" is the entry that followed "r" in the
+ * sorted queue.
+ */
+static void
+blkq_merge(struct blkq *q, struct blkreq *r, queue_t qp)
+{
+	struct blkreq *tail, *p;
+	u_long total;
+	int nsegs;
+	queue_t next;
+
+	tail = r;
+	total = r->nblks;
+	nsegs = r->nsegs;
+	while (!queue_end(&q->sorted, qp)) {
+		p = queue_entry(qp, struct blkreq, link);
+		if (p->unit != r->unit || p->cmd != r->cmd ||
+		    p->blkno != tail->blkno + (int)tail->nblks ||
+		    total + p->nblks > q->maxblks ||
+		    (q->maxsegs > 0 && nsegs + p->nsegs > q->maxsegs))
+			break;
+		next = queue_next(qp);
+		blkq_take(p);
+		tail->next = p;
+		tail = p;
+		total += p->nblks;
+		nsegs += p->nsegs;
+		qp = next;
+	}
+	DPRINTF(("blkq: dispatch blkno=%d nblks=%d\n", r->blkno, total));
+	q->headpos = r->blkno + (int)total;
+}
+
+/*
+ * Start pending requests while the device is idle.  A driver that
+ * completes a transfer synchronously calls blkq_done() from its
+ * start routine; the loop below picks up the next request then.
+ * Must be called at splhigh.
+ */
+static void
+blkq_dispatch(struct blkq *q)
+{
+	struct blkreq *r;
+	queue_t qp;
+
+	if (q->dispatching)
+		return;
+	q->dispatching = 1;
+	while (q->busy < q->depth && !queue_empty(&q->sorted)) {
+		r = blkq_pick(q);
+		qp = queue_next(&r->link);
+		blkq_take(r);
+		if (q->maxblks > 0)
+			blkq_merge(q, r, qp);
+		else
+			q->headpos = r->blkno + (int)r->nblks;
+		q->active = r;
+		q->busy++;
+		(*q->start)(q, r);
+	}
+	q->dispatching = 0;
+}
+
+/*
+ * Queue an asynchronous request.  r->done is called when the
+ * transfer completes.
+ */
+void
+blkq_submit(struct blkq *q, struct blkreq *r)
+{
+	u_long msec;
+	int s;
+
+	ASSERT(r->done != NULL);
+
+	msec = (r->cmd == IO_READ) ? BLK_READ_EXPIRE : BLK_WRITE_EXPIRE;
+	r->expire = timer_ticks() + mstohz(msec);
+	r->next = NULL;
+	r->error = 0;
+
+	s = splhigh();
+	blkq_insert(q, r);
+	enqueue(&q->fifo, &r->fifo);
+	blkq_dispatch(q);
+	splx(s);
+}
+
+/*
+ * Called by the driver when the active chain has completed.
+ */
+void
+blkq_done(struct blkq *q, int error)
+{
+	struct blkreq *r;
+	int s;
+
+	ASSERT(q->depth == 1);
+
+	s = splhigh();
+	r = q->active;
+	q->active = NULL;
+	blkq_end(q, r, error);
+	splx(s);
+}
+
+/*
+ * Called by the driver when the chain "r" has completed.
+ */
+void
+blkq_end(struct blkq *q, struct blkreq *r, int error)
+{
+	struct blkreq *next;
+	int s;
+
+	ASSERT(r != NULL);
+	ASSERT(q->busy > 0);
+
+	s = splhigh();
+	if (r == q->active)
+		q->active = NULL;
+	q->busy--;
+	while (r != NULL) {
+		next = r->next;	/* r may be gone after done() */
+		r->error = error;
+		(*r->done)(r);
+		r = next;
+	}
+	blkq_dispatch(q);
+	splx(s);
+}
+
+static void
+blkq_wakeup(struct blkreq *r)
+{
+	struct blkwait *w = r->arg;
+
+	if (--w->pending == 0)
+		sched_wakeup(&w->event);
+}
+
+/*
+ * Synchronous read/write on behalf of a read or write devop.
+ *
+ * The buffer is cut into requests of at most maxblks blocks, and
+ * up to BLK_BATCH of them are queued at once so that the device
+ * can work on them back to back, merged with other pending I/O.
+ * Queued requests are always waited for, even if the caller is
+ * interrupted, since the driver still owns them.
+ */
+int
+blkq_rw(struct blkq *q, void *unit, int cmd, char *buf, size_t *nbyte,
+	int blkno)
+{
+	struct blkreq *reqs[BLK_BATCH];
+	struct blkreq *r;
+	struct blkwait w;
+	size_t chunk, len, total, pos, done;
+	int i, n, error, merror;
+
+	chunk = BLK_MAXBYTES;
+	if (q->maxblks > 0 && q->maxblks * q->bsize < chunk)
+		chunk = q->maxblks * q->bsize;
+	chunk -= chunk % q->bsize;
+	total = *nbyte - (*nbyte % q->bsize);
+
+	event_init(&w.event, "blkio");
+	error = merror = 0;
+	pos = done = 0;
+	while (pos < total && error == 0 && merror == 0) {
+		/* Build a batch of requests. */
+		for (n = 0; n < BLK_BATCH && pos < total; n++) {
+			len = total - pos;
+			if (len > chunk)
+				len = chunk;
+			if ((r = kmem_alloc(sizeof(*r))) == NULL) {
+				merror = ENOMEM;
+				break;
+			}
+			if ((merror = blkreq_map(r, buf + pos, len)) != 0) {
+				kmem_free(r);
+				break;
+			}
+			r->unit = unit;
+			r->cmd = cmd;
+			r->blkno = blkno + (int)(pos / q->bsize);
+			r->nblks = len / q->bsize;
+			r->done = blkq_wakeup;
+			r->arg = &w;
+			reqs[n] = r;
+			pos += len;
+		}
+		if (n == 0)
+			break;
+
+		sched_lock();
+		w.pending = n;
+		for (i = 0; i < n; i++)
+			blkq_submit(q, reqs[i]);
+		while (w.pending > 0)
+			sched_sleep(&w.event);
+		sched_unlock();
+
+		/* Only the leading run of good requests counts. */
+		for (i = 0; i < n; i++) {
+			r = reqs[i];
+			if (r->error != 0 && error == 0)
+				error = r->error;
+			if (error == 0)
+				done += r->nblks * q->bsize;
+			kmem_free(r);
+		}
+	}
+	if (error == 0)
+		error = merror;
+	*nbyte = done;
+	return error;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * disklabel.c - disk naming and partition table parsing
+ */
+
+/*
+ * The hard disk drivers (hdd, ahci, virtio_blk) share one naming
+ * scheme, so that file systems find their partitions under the
+ * same names whichever controller the disk hangs off:
+ *
+ *   hd0	controller 0
+ *   hd0d1	disk 1 on controller 0
+ *   hd0d1p02	partition 2 (MBR slot) of that disk
+ */
+
+#include <driver.h>
+#include <disklabel.h>
+
+static int nctlrs;			/* controllers named so far */
+
+/*
+ * Name the next disk controller: "hd0", "hd1", ...
+ */
+void
+disk_ctlrname(char *name)
+{
+
+	name[0] = 'h';
+	name[1] = 'd';
+	name[2] = (char)('0' + nctlrs++);
+	name[3] = '\0';
+}
+
+/*
+ * Name partition slot "slot" of disk "disk".
+ */
+void
+disk_partname(char *name, const char *disk, int slot)
+{
+	char *p;
+
+	strlcpy(name, disk, MAXDEVNAME);
+	p = name + strnlen(name, MAXDEVNAME);
+	p[0] = 'p';
+	p[1] = (char)('0' + (slot / 10));
+	p[2] = (char)('0' + (slot % 10));
+	p[3] = '\0';
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Decode the partition table in sector 0.  Unused slots are
+ * returned with a type of 0.  Returns -1 if the sector has no
+ * valid DOS disklabel.
+ */
+int
+mbr_read(const uint8_t *sector, struct mbr_part *part)
+{
+	const uint8_t *p;
+	int i;
+
+	if (sector[MBR_SIGOFF] != 0x55 || sector[MBR_SIGOFF + 1] != 0xaa)
+		return -1;
+
+	for (i = 0; i < MBR_NPART; i++) {
+		p = &sector[MBR_PARTOFF + i * 16];
+		part[i].type = p[4];
+		part[i].start = get_le32(&p[8]);
+		part[i].nsects = get_le32(&p[12]);
+		if (part[i].start == 0 || part[i].nsects == 0)
+			part[i].type = 0;
+	}
+	return 0;
+}
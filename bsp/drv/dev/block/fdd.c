@@ -47,6 +47,7 @@
  */
 
 #include <driver.h>
+#include <blkq.h>
 
 /* #define DEBUG_FDD 1 */
 
@@ -103,15 +104,28 @@ struct fdd_softc {
 	int		isopen;		/* number of open counts */
 	int		track;		/* Current track for read buffer */
 	struct irp	irp;		/* I/O request packet */
+	struct blkq	q;		/* request queue */
+	struct dma_map	map;		/* DMA map of the request */
 	dma_t		dma;		/* DMA handle */
 	irq_t		irq;		/* interrupt handle */
 	timer_t		tmr;		/* timer id */
 	int		stat;		/* current state */
-	void		*rbuf;		/* DMA buffer for read (1 track) */
-	void		*wbuf;		/* DMA buffer for write (1 sector) */
+	void		*rbuf;		/* read buffer (1 track) */
+	void		*wbuf;		/* write buffer (1 sector) */
 	u_char		result[7];	/* result from fdc */
 };
 
+/*
+ * ISA DMA reaches the first 16M, in one piece within a 64K page.
+ */
+static const struct dma_tag fdc_dma_tag = {
+	/* maxaddr */	0xffffff,
+	/* boundary */	0x10000,
+	/* maxsegsz */	0,
+	/* align */	0,
+	/* maxsegs */	1,
+};
+
 static void	fdc_timeout(void *);
 
 static int	fdd_open(device_t, int);
@@ -216,6 +230,10 @@ fdc_on(struct fdd_softc *sc)
 	timer_callout(&sc->tmr, 250, &fdc_timeout, sc);
 }
 
+/*
+ * Complete the active request with an error.
+ * The motor is stopped before the next request can start.
+ */
 static void
 fdc_error(struct fdd_softc *sc, int error)
 {
@@ -224,9 +242,11 @@ fdc_error(struct fdd_softc *sc, int error)
 	DPRINTF(("fdc: error=%d\n", error));
 
 	dma_stop(sc->dma);
+	dmamap_unload(&sc->map);
 	irp->error = error;
-	sched_wakeup(&irp->iocomp);
 	fdc_off(sc);
+	if (sc->q.active != NULL)
+		blkq_done(&sc->q, error);
 }
 
 /*
@@ -313,6 +333,7 @@ fdc_io(struct fdd_softc *sc)
 
 	timer_callout(&sc->tmr, 2000, &fdc_timeout, sc);
 
+	dmamap_sync(&sc->map, read ? DMA_PREREAD : DMA_PREWRITE);
 	dma_setup(sc->dma, irp->buf, io_size, read);
 
 	/* Send command */
@@ -328,19 +349,23 @@ fdc_io(struct fdd_softc *sc)
 }
 
 /*
- * Wake up iorequester.
- * FDC motor is set to off after 5sec.
+ * Complete the active request.
+ * FDC motor is set to off after 5sec, unless the next
+ * request is started meanwhile.
  */
 static void
 fdc_ready(struct fdd_softc *sc)
 {
-	struct irp *irp = &sc->irp;
 
-	DPRINTF(("fdc: wakeup requester\n"));
+	DPRINTF(("fdc: complete request\n"));
 
+	dmamap_sync(&sc->map, (sc->irp.cmd == IO_READ) ?
+		    DMA_POSTREAD : DMA_POSTWRITE);
+	dmamap_unload(&sc->map);
 	sc->stat = FDS_READY;
-	sched_wakeup(&irp->iocomp);
 	timer_callout(&sc->tmr, 5000, &fdc_timeout, sc);
+	if (sc->q.active != NULL)
+		blkq_done(&sc->q, 0);
 }
 
 /*
@@ -512,44 +537,55 @@ fdd_close(device_t dev)
 }
 
 /*
- * Common routine for read/write
+ * Start a request from the queue.  Requests always refer to one
+ * of our buffers, and are never merged.  The buffers are ordinary
+ * pages, so the map bounces them when they are out of reach of
+ * the DMA controller or cross a 64K page.
  */
-static int
-fdd_rw(struct fdd_softc *sc, int cmd, char *buf, u_long blksz, int blkno)
+static void
+fdd_start(struct blkq *q, struct blkreq *r)
 {
+	struct fdd_softc *sc = q->priv;
 	struct irp *irp = &sc->irp;
 	int error;
 
-	DPRINTF(("fdd_rw: cmd=%x buf=%x blksz=%d blkno=%x\n",
-		 cmd, buf, blksz, blkno));
+	ASSERT(r->next == NULL);
 
-	irp->cmd = cmd;
+	if ((error = dmamap_load_segs(&sc->map, r->segs, r->nsegs)) != 0) {
+		blkq_done(q, error);
+		return;
+	}
+	irp->cmd = r->cmd;
 	irp->ntries = 0;
-	irp->blkno = blkno;
-	irp->blksz = blksz;
-	irp->buf = buf;
+	irp->blkno = r->blkno;
+	irp->blksz = r->nblks;
+	irp->buf = ptokv(sc->map.segs[0].addr);
 	irp->error = 0;
 
-	sched_lock();
 	if (sc->stat == FDS_OFF)
 		fdc_on(sc);
 	else
 		fdc_seek(sc);
+}
 
-	if (sched_sleep(&irp->iocomp) == SLP_INTR)
-		error = EINTR;
-	else
-		error = irp->error;
+/*
+ * Common routine for read/write
+ */
+static int
+fdd_rw(struct fdd_softc *sc, int cmd, char *buf, u_long blksz, int blkno)
+{
+	size_t size = blksz * SECTOR_SIZE;
 
-	sched_unlock();
-	return error;
+	DPRINTF(("fdd_rw: cmd=%x buf=%x blksz=%d blkno=%x\n",
+		 cmd, buf, blksz, blkno));
+
+	return blkq_rw(&sc->q, sc, cmd, buf, &size, blkno);
 }
 
 /*
  * Read
  *
  * Error:
- *  EINTR   ... Interrupted by signal
  *  EIO     ... Low level I/O error
  *  ENXIO   ... Write protected
  *  EFAULT  ... No physical memory is mapped to buffer
@@ -605,7 +641,6 @@ fdd_read(device_t dev, char *buf, size_t *nbyte, int blkno)
  * Write
  *
  * Error:
- *  EINTR   ... Interrupted by signal
  *  EIO     ... Low level I/O error
  *  ENXIO   ... Write protected
  *  EFAULT  ... No physical memory is mapped to buffer
@@ -676,8 +711,9 @@ fdd_init(struct driver *self)
 	struct fdd_softc *sc;
 	struct irp *irp;
 	device_t dev;
+	paddr_t pa;
 	char *buf;
-	int i;
+	int i, error;
 
 	dev = device_create(self, "fd0", D_BLK|D_PROT);
 	sc = device_private(dev);
@@ -687,14 +723,25 @@ fdd_init(struct driver *self)
 	/* Initialize I/O request packet */
 	irp = &sc->irp;
 	irp->cmd = IO_NONE;
-	event_init(&irp->iocomp, "fdd i/o");
+	blkq_init(&sc->q, SECTOR_SIZE, 0, fdd_start, sc);
 
 	/*
-	 * Allocate physical pages for DMA buffer.
-	 * Buffer: 1 track for read, 1 sector for write.
+	 * Allocate the buffers: 1 track for read, 1 sector for
+	 * write.  DMA goes through the bounce buffer of the map
+	 * whenever they do not suit the DMA controller.
 	 */
-	buf = dma_alloc(TRACK_SIZE + SECTOR_SIZE);
-	ASSERT(buf != NULL);
+	if ((error = dmamap_create(&sc->map, &fdc_dma_tag,
+				   TRACK_SIZE)) != 0) {
+		printf("fdd: no DMA memory\n");
+		device_destroy(dev);
+		return error;
+	}
+	if ((pa = page_alloc(round_page(TRACK_SIZE + SECTOR_SIZE))) == 0) {
+		dmamap_destroy(&sc->map);
+		device_destroy(dev);
+		return ENOMEM;
+	}
+	buf = ptokv(pa);
 	sc->rbuf = buf;
 	sc->wbuf = buf + TRACK_SIZE;
 	sc->dma = dma_attach(FDC_DMA);
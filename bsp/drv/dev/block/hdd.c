@@ -1,6 +1,8 @@
 #include <sys/param.h>
 #include <driver.h>
 #include <pci.h>
+#include <blkq.h>
+#include <disklabel.h>
 
 typedef unsigned long long uint64_t; /* Hmm. */
 
@@ -115,13 +117,42 @@ typedef enum ata_status_flag_t_ {
   ATA_STATUS_FLAG_BUSY = 0x80
 } ata_status_flag_t;
 
+/* These flags appear in the contents of DMA_REG_COMMAND. */
+typedef enum dma_command_flag_t_ {
+  DMA_COMMAND_FLAG_START = 0x01, /* start/stop the bus master */
+  DMA_COMMAND_FLAG_READ = 0x08 /* direction: 1 => device to memory */
+} dma_command_flag_t;
+
 typedef enum dma_status_flag_t_ {
   DMA_STATUS_FLAG_DMA_MODE = 0x01, /* if we are in DMA transfer mode */
   DMA_STATUS_FLAG_DMA_ERROR = 0x02, /* if a DMA transfer failed */
-  DMA_STATUS_FLAG_DMA_INTERRUPT = 0x04 /* DMA interrupt occurred */
+  DMA_STATUS_FLAG_DMA_INTERRUPT = 0x04, /* DMA interrupt occurred */
+  DMA_STATUS_FLAG_DRIVES_CAPABLE = 0x60 /* set by BIOS, read/write scratch bits */
   /* there are others, but they're apparently mostly obsolete */
 } dma_status_flag_t;
 
+/* One entry of a Physical Region Descriptor table, as read by the
+   bus master. Each entry describes a physically contiguous, word
+   aligned region which must not cross a 64K boundary. A count of
+   zero means 64K. */
+struct ata_prd {
+  uint32_t addr;
+  uint16_t count;
+  uint16_t flags;
+};
+
+#define PRD_FLAG_EOT	0x8000	/* last entry in the table */
+#define PRD_BOUNDARY	0x10000
+#define PRD_TABLE_SIZE	(PAGE_SIZE / sizeof(struct ata_prd))
+
+/* Set to 0 to always use PIO, e.g. to compare the two paths. When
+   enabled, DMA is still only used on controllers that advertise
+   bus-master support, and a disk falls back to PIO for good if a DMA
+   transfer fails. */
+#ifndef HDD_DMA
+#define HDD_DMA 1
+#endif
+
 /* These flags appear in the contents of ATA_REG_ERR. */
 typedef enum ata_error_flag_t_ {
   ATA_ERROR_FLAG_ILLEGAL_LENGTH = 0x01,
@@ -142,12 +173,11 @@ typedef enum ata_error_flag_t_ {
 #define DPRINTF(a)
 #endif
 
-/* At present, we limit individual transfers to a maximum of
-   BUFFER_LENGTH bytes. TODO: once we switch to DMA, this will
-   probably become obsolete. */
-/* However, 28-bit PIO mode doesn't support the transfer of more than
-   256 sectors = 128kBy at once, so splitting up large I/Os might
-   still be an interesting thing to do. */
+/* We limit individual transfers, including requests merged by the
+   queue, to a maximum of BUFFER_LENGTH bytes. 28-bit commands can't
+   transfer more than 256 sectors = 128kBy at once anyway, and this
+   keeps a merged chain of single-sector requests well within one
+   page of PRD entries. */
 #define BUFFER_LENGTH 65536
 #define BUFFER_LENGTH_IN_SECTORS (BUFFER_LENGTH / SECTOR_SIZE)
 
@@ -210,6 +240,7 @@ struct ata_disk {
 
   /* Computed based on some of the extracted identification_space fields. */
   int use_48bit_io;
+  int use_dma; /* cleared if a DMA transfer ever fails on this disk */
 
   /* The name of this device as it is known to the kernel. The file
      system's "/dev" node for this device is named using this. */
@@ -228,33 +259,33 @@ struct ata_channel {
   int base_port;
   int control_port;
   int dma_port;
+  struct ata_prd *prd; /* PRD table, or NULL if not using DMA */
+  paddr_t prd_phys; /* physical address of the PRD table */
 };
 
 /**
- * A single I/O request in progress. */
-struct hdd_request {
-  enum {
-    REQ_INVALID = 0,
-    REQ_NOT_STARTED,
-    REQ_WAITING_FOR_DEVICE,
-    REQ_COMPLETE /* TODO: do we really need this? */
-  } state;
-  struct ata_disk *disk;
-  struct irp irp;
-  struct queue link; /* link in chain of outstanding I/O requests */
-};
-
-/**
- * Represents a single IDE controller. */
+ * Represents a single IDE controller. Only one command can be
+ * outstanding per controller, so the request queue lives here rather
+ * than in each disk: q.active is the chain of blkreqs the disk is
+ * working on, with the disk itself in its unit field. */
 struct ata_controller {
   char devname[MAXDEVNAME]; /* "hdX\0"; used for debugging etc. */
   struct pci_device *pci_dev; /* the PCI config for this device */
-  struct queue request_queue; /* queue of hdd_requests. lock (splhigh) before using this */
-  int disk_active; /* whether any request is outstanding. lock (splhigh) before using this */
+  struct blkq q; /* pending and active requests. lock (splhigh) before using this */
+  struct irp irp; /* the command in progress: cmd, lba, sectors left, error */
+  int dma; /* whether the command in progress goes through the bus master */
+
+  /* PIO progress through the active chain: request, segment, offset. */
+  struct blkreq *pio_req;
+  int pio_seg;
+  size_t pio_off;
+  uint8_t bounce[SECTOR_SIZE]; /* for sectors straddling two segments */
+
   irq_t irq; /* we registered an IRQ with the kernel; this is the handle we were given */
   irq_t irq_secondary; /* we may have registered an IRQ for the secondary channel too */
   timer_t tmr; /* timeout timer id */
   int needs_dma_ack; /* HACK. See code relating to this field. */
+  int dma_capable; /* bus-master DMA is available and enabled */
   struct ata_channel channel[2]; /* the two channels within the controller */
   struct list disk_list; /* all disks attached to this controller */
   int timeout_count; /* count of timeouts that have occurred */
@@ -307,16 +338,18 @@ static void dma_write(struct ata_controller *c, int channelnum, int reg, uint8_t
   bus_write_8(c->channel[channelnum].dma_port + reg, val);
 }
 
-/* Clears a collection of ATA DMA status register bits. */
-static void dma_status_clear(struct ata_controller *c, int channelnum, dma_status_flag_t bits) {
-  dma_write(c, channelnum, DMA_REG_STATUS, bits);
-}
-
 /* Reads from an ATA DMA register. */
 static uint8_t dma_read(struct ata_controller *c, int channelnum, int reg) {
   return bus_read_8(c->channel[channelnum].dma_port + reg);
 }
 
+/* Clears a collection of ATA DMA status register bits. The
+   drive-capable bits are plain read/write bits, so preserve them. */
+static void dma_status_clear(struct ata_controller *c, int channelnum, dma_status_flag_t bits) {
+  uint8_t keep = dma_read(c, channelnum, DMA_REG_STATUS) & DMA_STATUS_FLAG_DRIVES_CAPABLE;
+  dma_write(c, channelnum, DMA_REG_STATUS, keep | bits);
+}
+
 /* A 400ns delay, used to wait for the device to start processing a
  * sent command and assert busy. */
 static void ata_delay400(struct ata_controller *c, int channelnum) {
@@ -385,9 +418,107 @@ static void ata_pio_write(struct ata_controller *c,
   }
 }
 
-static struct hdd_request *first_pending_request(struct ata_controller *c) {
-  queue_t q = queue_first(&c->request_queue);
-  return queue_entry(q, struct hdd_request, link);
+/* The bus master can only move whole 16-bit words. */
+static int chain_dma_ok(struct blkreq *r) {
+  int i;
+
+  for (; r != NULL; r = r->next) {
+    for (i = 0; i < r->nsegs; i++) {
+      if ((r->segs[i].addr & 1) || (r->segs[i].len & 1))
+	return 0;
+    }
+  }
+  return 1;
+}
+
+/* Move the PIO cursor n bytes on, stepping to the next segment and
+   then to the next request of the chain as each one is used up. */
+static void pio_advance(struct ata_controller *c, size_t n) {
+  c->pio_off += n;
+  if (c->pio_off == c->pio_req->segs[c->pio_seg].len) {
+    c->pio_off = 0;
+    if (++c->pio_seg == c->pio_req->nsegs) {
+      c->pio_seg = 0;
+      c->pio_req = c->pio_req->next;
+    }
+  }
+}
+
+/* Copy one sector between a bounce buffer and the chain's segments,
+   advancing the PIO cursor. */
+static void copy_sector(struct ata_controller *c, uint8_t *sector, int to_segments) {
+  size_t done = 0;
+
+  while (done < SECTOR_SIZE) {
+    struct dma_seg *seg = &c->pio_req->segs[c->pio_seg];
+    uint8_t *p = ptokv(seg->addr + c->pio_off);
+    size_t n = seg->len - c->pio_off;
+
+    if (n > SECTOR_SIZE - done)
+      n = SECTOR_SIZE - done;
+    if (to_segments)
+      memcpy(p, sector + done, n);
+    else
+      memcpy(sector + done, p, n);
+    done += n;
+    pio_advance(c, n);
+  }
+}
+
+/* Move one sector by PIO between the controller and the active
+   chain's buffers. Sectors that straddle two segments go through the
+   controller's bounce buffer. */
+static void pio_sector(struct ata_controller *c) {
+  int channelnum = ((struct ata_disk *) c->q.active->unit)->channel;
+  struct dma_seg *seg;
+
+  ASSERT(c->pio_req != NULL);
+  seg = &c->pio_req->segs[c->pio_seg];
+
+  if (seg->len - c->pio_off >= SECTOR_SIZE) {
+    uint8_t *p = ptokv(seg->addr + c->pio_off);
+
+    if (c->irp.cmd == IO_READ)
+      ata_pio_read(c, channelnum, p, SECTOR_SIZE);
+    else
+      ata_pio_write(c, channelnum, p, SECTOR_SIZE);
+    pio_advance(c, SECTOR_SIZE);
+  } else if (c->irp.cmd == IO_READ) {
+    ata_pio_read(c, channelnum, c->bounce, SECTOR_SIZE);
+    copy_sector(c, c->bounce, 1);
+  } else {
+    copy_sector(c, c->bounce, 0);
+    ata_pio_write(c, channelnum, c->bounce, SECTOR_SIZE);
+  }
+}
+
+/* Fill in the channel's PRD table from the segments of a chain of
+   requests, splitting entries at 64K boundaries. */
+static void dma_setup_prd(struct ata_channel *ch, struct blkreq *r) {
+  int i, n = 0;
+
+  for (; r != NULL; r = r->next) {
+    for (i = 0; i < r->nsegs; i++) {
+      paddr_t pa = r->segs[i].addr;
+      size_t len = r->segs[i].len;
+
+      while (len > 0) {
+	size_t chunk = PRD_BOUNDARY - (pa & (PRD_BOUNDARY - 1));
+
+	if (chunk > len)
+	  chunk = len;
+	ASSERT(n < (int) PRD_TABLE_SIZE);
+	ch->prd[n].addr = (uint32_t) pa;
+	ch->prd[n].count = (uint16_t) (chunk & 0xffff); /* 0 => 64K */
+	ch->prd[n].flags = 0;
+	n++;
+	pa += chunk;
+	len -= chunk;
+      }
+    }
+  }
+  ASSERT(n > 0);
+  ch->prd[n - 1].flags = PRD_FLAG_EOT;
 }
 
 /* Sends an I/O command to the disk, including the address of the
@@ -396,7 +527,8 @@ static struct hdd_request *first_pending_request(struct ata_controller *c) {
 static void hdd_setup_io(struct ata_disk *disk,
 			 int cmd,
 			 uint64_t lba,
-			 size_t sector_count)
+			 size_t sector_count,
+			 int dma)
 {
   struct ata_controller *c = disk->controller;
   uint8_t final_cmd;
@@ -404,24 +536,24 @@ static void hdd_setup_io(struct ata_disk *disk,
   switch (cmd) {
     case IO_READ:
       if (disk->use_48bit_io) {
-	/* Send READ SECTORS EXT command. */
+	/* Send READ SECTORS EXT or READ DMA EXT command. */
 	ata_write(c, disk->channel, ATA_REG_DISK_SELECT, 0x40 | (disk->slave << 4));
-	final_cmd = 0x24;
+	final_cmd = dma ? 0x25 : 0x24;
       } else {
-	/* Send READ SECTORS command. */
+	/* Send READ SECTORS or READ DMA command. */
 	ata_write(c, disk->channel, ATA_REG_DISK_SELECT, 0xE0 | (disk->slave << 4));
-	final_cmd = 0x20;
+	final_cmd = dma ? 0xC8 : 0x20;
       }
       break;
     case IO_WRITE:
       if (disk->use_48bit_io) {
-	/* Send WRITE SECTORS EXT command. */
+	/* Send WRITE SECTORS EXT or WRITE DMA EXT command. */
 	ata_write(c, disk->channel, ATA_REG_DISK_SELECT, 0x40 | (disk->slave << 4));
-	final_cmd = 0x34;
+	final_cmd = dma ? 0x35 : 0x34;
       } else {
-	/* Send WRITE SECTORS command. */
+	/* Send WRITE SECTORS or WRITE DMA command. */
 	ata_write(c, disk->channel, ATA_REG_DISK_SELECT, 0xE0 | (disk->slave << 4));
-	final_cmd = 0x30;
+	final_cmd = dma ? 0xCA : 0x30;
       }
       break;
     default:
@@ -445,7 +577,8 @@ static void hdd_setup_io(struct ata_disk *disk,
   ata_write(c, disk->channel, ATA_REG_COMMAND_STATUS, final_cmd);
 
   /* We'll get an interrupt sometime, if interrupts aren't disabled;
-     otherwise, we'll need to check the status register by polling. */
+     otherwise, we'll need to check the status register by polling.
+     For DMA, the interrupt comes once, after the whole transfer. */
 
   /* PIO writes should happen here. The IRQ will signal that the drive
      has accepted a sector's worth, not that it wants a sector's
@@ -469,43 +602,78 @@ static void timeout_handler(void *arg) {
   hdc_ist(arg);
 }
 
-/* CALL ONLY WITH splhigh! */
-static void maybe_send_next_request(struct ata_controller *c) {
-  if (!c->disk_active && !queue_empty(&c->request_queue)) {
-    struct hdd_request *req = first_pending_request(c);
-    struct irp *irp = &req->irp;
-
-    ASSERT(req->state == REQ_NOT_STARTED);
-
-    hdd_setup_io(req->disk, irp->cmd, irp->blkno, irp->blksz); /* TODO: 64 bit irp->blkno? */
+/* Send the command for the active chain to its disk. CALL ONLY WITH
+   splhigh! */
+static void send_request(struct ata_controller *c) {
+  struct ata_disk *disk = c->q.active->unit;
+  struct irp *irp = &c->irp;
+
+  c->pio_req = c->q.active;
+  c->pio_seg = 0;
+  c->pio_off = 0;
+
+  if (c->dma) {
+    int channelnum = disk->channel;
+    uint8_t dir = (irp->cmd == IO_READ) ? DMA_COMMAND_FLAG_READ : 0;
+
+    /* Stop the engine, point it at a fresh PRD table and clear any
+       stale status before issuing the command, then start it. */
+    dma_setup_prd(&c->channel[channelnum], c->q.active);
+    dma_write(c, channelnum, DMA_REG_COMMAND, 0);
+    bus_write_32(c->channel[channelnum].dma_port + DMA_REG_PRDT_ADDRESS,
+		 (uint32_t) c->channel[channelnum].prd_phys);
+    dma_status_clear(c, channelnum,
+		     DMA_STATUS_FLAG_DMA_ERROR | DMA_STATUS_FLAG_DMA_INTERRUPT);
+    dma_write(c, channelnum, DMA_REG_COMMAND, dir);
+    hdd_setup_io(disk, irp->cmd, irp->blkno, irp->blksz, 1);
+    dma_write(c, channelnum, DMA_REG_COMMAND, dir | DMA_COMMAND_FLAG_START);
+  } else {
+    hdd_setup_io(disk, irp->cmd, irp->blkno, irp->blksz, 0); /* TODO: 64 bit irp->blkno? */
     if (irp->cmd == IO_WRITE) {
-      if (ata_wait(c, req->disk->channel)) {
-	ata_pio_write(c, req->disk->channel, irp->buf, SECTOR_SIZE);
+      if (ata_wait(c, disk->channel)) {
+	pio_sector(c);
       } else {
 	/* TODO: cope with BUSY never going away */
       }
-      /* Adjust buf and blksz in the interrupt handler. */
+      /* Adjust blksz in the interrupt handler. */
     }
-    req->state = REQ_WAITING_FOR_DEVICE;
-    c->disk_active = 1;
-
-    /* We call the ist handler directly on timeout (!) */
-    timer_callout(&c->tmr, 1000, timeout_handler, c);
   }
-}
 
-/* CALL ONLY WITH splhigh! */
-static void complete_request(struct hdd_request *req) {
-  sched_wakeup(&req->irp.iocomp);
-  queue_remove(&req->link);
+  /* We call the ist handler directly on timeout (!) */
+  timer_callout(&c->tmr, 1000, timeout_handler, c);
+}
 
-  req->disk->controller->disk_active = 0; /* because we've just finished a request. */
-  /* Omitting the previous line would cause maybe_send_next_request to
-     happily ignore the remaining elements in the queue. */
-  maybe_send_next_request(req->disk->controller);
+/* The queue hands us a chain of requests for consecutive sectors of
+   one disk, which goes to the disk as a single command. Called by the
+   queue with splhigh. */
+static void hdd_start(struct blkq *q, struct blkreq *r) {
+  struct ata_controller *c = q->priv;
+  struct ata_disk *disk = r->unit;
+  struct blkreq *p;
+
+  c->irp.cmd = r->cmd;
+  c->irp.blkno = r->blkno;
+  c->irp.blksz = 0;
+  for (p = r; p != NULL; p = p->next)
+    c->irp.blksz += p->nblks;
+  c->irp.ntries = 0;
+  c->irp.error = 0;
+  c->dma = disk->use_dma && chain_dma_ok(r);
+  send_request(c);
+}
 
-  req->state = REQ_COMPLETE; /* won't last long, we're about to free it */
-  kmem_free(req);
+/* CALL ONLY WITH splhigh! */
+static void complete_request(struct ata_controller *c) {
+  int error = 0;
+
+  if (c->irp.error) {
+    printf("%s: I/O error 0x%08x at %d\n",
+	   ((struct ata_disk *) c->q.active->unit)->devname,
+	   c->irp.error, c->irp.blkno);
+    error = EIO;
+  }
+  /* This wakes the requesters and starts the next chain, if any. */
+  blkq_done(&c->q, error);
 }
 
 /* interrupt service routine. Lowest-level responder to an interrupt -
@@ -545,6 +713,38 @@ static int wait_for_drq(struct ata_controller *c, int channel) {
   return 0xC0000000 | (status << 16);
 }
 
+/* Finish a DMA request. The device has interrupted (or we timed
+   out), so stop the engine and find out how it went. If the bus
+   master itself failed on the first try, give up on DMA for this
+   disk and send the request again using PIO. CALL ONLY WITH
+   splhigh! */
+static void dma_complete(struct ata_controller *c, uint8_t status) {
+  struct ata_disk *disk = c->q.active->unit;
+  uint8_t bmstatus = dma_read(c, disk->channel, DMA_REG_STATUS);
+
+  dma_write(c, disk->channel, DMA_REG_COMMAND, 0);
+  dma_status_clear(c, disk->channel,
+		   DMA_STATUS_FLAG_DMA_ERROR | DMA_STATUS_FLAG_DMA_INTERRUPT);
+
+  if (status & (ATA_STATUS_FLAG_ERROR | ATA_STATUS_FLAG_DEVICE_FAILURE)) {
+    c->irp.error = irp_error(c, disk->channel, status);
+  } else if ((bmstatus & DMA_STATUS_FLAG_DMA_ERROR) ||
+	     !(bmstatus & DMA_STATUS_FLAG_DMA_INTERRUPT)) {
+    if (c->irp.ntries++ == 0) {
+      printf("%s: DMA failed (status 0x%02x), falling back to PIO\n",
+	     disk->devname, bmstatus);
+      disk->use_dma = 0;
+      c->dma = 0;
+      send_request(c);
+      return;
+    }
+    c->irp.error = 0xA0000000 | (bmstatus << 16);
+  } else {
+    c->irp.blksz = 0;
+  }
+  complete_request(c);
+}
+
 /* interrupt service thread. The main workhorse for communicating with
    the device. */
 static void hdc_ist(void *arg) {
@@ -555,7 +755,7 @@ static void hdc_ist(void *arg) {
 
   /* Don't return from this function without calling splx(s). */
 
-  if (!c->disk_active) {
+  if (c->q.active == NULL) {
     /* Nothing's happening, in theory! Read the real status registers
        to permit subsequent interrupts to fire. */
 #if DEBUG_HDD
@@ -571,18 +771,13 @@ static void hdc_ist(void *arg) {
     ata_read(c, 0, ATA_REG_COMMAND_STATUS);
     ata_read(c, 1, ATA_REG_COMMAND_STATUS);
 #endif
-  } else if (queue_empty(&c->request_queue)) {
-    panic("Active without a request in the queue!");
   } else {
     /* Here, we know we're supposed to be running, and we also know
        what we're supposed to be doing. */
-    struct hdd_request *req = first_pending_request(c);
-    struct ata_disk *disk = req->disk;
-    struct irp *irp = &req->irp;
+    struct ata_disk *disk = c->q.active->unit;
+    struct irp *irp = &c->irp;
     uint8_t status;
 
-    ASSERT(req->state == REQ_WAITING_FOR_DEVICE);
-
     /* DPRINTF(("%08x ist cmd %d\n", timer_ticks(), irp->cmd)); */
 
     /* Wait for BUSY to clear, if it's set. */
@@ -595,6 +790,12 @@ static void hdc_ist(void *arg) {
     status = ata_read(c, disk->channel, ATA_REG_COMMAND_STATUS);
     /* DPRINTF(("Initial status %02x\n", status)); */
 
+    if (c->dma) {
+      dma_complete(c, status);
+      splx(s);
+      return;
+    }
+
     /* See note in the code that sets needs_dma_ack. */
     if (c->needs_dma_ack) {
       /* TODO: maybe read and discard DMA_REG_STATUS here? */
@@ -606,30 +807,28 @@ static void hdc_ist(void *arg) {
        without doing anything more. */
     if (status & (ATA_STATUS_FLAG_ERROR | ATA_STATUS_FLAG_DEVICE_FAILURE)) {
       irp->error = irp_error(c, disk->channel, status);
-      complete_request(req);
+      complete_request(c);
     } else {
       switch (irp->cmd) {
 	case IO_READ:
 	  /* Wait for DRQ, and check for errors. */
 	  irp->error = wait_for_drq(c, disk->channel);
 	  if (irp->error) {
-	    complete_request(req);
+	    complete_request(c);
 	  } else {
-	    ata_pio_read(c, disk->channel, irp->buf, SECTOR_SIZE);
-	    irp->buf = ((char *) irp->buf) + SECTOR_SIZE;
+	    pio_sector(c);
 	    irp->blksz--;
 	  }
 	  break;
 
 	case IO_WRITE:
-	  irp->buf = ((char *) irp->buf) + SECTOR_SIZE;
 	  irp->blksz--;
 	  if (irp->blksz > 0) {
 	    irp->error = wait_for_drq(c, disk->channel);
 	    if (irp->error) {
-	      complete_request(req);
+	      complete_request(c);
 	    } else {
-	      ata_pio_write(c, disk->channel, irp->buf, SECTOR_SIZE);
+	      pio_sector(c);
 	    }
 	  }
 	  /* TODO: add flush-to-disk ioctl? */
@@ -640,10 +839,10 @@ static void hdc_ist(void *arg) {
       }
 
       /* Multiple sector transfers are supposed to send an interrupt
-	 FOR EACH SECTOR, so we should keep the entry in the queue
-	 until it's completely finished with. */
+	 FOR EACH SECTOR, so we should keep the chain active until
+	 it's completely finished with. */
       if (irp->blksz == 0) {
-	complete_request(req);
+	complete_request(c);
       }
     }
   }
@@ -656,7 +855,7 @@ static void hdc_ist(void *arg) {
 static int read_during_setup(struct ata_disk *disk, uint64_t lba, uint8_t *buf, size_t count) {
   struct ata_controller *c = disk->controller;
   int error;
-  hdd_setup_io(disk, IO_READ, lba, count);
+  hdd_setup_io(disk, IO_READ, lba, count, 0);
   ata_delay400(c, disk->channel);
   ata_wait(c, disk->channel);
   error = wait_for_drq(c, disk->channel);
@@ -691,27 +890,21 @@ static int read_during_setup(struct ata_disk *disk, uint64_t lba, uint8_t *buf,
 /* Read a disk's partition table. */
 static void setup_partitions(struct driver *self, struct ata_disk *disk) {
   uint8_t *sector0 = kmem_alloc(SECTOR_SIZE);
+  struct mbr_part mbr[MBR_NPART];
 
   if (read_during_setup(disk, 0, sector0, 1)) {
     kmem_free(sector0);
     return;
   }
 
-  if (0xaa55 == (* (uint16_t *) (&sector0[SECTOR_SIZE - 2]))) {
+  if (mbr_read(sector0, mbr) == 0) {
     int partition;
     /* Valid DOS disklabel? */
-    for (partition = 0; partition < 4; partition++) {
-      struct {
-	uint8_t flags;
-	uint8_t start_chs[3];
-	uint8_t system_id;
-	uint8_t end_chs[3];
-	uint32_t start_lba;
-	uint32_t sector_count;
-      } *p = (void *) (&sector0[0x1be + (partition * 16)]);
+    for (partition = 0; partition < MBR_NPART; partition++) {
+      struct mbr_part *p = &mbr[partition];
       struct ata_partition *part = NULL;
 
-      if ((p->start_lba == 0) || (p->sector_count == 0) || (p->system_id == 0)) {
+      if (p->type == 0) {
 	/* No allocated partition in this slot. */
 	continue;
       }
@@ -720,21 +913,14 @@ static void setup_partitions(struct driver *self, struct ata_disk *disk) {
 
       list_insert(list_last(&disk->partition_list), &part->link);
       part->disk = disk;
-      part->system_id = p->system_id;
-      part->start_lba = p->start_lba;
-      part->sector_count = p->sector_count;
+      part->system_id = p->type;
+      part->start_lba = p->start;
+      part->sector_count = p->nsects;
       /* TODO: sanity-check sector_count, to make sure it doesn't
 	 reach past the addressable_sector_count known to the whole
 	 disk. */
 
-      strlcpy(part->devname, disk->devname, MAXDEVNAME);
-      {
-	char *p = part->devname + strnlen(part->devname, MAXDEVNAME);
-	p[0] = 'p';
-	p[1] = '0' + (partition / 10);
-	p[2] = '0' + (partition % 10);
-	p[3] = '\0';
-      }
+      disk_partname(part->devname, disk->devname, partition);
       part->dev = device_create(self, part->devname, D_BLK | D_PROT);
       get_handle(part->dev)->kind = ATA_DEVICE_PARTITION;
       get_handle(part->dev)->pointer.partition = part;
@@ -866,6 +1052,8 @@ static int setup_disk(struct driver *self, struct ata_controller *c, int disknum
     }
   }
 
+  disk->use_dma = c->dma_capable;
+
   /* Weirdly, the ASCII strings in the identification_space are
      byte-swapped, because it was originally defined as a region of
      16-bit words (!) */
@@ -899,9 +1087,10 @@ static int setup_disk(struct driver *self, struct ata_controller *c, int disknum
   printf(" - %d log/phys, %d bytes/logical sector\n",
 	 disk->logical_sectors_per_physical_sector,
 	 disk->bytes_per_logical_sector);
-  printf(" - %s 48-bit I/O, %s 48-bit I/O\n",
+  printf(" - %s 48-bit I/O, %s 48-bit I/O, using %s\n",
 	 disk->_48bit_io_supported ? "supports" : "doesn't support",
-	 disk->use_48bit_io ? "using" : "not using");
+	 disk->use_48bit_io ? "using" : "not using",
+	 disk->use_dma ? "DMA" : "PIO");
 
   setup_partitions(self, disk);
   return 0;
@@ -912,7 +1101,6 @@ static int setup_disk(struct driver *self, struct ata_controller *c, int disknum
 }
 
 static void setup_controller(struct driver *self, struct pci_device *v) {
-  static char which_device = '0';
   char devname_tmp[MAXDEVNAME];
   int primary_native;
   int secondary_native;
@@ -944,22 +1132,15 @@ static void setup_controller(struct driver *self, struct pci_device *v) {
   primary_native = ((v->prog_if & 0x01) != 0);
   secondary_native = ((v->prog_if & 0x04) != 0);
 
-  {
-    char *n = &devname_tmp[0];
-    n[0] = 'h';
-    n[1] = 'd';
-    n[2] = which_device++; /* barrrrrrrrrrrrrrf */
-    n[3] = '\0';
-    /* Why is there a vsprintf but no vsnprintf or snprintf? */
-  }
+  /* "hdX", numbered together with any other disk controllers. */
+  disk_ctlrname(devname_tmp);
 
   printf("device %d.%d.%d = %s\n", v->bus, v->slot, v->function, devname_tmp);
 
   c = kmem_alloc(sizeof(struct ata_controller));
   memcpy(&c->devname[0], &devname_tmp[0], sizeof(c->devname));
   c->pci_dev = v;
-  queue_init(&c->request_queue);
-  c->disk_active = 0;
+  blkq_init(&c->q, SECTOR_SIZE, BUFFER_LENGTH_IN_SECTORS, hdd_start, c);
 
   /* TODO: claiming an IRQ more than once causes, um, issues, so don't do that. Ever. */
 
@@ -1010,6 +1191,29 @@ static void setup_controller(struct driver *self, struct pci_device *v) {
   c->channel[0].dma_port = read_pci_io_bar(v, 4);
   c->channel[1].dma_port = c->channel[0].dma_port + 8;
 
+  /* Bit 7 of prog_if says the controller can bus-master (see
+     above). If so, make sure bus mastering is switched on in the PCI
+     command register, since not every BIOS does that for us, and
+     give each channel a page for its PRD table. A PRD table must not
+     cross a 64K boundary, which a single page never does. */
+  c->dma_capable = 0;
+  if (HDD_DMA && (v->prog_if & 0x80) && c->channel[0].dma_port != 0) {
+    paddr_t pa = page_alloc(2 * PAGE_SIZE);
+
+    if (pa != 0) {
+      write_pci_command(v, read_pci_command(v) | PCI_COMMAND_BUS_MASTER);
+      c->channel[0].prd_phys = pa;
+      c->channel[0].prd = ptokv(pa);
+      c->channel[1].prd_phys = pa + PAGE_SIZE;
+      c->channel[1].prd = ptokv(pa + PAGE_SIZE);
+      c->dma_capable = 1;
+    }
+  }
+  if (!c->dma_capable) {
+    c->channel[0].prd = NULL;
+    c->channel[1].prd = NULL;
+  }
+
   /* On some controllers (e.g. the Dell implementation of Intel's
      82801EB that I have handy), it seems that clearing the DMA
      interrupt status bit is required even when not using DMA! */
@@ -1021,10 +1225,11 @@ static void setup_controller(struct driver *self, struct pci_device *v) {
     c->needs_dma_ack = 0;
   }
 
-  printf(" - pri 0x%04x/0x%04x/0x%04x, sec 0x%04x/0x%04x/0x%04x, %s DMA ACK\n",
+  printf(" - pri 0x%04x/0x%04x/0x%04x, sec 0x%04x/0x%04x/0x%04x, %s DMA ACK, %s\n",
 	 c->channel[0].base_port, c->channel[0].control_port, c->channel[0].dma_port,
 	 c->channel[1].base_port, c->channel[1].control_port, c->channel[1].dma_port,
-	 c->needs_dma_ack ? "do" : "don't");
+	 c->needs_dma_ack ? "do" : "don't",
+	 c->dma_capable ? "bus-master DMA" : "PIO only");
 
   /* Disable interrupts from the two channels. */
   write_control(c, 0, 2);
@@ -1070,40 +1275,6 @@ static int hdd_close(device_t dev) {
   return 0;
 }
 
-static int hdd_rw(struct ata_disk *disk, int cmd, uint8_t *buf, size_t block_count, int blkno)
-{
-  struct hdd_request *req = kmem_alloc(sizeof(struct hdd_request));
-  int err;
-
-  req->state = REQ_NOT_STARTED;
-  req->disk = disk;
-  req->irp.cmd = cmd;
-  req->irp.ntries = 0;
-  req->irp.error = 0;
-  req->irp.blkno = blkno;
-  req->irp.blksz = block_count;
-  req->irp.buf = buf;
-  event_init(&req->irp.iocomp, "hdd_rw");
-
-  sched_lock();
-
-  {
-    int s = splhigh();
-    enqueue(&disk->controller->request_queue, &req->link);
-    maybe_send_next_request(disk->controller);
-    splx(s);
-  }
-
-  if (sched_sleep(&req->irp.iocomp) == SLP_INTR) {
-    err = EINTR;
-  } else {
-    err = req->irp.error;
-  }
-  sched_unlock();
-
-  return err;
-}
-
 static void adjust_blkno(device_t dev,
 			 struct ata_disk **disk_p,
 			 int *blkno_p,
@@ -1128,90 +1299,36 @@ static void adjust_blkno(device_t dev,
   }
 }
 
-static int hdd_read(device_t dev, char *buf, size_t *nbyte, int blkno) {
+/* Common routine for read/write. The buffer is translated page by
+   page in blkq_rw, since it may well be backed by noncontiguous
+   physical pages, and handed to the controller's queue in pieces of
+   at most BUFFER_LENGTH bytes. Must be called in the context of the
+   task owning buf. */
+static int hdd_rw(device_t dev, int cmd, char *buf, size_t *nbyte, int blkno) {
   struct ata_disk *disk = NULL;
-  uint8_t *kbuf;
   size_t sector_count = *nbyte / SECTOR_SIZE;
-  size_t transferred_total = 0;
   size_t sector_limit = 0; /* number of first invalid sector */
+  int err;
 
-  /* DPRINTF(("R Pre adjustment: %08x count %d (%d bytes)\n", blkno, sector_count, *nbyte)); */
+  /* DPRINTF(("Pre adjustment: %08x count %d (%d bytes)\n", blkno, sector_count, *nbyte)); */
   adjust_blkno(dev, &disk, &blkno, &sector_limit);
-  /* DPRINTF(("R Post adjustment: %08x limit %08x\n", blkno, sector_limit)); */
+  /* DPRINTF(("Post adjustment: %08x limit %08x\n", blkno, sector_limit)); */
   if ((blkno < 0) || (blkno + sector_count > sector_limit))
     return EIO;
 
-  kbuf = kmem_map(buf, *nbyte);
-  if (kbuf == NULL)
-    return EFAULT;
-  /* TODO: could it be possible that noncontiguous physical pages are
-     backing this portion of virtual address space? The code here (and
-     in fdd.c, which it is based on) assumes not, I think... */
-
-  while (sector_count > 0) {
-    size_t transfer_sector_count =
-      (sector_count > BUFFER_LENGTH_IN_SECTORS) ? BUFFER_LENGTH_IN_SECTORS : sector_count;
-    size_t transfer_byte_count = SECTOR_SIZE * transfer_sector_count;
-    int err;
-
-    err = hdd_rw(disk, IO_READ, kbuf, transfer_sector_count, blkno);
-    if (err) {
-      printf("hdd_read error: 0x%08x\n", err);
-      *nbyte = transferred_total;
-      return EIO;
-    }
-
-    transferred_total += transfer_byte_count;
-    kbuf += transfer_byte_count;
-    blkno += transfer_sector_count;
-    sector_count -= transfer_sector_count;
-  }
+  *nbyte = sector_count * SECTOR_SIZE;
+  err = blkq_rw(&disk->controller->q, disk, cmd, buf, nbyte, blkno);
+  if (err && err != EFAULT)
+    err = EIO;
+  return err;
+}
 
-  *nbyte = transferred_total;
-  return 0;
+static int hdd_read(device_t dev, char *buf, size_t *nbyte, int blkno) {
+  return hdd_rw(dev, IO_READ, buf, nbyte, blkno);
 }
 
 static int hdd_write(device_t dev, char *buf, size_t *nbyte, int blkno) {
-  struct ata_disk *disk = NULL;
-  uint8_t *kbuf;
-  size_t sector_count = *nbyte / SECTOR_SIZE;
-  size_t transferred_total = 0;
-  size_t sector_limit = 0; /* number of first invalid sector */
-
-  /* DPRINTF(("W Pre adjustment: %08x count %d (%d bytes)\n", blkno, sector_count, *nbyte)); */
-  adjust_blkno(dev, &disk, &blkno, &sector_limit);
-  /* DPRINTF(("W Post adjustment: %08x limit %08x\n", blkno, sector_limit)); */
-  if ((blkno < 0) || (blkno + sector_count > sector_limit))
-    return EIO;
-
-  kbuf = kmem_map(buf, *nbyte);
-  if (kbuf == NULL)
-    return EFAULT;
-  /* TODO: same kmem_map caveat as for hdd_read */
-
-  /* printf("total of %d sectors to write starting at %d\n", sector_count, blkno); */
-  while (sector_count > 0) {
-    size_t transfer_sector_count =
-      (sector_count > BUFFER_LENGTH_IN_SECTORS) ? BUFFER_LENGTH_IN_SECTORS : sector_count;
-    size_t transfer_byte_count = SECTOR_SIZE * transfer_sector_count;
-    int err;
-
-    /* printf("about to write %d sectors at blkno %d\n", transfer_sector_count, blkno); */
-    err = hdd_rw(disk, IO_WRITE, kbuf, transfer_sector_count, blkno);
-    if (err) {
-      printf("hdd_write error: 0x%08x\n", err);
-      *nbyte = transferred_total;
-      return EIO;
-    }
-
-    transferred_total += transfer_byte_count;
-    kbuf += transfer_byte_count;
-    blkno += transfer_sector_count;
-    sector_count -= transfer_sector_count;
-  }
-
-  *nbyte = transferred_total;
-  return 0;
+  return hdd_rw(dev, IO_WRITE, buf, nbyte, blkno);
 }
 
 static struct devops hdd_devops = {
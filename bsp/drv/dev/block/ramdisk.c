@@ -32,6 +32,9 @@
  */
 
 #include <driver.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <blkq.h>
 
 /* #define DEBUG_RAMDISK 1 */
 
@@ -48,10 +51,12 @@ struct ramdisk_softc {
 	device_t	dev;		/* device object */
 	char		*addr;		/* base address of image */
 	size_t		size;		/* image size */
+	struct blkq	q;		/* request queue */
 };
 
 static int ramdisk_read(device_t, char *, size_t *, int);
 static int ramdisk_write(device_t, char *, size_t *, int);
+static int ramdisk_ioctl(device_t, u_long, void *);
 static int ramdisk_probe(struct driver *);
 static int ramdisk_init(struct driver *);
 
@@ -60,7 +65,7 @@ static struct devops ramdisk_devops = {
 	/* close */	no_close,
 	/* read */	ramdisk_read,
 	/* write */	ramdisk_write,
-	/* ioctl */	no_ioctl,
+	/* ioctl */	ramdisk_ioctl,
 	/* devctl */	no_devctl,
 };
 
@@ -74,62 +79,116 @@ struct driver ramdisk_driver = {
 	/* shutdown */	NULL,
 };
 
+/*
+ * Copy a chain of requests.  The transfer is done right here, so
+ * the queue only serves to order and merge requests.  Bytes beyond
+ * the end of the image are left untouched.
+ */
+static void
+ramdisk_start(struct blkq *q, struct blkreq *r)
+{
+	struct ramdisk_softc *sc = q->priv;
+	size_t off, len;
+	char *kva;
+	int i;
+
+	off = (size_t)r->blkno * BSIZE;
+	for (; r != NULL; r = r->next) {
+		for (i = 0; i < r->nsegs; i++) {
+			len = r->segs[i].len;
+			if (off >= sc->size)
+				len = 0;
+			else if (off + len > sc->size)
+				len = sc->size - off;
+			kva = ptokv(r->segs[i].addr);
+			if (r->cmd == IO_READ)
+				memcpy(kva, sc->addr + off, len);
+			else
+				memcpy(sc->addr + off, kva, len);
+			off += r->segs[i].len;
+		}
+	}
+	blkq_done(q, 0);
+}
+
+/*
+ * Common routine for read/write.  The image size need not be a
+ * multiple of BSIZE, so the last block may be partial.
+ */
 static int
-ramdisk_read(device_t dev, char *buf, size_t *nbyte, int blkno)
+ramdisk_rw(device_t dev, int cmd, char *buf, size_t *nbyte, int blkno)
 {
 	struct ramdisk_softc *sc = device_private(dev);
-	int offset = blkno * BSIZE;
-	void *kbuf;
-	size_t nr_read;
+	size_t offset = (size_t)blkno * BSIZE;
+	size_t count, len;
+	int error;
 
-	DPRINTF(("ramdisk_read: buf=%x nbyte=%d blkno=%x\n",
-		 buf, *nbyte, blkno));
+	DPRINTF(("ramdisk_rw: cmd=%d buf=%x nbyte=%d blkno=%x\n",
+		 cmd, buf, *nbyte, blkno));
 
 	/* Check overrun */
-	if (offset > (int)sc->size) {
-		DPRINTF(("ramdisk_read: overrun!\n"));
+	if (blkno < 0 || offset > sc->size) {
+		DPRINTF(("ramdisk_rw: overrun!\n"));
 		return EIO;
 	}
-	nr_read = *nbyte;
-	if (offset + nr_read > (int)sc->size)
-		nr_read = sc->size - offset;
-
-	/* Translate buffer address to kernel address */
-	if ((kbuf = kmem_map(buf, nr_read)) == NULL) {
-		return EFAULT;
+	count = *nbyte;
+	if (offset + count > sc->size)
+		count = sc->size - offset;
+
+	len = ((count + BSIZE - 1) / BSIZE) * BSIZE;
+	if (len > *nbyte)
+		len = *nbyte;
+	if ((error = blkq_rw(&sc->q, sc, cmd, buf, &len, blkno)) != 0) {
+		*nbyte = 0;
+		return error;
 	}
-
-	/* Copy data */
-	memcpy(kbuf, sc->addr + offset, nr_read);
-	*nbyte = nr_read;
+	*nbyte = (len < count) ? len : count;
 	return 0;
 }
 
 static int
-ramdisk_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+ramdisk_read(device_t dev, char *buf, size_t *nbyte, int blkno)
 {
-	struct ramdisk_softc *sc = device_private(dev);
-	int offset = blkno * BSIZE;
-	void *kbuf;
-	size_t nr_write;
 
-	DPRINTF(("ramdisk_write: buf=%x nbyte=%d blkno=%x\n",
-		 buf, *nbyte, blkno));
+	return ramdisk_rw(dev, IO_READ, buf, nbyte, blkno);
+}
 
-	/* Check overrun */
-	if (offset > (int)sc->size)
-		return EIO;
-	nr_write = *nbyte;
-	if (offset + nr_write > (int)sc->size)
-		nr_write = sc->size - offset;
+static int
+ramdisk_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
 
-	/* Translate buffer address to kernel address */
-	if ((kbuf = kmem_map(buf, nr_write)) == NULL)
-		return EFAULT;
+	return ramdisk_rw(dev, IO_WRITE, buf, nbyte, blkno);
+}
 
-	/* Copy data */
-	memcpy(sc->addr + offset, kbuf, nr_write);
-	*nbyte = nr_write;
+/*
+ * Map the image read-only into the caller, so that a file system
+ * can take the data straight from the image instead of reading
+ * it block by block.  The mapping follows any later writes.
+ */
+static int
+ramdisk_ioctl(device_t dev, u_long cmd, void *arg)
+{
+	struct ramdisk_softc *sc = device_private(dev);
+	struct devmap dm;
+	int error;
+
+	switch (cmd) {
+	case DMIOC_MAP:
+		if (copyin(arg, &dm, sizeof(dm)))
+			return EFAULT;
+		if (dm.dm_prot != PROT_READ)
+			return EACCES;
+		error = vm_physmap(kvtop(sc->addr), sc->size, PROT_READ,
+				   &dm.dm_addr);
+		if (error)
+			return error;
+		dm.dm_size = sc->size;
+		if (copyout(&dm, arg, sizeof(dm)))
+			return EFAULT;
+		break;
+	default:
+		return EINVAL;
+	}
 	return 0;
 }
 
@@ -167,6 +226,7 @@ ramdisk_init(struct driver *self)
 	sc->dev = dev;
 	sc->addr = (char *)ptokv(phys->base);
 	sc->size = (size_t)phys->size;
+	blkq_init(&sc->q, BSIZE, 128, ramdisk_start, sc);
 
 #ifdef DEBUG
 	printf("RAM disk at 0x%08x (%dK bytes)\n",
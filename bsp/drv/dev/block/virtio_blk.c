@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * virtio_blk.c - virtio block device
+ */
+
+/*
+ * Each command slot holds one chain of requests from the queue, so
+ * the device sees up to VBLK_MAXSLOTS transfers at once.  If the
+ * device takes indirect descriptors, a slot uses a single entry of
+ * the ring, which points to a descriptor table of its own; the ring
+ * then never limits the number of slots.  Otherwise the slot's
+ * descriptors are taken from the ring itself, and only as many
+ * slots as fit in the ring are used.
+ *
+ * Every slot owns a fixed range of ring descriptors, so the head
+ * that comes back on the used ring tells the slot directly.
+ *
+ * Disks and partitions get the same names as with the hdd driver.
+ * With QEMU, attach a disk by "-drive file=disk.img,if=virtio".
+ */
+
+#include <driver.h>
+#include <pci.h>
+#include <virtio.h>
+#include <blkq.h>
+#include <disklabel.h>
+
+/* #define DEBUG_VBLK 1 */
+
+#ifdef DEBUG_VBLK
+#define DPRINTF(a)	printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define SECTOR_SIZE	512
+
+#define VBLK_MAXSLOTS	32
+#define VBLK_NSEGS	62	/* data segments per slot */
+#define VBLK_MAXBLKS	256	/* sectors per command */
+
+#define SLOT(n)		((uint32_t)1 << (n))
+
+/* Feature bits */
+#define VBLK_F_SEG_MAX	0x00000004	/* seg_max is valid */
+#define VBLK_F_RO	0x00000020	/* read-only disk */
+
+/* Device configuration */
+#define VBLK_CFG_CAPACITY	0	/* 64-bit, in sectors */
+#define VBLK_CFG_SEG_MAX	12
+
+/* Request types */
+#define VBLK_T_IN	0
+#define VBLK_T_OUT	1
+
+#define VBLK_S_OK	0
+
+/*
+ * Request header, read by the device
+ */
+struct vblk_hdr {
+	uint32_t	type;
+	uint32_t	ioprio;
+	uint32_t	sector;		/* 64-bit sector number (low) */
+	uint32_t	sector_hi;
+};
+
+/*
+ * Per-slot DMA memory: the indirect descriptor table, the header
+ * and the status byte.  The size is kept a multiple of 16, so the
+ * tables of all slots stay aligned.
+ */
+struct vblk_cmd {
+	struct vring_desc tbl[VBLK_NSEGS + 2];
+	struct vblk_hdr	hdr;
+	uint8_t		status;
+	uint8_t		pad[15];
+};
+
+struct vblk_softc {
+	char		devname[MAXDEVNAME]; /* "hdXd0" */
+	struct virtio_dev vd;		/* transport */
+	struct virtq	vq;		/* request queue of the device */
+	int		indirect;	/* indirect descriptors in use */
+	int		stride;		/* ring descriptors per slot */
+	int		nslots;		/* command slots in use */
+	int		nsegs;		/* max data segments per slot */
+	int		rdonly;		/* read-only disk */
+	u_long		nsects;		/* capacity */
+	paddr_t		mem;		/* slot memory */
+	size_t		memsz;
+	struct vblk_cmd	*cmd;		/* per-slot memory */
+	uint8_t		*scratch;	/* one sector for probing */
+	uint32_t	issued;		/* slots in flight */
+	struct blkreq	*slot[VBLK_MAXSLOTS]; /* chain in each slot */
+	struct blkq	q;		/* request queue */
+};
+
+/*
+ * Device private data: a whole disk or one partition of it.
+ */
+struct vblk_unit {
+	struct vblk_softc *sc;
+	u_long		start;		/* first sector */
+	u_long		nsects;		/* number of sectors */
+};
+
+static int	vblk_read(device_t, char *, size_t *, int);
+static int	vblk_write(device_t, char *, size_t *, int);
+static int	vblk_init(struct driver *);
+
+static struct devops vblk_devops = {
+	/* open */	no_open,
+	/* close */	no_close,
+	/* read */	vblk_read,
+	/* write */	vblk_write,
+	/* ioctl */	no_ioctl,
+	/* devctl */	no_devctl,
+};
+
+struct driver virtio_blk_driver = {
+	/* name */	"virtio_blk",
+	/* devops */	&vblk_devops,
+	/* devsz */	sizeof(struct vblk_unit),
+	/* flags */	0,
+	/* probe */	NULL,
+	/* init */	vblk_init,
+	/* shutdown */	NULL,
+};
+
+static void
+vblk_setdesc(struct vring_desc *d, paddr_t addr, size_t len, int flags,
+	     int next)
+{
+
+	d->addr = (uint32_t)addr;
+	d->addr_hi = 0;
+	d->len = (uint32_t)len;
+	d->flags = (uint16_t)flags;
+	d->next = (uint16_t)next;
+}
+
+/*
+ * Fill in the descriptors of a slot for a chain of requests, and
+ * return the head to hand to the device.  A chain of one request
+ * and no data (nsegs 0) is used for probing: it reads into the
+ * scratch sector.
+ */
+static int
+vblk_load(struct vblk_softc *sc, int tag, struct blkreq *r, int cmd,
+	  u_long blkno)
+{
+	struct vblk_cmd *c = &sc->cmd[tag];
+	struct vring_desc *d;
+	int i, n, base, dflag;
+
+	c->hdr.type = (cmd == IO_READ) ? VBLK_T_IN : VBLK_T_OUT;
+	c->hdr.ioprio = 0;
+	c->hdr.sector = (uint32_t)blkno;
+	c->hdr.sector_hi = 0;
+	c->status = 0xff;
+
+	/* Descriptor indices are relative to the table in use. */
+	base = tag * sc->stride;
+	d = sc->indirect ? c->tbl : &sc->vq.desc[base];
+	if (sc->indirect)
+		base = 0;
+	dflag = (cmd == IO_READ) ? VRING_DESC_F_WRITE : 0;
+
+	vblk_setdesc(&d[0], kvtop(&c->hdr), sizeof(c->hdr),
+		     VRING_DESC_F_NEXT, base + 1);
+	n = 1;
+	if (r == NULL) {
+		vblk_setdesc(&d[n], kvtop(sc->scratch), SECTOR_SIZE,
+			     dflag | VRING_DESC_F_NEXT, base + n + 1);
+		n++;
+	}
+	for (; r != NULL; r = r->next) {
+		for (i = 0; i < r->nsegs; i++) {
+			ASSERT(n <= sc->nsegs);
+			vblk_setdesc(&d[n], r->segs[i].addr, r->segs[i].len,
+				     dflag | VRING_DESC_F_NEXT, base + n + 1);
+			n++;
+		}
+	}
+	vblk_setdesc(&d[n], kvtop(&c->status), 1, VRING_DESC_F_WRITE, 0);
+	n++;
+
+	if (!sc->indirect)
+		return tag * sc->stride;
+	vblk_setdesc(&sc->vq.desc[tag], kvtop(c->tbl),
+		     n * sizeof(struct vring_desc), VRING_DESC_F_INDIRECT, 0);
+	return tag;
+}
+
+/*
+ * Start a chain of requests from the queue in a free slot.
+ * Called by the queue at splhigh.
+ */
+static void
+vblk_start(struct blkq *q, struct blkreq *r)
+{
+	struct vblk_softc *sc = q->priv;
+	int tag;
+
+	for (tag = 0; tag < sc->nslots; tag++) {
+		if (!(sc->issued & SLOT(tag)))
+			break;
+	}
+	ASSERT(tag < sc->nslots);
+
+	sc->slot[tag] = r;
+	sc->issued |= SLOT(tag);
+	virtq_submit(&sc->vq, vblk_load(sc, tag, r, r->cmd,
+					(u_long)r->blkno));
+	virtq_notify(&sc->vq);
+}
+
+/*
+ * Interrupt service routine.  Reading the status acknowledges the
+ * interrupt, which may be shared with other PCI functions.
+ */
+static int
+vblk_isr(void *arg)
+{
+	struct vblk_softc *sc = arg;
+
+	if (virtio_intr(&sc->vd) == 0)
+		return INT_DONE;
+	return INT_CONTINUE;
+}
+
+/*
+ * Interrupt service thread.  Complete every finished slot; the
+ * queue refills each slot as it is freed.
+ */
+static void
+vblk_ist(void *arg)
+{
+	struct vblk_softc *sc = arg;
+	struct blkreq *r;
+	int head, tag, s;
+
+	s = splhigh();
+	while ((head = virtq_dequeue(&sc->vq, NULL)) >= 0) {
+		tag = head / sc->stride;
+		if (tag >= sc->nslots || !(sc->issued & SLOT(tag))) {
+			printf("%s: bogus completion %d\n", sc->devname, head);
+			continue;
+		}
+		r = sc->slot[tag];
+		sc->slot[tag] = NULL;
+		sc->issued &= ~SLOT(tag);
+		if (sc->cmd[tag].status != VBLK_S_OK)
+			printf("%s: I/O error, status %d, sector %d\n",
+			       sc->devname, sc->cmd[tag].status, r->blkno);
+		blkq_end(&sc->q, r,
+			 sc->cmd[tag].status == VBLK_S_OK ? 0 : EIO);
+	}
+	splx(s);
+}
+
+/*
+ * Read a sector into the scratch buffer by polling, before the
+ * interrupt is attached.
+ */
+static int
+vblk_poll(struct vblk_softc *sc, u_long blkno)
+{
+	int error;
+
+	sc->vq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+	virtq_submit(&sc->vq, vblk_load(sc, 0, NULL, IO_READ, blkno));
+	virtq_notify(&sc->vq);
+	error = 0;
+	if (virtq_poll(&sc->vq, NULL, 1000) < 0 ||
+	    sc->cmd[0].status != VBLK_S_OK) {
+		printf("%s: read of sector %d failed\n", sc->devname,
+		       (int)blkno);
+		error = EIO;
+	}
+	sc->vq.avail->flags = 0;
+	return error;
+}
+
+static device_t
+vblk_mkdev(struct driver *self, struct vblk_softc *sc, const char *name,
+	   u_long start, u_long nsects)
+{
+	struct vblk_unit *u;
+	device_t dev;
+
+	dev = device_create(self, name, D_BLK | D_PROT);
+	u = device_private(dev);
+	u->sc = sc;
+	u->start = start;
+	u->nsects = nsects;
+	return dev;
+}
+
+/*
+ * Register the partitions of the DOS disklabel.
+ */
+static void
+vblk_partitions(struct driver *self, struct vblk_softc *sc)
+{
+	struct mbr_part mbr[MBR_NPART];
+	char name[MAXDEVNAME];
+	int i;
+
+	if (vblk_poll(sc, 0) != 0 || mbr_read(sc->scratch, mbr) != 0)
+		return;
+
+	for (i = 0; i < MBR_NPART; i++) {
+		if (mbr[i].type == 0)
+			continue;
+		if (mbr[i].start >= sc->nsects ||
+		    mbr[i].nsects > sc->nsects - mbr[i].start) {
+			printf("%s: partition %d beyond end of disk\n",
+			       sc->devname, i);
+			continue;
+		}
+		disk_partname(name, sc->devname, i);
+		vblk_mkdev(self, sc, name, mbr[i].start, mbr[i].nsects);
+		printf(" - partition %s, type 0x%02x, 0x%08x size 0x%08x\n",
+		       name, mbr[i].type, mbr[i].start, mbr[i].nsects);
+	}
+}
+
+/*
+ * Work out how many slots to run, and how many segments each may
+ * carry, from what the device offers.
+ */
+static int
+vblk_setup(struct vblk_softc *sc)
+{
+	uint32_t segmax;
+
+	sc->nsegs = VBLK_NSEGS;
+	if (sc->vd.features & VBLK_F_SEG_MAX) {
+		segmax = virtio_cfg_read32(&sc->vd, VBLK_CFG_SEG_MAX);
+		if (segmax < (uint32_t)sc->nsegs)
+			sc->nsegs = (int)segmax;
+	}
+
+	if (sc->vd.features & VIRTIO_F_INDIRECT_DESC) {
+		sc->indirect = 1;
+		sc->stride = 1;
+		sc->nslots = sc->vq.size;
+	} else {
+		if (sc->nsegs > sc->vq.size - 2)
+			sc->nsegs = sc->vq.size - 2;
+		sc->stride = sc->nsegs + 2;
+		sc->nslots = sc->vq.size / sc->stride;
+	}
+	if (sc->nslots > VBLK_MAXSLOTS)
+		sc->nslots = VBLK_MAXSLOTS;
+
+	/* A single request must always fit in a slot. */
+	if (sc->nsegs < BLK_MAXSEGS || sc->nslots == 0) {
+		printf("%s: only %d segments per request\n", sc->devname,
+		       sc->nsegs);
+		return ENXIO;
+	}
+	return 0;
+}
+
+static void
+vblk_attach(struct driver *self, struct pci_device *v)
+{
+	struct vblk_softc *sc;
+	uint32_t hi;
+
+	if ((sc = kmem_alloc(sizeof(*sc))) == NULL)
+		return;
+	memset(sc, 0, sizeof(*sc));
+	if (virtio_attach(&sc->vd, v, VBLK_F_SEG_MAX | VBLK_F_RO |
+			  VIRTIO_F_INDIRECT_DESC) != 0) {
+		kmem_free(sc);
+		return;
+	}
+
+	disk_ctlrname(sc->devname);
+	sc->devname[3] = 'd';
+	sc->devname[4] = '0';
+	sc->devname[5] = '\0';
+
+	if (virtq_init(&sc->vd, &sc->vq, 0) != 0) {
+		printf("%s: no request queue\n", sc->devname);
+		goto fail;
+	}
+	if (vblk_setup(sc) != 0)
+		goto fail;
+
+	sc->memsz = round_page(sc->nslots * sizeof(struct vblk_cmd) +
+			       SECTOR_SIZE);
+	if ((sc->mem = page_alloc(sc->memsz)) == 0)
+		goto fail;
+	memset(ptokv(sc->mem), 0, sc->memsz);
+	sc->cmd = ptokv(sc->mem);
+	sc->scratch = (uint8_t *)(sc->cmd + sc->nslots);
+
+	sc->rdonly = (sc->vd.features & VBLK_F_RO) != 0;
+	sc->nsects = virtio_cfg_read32(&sc->vd, VBLK_CFG_CAPACITY);
+	hi = virtio_cfg_read32(&sc->vd, VBLK_CFG_CAPACITY + 4);
+	/* Block numbers are ints. */
+	if (hi != 0 || sc->nsects > 0x7fffffff)
+		sc->nsects = 0x7fffffff;
+
+	printf("device %d.%d.%d = %s (virtio, %lu sectors, %d slot%s%s%s)\n",
+	       v->bus, v->slot, v->function, sc->devname, sc->nsects,
+	       sc->nslots, sc->nslots > 1 ? "s" : "",
+	       sc->indirect ? ", indirect" : "",
+	       sc->rdonly ? ", read-only" : "");
+
+	blkq_init(&sc->q, SECTOR_SIZE, VBLK_MAXBLKS, vblk_start, sc);
+	sc->q.depth = sc->nslots;
+	sc->q.maxsegs = sc->nsegs;
+
+	virtio_ready(&sc->vd);
+	vblk_mkdev(self, sc, sc->devname, 0, sc->nsects);
+	vblk_partitions(self, sc);
+
+	/* PCI interrupts are level triggered. */
+	sc->vd.irq = irq_attach(read_pci_interrupt_line(v), IPL_BLOCK, 1,
+				vblk_isr, vblk_ist, sc);
+	return;
+
+ fail:
+	virtio_fail(&sc->vd);
+	if (sc->vq.mem != 0)
+		page_free(sc->vq.mem, sc->vq.memsz);
+	if (sc->mem != 0)
+		page_free(sc->mem, sc->memsz);
+	kmem_free(sc);
+}
+
+static int
+vblk_rw(device_t dev, int cmd, char *buf, size_t *nbyte, int blkno)
+{
+	struct vblk_unit *u = device_private(dev);
+	u_long nsects = *nbyte / SECTOR_SIZE;
+
+	DPRINTF(("vblk_rw: cmd=%d buf=%x nbyte=%d blkno=%x\n",
+		 cmd, buf, *nbyte, blkno));
+
+	if (blkno < 0 || (u_long)blkno > u->nsects ||
+	    nsects > u->nsects - (u_long)blkno)
+		return EIO;
+	if (cmd == IO_WRITE && u->sc->rdonly)
+		return EROFS;
+
+	*nbyte = nsects * SECTOR_SIZE;
+	return blkq_rw(&u->sc->q, u->sc, cmd, buf, nbyte,
+		       blkno + (int)u->start);
+}
+
+static int
+vblk_read(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+
+	return vblk_rw(dev, IO_READ, buf, nbyte, blkno);
+}
+
+static int
+vblk_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+
+	return vblk_rw(dev, IO_WRITE, buf, nbyte, blkno);
+}
+
+static int
+vblk_init(struct driver *self)
+{
+	struct pci_device *v;
+	size_t i;
+
+	for (i = 0; i < pci_device_count; i++) {
+		v = &pci_devices[i];
+		if (v->vendor_id == VIRTIO_VENDOR &&
+		    v->device_id == VIRTIO_DEV_BLK)
+			vblk_attach(self, v);
+	}
+	return 0;
+}
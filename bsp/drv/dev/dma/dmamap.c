@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dmamap.c - DMA mapping
+ */
+
+/*
+ * A driver describes what its device can address by a dma_tag,
+ * and gets the segments of each transfer from a dma_map.  When a
+ * buffer is out of reach of the device (above 16M for ISA DMA,
+ * misaligned, or in too many pieces), the data is copied through
+ * a bounce buffer instead.  dmamap_sync() keeps the memory and
+ * the cache coherent around the transfer.
+ */
+
+#include <driver.h>
+#include <dmamap.h>
+
+/* #define DEBUG_DMAMAP 1 */
+
+#ifdef DEBUG_DMAMAP
+#define DPRINTF(a)	printf a
+#else
+#define DPRINTF(a)
+#endif
+
+/*
+ * Translate a buffer into physically contiguous segments.
+ *
+ * kmem_map() only vouches for the first page of a range, and the
+ * pages behind a user buffer are generally scattered, so each page
+ * is looked up on its own.  This must be called in the context of
+ * the task owning the buffer, unless it is a kernel buffer.
+ */
+int
+dma_segs(char *buf, size_t len, struct dma_seg *segs, int maxsegs,
+	 int *nsegs)
+{
+	struct dma_seg *seg;
+	size_t off, chunk;
+	void *kva;
+	paddr_t pa;
+	int n = 0;
+
+	for (off = 0; off < len; off += chunk) {
+		chunk = PAGE_SIZE - ((vaddr_t)(buf + off) & PAGE_MASK);
+		if (chunk > len - off)
+			chunk = len - off;
+		if (!user_area(buf + off))
+			kva = buf + off;
+		else if ((kva = kmem_map(buf + off, chunk)) == NULL)
+			return EFAULT;
+		pa = kvtop(kva);
+
+		if (n > 0) {
+			seg = &segs[n - 1];
+			if (seg->addr + seg->len == pa) {
+				seg->len += chunk;
+				continue;
+			}
+		}
+		if (n == maxsegs)
+			return EFBIG;
+		seg = &segs[n++];
+		seg->addr = pa;
+		seg->len = chunk;
+	}
+	*nsegs = n;
+	return 0;
+}
+
+/*
+ * Return true if the device can reach a segment as it is.
+ */
+static int
+dma_reachable(const struct dma_tag *tag, const struct dma_seg *seg)
+{
+
+	if (tag->maxaddr != 0 && seg->addr + (seg->len - 1) > tag->maxaddr)
+		return 0;
+	if (tag->align > 1 && ((seg->addr | seg->len) & (tag->align - 1)))
+		return 0;
+	return 1;
+}
+
+/*
+ * Build the segments for the device, splitting them at the
+ * boundary and at the max segment size of the device.
+ */
+static int
+dmamap_split(struct dma_map *map, const struct dma_seg *src, int n)
+{
+	const struct dma_tag *tag = map->tag;
+	struct dma_seg *seg;
+	paddr_t pa;
+	size_t len, chunk;
+	int max;
+
+	max = DMA_MAXSEGS;
+	if (tag->maxsegs > 0 && tag->maxsegs < max)
+		max = tag->maxsegs;
+
+	map->nsegs = 0;
+	for (; n > 0; n--, src++) {
+		pa = src->addr;
+		len = src->len;
+		while (len > 0) {
+			chunk = len;
+			if (tag->boundary != 0 &&
+			    chunk > tag->boundary - (pa & (tag->boundary - 1)))
+				chunk = tag->boundary -
+				    (pa & (tag->boundary - 1));
+			if (tag->maxsegsz != 0 && chunk > tag->maxsegsz)
+				chunk = tag->maxsegsz;
+			if (map->nsegs == max)
+				return EFBIG;
+			seg = &map->segs[map->nsegs++];
+			seg->addr = pa;
+			seg->len = chunk;
+			pa += chunk;
+			len -= chunk;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Set up the device's segments for the memory in "bufs",
+ * going through the bounce buffer if the device can not use
+ * the memory directly.
+ */
+static int
+dmamap_setup(struct dma_map *map)
+{
+	struct dma_seg seg;
+	size_t total = 0;
+	int i, direct = 1;
+
+	map->bounced = 0;
+	for (i = 0; i < map->nbufs; i++) {
+		if (!dma_reachable(map->tag, &map->bufs[i]))
+			direct = 0;
+		total += map->bufs[i].len;
+	}
+	if (direct && dmamap_split(map, map->bufs, map->nbufs) == 0)
+		return 0;
+
+	if (map->bounce == 0 || total > map->bouncesz)
+		return EFBIG;
+	seg.addr = map->bounce;
+	seg.len = total;
+	if (!dma_reachable(map->tag, &seg))
+		return EINVAL;
+
+	DPRINTF(("dmamap: bounce %d bytes\n", total));
+	map->bounced = 1;
+	return dmamap_split(map, &seg, 1);
+}
+
+/*
+ * Initialize a map for a device.
+ *
+ * If "maxsize" is not zero, a bounce buffer of that size is
+ * allocated within the reach of the device.  Call this when the
+ * driver is initialized, while low memory is still free.
+ */
+int
+dmamap_create(struct dma_map *map, const struct dma_tag *tag,
+	      size_t maxsize)
+{
+	paddr_t pa, tmp;
+	size_t size, boundary;
+
+	map->tag = tag;
+	map->bounce = 0;
+	map->bouncesz = 0;
+	map->bounced = 0;
+	map->nsegs = 0;
+	map->nbufs = 0;
+	if (maxsize == 0)
+		return 0;
+
+	size = round_page(maxsize);
+	boundary = tag->boundary;
+	if (boundary != 0 && size <= boundary) {
+		/*
+		 * Find free pages of (boundary + size), and take
+		 * the part which does not cross the boundary.
+		 */
+		sched_lock();
+		tmp = page_alloc(boundary + size);
+		if (tmp != 0) {
+			page_free(tmp, boundary + size);
+			pa = (tmp + boundary - 1) & ~(paddr_t)(boundary - 1);
+			if (page_reserve(pa, size) != 0)
+				pa = 0;
+		} else
+			pa = 0;
+		sched_unlock();
+	} else
+		pa = page_alloc(size);
+	if (pa == 0)
+		return ENOMEM;
+
+	if (tag->maxaddr != 0 && pa + (size - 1) > tag->maxaddr) {
+		page_free(pa, size);
+		return ENOMEM;
+	}
+	map->bounce = pa;
+	map->bouncesz = size;
+	return 0;
+}
+
+void
+dmamap_destroy(struct dma_map *map)
+{
+
+	if (map->bounce != 0)
+		page_free(map->bounce, map->bouncesz);
+	map->bounce = 0;
+	map->bouncesz = 0;
+}
+
+/*
+ * Load a user or kernel buffer into a map.
+ * This must be called in the context of the task owning the
+ * buffer, unless it is a kernel buffer.
+ */
+int
+dmamap_load(struct dma_map *map, char *buf, size_t len)
+{
+	int error;
+
+	if (len > DMA_MAXBYTES)
+		return EFBIG;
+	error = dma_segs(buf, len, map->bufs, DMA_MAXSEGS, &map->nbufs);
+	if (error)
+		return error;
+	return dmamap_setup(map);
+}
+
+/*
+ * Load physical segments into a map.
+ */
+int
+dmamap_load_segs(struct dma_map *map, const struct dma_seg *segs,
+		 int nsegs)
+{
+
+	if (nsegs > DMA_MAXSEGS)
+		return EFBIG;
+	memcpy(map->bufs, segs, (size_t)nsegs * sizeof(struct dma_seg));
+	map->nbufs = nsegs;
+	return dmamap_setup(map);
+}
+
+/*
+ * Copy data between the memory and the bounce buffer.
+ */
+static void
+dmamap_bounce(struct dma_map *map, int to_bounce)
+{
+	char *bounce = ptokv(map->bounce);
+	char *p;
+	int i;
+
+	for (i = 0; i < map->nbufs; i++) {
+		p = ptokv(map->bufs[i].addr);
+		if (to_bounce)
+			memcpy(bounce, p, map->bufs[i].len);
+		else
+			memcpy(p, bounce, map->bufs[i].len);
+		bounce += map->bufs[i].len;
+	}
+}
+
+static void
+dmamap_cache(struct dma_map *map, int op)
+{
+	int i;
+
+	for (i = 0; i < map->nsegs; i++)
+		cache_sync(ptokv(map->segs[i].addr), map->segs[i].len, op);
+}
+
+/*
+ * Make the memory and the cache coherent around a transfer.
+ *
+ * Data to the device is written back from the cache before the
+ * transfer.  Data from the device is dropped from the cache both
+ * before the transfer, so that no dirty line is written over it,
+ * and after, in case the CPU has fetched a line meanwhile.
+ */
+void
+dmamap_sync(struct dma_map *map, int ops)
+{
+
+	if (ops & DMA_PREWRITE) {
+		if (map->bounced)
+			dmamap_bounce(map, 1);
+		dmamap_cache(map, CACHE_WBACK);
+	}
+	if (ops & (DMA_PREREAD | DMA_POSTREAD))
+		dmamap_cache(map, CACHE_INVAL);
+	if ((ops & DMA_POSTREAD) && map->bounced)
+		dmamap_bounce(map, 0);
+}
+
+void
+dmamap_unload(struct dma_map *map)
+{
+
+	map->nsegs = 0;
+	map->nbufs = 0;
+	map->bounced = 0;
+}
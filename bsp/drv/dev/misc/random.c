@@ -28,25 +28,62 @@
  */
 
 /*
- * null.c - /dev/random device
+ * random.c - /dev/random and /dev/urandom devices
+ */
+
+/*
+ * Random numbers are the key stream of ChaCha20.  Each read takes
+ * a private key derived from the global generator, so that large
+ * reads run without locking, and generates the output directly
+ * into the caller's buffer.  The global key is replaced after
+ * every use ("fast key erasure"), thus the past output can not be
+ * reconstructed from the current state.
+ *
+ * The kernel mixes the timing of every interrupt into a small
+ * pool.  The key is reseeded from that pool every RESEED_MSEC,
+ * or after RESEED_BYTES of output.  Reading /dev/random waits
+ * until enough interrupts have been sampled since boot, while
+ * /dev/urandom never blocks.
  */
 
 #include <driver.h>
 
+#define RESEED_MSEC	10000		/* reseed interval */
+#define RESEED_BYTES	(1024 * 1024)	/* output between reseeds */
+#define SEED_SAMPLES	128		/* interrupts before first use */
+
+#define ROTL(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QROUND(a, b, c, d) do { \
+	a += b; d ^= a; d = ROTL(d, 16); \
+	c += d; b ^= c; b = ROTL(b, 12); \
+	a += b; d ^= a; d = ROTL(d, 8); \
+	c += d; b ^= c; b = ROTL(b, 7); \
+} while (0)
+
+/*
+ * ChaCha20 state: constants, 256-bit key, 64-bit block counter
+ * and 64-bit nonce.
+ */
+struct chacha {
+	uint32_t	in[16];
+};
+
 static int random_read(device_t, char *, size_t *, int);
+static int random_write(device_t, char *, size_t *, int);
 static int random_init(struct driver *);
 
 static struct devops random_devops = {
 	/* open */	no_open,
 	/* close */	no_close,
 	/* read */	random_read,
-	/* write */	no_write,
+	/* write */	random_write,
 	/* ioctl */	no_ioctl,
 	/* devctl */	no_devctl,
 };
 
 struct driver random_driver = {
-	/* name */	"null",
+	/* name */	"random",
 	/* devops */	&random_devops,
 	/* devsz */	0,
 	/* flags */	0,
@@ -55,13 +92,203 @@ struct driver random_driver = {
 	/* shutdown */	NULL,
 };
 
+static const uint32_t sigma[4] = {
+	0x61707865, 0x3320646e, 0x79622d32, 0x6b206574	/* "expand 32-byte k" */
+};
+
+static device_t		random_dev;	/* /dev/random */
+static struct chacha	random_state;	/* global generator */
+static u_long		random_stamp;	/* ticks at last reseed */
+static size_t		random_count;	/* bytes since last reseed */
+static u_int		random_samples;	/* interrupts sampled in total */
+
+/*
+ * Set the key and clear the counter and nonce.
+ */
+static void
+chacha_setkey(struct chacha *cs, const uint32_t *key)
+{
+
+	memcpy(&cs->in[0], sigma, sizeof(sigma));
+	memcpy(&cs->in[4], key, 32);
+	cs->in[12] = 0;
+	cs->in[13] = 0;
+	cs->in[14] = 0;
+	cs->in[15] = 0;
+}
+
+/*
+ * Generate the next 64-byte block of key stream.
+ */
+static void
+chacha_block(struct chacha *cs, uint32_t *out)
+{
+	uint32_t x[16];
+	int i;
+
+	memcpy(x, cs->in, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QROUND(x[0], x[4], x[8], x[12]);
+		QROUND(x[1], x[5], x[9], x[13]);
+		QROUND(x[2], x[6], x[10], x[14]);
+		QROUND(x[3], x[7], x[11], x[15]);
+		QROUND(x[0], x[5], x[10], x[15]);
+		QROUND(x[1], x[6], x[11], x[12]);
+		QROUND(x[2], x[7], x[8], x[13]);
+		QROUND(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++)
+		out[i] = x[i] + cs->in[i];
+
+	if (++cs->in[12] == 0)
+		cs->in[13]++;
+}
+
+/*
+ * Fill buf with key stream.
+ */
+static void
+chacha_fill(struct chacha *cs, char *buf, size_t len)
+{
+	uint32_t blk[16];
+
+	if (((vaddr_t)buf & 3) == 0) {
+		while (len >= sizeof(blk)) {
+			chacha_block(cs, (uint32_t *)buf);
+			buf += sizeof(blk);
+			len -= sizeof(blk);
+		}
+	}
+	while (len > 0) {
+		chacha_block(cs, blk);
+		if (len < sizeof(blk)) {
+			memcpy(buf, blk, len);
+			break;
+		}
+		memcpy(buf, blk, sizeof(blk));
+		buf += sizeof(blk);
+		len -= sizeof(blk);
+	}
+	memset(blk, 0, sizeof(blk));
+}
+
+/*
+ * Replace the global key with fresh key stream, after mixing
+ * in the optional seed material.
+ */
+static void
+random_rekey(const uint32_t *seed, int nwords)
+{
+	uint32_t blk[16];
+	int i;
+
+	for (i = 0; i < nwords && i < 10; i++)
+		random_state.in[i + 4] ^= seed[i];
+
+	chacha_block(&random_state, blk);
+	chacha_setkey(&random_state, blk);
+	memset(blk, 0, sizeof(blk));
+}
+
+/*
+ * Mix the interrupt timing pool into the key.
+ */
+static void
+random_reseed(void)
+{
+	uint32_t pool[16];
+	int i;
+
+	random_samples += irq_entropy(pool, sizeof(pool));
+
+	/* Fold the pool in half to fit the key */
+	for (i = 0; i < 8; i++)
+		pool[i] ^= ROTL(pool[i + 8], 16);
+	random_rekey(pool, 8);
+	memset(pool, 0, sizeof(pool));
+
+	random_stamp = timer_ticks();
+	random_count = 0;
+}
+
+/*
+ * Take a private generator for one read request.
+ */
+static void
+random_getkey(struct chacha *cs, size_t len)
+{
+	uint32_t key[8];
+
+	sched_lock();
+	if (random_count >= RESEED_BYTES ||
+	    timer_ticks() - random_stamp >= mstohz(RESEED_MSEC))
+		random_reseed();
+	random_count += len;
+
+	chacha_block(&random_state, cs->in);
+	memcpy(key, cs->in, sizeof(key));
+	random_rekey(NULL, 0);
+	sched_unlock();
+
+	chacha_setkey(cs, key);
+	memset(key, 0, sizeof(key));
+}
+
 static int
 random_read(device_t dev, char *buf, size_t *nbyte, int blkno)
 {
+	struct chacha cs;
+	size_t total, len;
+	void *p;
+
+	/* /dev/random waits until the pool is seeded */
+	while (dev == random_dev && random_samples < SEED_SAMPLES) {
+		sched_lock();
+		random_reseed();
+		sched_unlock();
+		if (random_samples < SEED_SAMPLES)
+			timer_delay(10);
+	}
+
+	random_getkey(&cs, *nbyte);
 
-	/* TODO */
+	/* Map and fill the buffer one page at a time */
+	for (total = 0; total < *nbyte; total += len) {
+		len = PAGE_SIZE - ((vaddr_t)(buf + total) & (PAGE_SIZE - 1));
+		if (len > *nbyte - total)
+			len = *nbyte - total;
+		if ((p = kmem_map(buf + total, len)) == NULL) {
+			memset(&cs, 0, sizeof(cs));
+			*nbyte = total;
+			return (total == 0) ? EFAULT : 0;
+		}
+		chacha_fill(&cs, p, len);
+	}
+	memset(&cs, 0, sizeof(cs));
+	return 0;
+}
+
+/*
+ * Data written to the device is mixed into the key.
+ */
+static int
+random_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+	uint32_t seed[8];
+	size_t total, len;
 
-	*nbyte = 0;
+	for (total = 0; total < *nbyte; total += len) {
+		len = *nbyte - total;
+		if (len > sizeof(seed))
+			len = sizeof(seed);
+		memset(seed, 0, sizeof(seed));
+		if (copyin(buf + total, seed, len))
+			return EFAULT;
+		sched_lock();
+		random_rekey(seed, 8);
+		sched_unlock();
+	}
+	memset(seed, 0, sizeof(seed));
 	return 0;
 }
 
@@ -69,6 +296,9 @@ static int
 random_init(struct driver *self)
 {
 
-	device_create(self, "random", D_CHR);
+	random_reseed();
+
+	random_dev = device_create(self, "random", D_CHR);
+	device_create(self, "urandom", D_CHR);
 	return 0;
 }
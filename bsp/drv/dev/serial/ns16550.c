@@ -46,6 +46,30 @@
 #define COM_BASE	CONFIG_NS16550_BASE
 #define COM_IRQ		CONFIG_NS16550_IRQ
 
+#ifdef CONFIG_NS16550_BAUD
+#define COM_BAUD	CONFIG_NS16550_BAUD
+#else
+#define COM_BAUD	115200
+#endif
+
+/* Input clock of the UART: 1.8432MHz on PC */
+#ifdef CONFIG_NS16550_CLOCK
+#define COM_CLOCK	CONFIG_NS16550_CLOCK
+#else
+#define COM_CLOCK	1843200
+#endif
+
+#if COM_BAUD > COM_CLOCK / 16
+#error "NS16550_BAUD is too high for NS16550_CLOCK"
+#endif
+
+/* Receive FIFO trigger level: 1, 4, 8 or 14 bytes */
+#ifdef CONFIG_NS16550_RXTRIG
+#define COM_RXTRIG	CONFIG_NS16550_RXTRIG
+#else
+#define COM_RXTRIG	8
+#endif
+
 /* Register offsets */
 #define COM_RBR		(COM_BASE + 0x00)	/* receive buffer register */
 #define COM_THR		(COM_BASE + 0x00)	/* transmit holding register */
@@ -71,7 +95,20 @@
 #define	IIR_TXB		0x02	/* transmitter holding register empty */
 #define	IIR_RXB		0x04	/* received data available */
 #define	IIR_LSR		0x06	/* line status change */
-#define	IIR_MASK	0x07	/* mask off just the meaningful bits */
+#define	IIR_RXTO	0x0c	/* receive timeout with data in FIFO */
+#define	IIR_MASK	0x0f	/* mask off just the meaningful bits */
+#define	IIR_FIFO	0xc0	/* FIFOs enabled (16550A) */
+
+/* FIFO control register */
+#define	FCR_ENABLE	0x01	/* enable FIFOs */
+#define	FCR_RCV_RST	0x02	/* clear receive FIFO */
+#define	FCR_XMT_RST	0x04	/* clear transmit FIFO */
+#define	FCR_TRIG_1	0x00	/* receive trigger levels */
+#define	FCR_TRIG_4	0x40
+#define	FCR_TRIG_8	0x80
+#define	FCR_TRIG_14	0xc0
+
+#define	FIFO_SIZE	16	/* transmit FIFO of 16550A */
 
 /* line status register */
 #define	LSR_RCV_FIFO	0x80
@@ -93,6 +130,7 @@ static char	ns16550_rcv_char(struct serial_port *);
 static void	ns16550_set_poll(struct serial_port *, int);
 static void	ns16550_start(struct serial_port *);
 static void	ns16550_stop(struct serial_port *);
+static void	ns16550_xmt_start(struct serial_port *);
 
 
 struct driver ns16550_driver = {
@@ -111,10 +149,12 @@ static struct serial_ops ns16550_ops = {
 	/* set_poll */	ns16550_set_poll,
 	/* start */	ns16550_start,
 	/* stop */	ns16550_stop,
+	/* xmt_start */	ns16550_xmt_start,
 };
 
 
 static struct serial_port ns16550_port;
+static int ns16550_fifosz;	/* bytes we may write per THRE */
 
 
 static void
@@ -148,39 +188,120 @@ ns16550_set_poll(struct serial_port *sp, int on)
 	}
 }
 
+/*
+ * Drain the receive FIFO.
+ */
+static void
+ns16550_rxdrain(struct serial_port *sp)
+{
+	char buf[32];
+	int n = 0;
+
+	while (bus_read_8(COM_LSR) & LSR_RXRDY) {
+		buf[n++] = bus_read_8(COM_RBR);
+		if (n == sizeof(buf)) {
+			serial_rcv_buf(sp, buf, n);
+			n = 0;
+		}
+	}
+	if (n > 0)
+		serial_rcv_buf(sp, buf, n);
+}
+
+/*
+ * Fill the transmit FIFO.  Must be called with the
+ * transmitter holding register empty.
+ */
+static void
+ns16550_txfill(struct serial_port *sp)
+{
+	char buf[FIFO_SIZE];
+	int i, n;
+
+	n = serial_xmt_fill(sp, buf, ns16550_fifosz);
+	for (i = 0; i < n; i++)
+		bus_write_8(COM_THR, buf[i]);
+}
+
 static int
 ns16550_isr(void *arg)
 {
 	struct serial_port *sp = arg;
-
-	switch (bus_read_8(COM_IIR) & IIR_MASK) {
-	case IIR_MSR:		/* Modem status change */
-		break;
-	case IIR_LSR:		/* Line status change */
-		bus_read_8(COM_LSR);
-		break;
-	case IIR_TXB:		/* Transmitter holding register empty */
-		serial_xmt_done(sp);
-		break;
-	case IIR_RXB:		/* Received data available */
-		bus_read_8(COM_LSR);
-		serial_rcv_char(sp, bus_read_8(COM_RBR));
-		break;
+	int iir;
+
+	while (!((iir = bus_read_8(COM_IIR)) & IIR_IP)) {
+		switch (iir & IIR_MASK) {
+		case IIR_MSR:		/* Modem status change */
+			bus_read_8(COM_MSR);
+			break;
+		case IIR_LSR:		/* Line status change */
+			bus_read_8(COM_LSR);
+			break;
+		case IIR_TXB:		/* Transmitter holding register empty */
+			ns16550_txfill(sp);
+			serial_xmt_done(sp);
+			break;
+		case IIR_RXB:		/* Received data available */
+		case IIR_RXTO:		/* Receive timeout */
+			ns16550_rxdrain(sp);
+			break;
+		default:
+			return 0;
+		}
 	}
 	return 0;
 }
 
+/*
+ * Prime the transmitter.  If it is busy, the THRE interrupt
+ * will pick up the queued data.
+ */
 static void
-ns16550_start(struct serial_port *sp)
+ns16550_xmt_start(struct serial_port *sp)
 {
 	int s;
 
+	s = splhigh();
+	if (bus_read_8(COM_LSR) & LSR_TXRDY)
+		ns16550_txfill(sp);
+	splx(s);
+}
+
+static void
+ns16550_start(struct serial_port *sp)
+{
+	int s, div, fcr;
+
+	div = COM_CLOCK / (16 * COM_BAUD);
+	switch (COM_RXTRIG) {
+	case 1:
+		fcr = FCR_TRIG_1;
+		break;
+	case 4:
+		fcr = FCR_TRIG_4;
+		break;
+	case 14:
+		fcr = FCR_TRIG_14;
+		break;
+	default:
+		fcr = FCR_TRIG_8;
+		break;
+	}
+
 	bus_write_8(COM_IER, 0x00);	/* Disable interrupt */
 	bus_write_8(COM_LCR, 0x80);	/* Access baud rate */
-	bus_write_8(COM_DLL, 0x01);	/* 115200 baud */
-	bus_write_8(COM_DLM, 0x00);
+	bus_write_8(COM_DLL, div & 0xff);
+	bus_write_8(COM_DLM, (div >> 8) & 0xff);
 	bus_write_8(COM_LCR, 0x03);	/* N, 8, 1 */
-	bus_write_8(COM_FCR, 0x06);	/* Disable & clear FIFO */
+
+	/* Enable & clear FIFO.  An 8250/16450 has none. */
+	bus_write_8(COM_FCR, FCR_ENABLE|FCR_RCV_RST|FCR_XMT_RST|fcr);
+	if ((bus_read_8(COM_IIR) & IIR_FIFO) == IIR_FIFO)
+		ns16550_fifosz = FIFO_SIZE;
+	else {
+		bus_write_8(COM_FCR, 0x00);
+		ns16550_fifosz = 1;
+	}
 
 	sp->irq = irq_attach(COM_IRQ, IPL_COMM, 0, ns16550_isr,
 			     IST_NONE, sp);
@@ -46,7 +46,18 @@
 #define UART_BASE	CONFIG_PL011_BASE
 #define UART_IRQ	CONFIG_PL011_IRQ
 #define UART_CLK	14745600
+#ifdef CONFIG_PL011_BAUD
+#define BAUD_RATE	CONFIG_PL011_BAUD
+#else
 #define BAUD_RATE	115200
+#endif
+
+/* Receive FIFO trigger level: 0-4 for 1/8, 1/4, 1/2, 3/4, 7/8 full */
+#ifdef CONFIG_PL011_RXTRIG
+#define RX_TRIG		CONFIG_PL011_RXTRIG
+#else
+#define RX_TRIG		2
+#endif
 
 /* UART Registers */
 #define UART_DR		(UART_BASE + 0x00)
@@ -57,6 +68,7 @@
 #define UART_FBRD	(UART_BASE + 0x28)
 #define UART_LCRH	(UART_BASE + 0x2c)
 #define UART_CR		(UART_BASE + 0x30)
+#define UART_IFLS	(UART_BASE + 0x34)
 #define UART_IMSC	(UART_BASE + 0x38)
 #define UART_MIS	(UART_BASE + 0x40)
 #define UART_ICR	(UART_BASE + 0x44)
@@ -68,15 +80,21 @@
 /* Masked interrupt status register */
 #define MIS_RX		0x10	/* Receive interrupt */
 #define MIS_TX		0x20	/* Transmit interrupt */
+#define MIS_RT		0x40	/* Receive timeout interrupt */
 
 /* Interrupt clear register */
 #define ICR_RX		0x10	/* Clear receive interrupt */
 #define ICR_TX		0x20	/* Clear transmit interrupt */
+#define ICR_RT		0x40	/* Clear receive timeout interrupt */
 
 /* Line control register (High) */
 #define LCRH_WLEN8	0x60	/* 8 bits */
 #define LCRH_FEN	0x10	/* Enable FIFO */
 
+/* Interrupt FIFO level select register */
+#define IFLS_TX_1_4	0x01	/* Transmit FIFO becomes 1/4 full */
+#define IFLS_RX_SHIFT	3
+
 /* Control register */
 #define CR_UARTEN	0x0001	/* UART enable */
 #define CR_TXE		0x0100	/* Transmit enable */
@@ -85,6 +103,7 @@
 /* Interrupt mask set/clear register */
 #define IMSC_RX		0x10	/* Receive interrupt mask */
 #define IMSC_TX		0x20	/* Transmit interrupt mask */
+#define IMSC_RT		0x40	/* Receive timeout interrupt mask */
 
 /* Forward functions */
 static int	pl011_init(struct driver *);
@@ -93,6 +112,7 @@ static char	pl011_rcv_char(struct serial_port *);
 static void	pl011_set_poll(struct serial_port *, int);
 static void	pl011_start(struct serial_port *);
 static void	pl011_stop(struct serial_port *);
+static void	pl011_xmt_start(struct serial_port *);
 
 
 struct driver pl011_driver = {
@@ -111,6 +131,7 @@ static struct serial_ops pl011_ops = {
 	/* set_poll */	pl011_set_poll,
 	/* start */	pl011_start,
 	/* stop */	pl011_stop,
+	/* xmt_start */	pl011_xmt_start,
 };
 
 static struct serial_port pl011_port;
@@ -146,44 +167,78 @@ pl011_set_poll(struct serial_port *sp, int on)
 		 */
 		bus_write_32(UART_IMSC, 0);
 	} else
-		bus_write_32(UART_IMSC, (IMSC_RX | IMSC_TX));
+		bus_write_32(UART_IMSC, (IMSC_RX | IMSC_TX | IMSC_RT));
+}
+
+/*
+ * Fill the transmit FIFO until it is full or the output
+ * queue is empty.
+ */
+static void
+pl011_txfill(struct serial_port *sp)
+{
+	char c;
+
+	while (!(bus_read_32(UART_FR) & FR_TXFF)) {
+		if (serial_xmt_fill(sp, &c, 1) == 0)
+			break;
+		bus_write_32(UART_DR, (uint32_t)c);
+	}
 }
 
 static int
 pl011_isr(void *arg)
 {
 	struct serial_port *sp = arg;
-	int c;
+	char buf[32];
+	int n;
 	uint32_t mis;
 
 	mis = bus_read_32(UART_MIS);
 
-	if (mis & MIS_RX) {
+	if (mis & (MIS_RX | MIS_RT)) {
 		/*
-		 * Receive interrupt
+		 * Receive interrupt: drain the FIFO
 		 */
-		while (bus_read_32(UART_FR) & FR_RXFE)
-			;
-		do {
-			c = bus_read_32(UART_DR);
-			serial_rcv_char(sp, c);
-		} while ((bus_read_32(UART_FR) & FR_RXFE) == 0);
+		n = 0;
+		while ((bus_read_32(UART_FR) & FR_RXFE) == 0) {
+			buf[n++] = bus_read_32(UART_DR) & 0xff;
+			if (n == sizeof(buf)) {
+				serial_rcv_buf(sp, buf, n);
+				n = 0;
+			}
+		}
+		if (n > 0)
+			serial_rcv_buf(sp, buf, n);
 
 		/* Clear interrupt status */
-		bus_write_32(UART_ICR, ICR_RX);
+		bus_write_32(UART_ICR, ICR_RX | ICR_RT);
 	}
 	if (mis & MIS_TX) {
 		/*
 		 * Transmit interrupt
 		 */
-		serial_xmt_done(sp);
-
-		/* Clear interrupt status */
 		bus_write_32(UART_ICR, ICR_TX);
+		pl011_txfill(sp);
+		serial_xmt_done(sp);
 	}
 	return 0;
 }
 
+/*
+ * Prime the transmit FIFO.  The transmit interrupt only
+ * fires when the FIFO drains through its trigger level.
+ */
+static void
+pl011_xmt_start(struct serial_port *sp)
+{
+	int s;
+
+	s = splhigh();
+	pl011_txfill(sp);
+	splx(s);
+}
+
 static void
 pl011_start(struct serial_port *sp)
 {
@@ -206,6 +261,7 @@ pl011_start(struct serial_port *sp)
 
 	/* Set N, 8, 1, FIFO enable */
 	bus_write_32(UART_LCRH, (LCRH_WLEN8 | LCRH_FEN));
+	bus_write_32(UART_IFLS, (RX_TRIG << IFLS_RX_SHIFT) | IFLS_TX_1_4);
 
 	/* Enable UART */
 	bus_write_32(UART_CR, (CR_RXE | CR_TXE | CR_UARTEN));
@@ -214,7 +270,7 @@ pl011_start(struct serial_port *sp)
 	sp->irq = irq_attach(UART_IRQ, IPL_COMM, 0, pl011_isr, IST_NONE, sp);
 
 	/* Enable TX/RX interrupt */
-	bus_write_32(UART_IMSC, (IMSC_RX | IMSC_TX));
+	bus_write_32(UART_IMSC, (IMSC_RX | IMSC_TX | IMSC_RT));
 }
 
 static void
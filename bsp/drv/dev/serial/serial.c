@@ -117,6 +117,9 @@ serial_ioctl(device_t dev, u_long cmd, void *arg)
 
 /*
  * Start TTY output operation.
+ * A driver with a transmit interrupt supplies xmt_start to
+ * prime its FIFO; the rest is sent from its interrupt handler.
+ * Otherwise, the output queue is written out by polling.
  */
 static void
 serial_start(struct tty *tp)
@@ -125,10 +128,27 @@ serial_start(struct tty *tp)
 	struct serial_port *port = sc->port;
 	int c;
 
+	if (sc->ops->xmt_start != NULL) {
+		sc->ops->xmt_start(port);
+		return;
+	}
 	while ((c = tty_getc(&tp->t_outq)) >= 0)
 		sc->ops->xmt_char(port, c);
 }
 
+/*
+ * Take up to n characters to transmit.
+ * Returns the number of characters stored in buf.
+ */
+int
+serial_xmt_fill(struct serial_port *port, char *buf, int n)
+{
+
+	if (port->tty->t_state & TS_TTSTOP)
+		return 0;
+	return tty_getbuf(&port->tty->t_outq, buf, n);
+}
+
 /*
  * Output completed.
  */
@@ -149,6 +169,16 @@ serial_rcv_char(struct serial_port *port, char c)
 	tty_input(c, port->tty);
 }
 
+/*
+ * Input of characters drained from a receive FIFO.
+ */
+void
+serial_rcv_buf(struct serial_port *port, const char *buf, int n)
+{
+
+	tty_input_buf(buf, n, port->tty);
+}
+
 static int
 serial_cngetc(device_t dev)
 {
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * virtio_cons.c - virtio console
+ */
+
+/*
+ * The first port of a virtio console is a tty.  Input arrives in
+ * VCONS_NBUF buffers that are kept posted to the receive queue, and
+ * output is copied from the tty's output queue into transmit
+ * buffers of up to VCONS_BUFSZ bytes, so a whole line costs a
+ * single notification instead of one register access per
+ * character.
+ *
+ * With QEMU:
+ *   -device virtio-serial-pci -chardev stdio,id=vc0
+ *   -device virtconsole,chardev=vc0
+ */
+
+#include <driver.h>
+#include <pci.h>
+#include <virtio.h>
+#include <tty.h>
+
+/* #define DEBUG_VCONS 1 */
+
+#ifdef DEBUG_VCONS
+#define DPRINTF(a)	printf a
+#else
+#define DPRINTF(a)
+#endif
+
+#define VCONS_NBUF	8	/* buffers per direction */
+#define VCONS_BUFSZ	256
+#define VCONS_MEMSZ	(VCONS_NBUF * VCONS_BUFSZ * 2)
+
+#define SLOT(n)		((uint32_t)1 << (n))
+
+/* Feature bits */
+#define VCONS_F_SIZE	0x00000001	/* cols and rows are valid */
+
+/* Device configuration */
+#define VCONS_CFG_COLS	0
+#define VCONS_CFG_ROWS	2
+
+/* Queues of port 0 */
+#define VCONS_RXQ	0
+#define VCONS_TXQ	1
+
+struct vcons_softc {
+	device_t	dev;		/* device object */
+	struct tty	tty;		/* tty structure */
+	struct virtio_dev vd;		/* transport */
+	struct virtq	rxq;		/* receive queue */
+	struct virtq	txq;		/* transmit queue */
+	int		nrx;		/* receive buffers */
+	int		ntx;		/* transmit buffers */
+	paddr_t		mem;		/* buffer memory */
+	char		*rxbuf;
+	char		*txbuf;
+	uint32_t	txbusy;		/* transmit buffers in flight */
+};
+
+static int	vcons_read(device_t, char *, size_t *, int);
+static int	vcons_write(device_t, char *, size_t *, int);
+static int	vcons_ioctl(device_t, u_long, void *);
+static int	vcons_init(struct driver *);
+
+static struct devops vcons_devops = {
+	/* open */	no_open,
+	/* close */	no_close,
+	/* read */	vcons_read,
+	/* write */	vcons_write,
+	/* ioctl */	vcons_ioctl,
+	/* devctl */	no_devctl,
+};
+
+struct driver virtio_cons_driver = {
+	/* name */	"virtio_cons",
+	/* devops */	&vcons_devops,
+	/* devsz */	sizeof(struct vcons_softc),
+	/* flags */	0,
+	/* probe */	NULL,
+	/* init */	vcons_init,
+	/* unload */	NULL,
+};
+
+static int nconsoles;
+
+
+static int
+vcons_read(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+	struct vcons_softc *sc = device_private(dev);
+
+	return tty_read(&sc->tty, buf, nbyte);
+}
+
+static int
+vcons_write(device_t dev, char *buf, size_t *nbyte, int blkno)
+{
+	struct vcons_softc *sc = device_private(dev);
+
+	return tty_write(&sc->tty, buf, nbyte);
+}
+
+static int
+vcons_ioctl(device_t dev, u_long cmd, void *arg)
+{
+	struct vcons_softc *sc = device_private(dev);
+
+	return tty_ioctl(&sc->tty, cmd, arg);
+}
+
+/*
+ * Start TTY output operation.  Fill every idle transmit buffer
+ * from the output queue, and notify the device once.
+ */
+static void
+vcons_start(struct tty *tp)
+{
+	struct vcons_softc *sc = device_private(tp->t_dev);
+	char *buf;
+	int i, len, kick = 0;
+	int s;
+
+	s = splhigh();
+	for (i = 0; i < sc->ntx && tp->t_outq.tq_count > 0; i++) {
+		if (sc->txbusy & SLOT(i))
+			continue;
+		buf = sc->txbuf + i * VCONS_BUFSZ;
+		len = tty_getbuf(&tp->t_outq, buf, VCONS_BUFSZ);
+		sc->txq.desc[i].len = (uint32_t)len;
+		sc->txbusy |= SLOT(i);
+		virtq_submit(&sc->txq, i);
+		kick = 1;
+	}
+	if (kick)
+		virtq_notify(&sc->txq);
+	splx(s);
+}
+
+static int
+vcons_isr(void *arg)
+{
+	struct vcons_softc *sc = arg;
+
+	if (virtio_intr(&sc->vd) == 0)
+		return INT_DONE;
+	return INT_CONTINUE;
+}
+
+/*
+ * Interrupt service thread.  Pass the received characters to the
+ * tty and post the buffers again, then recycle the transmit
+ * buffers the device is done with.
+ */
+static void
+vcons_ist(void *arg)
+{
+	struct vcons_softc *sc = arg;
+	struct tty *tp = &sc->tty;
+	uint32_t len;
+	char *buf;
+	int head, kick = 0, sent = 0;
+	int s;
+
+	s = splhigh();
+	while ((head = virtq_dequeue(&sc->rxq, &len)) >= 0) {
+		if (head >= sc->nrx)
+			continue;
+		buf = sc->rxbuf + head * VCONS_BUFSZ;
+		if (len > VCONS_BUFSZ)
+			len = VCONS_BUFSZ;
+		tty_input_buf(buf, (int)len, tp);
+		virtq_submit(&sc->rxq, head);
+		kick = 1;
+	}
+	if (kick)
+		virtq_notify(&sc->rxq);
+
+	while ((head = virtq_dequeue(&sc->txq, NULL)) >= 0) {
+		if (head < sc->ntx)
+			sc->txbusy &= ~SLOT(head);
+		sent = 1;
+	}
+	if (sent) {
+		vcons_start(tp);
+		tty_done(tp);
+	}
+	splx(s);
+}
+
+static void
+vcons_attach(struct driver *self, struct pci_device *v)
+{
+	struct vcons_softc *sc;
+	struct virtio_dev vd;
+	char name[MAXDEVNAME];
+	device_t dev;
+	int i;
+
+	if (nconsoles > 9)
+		return;
+	memset(&vd, 0, sizeof(vd));
+	if (virtio_attach(&vd, v, VCONS_F_SIZE) != 0)
+		return;
+
+	name[0] = 'v';
+	name[1] = 't';
+	name[2] = 't';
+	name[3] = 'y';
+	name[4] = (char)('0' + nconsoles++);
+	name[5] = '\0';
+	dev = device_create(self, name, D_CHR|D_TTY);
+	sc = device_private(dev);
+	sc->dev = dev;
+	sc->vd = vd;
+
+	if (virtq_init(&sc->vd, &sc->rxq, VCONS_RXQ) != 0 ||
+	    virtq_init(&sc->vd, &sc->txq, VCONS_TXQ) != 0 ||
+	    (sc->mem = page_alloc(round_page(VCONS_MEMSZ))) == 0) {
+		printf("%s: setup failed\n", name);
+		virtio_fail(&sc->vd);
+		if (sc->rxq.mem != 0)
+			page_free(sc->rxq.mem, sc->rxq.memsz);
+		if (sc->txq.mem != 0)
+			page_free(sc->txq.mem, sc->txq.memsz);
+		device_destroy(dev);
+		return;
+	}
+	sc->rxbuf = ptokv(sc->mem);
+	sc->txbuf = sc->rxbuf + VCONS_NBUF * VCONS_BUFSZ;
+
+	tty_attach(&sc->tty);
+	sc->tty.t_dev = dev;
+	sc->tty.t_oproc = vcons_start;
+	if (sc->vd.features & VCONS_F_SIZE) {
+		sc->tty.t_winsize.ws_col =
+		    virtio_cfg_read16(&sc->vd, VCONS_CFG_COLS);
+		sc->tty.t_winsize.ws_row =
+		    virtio_cfg_read16(&sc->vd, VCONS_CFG_ROWS);
+	}
+
+	/* Descriptor i always points to buffer i. */
+	sc->nrx = VCONS_NBUF;
+	if (sc->nrx > sc->rxq.size)
+		sc->nrx = sc->rxq.size;
+	for (i = 0; i < sc->nrx; i++) {
+		sc->rxq.desc[i].addr = (uint32_t)kvtop(sc->rxbuf +
+						       i * VCONS_BUFSZ);
+		sc->rxq.desc[i].len = VCONS_BUFSZ;
+		sc->rxq.desc[i].flags = VRING_DESC_F_WRITE;
+		virtq_submit(&sc->rxq, i);
+	}
+	sc->ntx = VCONS_NBUF;
+	if (sc->ntx > sc->txq.size)
+		sc->ntx = sc->txq.size;
+	for (i = 0; i < sc->ntx; i++)
+		sc->txq.desc[i].addr = (uint32_t)kvtop(sc->txbuf +
+						       i * VCONS_BUFSZ);
+
+	printf("device %d.%d.%d = %s (virtio console)\n",
+	       v->bus, v->slot, v->function, name);
+
+	/* PCI interrupts are level triggered. */
+	sc->vd.irq = irq_attach(read_pci_interrupt_line(v), IPL_COMM, 1,
+				vcons_isr, vcons_ist, sc);
+	virtio_ready(&sc->vd);
+	virtq_notify(&sc->rxq);
+}
+
+static int
+vcons_init(struct driver *self)
+{
+	struct pci_device *v;
+	size_t i;
+
+	for (i = 0; i < pci_device_count; i++) {
+		v = &pci_devices[i];
+		if (v->vendor_id == VIRTIO_VENDOR &&
+		    v->device_id == VIRTIO_DEV_CONSOLE)
+			vcons_attach(self, v);
+	}
+	return 0;
+}
@@ -32,6 +32,8 @@
  */
 
 #include <driver.h>
+#include <sys/sysinfo.h>
+#include <sys/ioctl.h>
 #include <wscons.h>
 #include <devctl.h>
 #include <pm.h>
@@ -50,15 +52,26 @@
 #define SEQ_DATA	0x3c5
 
 #define VID_RAM		0xB8000
+#define VID_SIZE	0x8000		/* 32K bytes for text modes */
+#define VID_CELLS	(VID_SIZE / 2)
+
+#define VGA_MAPCHECK	1000		/* msec between checks of mappings */
+#define VGA_MAXTASKS	8		/* max tasks mapping the memory */
 
 struct vga_softc {
 	device_t	dev;
 	short		*vram;
 	int		cols;
+	int		rows;
+	int		origin;		/* first cell on screen */
+	task_t		maptask[VGA_MAXTASKS]; /* tasks mapping vram */
+	int		nmaps;		/* number of tasks in maptask */
+	timer_t		tmr;		/* timer to check the mappings */
 	int		attr;
 	int		blank;
 };
 
+static int	vga_ioctl(device_t, u_long, void *);
 static int	vga_devctl(device_t, u_long, void *);
 static int	vga_init(struct driver *);
 static void	vga_cursor(void*, int, int);
@@ -67,13 +80,16 @@ static void	vga_copyrows(void *,int, int, int);
 static void	vga_eraserows(void *,int, int);
 static void	vga_set_attr(void *, int);
 static void	vga_get_cursor(void *, int *, int *);
+static void	vga_putrow(void *, int, int, const u_short *, int);
+static int	vga_scroll(void *, int);
+static void	vga_getrow(void *, int, int, u_short *, int);
 
 static struct devops vga_devops = {
 	/* open */	no_open,
 	/* close */	no_close,
 	/* read */	no_read,
 	/* write */	no_write,
-	/* ioctl */	no_ioctl,
+	/* ioctl */	vga_ioctl,
 	/* devctl */	vga_devctl,
 };
 
@@ -94,6 +110,9 @@ static struct wscons_video_ops wscons_vga_ops = {
 	vga_eraserows,	/* eraserows */
 	vga_set_attr,	/* set_attr */
 	vga_get_cursor,	/* set_cursor */
+	vga_putrow,	/* putrow */
+	vga_scroll,	/* scroll */
+	vga_getrow,	/* getrow */
 };
 
 
@@ -133,13 +152,25 @@ vga_off(void)
 	bus_write_8(SEQ_DATA, val | 0x20);
 }
 
+static void
+vga_set_origin(struct vga_softc *sc, int origin)
+{
+	int s;
+
+	sc->origin = origin;
+	s = splhigh();
+	crtc_write(0x0c, (u_char)((origin >> 8) & 0xff));
+	crtc_write(0x0d, (u_char)(origin & 0xff));
+	splx(s);
+}
+
 static void
 vga_cursor(void *aux, int row, int col)
 {
 	struct vga_softc *sc = aux;
 	int pos, s;
 
-	pos = row * sc->cols + col;
+	pos = sc->origin + row * sc->cols + col;
 
 	s = splhigh();
 	crtc_write(0x0e, (u_char)((pos >> 8) & 0xff));
@@ -152,7 +183,25 @@ vga_putc(void *aux, int row, int col, int ch)
 {
 	struct vga_softc *sc = aux;
 
-	sc->vram[row * sc->cols + col] = ch | (sc->attr << 8);
+	sc->vram[sc->origin + row * sc->cols + col] = ch | (sc->attr << 8);
+}
+
+static void
+vga_putrow(void *aux, int row, int col, const u_short *cells, int n)
+{
+	struct vga_softc *sc = aux;
+
+	memcpy(sc->vram + sc->origin + row * sc->cols + col, cells,
+	       (size_t)n * 2);
+}
+
+static void
+vga_getrow(void *aux, int row, int col, u_short *cells, int n)
+{
+	struct vga_softc *sc = aux;
+
+	memcpy(cells, sc->vram + sc->origin + row * sc->cols + col,
+	       (size_t)n * 2);
 }
 
 static void
@@ -160,18 +209,87 @@ vga_copyrows(void *aux, int srcrow, int dstrow, int nrows)
 {
 	struct vga_softc *sc = aux;
 
-	memcpy(sc->vram + dstrow * sc->cols,
-	       sc->vram + srcrow * sc->cols,
+	memcpy(sc->vram + sc->origin + dstrow * sc->cols,
+	       sc->vram + sc->origin + srcrow * sc->cols,
 	       (size_t)nrows * sc->cols * 2);
 }
 
+/*
+ * Find the task which has called the driver.
+ */
+static task_t
+vga_curtask(void)
+{
+	struct taskinfo ti;
+
+	ti.cookie = 0;
+	while (sysinfo(INFO_TASK, &ti) == 0) {
+		if (ti.active)
+			return ti.id;
+	}
+	return TASK_NULL;
+}
+
+/*
+ * Drop the tasks which do not map the video memory any more.
+ * Prex does not close devices when a task exits, so the memory
+ * maps of the tasks which have mapped it are looked at.  This
+ * runs from the timer thread once a second while any is left,
+ * and only walks the segments of those tasks.
+ */
+static void
+vga_mapcheck(void *aux)
+{
+	struct vga_softc *sc = aux;
+	struct vminfo vi;
+	int i, found;
+
+	for (i = 0; i < sc->nmaps; ) {
+		found = 0;
+		vi.cookie = 0;
+		vi.task = sc->maptask[i];
+		while (!found && sysinfo(INFO_VM, &vi) == 0) {
+			if ((vi.flags & VF_MAPPED) && vi.phys == VID_RAM)
+				found = 1;
+		}
+		if (found)
+			i++;
+		else
+			sc->maptask[i] = sc->maptask[--sc->nmaps];
+	}
+	if (sc->nmaps > 0)
+		timer_callout(&sc->tmr, VGA_MAPCHECK, vga_mapcheck, sc);
+}
+
+/*
+ * Scroll by moving the start address of the screen through the
+ * video memory, so that no text is copied.  When the screen
+ * reaches the end of the memory, go back to the top and let
+ * wscons redraw it.
+ */
+static int
+vga_scroll(void *aux, int nrows)
+{
+	struct vga_softc *sc = aux;
+	int origin;
+
+	origin = sc->origin + nrows * sc->cols;
+	if (sc->nmaps > 0 || origin + sc->rows * sc->cols > VID_CELLS) {
+		if (sc->origin != 0)
+			vga_set_origin(sc, 0);
+		return -1;
+	}
+	vga_set_origin(sc, origin);
+	return 0;
+}
+
 static void
 vga_eraserows(void *aux, int row, int nrows)
 {
 	struct vga_softc *sc = aux;
 	int i, start, end;
 
-	start = row * sc->cols;
+	start = sc->origin + row * sc->cols;
 	end = start + nrows * sc->cols;
 
 	for (i = start; i < end; i++)
@@ -198,11 +316,66 @@ vga_get_cursor(void *aux, int *col, int *row)
 	offset = crtc_read(0x0e);
 	offset <<= 8;
 	offset += crtc_read(0x0f);
+	offset -= sc->origin;
 	*col = (int)offset % sc->cols;
 	*row = (int)offset / sc->cols;
 	splx(s);
 }
 
+/*
+ * Map the video memory into the caller, so that it can draw
+ * without a system call per character.  The screen is moved to
+ * the top of the memory and stays there until no task has the
+ * memory mapped.
+ */
+static int
+vga_ioctl(device_t dev, u_long cmd, void *arg)
+{
+	struct vga_softc *sc = device_private(dev);
+	struct devmap dm;
+	task_t task;
+	int i, error;
+
+	switch (cmd) {
+	case DMIOC_MAP:
+		if (copyin(arg, &dm, sizeof(dm)))
+			return EFAULT;
+		sched_lock();
+		task = vga_curtask();
+		for (i = 0; i < sc->nmaps && sc->maptask[i] != task; i++)
+			;
+		if (i == VGA_MAXTASKS) {
+			sched_unlock();
+			return EBUSY;
+		}
+		error = vm_physmap(VID_RAM, VID_SIZE, dm.dm_prot,
+				   &dm.dm_addr);
+		if (error) {
+			sched_unlock();
+			return error;
+		}
+		if (sc->origin != 0) {
+			memcpy(sc->vram, sc->vram + sc->origin,
+			       (size_t)sc->rows * sc->cols * 2);
+			vga_set_origin(sc, 0);
+		}
+		if (i == sc->nmaps) {
+			sc->maptask[sc->nmaps++] = task;
+			if (sc->nmaps == 1)
+				timer_callout(&sc->tmr, VGA_MAPCHECK,
+					      vga_mapcheck, sc);
+		}
+		sched_unlock();
+		dm.dm_size = VID_SIZE;
+		if (copyout(&dm, arg, sizeof(dm)))
+			return EFAULT;
+		break;
+	default:
+		return EINVAL;
+	}
+	return 0;
+}
+
 static int
 vga_devctl(device_t dev, u_long cmd, void *arg)
 {
@@ -246,6 +419,9 @@ vga_init(struct driver *self)
 	sc = device_private(dev);
 	sc->vram = ptokv(VID_RAM);
 	sc->cols = bi->video.text_x;
+	sc->rows = bi->video.text_y;
+	sc->origin = 0;
+	sc->nmaps = 0;
 	sc->attr = 0x0f;
 	sc->blank = 0;
 
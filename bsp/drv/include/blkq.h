@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BLKQ_H
+#define _BLKQ_H
+
+#include <sys/cdefs.h>
+#include <sys/queue.h>
+#include <dmamap.h>
+
+/*
+ * A request never covers more than BLK_MAXBYTES of one caller's
+ * buffer, so it touches at most BLK_MAXSEGS physical pages.
+ */
+#define BLK_MAXBYTES	65536
+#define BLK_MAXSEGS	((BLK_MAXBYTES / PAGE_SIZE) + 1)
+
+/*
+ * Block I/O request
+ *
+ * The submitter fills in cmd, blkno, nblks, segs, done and arg.
+ * When the request is dispatched, requests for adjacent blocks are
+ * chained to it through "next" and handed to the driver as one
+ * transfer.  The done routine is called at splhigh from the
+ * driver's completion context.
+ */
+struct blkreq {
+	struct queue	link;		/* link in sorted queue */
+	struct queue	fifo;		/* link in arrival order */
+	struct blkreq	*next;		/* next request of a merged chain */
+	void		*unit;		/* driver private unit */
+	int		cmd;		/* IO_READ or IO_WRITE */
+	int		blkno;		/* first block */
+	u_long		nblks;		/* number of blocks */
+	u_long		expire;		/* deadline in ticks */
+	int		nsegs;		/* number of segments */
+	struct dma_seg	segs[BLK_MAXSEGS]; /* I/O buffer */
+	int		error;		/* completion status */
+	void		(*done)(struct blkreq *); /* completion routine */
+	void		*arg;		/* argument for done */
+};
+
+/*
+ * Request queue of one device (or controller)
+ *
+ * Pending requests are served in ascending block order from the
+ * last head position (C-LOOK), unless the oldest one has passed
+ * its deadline.  The start routine is called at splhigh with a
+ * chain of requests, and the driver reports its completion by
+ * blkq_done().  A maxblks of 0 disables merging.
+ *
+ * A device that takes several commands at once raises depth after
+ * blkq_init(), and completes each chain by blkq_end() instead;
+ * "active" is then only the chain started last.  A non-zero
+ * maxsegs bounds the segments of a merged chain.
+ */
+struct blkq {
+	struct queue	sorted;		/* pending requests by block */
+	struct queue	fifo;		/* pending requests by age */
+	struct blkreq	*active;	/* chain being serviced */
+	int		depth;		/* max chains in flight */
+	int		busy;		/* chains in flight */
+	int		dispatching;	/* in blkq_dispatch() */
+	int		headpos;	/* block after last dispatch */
+	size_t		bsize;		/* block size */
+	u_long		maxblks;	/* max blocks per transfer */
+	int		maxsegs;	/* max segments per transfer */
+	void		(*start)(struct blkq *, struct blkreq *);
+	void		*priv;		/* driver private data */
+};
+
+/* Deadlines */
+#define BLK_READ_EXPIRE		500	/* msec */
+#define BLK_WRITE_EXPIRE	5000	/* msec */
+
+/* Max requests one blkq_rw() keeps in flight */
+#define BLK_BATCH	8
+
+__BEGIN_DECLS
+void	blkq_init(struct blkq *, size_t, u_long,
+		  void (*)(struct blkq *, struct blkreq *), void *);
+int	blkreq_map(struct blkreq *, char *, size_t);
+void	blkq_submit(struct blkq *, struct blkreq *);
+void	blkq_done(struct blkq *, int);
+void	blkq_end(struct blkq *, struct blkreq *, int);
+int	blkq_rw(struct blkq *, void *, int, char *, size_t *, int);
+__END_DECLS
+
+#endif /* !_BLKQ_H */
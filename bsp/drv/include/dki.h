@@ -63,6 +63,12 @@ extern dkifn_t	*dki_table;		/* pointer to DKI function table */
 /* No IST for irq_attach() */
 #define IST_NONE        ((void (*)(void *)) -1)
 
+/*
+ * Operations for cache_sync()
+ */
+#define CACHE_WBACK	0	/* write dirty lines back to memory */
+#define CACHE_INVAL	1	/* write back and discard lines */
+
 /*
  * Event for sleep/wakeup
  */
@@ -121,10 +127,12 @@ void	*kmem_map(void *, size_t);
 
 paddr_t	 page_alloc(psize_t);
 void	 page_free(paddr_t, psize_t);
-void	 page_reserve(paddr_t, psize_t);
+int	 page_reserve(paddr_t, psize_t);
+int	 vm_physmap(paddr_t, size_t, int, void **);
 
 irq_t	 irq_attach(int, int, int, int (*)(void *), void (*)(void *), void *);
 void	 irq_detach(irq_t);
+int	 irq_entropy(void *, size_t);
 
 int	 spl0(void);
 int	 splhigh(void);
@@ -146,6 +154,7 @@ int	 task_capable(cap_t);
 int	 exception_post(task_t, int);
 void	 machine_bootinfo(struct bootinfo **);
 void	 machine_powerdown(int);
+void	 cache_sync(void *, size_t, int);
 int	 sysinfo(int, void *);
 void	 panic(const char *);
 void	 printf(const char *, ...);
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DMAMAP_H
+#define _DMAMAP_H
+
+#include <sys/cdefs.h>
+
+/*
+ * A transfer never covers more than DMA_MAXBYTES of a buffer.
+ * Splitting at a boundary may add one segment per boundary
+ * crossed, which is allowed for up to 64K boundaries.
+ */
+#define DMA_MAXBYTES	65536
+#define DMA_MAXSEGS	((DMA_MAXBYTES / PAGE_SIZE) + 2)
+
+/*
+ * Physically contiguous piece of a transfer.
+ */
+struct dma_seg {
+	paddr_t		addr;		/* physical address */
+	size_t		len;		/* length in bytes */
+};
+
+/*
+ * What a device can address.  A zero field means no limit.
+ * The boundary must be a power of two.
+ */
+struct dma_tag {
+	paddr_t		maxaddr;	/* highest address reachable */
+	size_t		boundary;	/* segments do not cross this */
+	size_t		maxsegsz;	/* max bytes in one segment */
+	size_t		align;		/* alignment of address and length */
+	int		maxsegs;	/* max segments of a transfer */
+};
+
+/*
+ * DMA map
+ *
+ * A map holds the segments of one transfer, as the device has to
+ * see them.  When the memory does not suit the device, the data
+ * goes through the bounce buffer allocated by dmamap_create(),
+ * and "bufs" keeps the memory it is copied from and to.
+ */
+struct dma_map {
+	const struct dma_tag *tag;	/* limits of the device */
+	paddr_t		bounce;		/* bounce buffer, or 0 */
+	size_t		bouncesz;	/* size of bounce buffer */
+	int		bounced;	/* current transfer is bounced */
+	int		nsegs;		/* segments for the device */
+	struct dma_seg	segs[DMA_MAXSEGS];
+	int		nbufs;		/* segments of the memory */
+	struct dma_seg	bufs[DMA_MAXSEGS];
+};
+
+/*
+ * Operations for dmamap_sync()
+ */
+#define DMA_PREREAD	0x01	/* before the device writes memory */
+#define DMA_POSTREAD	0x02	/* after the device wrote memory */
+#define DMA_PREWRITE	0x04	/* before the device reads memory */
+#define DMA_POSTWRITE	0x08	/* after the device read memory */
+
+__BEGIN_DECLS
+int	dma_segs(char *, size_t, struct dma_seg *, int, int *);
+int	dmamap_create(struct dma_map *, const struct dma_tag *, size_t);
+void	dmamap_destroy(struct dma_map *);
+int	dmamap_load(struct dma_map *, char *, size_t);
+int	dmamap_load_segs(struct dma_map *, const struct dma_seg *, int);
+void	dmamap_sync(struct dma_map *, int);
+void	dmamap_unload(struct dma_map *);
+__END_DECLS
+
+#endif /* !_DMAMAP_H */
@@ -3,6 +3,11 @@
 
 #define N_PCI_BASE_ADDRESS_REGISTERS 6
 
+/* The HAL maps this window of physical address space, where the
+   firmware places memory BARs, at the same kernel virtual address. */
+#define PCI_MEM_BASE	0xfc000000
+#define PCI_MEM_SIZE	0x04000000
+
 #define PCI_HEADER_TYPE_GENERAL	0x00
 #define PCI_HEADER_TYPE_BRIDGE	0x01
 #define PCI_HEADER_TYPE_CARDBUS	0x02
@@ -145,4 +150,7 @@ extern void write_pci_interrupt_line(struct pci_device *v, int irqno);
 extern void write_pci_raw_bar(struct pci_device *v, int bar_number, uint32_t val);
 extern void write_pci_io_bar(struct pci_device *v, int bar_number, uint32_t val);
 
+extern uint32_t read_pci_mem_bar(struct pci_device *v, int bar_number);
+extern void *pci_mem_map(uint32_t addr, size_t size);
+
 #endif
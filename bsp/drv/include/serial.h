@@ -44,12 +44,15 @@ struct serial_ops {
 	void	(*set_poll)(struct serial_port *port, int on);
 	void	(*start)(struct serial_port *port);
 	void	(*stop)(struct serial_port *port);
+	void	(*xmt_start)(struct serial_port *port);	/* optional */
 };
 
 __BEGIN_DECLS
 void	serial_attach(struct serial_ops *, struct serial_port *);
 void	serial_xmt_done(struct serial_port *);
 void	serial_rcv_char(struct serial_port *, char);
+void	serial_rcv_buf(struct serial_port *, const char *, int);
+int	serial_xmt_fill(struct serial_port *, char *, int);
 __END_DECLS
 
 #endif /* !_SERIAL_H */
@@ -41,11 +41,19 @@
 #include <sys/termios.h>
 #include <sys/syslimits.h>
 
+/*
+ * Size of each tty queue.  This must be a power of 2.  A larger
+ * queue lets a fast serial line burst without losing input.
+ */
+#ifdef CONFIG_TTYQ_SIZE
+#define TTYQ_SIZE	CONFIG_TTYQ_SIZE
+#else
 #define TTYQ_SIZE	MAX_INPUT
+#endif
 #define TTYQ_HIWAT	(TTYQ_SIZE - 10)
 
 struct tty_queue {
-	char	tq_buf[TTYQ_SIZE];
+	char	*tq_buf;	/* TTYQ_SIZE bytes, set by tty_attach() */
 	int	tq_head;
 	int	tq_tail;
 	int	tq_count;
@@ -92,7 +100,9 @@ int	 tty_read(struct tty *, char *, size_t *);
 int	 tty_write(struct tty *, char *, size_t *);
 int	 tty_ioctl(struct tty *, u_long, void *);
 void	 tty_input(int, struct tty *);
+void	 tty_input_buf(const char *, int, struct tty *);
 int	 tty_getc(struct tty_queue *);
+int	 tty_getbuf(struct tty_queue *, char *, int);
 void	 tty_done(struct tty *);
 void	 tty_attach(struct tty *);
 __END_DECLS
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include <sys/cdefs.h>
+#include <pci.h>
+
+/*
+ * Legacy (0.9.5) virtio over PCI, as offered by QEMU's
+ * transitional devices.
+ */
+#define VIRTIO_VENDOR		0x1af4
+#define VIRTIO_DEV_BLK		0x1001
+#define VIRTIO_DEV_CONSOLE	0x1003
+
+/* Device independent feature bits */
+#define VIRTIO_F_INDIRECT_DESC	0x10000000
+
+/* Descriptor flags */
+#define VRING_DESC_F_NEXT	0x0001	/* chain continues in "next" */
+#define VRING_DESC_F_WRITE	0x0002	/* device writes the buffer */
+#define VRING_DESC_F_INDIRECT	0x0004	/* buffer is a descriptor table */
+
+#define VRING_AVAIL_F_NO_INTERRUPT 0x0001
+#define VRING_USED_F_NO_NOTIFY	0x0001
+
+/* The legacy ring layout is defined in 4K pages. */
+#define VRING_ALIGN		4096
+
+struct vring_desc {
+	uint32_t	addr;		/* physical address (low) */
+	uint32_t	addr_hi;
+	uint32_t	len;
+	uint16_t	flags;
+	uint16_t	next;		/* index of next descriptor */
+};
+
+struct vring_avail {
+	uint16_t	flags;
+	uint16_t	idx;		/* next free ring entry */
+	uint16_t	ring[1];	/* [size] */
+};
+
+struct vring_used_elem {
+	uint32_t	id;		/* head of the finished chain */
+	uint32_t	len;		/* bytes written by the device */
+};
+
+struct vring_used {
+	uint16_t	flags;
+	uint16_t	idx;
+	struct vring_used_elem ring[1];	/* [size] */
+};
+
+struct virtio_dev;
+
+/*
+ * One virtqueue.  The descriptor table belongs to the driver,
+ * which decides how the descriptors are used; this module only
+ * moves heads through the available and used rings.
+ */
+struct virtq {
+	struct virtio_dev *vd;		/* device */
+	int		num;		/* queue index */
+	int		size;		/* number of descriptors */
+	paddr_t		mem;		/* ring memory */
+	size_t		memsz;
+	struct vring_desc *desc;	/* descriptor table */
+	struct vring_avail *avail;	/* available ring */
+	volatile struct vring_used *used; /* used ring */
+	uint16_t	lastused;	/* next used entry to reap */
+};
+
+struct virtio_dev {
+	struct pci_device *pci;		/* PCI function */
+	int		iobase;		/* I/O BAR 0 */
+	uint32_t	features;	/* negotiated features */
+	irq_t		irq;		/* interrupt handle */
+};
+
+__BEGIN_DECLS
+int	virtio_attach(struct virtio_dev *, struct pci_device *, uint32_t);
+void	virtio_ready(struct virtio_dev *);
+void	virtio_fail(struct virtio_dev *);
+int	virtio_intr(struct virtio_dev *);
+uint8_t	virtio_cfg_read8(struct virtio_dev *, int);
+uint16_t virtio_cfg_read16(struct virtio_dev *, int);
+uint32_t virtio_cfg_read32(struct virtio_dev *, int);
+int	virtq_init(struct virtio_dev *, struct virtq *, int);
+void	virtq_submit(struct virtq *, int);
+void	virtq_notify(struct virtq *);
+int	virtq_dequeue(struct virtq *, uint32_t *);
+int	virtq_poll(struct virtq *, uint32_t *, int);
+__END_DECLS
+
+#endif /* !_VIRTIO_H */
@@ -34,6 +34,12 @@
 
 /*
  * Video interface
+ *
+ * putrow, scroll and getrow are optional.  putrow draws "n" cells,
+ * each holding a character and its attribute in the high byte.
+ * scroll moves the screen up by "nrows" rows, and returns non-zero
+ * if the driver could not do it and the whole screen must be
+ * redrawn.  getrow reads "n" cells from the screen.
  */
 struct wscons_video_ops {
 	void	(*cursor)    (void *aux, int row, int col);
@@ -42,6 +48,11 @@ struct wscons_video_ops {
 	void	(*eraserows) (void *aux, int row, int nrows);
 	void	(*set_attr)  (void *aux, int attr);
 	void	(*get_cursor)(void *aux, int *col, int *row);
+	void	(*putrow)    (void *aux, int row, int col,
+			      const u_short *cells, int n);
+	int	(*scroll)    (void *aux, int nrows);
+	void	(*getrow)    (void *aux, int row, int col,
+			      u_short *cells, int n);
 };
 
 /*
@@ -80,6 +80,17 @@ clock_isr(void *arg)
 	return INT_DONE;
 }
 
+/*
+ * Return a fast running counter value.
+ * This is used to sample the timing of events.
+ */
+u_long
+clock_count(void)
+{
+
+	return (u_long)TMR0_COUNT;
+}
+
 /*
  * Initialize clock H/W chip.
  * Setup clock tick rate and install clock ISR.
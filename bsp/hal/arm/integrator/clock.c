@@ -79,6 +79,17 @@ clock_isr(void *arg)
 	return INT_DONE;
 }
 
+/*
+ * Return a fast running counter value.
+ * This is used to sample the timing of events.
+ */
+u_long
+clock_count(void)
+{
+
+	return (u_long)TMR_VAL;
+}
+
 /*
  * Initialize clock H/W chip.
  * Setup clock tick rate and install clock ISR.
@@ -102,3 +102,12 @@ copyinstr(const void *uaddr, void *kaddr, size_t len)
 	}
 	return EFAULT;
 }
+
+/*
+ * Keep the cache coherent with DMA.
+ * Nothing to do, as the host bridge snoops the bus.
+ */
+void
+cache_sync(void *addr, size_t len, int op)
+{
+}
@@ -207,6 +207,15 @@ tss_init(void)
 	load_tr(KERNEL_TSS);
 }
 
+/*
+ * Keep the cache coherent with DMA.
+ * Nothing to do, as the bus masters snoop the cache.
+ */
+void
+cache_sync(void *addr, size_t len, int op)
+{
+}
+
 /*
  * Initialize CPU state.
  * Setup segment and interrupt descriptor.
@@ -169,7 +169,7 @@ mmu_newmap(void)
 
 	/* Copy kernel page tables */
 	i = PAGE_DIR(KERNBASE);
-	memcpy(&pgd[i], &boot_pgd[i], (size_t)(1024 - i));
+	memcpy(&pgd[i], &boot_pgd[i], (size_t)(1024 - i) * sizeof(*pgd));
 	return pgd;
 }
 
@@ -47,6 +47,8 @@ void	 outb(int, u_char);
 u_char	 inb(int);
 void	 outb_p(int, u_char);
 u_char	 inb_p(int);
+int	 has_tsc(void);
+uint32_t rdtsc(void);
 __END_DECLS
 
 #endif /* !_X86_CPUFUNC_H */
@@ -50,6 +50,8 @@
 #define PIT_CH0		0x40
 #define PIT_CTRL	0x43
 
+static int tsc_avail;		/* true if CPU has time stamp counter */
+
 /*
  * Clock interrupt service routine.
  * No H/W reprogram is required.
@@ -66,6 +68,28 @@ clock_isr(void *arg)
 	return INT_DONE;
 }
 
+/*
+ * Return a fast running counter value.
+ * This is used to sample the timing of events.
+ */
+u_long
+clock_count(void)
+{
+	u_long lo, hi;
+	int s;
+
+	if (tsc_avail)
+		return (u_long)rdtsc();
+
+	/* Latch and read the counter of the PIT */
+	s = splhigh();
+	outb(PIT_CTRL, 0x00);
+	lo = inb(PIT_CH0);
+	hi = inb(PIT_CH0);
+	splx(s);
+	return (hi << 8) | lo;
+}
+
 /*
  * Initialize clock H/W chip.
  * Setup clock tick rate and install clock ISR.
@@ -75,6 +99,8 @@ clock_init(void)
 {
 	irq_t clock_irq;
 
+	tsc_avail = has_tsc();
+
 	outb_p(PIT_CTRL, 0x34);		/* Command to set generator mode */
 	outb_p(PIT_CH0, (u_char)(PIT_LATCH & 0xff));		/* LSB */
 	outb_p(PIT_CH0, (u_char)((PIT_LATCH >> 8) & 0xff));	/* MSB */
@@ -55,6 +55,11 @@ static struct mmumap mmumap_table[] =
 	 */
 	{ 0x80000000, 0x00000000, AUTOSIZE, VMT_RAM },
 
+	/*
+	 * PCI memory space (see PCI_MEM_BASE in pci.h)
+	 */
+	{ 0xfc000000, 0xfc000000, 0x4000000, VMT_IO },
+
 	{ 0,0,0,0 }
 };
 #endif
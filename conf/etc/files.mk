@@ -5,7 +5,11 @@
 ifeq ($(CONFIG_POSIX),y)
 
 FILES+= 	$(SRCDIR)/usr/sbin/init/init
+ifeq ($(_FSBENCH_),1)
+FILES+= 	$(SRCDIR)/usr/sample/fsbench/rc
+else
 FILES+= 	$(SRCDIR)/conf/etc/rc
+endif
 FILES+= 	$(SRCDIR)/conf/etc/fstab
 
 ifeq ($(CONFIG_CMDBOX),y)
@@ -36,6 +40,10 @@ ifeq ($(CONFIG_CMD_DEBUG),y)
 FILES+= 	$(SRCDIR)/usr/sbin/debug/debug
 endif
 
+ifeq ($(CONFIG_CMD_MSGSTAT),y)
+FILES+= 	$(SRCDIR)/usr/sbin/msgstat/msgstat
+endif
+
 ifeq ($(CONFIG_CMD_MOUNT),y)
 FILES+= 	$(SRCDIR)/usr/sbin/mount/mount
 endif
@@ -53,6 +61,7 @@ ifneq ($(CONFIG_TINY),y)
 FILES+=		$(SRCDIR)/usr/sample/hello/hello
 FILES+=		$(SRCDIR)/usr/sample/tetris/tetris
 FILES+=		$(SRCDIR)/usr/sample/fsperf/fsperf
+FILES+=		$(SRCDIR)/usr/sample/fsbench/fsbench
 endif
 endif
 
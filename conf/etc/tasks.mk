@@ -42,6 +42,7 @@ endif
 #TASKS+= 	$(SRCDIR)/usr/test/ramdisk/ramdisk.rt
 #TASKS+= 	$(SRCDIR)/usr/test/reset/reset.rt
 #TASKS+= 	$(SRCDIR)/usr/test/zero/zero.rt
+#TASKS+= 	$(SRCDIR)/usr/test/random/random.rt
 
 #TASKS+= 	$(SRCDIR)/usr/test/cpufreq/cpufreq.rt
 #TASKS+= 	$(SRCDIR)/usr/sample/cpumon/cpumon.rt
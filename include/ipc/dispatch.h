@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IPC_DISPATCH_H
+#define _IPC_DISPATCH_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <ipc/ipc.h>
+
+/*
+ * Message dispatch table
+ *
+ * A server registers the index of each entry in its own message
+ * map, and the table finds it by indexing directly with the
+ * message code.  Standard messages (STD_*) occupy the first
+ * STD_NMSG slots and the messages of the server class follow.
+ * The table also keeps the statistics for each slot.
+ */
+struct msg_dispatch {
+	int		 md_class;	/* message class of the server */
+	int		 md_nslot;	/* number of slots */
+	short		*md_index;	/* map index for each slot */
+	struct msg_stat	*md_stat;	/* statistics for each slot */
+};
+
+__BEGIN_DECLS
+int	msg_dispatch_init(struct msg_dispatch *, int, int);
+int	msg_dispatch_add(struct msg_dispatch *, int, int);
+int	msg_dispatch_slot(struct msg_dispatch *, int);
+void	msg_dispatch_account(struct msg_dispatch *, int, u_long, u_long, int);
+int	msg_dispatch_getstat(struct msg_dispatch *, struct msgstat_msg *);
+void	msg_dispatch_dump(struct msg_dispatch *);
+__END_DECLS
+
+#endif /* !_IPC_DISPATCH_H */
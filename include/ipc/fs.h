@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <sys/fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <ipc/ipc.h>
 
 #include <limits.h>
@@ -82,6 +83,13 @@
 #define FS_FTRUNCATE	0x00000225
 #define FS_FCHDIR	0x00000226
 #define FS_FINDROOT	0x00000227
+#define FS_READV	0x00000228
+#define FS_WRITEV	0x00000229
+#define FS_GETDIRENTRIES 0x0000022A
+#define FS_MMAP		0x0000022B
+#define FS_MUNMAP	0x0000022C
+#define FS_MSYNC	0x0000022D
+#define FS_DEVICE	0x0000022E
 
 /*
  * Mount message
@@ -104,6 +112,7 @@ struct open_msg {
 	mode_t	mode;			/* open mode */
 	char	path[PATH_MAX];		/* open file */
 	int	fd;			/* file descriptor */
+	device_t dev;			/* direct device handle */
 };
 
 /*
@@ -116,6 +125,71 @@ struct io_msg {
 	size_t	size;			/* read/write size */
 };
 
+/*
+ * Vectored I/O request message
+ *
+ * The vectors are handled in order within one request, and the
+ * transfer stops at the first short read or write.
+ */
+struct iov_msg {
+	struct msg_header hdr;		/* message header */
+	int	fd;			/* file descriptor */
+	int	iovcnt;			/* number of vectors */
+	struct iovec iov[IOV_MAX];	/* i/o vectors */
+	size_t	size;			/* total transferred size */
+};
+
+/*
+ * Directory entries message
+ *
+ * Fills the buffer with packed directory entries.  If DIRENTS_STAT
+ * is set, each record also carries the stat of the entry.
+ */
+struct dirents_msg {
+	struct msg_header hdr;		/* message header */
+	int	fd;			/* file descriptor */
+	char	*buf;			/* buffer for entries */
+	size_t	size;			/* buffer size, filled size */
+	int	flags;			/* request flags */
+	long	base;			/* position of the first entry */
+};
+
+#define DIRENTS_STAT	0x0001		/* return stat with entries */
+
+/*
+ * Memory mapped file message
+ *
+ * A server holding CAP_EXTMEM can map a file into another
+ * task by setting the task field.  FS_MUNMAP and FS_MSYNC
+ * use the addr, len and flags fields.  FS_MUNMAP with NULL
+ * addr releases all mappings of the task; it is allowed only
+ * for a server holding CAP_PROTSERV.
+ */
+struct mmap_msg {
+	struct msg_header hdr;		/* message header */
+	task_t	task;			/* target task, or 0 for sender */
+	int	fd;			/* file descriptor */
+	void	*addr;			/* requested/mapped address */
+	size_t	len;			/* length to map */
+	int	prot;			/* PROT_* */
+	int	flags;			/* MAP_* or MS_* */
+	off_t	off;			/* file offset */
+};
+
+/*
+ * Device handle message
+ *
+ * Returns the handle of a character device file so that the
+ * caller can drive the device directly.  NODEV is returned for
+ * other files, or if the caller does not have CAP_RAWIO.
+ */
+struct device_msg {
+	struct msg_header hdr;		/* message header */
+	int	fd;			/* file descriptor */
+	device_t dev;			/* device handle */
+	int	flags;			/* FREAD/FWRITE of the file */
+};
+
 /*
  * File stat message
  */
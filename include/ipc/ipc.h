@@ -38,12 +38,15 @@
  * The ID of send task is automatically filled by the kernel
  * in msg_send() call. So there are no need to set it by the
  * sender task. The receiver task can always trust the task ID
- * in all messages.
+ * in all messages. The send time is also filled by the kernel
+ * so that the receiver can know how long the message waited
+ * in the queue.
  */
 struct msg_header {
 	task_t	task;		/* id of send task */
 	int	code;		/* message code */
 	int	status;		/* return status */
+	u_long	time;		/* system tick at send time */
 };
 
 /*
@@ -54,6 +57,18 @@ struct msg_header {
 #define STD_DEBUG	0x00000002
 #define STD_BOOT	0x00000003
 #define STD_SHUTDOWN	0x00000004
+#define STD_MSGSTAT	0x00000005
+
+#define STD_NMSG	6		/* number of standard messages */
+
+/*
+ * Message code layout.
+ *
+ * The upper bits of the message code select the server (class)
+ * and the lower 8 bits select the message within the server.
+ */
+#define MSG_CLASS(code)		((code) & ~0xff)
+#define MSG_NUMBER(code)	((code) & 0xff)
 
 /*
  * Generic message
@@ -63,4 +78,33 @@ struct msg {
 	int	data[4];		/* integer data */
 };
 
+/*
+ * Per-message statistics
+ *
+ * Times are measured in system ticks. The histogram bucket n
+ * counts the requests which took 2^(n-1) to 2^n-1 ticks, and
+ * bucket 0 counts the requests completed within a tick. The
+ * last bucket also counts all longer requests.
+ */
+#define MSGSTAT_NBUCKET	8
+
+struct msg_stat {
+	u_long	count;				/* number of requests */
+	u_long	errors;				/* number of failed requests */
+	u_long	wait;				/* total queue wait time */
+	u_long	service;			/* total service time */
+	u_long	wait_hist[MSGSTAT_NBUCKET];	/* queue wait histogram */
+	u_long	service_hist[MSGSTAT_NBUCKET];	/* service time histogram */
+};
+
+/*
+ * Message statistics message
+ */
+struct msgstat_msg {
+	struct msg_header hdr;		/* message header */
+	int	index;			/* in: first slot, out: found slot */
+	int	code;			/* out: message code */
+	struct msg_stat stat;		/* out: statistics */
+};
+
 #endif /* !_SYS_IPC_H */
@@ -54,6 +54,21 @@ struct dirent {
 	char	 d_name[NAME_MAX];	/* name must be no longer than this */
 };
 
+/*
+ * Size of a packed entry returned by getdirentries(2).  The name
+ * is padded with null bytes to a 4 byte boundary.
+ */
+#define	_DIRENT_NAMEOFF		((size_t)((struct dirent *)0)->d_name)
+#define	_DIRENT_RECLEN(namlen) \
+	((_DIRENT_NAMEOFF + (namlen) + 1 + 3) & ~3)
+
+/*
+ * When the entries are read with their attributes, a struct stat
+ * follows the padded name in each record.
+ */
+#define	DIRENT_STAT(dp) \
+	((struct stat *)((char *)(dp) + _DIRENT_RECLEN((dp)->d_namlen)))
+
 /*
  * File types
  */
@@ -107,6 +107,22 @@ struct __timeval {
 	long	tv_usec;	/* and microseconds */
 };
 
+/*
+ * Device memory I/O control code
+ */
+#define DMIOC_MAP		 _IOWR('M', 0, struct devmap)
+
+/*
+ * Memory of a device mapped into the caller.  The caller sets
+ * dm_prot, and gets the address and size of the mapping.  It is
+ * released by vm_free().
+ */
+struct devmap {
+	void	*dm_addr;	/* mapped address */
+	size_t	dm_size;	/* size in bytes */
+	int	dm_prot;	/* PROT_READ, optionally PROT_WRITE */
+};
+
 __BEGIN_DECLS
 int	ioctl(int, unsigned long, ...);
 __END_DECLS
@@ -38,6 +38,9 @@ extern object_t __fs_obj;
 
 __BEGIN_DECLS
 int __posix_call(object_t, void *, size_t, int);
+device_t __fdev_lookup(int, int);
+void	__fdev_set(int, device_t, int);
+void	__fdev_clear(int);
 __END_DECLS
 
 #endif	/* KERNEL */
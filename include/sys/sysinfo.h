@@ -137,6 +137,12 @@ struct devinfo {
 	device_t	id;		/* device id */
 	int	 	flags;		/* device characteristics flags */
 	char	 	name[MAXDEVNAME]; /* device name */
+	u_long		nread;		/* number of read requests */
+	u_long		nwrite;		/* number of write requests */
+	u_long		nioctl;		/* number of ioctl requests */
+	u_long		rbytes;		/* bytes read (wraps around) */
+	u_long		wbytes;		/* bytes written (wraps around) */
+	u_long		ticks;		/* ticks spent in read and write */
 };
 
 /*
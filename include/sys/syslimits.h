@@ -40,6 +40,7 @@
 #define	OPEN_MAX      CONFIG_OPEN_MAX	/* max open files per process */
 #define	PATH_MAX		  256	/* max bytes in pathname (include null)*/
 #define	PIPE_BUF		 1024	/* max bytes for atomic pipe writes */
+#define	IOV_MAX			   16	/* max elements in i/o vector */
 #define	LINE_MAX		  256	/* max bytes in an input line */
 
 #endif
@@ -74,6 +74,7 @@ struct vnode {
 	int		v_blkno;	/* block number */
 	char		*v_path;	/* pointer to path in fs */
 	void		*v_data;	/* private data for fs */
+	struct mmap_object *v_object;	/* pages of mapped file */
 };
 typedef struct vnode *vnode_t;
 
@@ -119,6 +120,8 @@ struct vnops {
 	int (*vop_setattr)	(vnode_t, struct vattr *);
 	int (*vop_inactive)	(vnode_t);
 	int (*vop_truncate)	(vnode_t, off_t);
+	int (*vop_getpages)	(vnode_t, off_t, void *, size_t);
+	int (*vop_putpages)	(vnode_t, off_t, void *, size_t, size_t *);
 };
 
 typedef	int (*vnop_open_t)	(vnode_t, int);
@@ -139,6 +142,8 @@ typedef	int (*vnop_getattr_t)	(vnode_t, struct vattr *);
 typedef	int (*vnop_setattr_t)	(vnode_t, struct vattr *);
 typedef	int (*vnop_inactive_t)	(vnode_t);
 typedef	int (*vnop_truncate_t)	(vnode_t, off_t);
+typedef	int (*vnop_getpages_t)	(vnode_t, off_t, void *, size_t);
+typedef	int (*vnop_putpages_t)	(vnode_t, off_t, void *, size_t, size_t *);
 
 /*
  * vnode interface
@@ -162,6 +167,22 @@ typedef	int (*vnop_truncate_t)	(vnode_t, off_t);
 #define VOP_SETATTR(VP, VAP)	   ((VP)->v_op->vop_setattr)(VP, VAP)
 #define VOP_INACTIVE(VP)	   ((VP)->v_op->vop_inactive)(VP)
 #define VOP_TRUNCATE(VP, N)	   ((VP)->v_op->vop_truncate)(VP, N)
+#define VOP_GETPAGES(VP, O, B, S)  ((VP)->v_op->vop_getpages)(VP, O, B, S)
+#define VOP_PUTPAGES(VP, O, B, S, C)  ((VP)->v_op->vop_putpages)(VP, O, B, S, C)
+
+/*
+ * Reader/writer lock for file system private data.
+ * Readers can hold the lock at the same time, and a writer
+ * holds it exclusively.  The write lock can be nested.
+ */
+struct rwlock {
+	mutex_t		rw_mutex;	/* lock for this structure */
+	cond_t		rw_cond;	/* wait for lock release */
+	int		rw_readers;	/* number of active readers */
+	int		rw_wwait;	/* number of waiting writers */
+	int		rw_wlocks;	/* write lock count */
+	thread_t	rw_owner;	/* thread holding write lock */
+};
 
 __BEGIN_DECLS
 int	 vop_nullop(void);
@@ -178,6 +199,19 @@ void	 vref(vnode_t);
 void	 vrele(vnode_t);
 int	 vcount(vnode_t);
 void	 vflush(struct mount *);
+#if CONFIG_FS_THREADS > 1
+void	 rw_init(struct rwlock *);
+void	 rw_destroy(struct rwlock *);
+void	 rw_rlock(struct rwlock *);
+void	 rw_wlock(struct rwlock *);
+void	 rw_unlock(struct rwlock *);
+#else
+#define rw_init(rw)		do {} while (0)
+#define rw_destroy(rw)		do {} while (0)
+#define rw_rlock(rw)		do {} while (0)
+#define rw_wlock(rw)		do {} while (0)
+#define rw_unlock(rw)		do {} while (0)
+#endif
 __END_DECLS
 
 #endif /* !_SYS_VNODE_H_ */
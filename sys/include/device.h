@@ -34,25 +34,42 @@
 #include <types.h>
 #include <sys/device.h>
 
+/*
+ * Applications refer to a device by a handle which holds the
+ * index in the device table and the generation number of that
+ * slot.  A stale handle is detected without searching.
+ */
+#define DEVH_SLOTBITS	7
+#define NDEVICES	(1 << DEVH_SLOTBITS)	/* slot 0 is not used */
+#define DEVH_SLOT(h)	((int)((h) & (NDEVICES - 1)))
+
 /*
  * Device object
  */
 struct device {
 	struct device	*next;		/* linkage on list of all devices */
+	struct device	*hnext;		/* linkage on name hash chain */
 	struct driver	*driver;	/* pointer to the driver object */
 	char		name[MAXDEVNAME]; /* name of device */
 	int		flags;		/* D_* flags defined above */
 	int		active;		/* device has not been destroyed */
 	int		refcnt;		/* reference count */
 	void		*private;	/* private storage */
+	u_long		handle;		/* handle for applications */
+	u_long		nread;		/* number of read requests */
+	u_long		nwrite;		/* number of write requests */
+	u_long		nioctl;		/* number of ioctl requests */
+	u_long		rbytes;		/* bytes read */
+	u_long		wbytes;		/* bytes written */
+	u_long		ticks;		/* ticks spent in read and write */
 };
 
 __BEGIN_DECLS
-int	 device_open(const char *, int, device_t *);
-int	 device_close(device_t);
-int	 device_read(device_t, void *, size_t *, int);
-int	 device_write(device_t, void *, size_t *, int);
-int	 device_ioctl(device_t, u_long, void *);
+int	 device_open(const char *, int, u_long *);
+int	 device_close(u_long);
+int	 device_read(u_long, void *, size_t *, int);
+int	 device_write(u_long, void *, size_t *, int);
+int	 device_ioctl(u_long, u_long, void *);
 int	 device_info(struct devinfo *);
 void	 device_init(void);
 __BEGIN_DECLS
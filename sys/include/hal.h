@@ -89,6 +89,12 @@ struct mmumap
 /* No IST for irq_attach() */
 #define IST_NONE        ((void (*)(void *)) -1)
 
+/*
+ * Operations for cache_sync()
+ */
+#define CACHE_WBACK	0	/* write dirty lines back to memory */
+#define CACHE_INVAL	1	/* write back and discard lines */
+
 /*
  * Interrupt mode for interrupt_setup()
  */
@@ -133,6 +139,9 @@ void	  machine_abort(void);
 void	  machine_bootinfo(struct bootinfo **);
 
 void	  clock_init(void);
+u_long	  clock_count(void);
+
+void	  cache_sync(void *, size_t, int);
 
 #ifdef DEBUG
 void	  diag_init(void);
@@ -67,6 +67,7 @@ __BEGIN_DECLS
 irq_t	 irq_attach(int, int, int, int (*)(void *), void (*)(void *), void *);
 void	 irq_detach(irq_t);
 void	 irq_handler(int);
+int	 irq_entropy(void *, size_t);
 int	 irq_info(struct irqinfo *);
 void	 irq_init(void);
 __BEGIN_DECLS
@@ -55,6 +55,7 @@ struct seg {
 #define SEG_EXEC	0x00000004
 #define SEG_SHARED	0x00000008
 #define SEG_MAPPED	0x00000010
+#define SEG_LENT	0x00000020	/* mapped by vm_share() */
 #define SEG_FREE	0x00000080
 
 /* Attribute for vm_attribute() */
@@ -78,6 +79,8 @@ int	 vm_allocate(task_t, void **, size_t, int);
 int	 vm_free(task_t, void *);
 int	 vm_attribute(task_t, void *, int);
 int	 vm_map(task_t, void *, size_t, void **);
+int	 vm_share(task_t, void *, size_t, void **);
+int	 vm_physmap(paddr_t, size_t, int, void **);
 vm_map_t vm_dup(vm_map_t);
 vm_map_t vm_create(void);
 int	 vm_reference(vm_map_t);
@@ -62,6 +62,7 @@
 #include <thread.h>
 #include <task.h>
 #include <event.h>
+#include <timer.h>
 #include <ipc.h>
 
 /* forward declarations */
@@ -122,9 +123,12 @@ msg_send(object_t obj, void *msg, size_t size)
 	/*
 	 * The sender ID is filled in the message header
 	 * by the kernel. So, the receiver can trust it.
+	 * The send time is stamped for the statistics of
+	 * the receiver.
 	 */
 	hdr = (struct msg_header *)kmsg;
 	hdr->task = curtask;
+	hdr->time = timer_ticks();
 
 	/*
 	 * If receiver already exists, wake it up.
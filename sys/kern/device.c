@@ -58,6 +58,7 @@
 static device_t	device_create(struct driver *, const char *, int);
 static int	device_destroy(device_t);
 static device_t	device_lookup(const char *);
+static device_t	device_handle(u_long);
 static int	device_valid(device_t);
 static int	device_reference(device_t);
 static void	device_release(device_t);
@@ -114,11 +115,36 @@ static const dkifn_t dkient[] = {
 	/* 35 */ DKIENT(sys_nosys),
 	/* 36 */ DKIENT(sys_nosys),
 #endif
+	/* 37 */ DKIENT(vm_physmap),
+	/* 38 */ DKIENT(irq_entropy),
+	/* 39 */ DKIENT(cache_sync),
 };
 
 /* list head of the devices */
 static struct device *device_list = NULL;
 
+/* device table indexed by the slot of a handle */
+static struct device *device_table[NDEVICES];
+static u_long device_gen[NDEVICES];	/* generation of each slot */
+
+/* hash table for device names */
+#define DEVHASH_SIZE	32
+static struct device *device_hash[DEVHASH_SIZE];
+
+/*
+ * Hash function for device names.
+ */
+static u_int
+device_hashname(const char *name)
+{
+	u_int h = 0;
+	int i;
+
+	for (i = 0; i < MAXDEVNAME && name[i] != '\0'; i++)
+		h = h * 31 + (u_char)name[i];
+	return h & (DEVHASH_SIZE - 1);
+}
+
 /*
  * device_create - create new device object.
  *
@@ -132,6 +158,8 @@ device_create(struct driver *drv, const char *name, int flags)
 	device_t dev;
 	size_t len;
 	void *private = NULL;
+	u_int h;
+	int slot;
 
 	ASSERT(drv != NULL);
 
@@ -146,6 +174,17 @@ device_create(struct driver *drv, const char *name, int flags)
 	if (device_lookup(name) != NULL)
 		panic("duplicate device");
 
+	/* Find a free slot in the device table. */
+	for (slot = 1; slot < NDEVICES; slot++) {
+		if (device_table[slot] == NULL)
+			break;
+	}
+	if (slot == NDEVICES) {
+		printf("device_create: too many devices\n");
+		sched_unlock();
+		return NULL;
+	}
+
 	/*
 	 * Allocate a device structure and device private data.
 	 */
@@ -157,6 +196,7 @@ device_create(struct driver *drv, const char *name, int flags)
 			panic("devsz");
 		memset(private, 0, drv->devsz);
 	}
+	memset(dev, 0, sizeof(*dev));
 	strlcpy(dev->name, name, len + 1);
 	dev->driver = drv;
 	dev->flags = flags;
@@ -166,6 +206,16 @@ device_create(struct driver *drv, const char *name, int flags)
 	dev->next = device_list;
 	device_list = dev;
 
+	h = device_hashname(dev->name);
+	dev->hnext = device_hash[h];
+	device_hash[h] = dev;
+
+	/* Generation 0 is skipped so that a handle is never 0. */
+	if (++device_gen[slot] > (~0UL >> DEVH_SLOTBITS))
+		device_gen[slot] = 1;
+	dev->handle = (device_gen[slot] << DEVH_SLOTBITS) | (u_long)slot;
+	device_table[slot] = dev;
+
 	sched_unlock();
 	return dev;
 }
@@ -198,13 +248,28 @@ device_lookup(const char *name)
 {
 	device_t dev;
 
-	for (dev = device_list; dev != NULL; dev = dev->next) {
+	for (dev = device_hash[device_hashname(name)]; dev != NULL;
+	     dev = dev->hnext) {
 		if (!strncmp(dev->name, name, MAXDEVNAME))
 			return dev;
 	}
 	return NULL;
 }
 
+/*
+ * Look up an active device object by its handle.
+ */
+static device_t
+device_handle(u_long handle)
+{
+	device_t dev;
+
+	dev = device_table[DEVH_SLOT(handle)];
+	if (dev == NULL || dev->handle != handle || !dev->active)
+		return NULL;
+	return dev;
+}
+
 /*
  * Return device's private data.
  */
@@ -223,18 +288,10 @@ device_private(device_t dev)
 static int
 device_valid(device_t dev)
 {
-	device_t tmp;
-	int found = 0;
 
-	for (tmp = device_list; tmp != NULL; tmp = tmp->next) {
-		if (tmp == dev) {
-			found = 1;
-			break;
-		}
-	}
-	if (found && dev->active)
-		return 1;
-	return 0;
+	if (dev == NULL || device_table[DEVH_SLOT(dev->handle)] != dev)
+		return 0;
+	return dev->active;
 }
 
 /*
@@ -281,10 +338,71 @@ device_release(device_t dev)
 			break;
 		}
 	}
+	for (tmp = &device_hash[device_hashname(dev->name)]; *tmp;
+	     tmp = &(*tmp)->hnext) {
+		if (*tmp == dev) {
+			*tmp = dev->hnext;
+			break;
+		}
+	}
+	device_table[DEVH_SLOT(dev->handle)] = NULL;
 	kmem_free(dev);
 	sched_unlock();
 }
 
+/*
+ * Translate a handle from an application to the device
+ * object, and take a reference on it.
+ */
+static int
+device_acquire(u_long handle, device_t *devp)
+{
+	device_t dev;
+	int error;
+
+	sched_lock();
+	if ((dev = device_handle(handle)) == NULL) {
+		sched_unlock();
+		return ENODEV;
+	}
+	error = device_reference(dev);
+	sched_unlock();
+	if (!error)
+		*devp = dev;
+	return error;
+}
+
+/* Requests for device_account() */
+#define ACCT_READ	0
+#define ACCT_WRITE	1
+#define ACCT_IOCTL	2
+
+/*
+ * Account a request to the device statistics.
+ */
+static void
+device_account(device_t dev, int req, size_t count, u_long start)
+{
+
+	sched_lock();
+	switch (req) {
+	case ACCT_READ:
+		dev->nread++;
+		dev->rbytes += count;
+		dev->ticks += timer_ticks() - start;
+		break;
+	case ACCT_WRITE:
+		dev->nwrite++;
+		dev->wbytes += count;
+		dev->ticks += timer_ticks() - start;
+		break;
+	case ACCT_IOCTL:
+		dev->nioctl++;
+		break;
+	}
+	sched_unlock();
+}
+
 /*
  * device_open - open the specified device.
  *
@@ -296,7 +414,7 @@ device_release(device_t dev)
  * needed.
  */
 int
-device_open(const char *name, int mode, device_t *devp)
+device_open(const char *name, int mode, u_long *devp)
 {
 	struct devops *ops;
 	device_t dev;
@@ -323,7 +441,7 @@ device_open(const char *name, int mode, device_t *devp)
 	ASSERT(ops->open != NULL);
 	error = (*ops->open)(dev, mode);
 	if (!error)
-		error = copyout(&dev, devp, sizeof(dev));
+		error = copyout(&dev->handle, devp, sizeof(dev->handle));
 
 	device_release(dev);
 	return error;
@@ -336,12 +454,13 @@ device_open(const char *name, int mode, device_t *devp)
  * this function does not return any errors.
  */
 int
-device_close(device_t dev)
+device_close(u_long handle)
 {
 	struct devops *ops;
+	device_t dev;
 	int error;
 
-	if ((error = device_reference(dev)) != 0)
+	if ((error = device_acquire(handle, &dev)) != 0)
 		return error;
 
 	ops = dev->driver->devops;
@@ -359,16 +478,18 @@ device_close(device_t dev)
  * Note: The size of one block is device dependent.
  */
 int
-device_read(device_t dev, void *buf, size_t *nbyte, int blkno)
+device_read(u_long handle, void *buf, size_t *nbyte, int blkno)
 {
 	struct devops *ops;
+	device_t dev;
 	size_t count;
+	u_long start;
 	int error;
 
 	if (!user_area(buf))
 		return EFAULT;
 
-	if ((error = device_reference(dev)) != 0)
+	if ((error = device_acquire(handle, &dev)) != 0)
 		return error;
 
 	if (copyin(nbyte, &count, sizeof(count))) {
@@ -378,7 +499,9 @@ device_read(device_t dev, void *buf, size_t *nbyte, int blkno)
 
 	ops = dev->driver->devops;
 	ASSERT(ops->read != NULL);
+	start = timer_ticks();
 	error = (*ops->read)(dev, buf, &count, blkno);
+	device_account(dev, ACCT_READ, error ? 0 : count, start);
 	if (!error)
 		error = copyout(&count, nbyte, sizeof(count));
 
@@ -392,16 +515,18 @@ device_read(device_t dev, void *buf, size_t *nbyte, int blkno)
  * Actual write count is set in "nbyte" as return.
  */
 int
-device_write(device_t dev, void *buf, size_t *nbyte, int blkno)
+device_write(u_long handle, void *buf, size_t *nbyte, int blkno)
 {
 	struct devops *ops;
+	device_t dev;
 	size_t count;
+	u_long start;
 	int error;
 
 	if (!user_area(buf))
 		return EFAULT;
 
-	if ((error = device_reference(dev)) != 0)
+	if ((error = device_acquire(handle, &dev)) != 0)
 		return error;
 
 	if (copyin(nbyte, &count, sizeof(count))) {
@@ -411,7 +536,9 @@ device_write(device_t dev, void *buf, size_t *nbyte, int blkno)
 
 	ops = dev->driver->devops;
 	ASSERT(ops->write != NULL);
+	start = timer_ticks();
 	error = (*ops->write)(dev, buf, &count, blkno);
+	device_account(dev, ACCT_WRITE, error ? 0 : count, start);
 	if (!error)
 		error = copyout(&count, nbyte, sizeof(count));
 
@@ -427,14 +554,16 @@ device_write(device_t dev, void *buf, size_t *nbyte, int blkno)
  * pointed by the arg value.
  */
 int
-device_ioctl(device_t dev, u_long cmd, void *arg)
+device_ioctl(u_long handle, u_long cmd, void *arg)
 {
 	struct devops *ops;
+	device_t dev;
 	int error;
 
-	if ((error = device_reference(dev)) != 0)
+	if ((error = device_acquire(handle, &dev)) != 0)
 		return error;
 
+	device_account(dev, ACCT_IOCTL, 0, 0);
 	ops = dev->driver->devops;
 	ASSERT(ops->ioctl != NULL);
 	error = (*ops->ioctl)(dev, cmd, arg);
@@ -516,18 +645,23 @@ device_broadcast(u_long cmd, void *arg, int force)
 int
 device_info(struct devinfo *info)
 {
-	u_long target = info->cookie;
-	u_long i = 0;
+	u_long i;
 	device_t dev;
 	int error = ESRCH;
 
 	sched_lock();
-	for (dev = device_list; dev != NULL; dev = dev->next) {
-		if (i++ == target) {
-			info->cookie = i;
-			info->id = dev;
+	for (i = info->cookie; i < NDEVICES; i++) {
+		if ((dev = device_table[i]) != NULL && dev->active) {
+			info->cookie = i + 1;
+			info->id = (device_t)dev->handle;
 			info->flags = dev->flags;
 			strlcpy(info->name, dev->name, MAXDEVNAME);
+			info->nread = dev->nread;
+			info->nwrite = dev->nwrite;
+			info->nioctl = dev->nioctl;
+			info->rbytes = dev->rbytes;
+			info->wbytes = dev->wbytes;
+			info->ticks = dev->ticks;
 			error = 0;
 			break;
 		}
@@ -71,6 +71,15 @@ static void	irq_thread(void *);
 
 static struct irq	*irq_table[MAXIRQS];	/* IRQ descriptor table */
 
+/*
+ * Entropy pool fed by the arrival time of interrupts.
+ */
+#define POOL_WORDS	16
+
+static uint32_t		irq_pool[POOL_WORDS];
+static int		irq_poolidx;
+static u_int		irq_samples;	/* samples since last read */
+
 /*
  * irq_attach - attach ISR and IST to the specified interrupt.
  *
@@ -190,8 +199,16 @@ void
 irq_handler(int vector)
 {
 	struct irq *irq;
+	uint32_t w;
 	int rc;
 
+	/* Mix the arrival time into the entropy pool */
+	w = irq_pool[irq_poolidx];
+	irq_pool[irq_poolidx] = ((w << 7) | (w >> 25)) +
+	    ((uint32_t)clock_count() ^ ((uint32_t)vector << 24));
+	irq_poolidx = (irq_poolidx + 1) & (POOL_WORDS - 1);
+	irq_samples++;
+
 	irq = irq_table[vector];
 	if (irq == NULL) {
 		DPRINTF(("Random interrupt ignored\n"));
@@ -218,6 +235,27 @@ irq_handler(int vector)
 	}
 }
 
+/*
+ * Copy the entropy pool to buf.
+ * Returns the number of interrupts sampled since the last call.
+ */
+int
+irq_entropy(void *buf, size_t len)
+{
+	u_int n;
+	int s;
+
+	if (len > sizeof(irq_pool))
+		len = sizeof(irq_pool);
+
+	s = splhigh();
+	memcpy(buf, irq_pool, len);
+	n = irq_samples;
+	irq_samples = 0;
+	splx(s);
+	return (int)n;
+}
+
 /*
  * Return irq information.
  */
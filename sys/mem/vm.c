@@ -65,6 +65,7 @@ static int	   do_allocate(vm_map_t, void **, size_t, int);
 static int	   do_free(vm_map_t, void *);
 static int	   do_attribute(vm_map_t, void *, int);
 static int	   do_map(vm_map_t, void *, size_t, void **);
+static int	   do_share(vm_map_t, void *, size_t, void **);
 static vm_map_t	   do_dup(vm_map_t);
 
 
@@ -438,7 +439,7 @@ do_map(vm_map_t map, void *addr, size_t size, void **alloc)
 		return ENOMEM;
 	}
 
-	cur->flags = tgt->flags | SEG_MAPPED;
+	cur->flags = (tgt->flags & ~SEG_LENT) | SEG_MAPPED;
 	cur->phys = pa;
 
 	tmp = (void *)(cur->addr + offset);
@@ -448,6 +449,165 @@ do_map(vm_map_t map, void *addr, size_t size, void **alloc)
 	return 0;
 }
 
+/**
+ * vm_share - map current task's memory to another task.
+ *
+ * The pages are mapped with the attribute of the current
+ * segment.  If "*alloc" is not NULL, the memory is mapped at
+ * that address in the target task.  The mapped segment does
+ * not own its pages, so the caller must keep them until the
+ * target task frees the segment.  The segment is not passed
+ * to a child of the target task on fork.
+ */
+int
+vm_share(task_t target, void *addr, size_t size, void **alloc)
+{
+	int error;
+	void *uaddr;
+
+	sched_lock();
+	if (!task_valid(target)) {
+		sched_unlock();
+		return ESRCH;
+	}
+	if (target == curtask) {
+		sched_unlock();
+		return EINVAL;
+	}
+	if (!task_capable(CAP_EXTMEM)) {
+		sched_unlock();
+		return EPERM;
+	}
+	if (!user_area(addr)) {
+		sched_unlock();
+		return EFAULT;
+	}
+	if (copyin(alloc, &uaddr, sizeof(uaddr))) {
+		sched_unlock();
+		return EFAULT;
+	}
+	if (uaddr != NULL && !user_area(uaddr)) {
+		sched_unlock();
+		return EACCES;
+	}
+
+	error = do_share(target->map, addr, size, &uaddr);
+	if (!error) {
+		if (copyout(&uaddr, alloc, sizeof(uaddr)))
+			error = EFAULT;
+	}
+	sched_unlock();
+	return error;
+}
+
+static int
+do_share(vm_map_t map, void *addr, size_t size, void **alloc)
+{
+	struct seg *seg, *src;
+	vm_map_t curmap;
+	vaddr_t start, end;
+	paddr_t pa;
+	size_t offset;
+	int map_type;
+
+	if (size == 0)
+		return EINVAL;
+	if (map->total + size >= MAXMEM)
+		return ENOMEM;
+
+	start = trunc_page((vaddr_t)addr);
+	end = round_page((vaddr_t)addr + size);
+	size = (size_t)(end - start);
+	offset = (size_t)((vaddr_t)addr - start);
+
+	/*
+	 * Find the source segment in current task
+	 */
+	curmap = curtask->map;
+	seg = seg_lookup(&curmap->head, start, size);
+	if (seg == NULL || (seg->flags & SEG_FREE))
+		return EINVAL;	/* not allocated */
+	src = seg;
+
+	/*
+	 * Find the free segment in target task
+	 */
+	if (*alloc == NULL)
+		seg = seg_alloc(&map->head, size);
+	else
+		seg = seg_reserve(&map->head,
+				  trunc_page((vaddr_t)*alloc), size);
+	if (seg == NULL)
+		return ENOMEM;
+
+	if (src->flags & SEG_WRITE)
+		map_type = PG_WRITE;
+	else
+		map_type = PG_READ;
+
+	pa = src->phys + (paddr_t)(start - src->addr);
+	if (mmu_map(map->pgd, pa, seg->addr, size, map_type)) {
+		seg_free(&map->head, seg);
+		return ENOMEM;
+	}
+
+	seg->flags = (src->flags & (SEG_READ | SEG_WRITE | SEG_EXEC))
+		| SEG_MAPPED | SEG_LENT;
+	seg->phys = pa;
+
+	*alloc = (void *)(seg->addr + offset);
+	map->total += size;
+	return 0;
+}
+
+/**
+ * vm_physmap - map physical memory to current task.
+ *
+ * This lets a driver hand the memory of its device (a RAM disk
+ * image, a frame buffer) to the caller of an ioctl, so that the
+ * task can access it without copying.  The segment does not own
+ * its pages; they are left alone when the task frees it.  The
+ * mapped address is returned in "*addr", which is a kernel
+ * pointer.
+ */
+int
+vm_physmap(paddr_t pa, size_t size, int prot, void **addr)
+{
+	vm_map_t map;
+	struct seg *seg;
+	size_t offset;
+	int error = 0;
+
+	if (size == 0 || !(prot & PROT_READ) ||
+	    prot & ~(PROT_READ | PROT_WRITE))
+		return EINVAL;
+
+	offset = (size_t)(pa & PAGE_MASK);
+	pa = trunc_page(pa);
+	size = round_page(size + offset);
+
+	sched_lock();
+	map = curtask->map;
+	if (map->total + size >= MAXMEM)
+		error = ENOMEM;
+	else if ((seg = seg_alloc(&map->head, size)) == NULL)
+		error = ENOMEM;
+	else if (mmu_map(map->pgd, pa, seg->addr, size,
+			 (prot & PROT_WRITE) ? PG_WRITE : PG_READ)) {
+		seg_free(&map->head, seg);
+		error = ENOMEM;
+	} else {
+		seg->flags = SEG_READ | SEG_MAPPED;
+		if (prot & PROT_WRITE)
+			seg->flags |= SEG_WRITE;
+		seg->phys = pa;
+		map->total += size;
+		*addr = (void *)(seg->addr + offset);
+	}
+	sched_unlock();
+	return error;
+}
+
 /*
  * Create new virtual memory space.
  * No memory is inherited.
@@ -591,6 +751,15 @@ do_dup(vm_map_t org_map)
 			/*
 			 * Skip free segment
 			 */
+		} else if (src->flags & SEG_LENT) {
+			/*
+			 * The pages lent by vm_share() belong to the
+			 * task which shared them.  It maps them to
+			 * the child again if it keeps them for the
+			 * child, so the child does not get them here.
+			 */
+			dest->flags = SEG_FREE;
+			new_map->total -= src->size;
 		} else {
 			/* Check if the segment can be shared */
 			if (!(src->flags & SEG_WRITE) &&
@@ -598,7 +767,13 @@ do_dup(vm_map_t org_map)
 				dest->flags |= SEG_SHARED;
 			}
 
+			/*
+			 * Other mapped segments are copied to the
+			 * child's own pages.
+			 */
 			if (!(dest->flags & SEG_SHARED)) {
+				dest->flags &= ~SEG_MAPPED;
+
 				/* Allocate new physical page. */
 				dest->phys = page_alloc(src->size);
 				if (dest->phys == 0)
@@ -59,6 +59,7 @@ static int	   do_allocate(vm_map_t, void **, size_t, int);
 static int	   do_free(vm_map_t, void *);
 static int	   do_attribute(vm_map_t, void *, int);
 static int	   do_map(vm_map_t, void *, size_t, void **);
+static int	   do_share(vm_map_t, void *, size_t, void **);
 
 
 static struct vm_map	kernel_map;	/* vm mapping for kernel */
@@ -360,6 +361,129 @@ do_map(vm_map_t map, void *addr, size_t size, void **alloc)
 	return 0;
 }
 
+/**
+ * vm_share - map current task's memory to another task.
+ *
+ * Since all tasks share one address space, the memory is
+ * visible at the same address in the target task.  A fixed
+ * address is accepted only if it is the address itself.
+ */
+int
+vm_share(task_t target, void *addr, size_t size, void **alloc)
+{
+	int error;
+	void *uaddr;
+
+	sched_lock();
+	if (!task_valid(target)) {
+		sched_unlock();
+		return ESRCH;
+	}
+	if (target == curtask) {
+		sched_unlock();
+		return EINVAL;
+	}
+	if (!task_capable(CAP_EXTMEM)) {
+		sched_unlock();
+		return EPERM;
+	}
+	if (!user_area(addr)) {
+		sched_unlock();
+		return EFAULT;
+	}
+	if (copyin(alloc, &uaddr, sizeof(uaddr))) {
+		sched_unlock();
+		return EFAULT;
+	}
+	if (uaddr != NULL && uaddr != addr) {
+		sched_unlock();
+		return EINVAL;
+	}
+
+	error = do_share(target->map, addr, size, &uaddr);
+	if (!error) {
+		if (copyout(&uaddr, alloc, sizeof(uaddr)))
+			error = EFAULT;
+	}
+	sched_unlock();
+	return error;
+}
+
+static int
+do_share(vm_map_t map, void *addr, size_t size, void **alloc)
+{
+	struct seg *seg, *src;
+	vaddr_t start, end;
+
+	if (size == 0)
+		return EINVAL;
+	if (map->total + size >= MAXMEM)
+		return ENOMEM;
+
+	start = trunc_page((vaddr_t)addr);
+	end = round_page((vaddr_t)addr + size);
+	size = (size_t)(end - start);
+
+	/*
+	 * Find the source segment in current task
+	 */
+	seg = seg_lookup(&curtask->map->head, start, size);
+	if (seg == NULL || (seg->flags & SEG_FREE))
+		return EINVAL;	/* not allocated */
+	src = seg;
+
+	/*
+	 * Create new segment to map
+	 */
+	if ((seg = seg_create(&map->head, start, size)) == NULL)
+		return ENOMEM;
+	seg->flags = (src->flags & (SEG_READ | SEG_WRITE | SEG_EXEC))
+		| SEG_MAPPED;
+
+	*alloc = addr;
+	map->total += size;
+	return 0;
+}
+
+/**
+ * vm_physmap - map physical memory to current task.
+ *
+ * Without an MMU, the task can already reach the memory, so only
+ * a segment is recorded for it.
+ */
+int
+vm_physmap(paddr_t pa, size_t size, int prot, void **addr)
+{
+	vm_map_t map;
+	struct seg *seg;
+	vaddr_t start;
+	int error = 0;
+
+	if (size == 0 || !(prot & PROT_READ) ||
+	    prot & ~(PROT_READ | PROT_WRITE))
+		return EINVAL;
+
+	start = trunc_page((vaddr_t)ptokv(pa));
+	size = (size_t)(round_page((vaddr_t)ptokv(pa) + size) - start);
+
+	sched_lock();
+	map = curtask->map;
+	if (map->total + size >= MAXMEM)
+		error = ENOMEM;
+	else if ((seg = seg_create(&map->head, start, size)) == NULL)
+		error = ENOMEM;
+	else {
+		seg->flags = SEG_READ | SEG_MAPPED;
+		if (prot & PROT_WRITE)
+			seg->flags |= SEG_WRITE;
+		seg->phys = trunc_page(pa);
+		map->total += size;
+		*addr = ptokv(pa);
+	}
+	sched_unlock();
+	return error;
+}
+
 /*
  * Create new virtual memory space.
  * No memory is inherited.
@@ -40,6 +40,7 @@ extern int echo_main(int argc, char *argv[]);
 extern int free_main(int argc, char *argv[]);
 extern int head_main(int argc, char *argv[]);
 extern int hostname_main(int argc, char *argv[]);
+extern int iostat_main(int argc, char *argv[]);
 extern int kill_main(int argc, char *argv[]);
 extern int ls_main(int argc, char *argv[]);
 extern int mkdir_main(int argc, char *argv[]);
@@ -90,6 +91,9 @@ const struct cmdentry builtin_cmds[] = {
 #ifdef CONFIG_CMD_HOSTNAME
 	{ "hostname" ,hostname_main   },
 #endif
+#ifdef CONFIG_CMD_IOSTAT
+	{ "iostat"   ,iostat_main     },
+#endif
 #ifdef CONFIG_CMD_KILL
 	{ "kill"     ,kill_main       },
 #endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iostat - report device I/O statistics
+ */
+
+#include <sys/prex.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef CMDBOX
+#define main(argc, argv)	iostat_main(argc, argv)
+#endif
+
+#define MAXDEV	64
+
+static struct devinfo	prev[MAXDEV];
+static int		hz;
+
+static void usage(void);
+
+/*
+ * Find the previous sample of the device.
+ */
+static struct devinfo *
+lookup(struct devinfo *info, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (prev[i].id == info->id)
+			return &prev[i];
+	}
+	return NULL;
+}
+
+/*
+ * Print the I/O since the previous sample, or since boot if
+ * "msec" is 0.  Returns the number of devices sampled.
+ */
+static int
+report(int nprev, u_long msec)
+{
+	struct devinfo info, zero, *p;
+	u_long nops, rkb, wkb, ticks;
+	int n = 0;
+
+	memset(&zero, 0, sizeof(zero));
+	printf("device       reads   writes   read KB  write KB  msec/op");
+	printf(msec ? "     KB/s\n" : "\n");
+
+	info.cookie = 0;
+	while (sys_info(INFO_DEVICE, &info) == 0) {
+		if (msec == 0 || (p = lookup(&info, nprev)) == NULL)
+			p = &zero;
+		nops = (info.nread - p->nread) + (info.nwrite - p->nwrite);
+		if (nops != 0) {
+			rkb = (info.rbytes - p->rbytes) / 1024;
+			wkb = (info.wbytes - p->wbytes) / 1024;
+			ticks = info.ticks - p->ticks;
+			printf("%-10s %7lu  %7lu  %8lu  %8lu  %7lu",
+			       info.name, info.nread - p->nread,
+			       info.nwrite - p->nwrite, rkb, wkb,
+			       ticks * 1000 / hz / nops);
+			if (msec)
+				printf("  %7lu", (rkb + wkb) * 1000 / msec);
+			printf("\n");
+		}
+		if (n < MAXDEV)
+			prev[n++] = info;
+	}
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timerinfo tinfo;
+	int ch, n, interval = 0;
+
+	while ((ch = getopt(argc, argv, "")) != -1)
+		switch(ch) {
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		usage();
+	if (argc == 1 && (interval = atoi(*argv)) <= 0)
+		usage();
+
+	sys_info(INFO_TIMER, &tinfo);
+	if ((hz = tinfo.hz) == 0)
+		hz = 1000;
+
+	/* Totals since boot */
+	n = report(0, 0);
+
+	while (interval > 0) {
+		sleep((u_int)interval);
+		printf("\n");
+		n = report(n, (u_long)interval * 1000);
+	}
+	exit(0);
+	/* NOTREACHED */
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: iostat [interval]\n");
+	exit(1);
+}
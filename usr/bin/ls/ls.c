@@ -265,7 +265,7 @@ do_ls(char *path)
 
 	if (S_ISDIR(st.st_mode)) {
 
-		dir = opendir(path);
+		dir = __opendir2(path, DTF_STAT);
 		if (dir == NULL)
 			return ENOTDIR;
 
@@ -276,6 +276,12 @@ do_ls(char *path)
 			if (entry == NULL)
 				break;
 
+			/* Use the stat read with the entry if we have it. */
+			if (DIRENT_STAT(entry)->st_mode != 0) {
+				printentry(entry->d_name, DIRENT_STAT(entry));
+				nr_file++;
+				continue;
+			}
 			buf[0] = 0;
 			strlcpy(buf, path, sizeof(buf));
 			buf[sizeof(buf) - 1] = '\0';
@@ -46,12 +46,21 @@ typedef void *	DIR;
 
 struct _dirdesc {
 	int	dd_fd;		/* file descriptor associated with directory */
-	struct dirent dd_ent;
+	int	dd_flags;	/* flags for readdir */
+	long	dd_loc;		/* offset in current buffer */
+	long	dd_size;	/* amount of data in buffer */
+	long	dd_len;		/* size of data buffer */
+	char	*dd_buf;	/* data buffer */
 };
 typedef struct _dirdesc DIR;
 
 #define	dirfd(dirp)	((dirp)->dd_fd)
 
+/* flags for __opendir2 */
+#define	DTF_STAT	0x0001	/* read the stat of each entry with it */
+
+#define	DIRBLKSIZ	2048	/* size of directory buffer */
+
 #ifndef NULL
 #define	NULL	0
 #endif
@@ -67,8 +76,10 @@ void rewinddir(DIR *);
 int closedir(DIR *);
 
 #ifndef _POSIX_SOURCE
+DIR *__opendir2(const char *, int);
 long telldir(const DIR *);
 void seekdir(DIR *, long);
+int getdirentries(int, char *, int, long *);
 #endif /* not POSIX */
 __END_DECLS
 
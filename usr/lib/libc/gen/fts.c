@@ -46,7 +46,7 @@ static size_t	 fts_maxarglen(char * const *);
 static void	 fts_padjust(FTS *, void *);
 static int	 fts_palloc(FTS *, size_t);
 static FTSENT	*fts_sort(FTS *, FTSENT *, int);
-static u_short	 fts_stat(FTS *, FTSENT *, int);
+static u_short	 fts_stat(FTS *, FTSENT *, int, struct stat *);
 
 
 #define ALIGNBYTES 7
@@ -116,7 +116,7 @@ fts_open(char * const *argv, int options,
 		p->fts_level = FTS_ROOTLEVEL;
 		p->fts_parent = parent;
 		p->fts_accpath = p->fts_name;
-		p->fts_info = fts_stat(sp, p, ISSET(FTS_COMFOLLOW));
+		p->fts_info = fts_stat(sp, p, ISSET(FTS_COMFOLLOW), NULL);
 
 		/* Command-line "." and ".." are real directories. */
 		if (p->fts_info == FTS_DOT)
@@ -268,7 +268,7 @@ fts_read(FTS *sp)
 
 	/* Any type of file may be re-visited; re-stat and re-turn. */
 	if (instr == FTS_AGAIN) {
-		p->fts_info = fts_stat(sp, p, 0);
+		p->fts_info = fts_stat(sp, p, 0, NULL);
 		return (p);
 	}
 
@@ -280,7 +280,7 @@ fts_read(FTS *sp)
 	 */
 	if (instr == FTS_FOLLOW &&
 	    (p->fts_info == FTS_SL || p->fts_info == FTS_SLNONE)) {
-		p->fts_info = fts_stat(sp, p, 1);
+		p->fts_info = fts_stat(sp, p, 1, NULL);
 		if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
 			if ((p->fts_symfd = open(".", O_RDONLY, 0)) < 0) {
 				p->fts_errno = errno;
@@ -369,7 +369,7 @@ next:	tmp = p;
 		if (p->fts_instr == FTS_SKIP)
 			goto next;
 		if (p->fts_instr == FTS_FOLLOW) {
-			p->fts_info = fts_stat(sp, p, 1);
+			p->fts_info = fts_stat(sp, p, 1, NULL);
 			if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
 				if ((p->fts_symfd =
 				    open(".", O_RDONLY, 0)) < 0) {
@@ -542,9 +542,7 @@ fts_build(FTS *sp, int type)
 	DIR *dirp;
 	void *adjaddr;
 	int cderrno, descend, len, level, maxlen, nlinks, saved_errno;
-#ifdef FTS_WHITEOUT
 	int oflag;
-#endif
 	char *cp = NULL;	/* pacify gcc */
 
 	/* Set current node pointer. */
@@ -560,7 +558,14 @@ fts_build(FTS *sp, int type)
 	else
 		oflag = DTF_HIDEW|DTF_NODUP|DTF_REWIND;
 #else
-#define __opendir2(path, flag) opendir(path)
+	/*
+	 * Ask for the stat of each entry with the directory
+	 * entries if we are going to stat them anyway.
+	 */
+	if (type == BNAMES || (ISSET(FTS_NOSTAT) && ISSET(FTS_PHYSICAL)))
+		oflag = 0;
+	else
+		oflag = DTF_STAT;
 #endif
 	if ((dirp = __opendir2(cur->fts_accpath, oflag)) == NULL) {
 		if (type == BREAD) {
@@ -697,7 +702,8 @@ mem1:				saved_errno = errno;
 			} else
 				p->fts_accpath = p->fts_name;
 			/* Stat it. */
-			p->fts_info = fts_stat(sp, p, 0);
+			p->fts_info = fts_stat(sp, p, 0,
+			    (dirp->dd_flags & DTF_STAT) ? DIRENT_STAT(dp) : NULL);
 
 			/* Decrement link count if applicable. */
 			if (nlinks > 0 && (p->fts_info == FTS_D ||
@@ -763,7 +769,7 @@ mem1:				saved_errno = errno;
 }
 
 static u_short
-fts_stat(FTS *sp, FTSENT *p, int follow)
+fts_stat(FTS *sp, FTSENT *p, int follow, struct stat *dsbp)
 {
 	FTSENT *t;
 	dev_t dev;
@@ -800,6 +806,9 @@ fts_stat(FTS *sp, FTSENT *p, int follow)
 			p->fts_errno = saved_errno;
 			goto err;
 		}
+	} else if (dsbp != NULL && dsbp->st_mode != 0) {
+		/* Use the stat returned with the directory entry. */
+		memcpy(sbp, dsbp, sizeof(struct stat));
 	} else if (lstat(p->fts_accpath, sbp)) {
 		p->fts_errno = errno;
 err:		memset(sbp, 0, sizeof(struct stat));
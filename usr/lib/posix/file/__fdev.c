@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * __fdev.c - direct device handles.
+ */
+
+/*
+ * A task holding CAP_RAWIO may drive a character device opened
+ * through devfs without a round trip to the file system server.
+ * The server still resolves the path and checks the access
+ * rights at open time, and then hands out the kernel handle of
+ * the device.  read(), write() and ioctl() use this handle to
+ * call the driver directly.
+ *
+ * The state of a descriptor is learned when it is opened, or on
+ * its first use if it was inherited or duplicated.  Since the
+ * character devices do not use the file offset, the handle can
+ * be shared with the server and other tasks without any further
+ * synchronization.
+ */
+
+#include <sys/prex.h>
+#include <sys/posix.h>
+#include <ipc/fs.h>
+
+#include <limits.h>
+
+#define FDEV_UNKNOWN	0		/* not asked yet */
+#define FDEV_NONE	1		/* use file system server */
+#define FDEV_DIRECT	2		/* use device handle */
+
+struct fdev {
+	device_t	dev;		/* device handle */
+	int		state;		/* FDEV_* */
+	int		flags;		/* FREAD/FWRITE */
+};
+
+static struct fdev fdev_table[OPEN_MAX];
+
+/*
+ * Set the device handle of the file descriptor.
+ * NODEV is set for a file which is not a device.
+ */
+void
+__fdev_set(int fd, device_t dev, int flags)
+{
+	struct fdev *fdp;
+
+	if (fd < 0 || fd >= OPEN_MAX)
+		return;
+	fdp = &fdev_table[fd];
+	fdp->dev = dev;
+	fdp->flags = flags;
+	fdp->state = (dev == NODEV) ? FDEV_NONE : FDEV_DIRECT;
+}
+
+/*
+ * Forget the state of the closed file descriptor.
+ */
+void
+__fdev_clear(int fd)
+{
+
+	if (fd < 0 || fd >= OPEN_MAX)
+		return;
+	fdev_table[fd].state = FDEV_UNKNOWN;
+}
+
+/*
+ * Return the device handle to use for the access type, or
+ * NODEV if the request must be sent to the file system server.
+ */
+device_t
+__fdev_lookup(int fd, int acc)
+{
+	struct fdev *fdp;
+	struct device_msg m;
+
+	if (fd < 0 || fd >= OPEN_MAX)
+		return NODEV;
+	fdp = &fdev_table[fd];
+
+	if (fdp->state == FDEV_UNKNOWN) {
+		m.hdr.code = FS_DEVICE;
+		m.fd = fd;
+		if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+			return NODEV;
+		__fdev_set(fd, m.dev, m.flags);
+	}
+	if (fdp->state != FDEV_DIRECT || (fdp->flags & acc) != acc)
+		return NODEV;
+	return fdp->dev;
+}
@@ -44,6 +44,7 @@ closedir(DIR *dir)
 	m.data[0] = dir->dd_fd;
 	if (__posix_call(__fs_obj, &m, sizeof(m), 0) != 0)
 		return -1;
+	free(dir->dd_buf);
 	free(dir);
 	return 0;
 }
@@ -43,7 +43,8 @@ ioctl(int fd, unsigned long cmd, ...)
 	char *argp;
 	va_list args;
 	size_t size;
-	int retval = 0;
+	device_t dev;
+	int error, retval = 0;
 
 	va_start(args, cmd);
 	argp = va_arg(args, char *);
@@ -77,11 +78,18 @@ ioctl(int fd, unsigned long cmd, ...)
 			memcpy(&m.buf, argp, size);
 	}
 
-	m.hdr.code = FS_IOCTL;
-	m.fd = fd;
-	m.request = cmd;
-	if (__posix_call(__fs_obj, &m, sizeof(m), 0) != 0)
-		return -1;
+	if ((dev = __fdev_lookup(fd, 0)) != NODEV) {
+		if ((error = device_ioctl(dev, cmd, m.buf)) != 0) {
+			errno = error;
+			return -1;
+		}
+	} else {
+		m.hdr.code = FS_IOCTL;
+		m.fd = fd;
+		m.request = cmd;
+		if (__posix_call(__fs_obj, &m, sizeof(m), 0) != 0)
+			return -1;
+	}
 
 	/*
 	 * Copy out
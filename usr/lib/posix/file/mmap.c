@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/prex.h>
+#include <sys/posix.h>
+#include <sys/mman.h>
+#include <ipc/fs.h>
+
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Map a file through the file system server.  A private
+ * writable mapping is made by copying the shared pages to
+ * anonymous memory.
+ */
+void *
+mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	struct mmap_msg m;
+	void *copy;
+	int anywhere;
+
+	anywhere = (flags & MAP_FIXED) ? 0 : 1;
+	if (flags & MAP_ANON) {
+		if (vm_allocate(task_self(), &addr, len, anywhere) != 0) {
+			errno = ENOMEM;
+			return MAP_FAILED;
+		}
+		return addr;
+	}
+
+	m.hdr.code = FS_MMAP;
+	m.task = 0;
+	m.fd = fd;
+	m.addr = addr;
+	m.len = len;
+	m.prot = prot;
+	m.flags = flags;
+	m.off = off;
+	if (!(flags & MAP_PRIVATE) || !(prot & PROT_WRITE)) {
+		if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+			return MAP_FAILED;
+		return m.addr;
+	}
+
+	m.addr = NULL;
+	m.prot = PROT_READ;
+	m.flags &= ~MAP_FIXED;
+	if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+		return MAP_FAILED;
+	copy = addr;
+	if (vm_allocate(task_self(), &copy, len, anywhere) != 0) {
+		munmap(m.addr, len);
+		errno = ENOMEM;
+		return MAP_FAILED;
+	}
+	memcpy(copy, m.addr, len);
+	munmap(m.addr, len);
+	return copy;
+}
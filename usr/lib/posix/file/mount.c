@@ -46,6 +46,8 @@ mount(const char *dev, const char *dir, const char *fs, int flags,
 	strlcpy(m.fs, (char *)fs, 16);
 	if (data != NULL)
 		strlcpy(m.data, (char *)data, 64);
+	else
+		m.data[0] = '\0';
 	m.flags = flags;
 	m.hdr.code = FS_MOUNT;
 	return __posix_call(__fs_obj, &m, sizeof(m), 1);
@@ -38,18 +38,36 @@
 #include <dirent.h>
 
 DIR *
-opendir(const char *name)
+__opendir2(const char *name, int flags)
 {
 	struct open_msg m;
 	struct _dirdesc *dir;
 
 	if ((dir = malloc(sizeof(struct _dirdesc))) == NULL)
 		return NULL;
+	if ((dir->dd_buf = malloc(DIRBLKSIZ)) == NULL) {
+		free(dir);
+		return NULL;
+	}
 
 	m.hdr.code = FS_OPENDIR;
 	strlcpy(m.path, (char *)name, PATH_MAX);
-	if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+	if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0) {
+		free(dir->dd_buf);
+		free(dir);
 		return NULL;
+	}
 	dir->dd_fd = m.fd;
+	dir->dd_flags = flags;
+	dir->dd_loc = 0;
+	dir->dd_size = 0;
+	dir->dd_len = DIRBLKSIZ;
 	return dir;
 }
+
+DIR *
+opendir(const char *name)
+{
+
+	return __opendir2(name, 0);
+}
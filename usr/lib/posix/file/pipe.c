@@ -42,5 +42,7 @@ pipe(int fd[2])
 		return -1;
 	fd[0] = m.data[0];
 	fd[1] = m.data[1];
+	__fdev_set(fd[0], NODEV, 0);
+	__fdev_set(fd[1], NODEV, 0);
 	return 0;
 }
@@ -38,6 +38,16 @@ int
 read(int fd, void *buf, size_t len)
 {
 	struct io_msg m;
+	device_t dev;
+	int error;
+
+	if ((dev = __fdev_lookup(fd, FREAD)) != NODEV) {
+		if ((error = device_read(dev, buf, &len, 0)) != 0) {
+			errno = error;
+			return -1;
+		}
+		return (int)len;
+	}
 
 	m.hdr.code = FS_READ;
 	m.fd = fd;
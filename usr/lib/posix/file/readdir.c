@@ -36,16 +36,30 @@
 #include <string.h>
 #include <errno.h>
 
+/*
+ * The entries are read into the directory buffer in bulk,
+ * so that one request is sent for many entries.
+ */
 struct dirent *
 readdir(DIR *dir)
 {
-	struct dir_msg m;
-	struct dirent *entry = &dir->dd_ent;
+	struct dirents_msg m;
+	struct dirent *dp;
 
-	m.hdr.code = FS_READDIR;
-	m.fd = dir->dd_fd;
-	if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
-		return NULL;
-	memcpy(entry, &m.dirent, sizeof(struct dirent));
-	return &dir->dd_ent;
+	if (dir->dd_loc >= dir->dd_size) {
+		m.hdr.code = FS_GETDIRENTRIES;
+		m.fd = dir->dd_fd;
+		m.buf = dir->dd_buf;
+		m.size = (size_t)dir->dd_len;
+		m.flags = (dir->dd_flags & DTF_STAT) ? DIRENTS_STAT : 0;
+		if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+			return NULL;
+		if (m.size == 0)
+			return NULL;
+		dir->dd_loc = 0;
+		dir->dd_size = (long)m.size;
+	}
+	dp = (struct dirent *)(dir->dd_buf + dir->dd_loc);
+	dir->dd_loc += dp->d_reclen;
+	return dp;
 }
@@ -43,6 +43,8 @@ rewinddir(DIR *dir)
 	m.hdr.code = FS_REWINDDIR;
 	m.data[0] = dir->dd_fd;
 	__posix_call(__fs_obj, &m, sizeof(m), 1);
+	dir->dd_loc = 0;
+	dir->dd_size = 0;
 
 	/*
 	 * XXX: rewinddir() does not return error. But, we may get error...
@@ -32,11 +32,22 @@
 #include <ipc/fs.h>
 
 #include <stddef.h>
+#include <errno.h>
 
 int
 write(int fd, void *buf, size_t len)
 {
 	struct io_msg m;
+	device_t dev;
+	int error;
+
+	if ((dev = __fdev_lookup(fd, FWRITE)) != NODEV) {
+		if ((error = device_write(dev, buf, &len, 0)) != 0) {
+			errno = error;
+			return -1;
+		}
+		return (int)len;
+	}
 
 	m.hdr.code = FS_WRITE;
 	m.fd = fd;
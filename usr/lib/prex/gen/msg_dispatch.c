@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * msg_dispatch.c - direct-indexed message dispatch for servers.
+ */
+
+#include <sys/prex.h>
+#include <ipc/ipc.h>
+#include <ipc/dispatch.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Convert a message code to the slot index.
+ * Returns -1 if the code does not belong to this table.
+ */
+static int
+code_to_slot(struct msg_dispatch *md, int code)
+{
+	int slot;
+
+	if (code >= 0 && code < STD_NMSG)
+		return code;
+	if (MSG_CLASS(code) != md->md_class)
+		return -1;
+	slot = STD_NMSG + MSG_NUMBER(code);
+	if (slot >= md->md_nslot)
+		return -1;
+	return slot;
+}
+
+static int
+slot_to_code(struct msg_dispatch *md, int slot)
+{
+
+	if (slot < STD_NMSG)
+		return slot;
+	return md->md_class + slot - STD_NMSG;
+}
+
+/*
+ * Return the histogram bucket for the specified ticks.
+ */
+static int
+bucket(u_long ticks)
+{
+	int n = 0;
+
+	while (ticks != 0 && n < MSGSTAT_NBUCKET - 1) {
+		ticks >>= 1;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Initialize the dispatch table for the server which
+ * handles nmsg messages starting at the code 'class'.
+ */
+int
+msg_dispatch_init(struct msg_dispatch *md, int class, int nmsg)
+{
+	int i, nslot;
+
+	nslot = STD_NMSG + nmsg;
+	md->md_index = malloc(sizeof(short) * nslot);
+	md->md_stat = malloc(sizeof(struct msg_stat) * nslot);
+	if (md->md_index == NULL || md->md_stat == NULL)
+		return ENOMEM;
+
+	md->md_class = MSG_CLASS(class);
+	md->md_nslot = nslot;
+	for (i = 0; i < nslot; i++)
+		md->md_index[i] = -1;
+	memset(md->md_stat, 0, sizeof(struct msg_stat) * nslot);
+	return 0;
+}
+
+/*
+ * Bind the message code to the index of the server's map.
+ * Returns EINVAL if the code is out of the table, or EEXIST
+ * if the code is bound already.
+ */
+int
+msg_dispatch_add(struct msg_dispatch *md, int code, int index)
+{
+	int slot;
+
+	if ((slot = code_to_slot(md, code)) == -1)
+		return EINVAL;
+	if (md->md_index[slot] != -1)
+		return EEXIST;
+	md->md_index[slot] = (short)index;
+	return 0;
+}
+
+/*
+ * Find the slot for the message code.
+ * Returns -1 if no handler is registered for the code.
+ */
+int
+msg_dispatch_slot(struct msg_dispatch *md, int code)
+{
+	int slot;
+
+	if ((slot = code_to_slot(md, code)) == -1)
+		return -1;
+	if (md->md_index[slot] == -1)
+		return -1;
+	return slot;
+}
+
+/*
+ * Account one request.
+ *
+ * 'sent' is the send time stamped by the kernel, and 'start'
+ * is the time when the server started to handle the request.
+ * The statistics are updated without locking, so that a few
+ * counts may be lost when multiple threads race.
+ */
+void
+msg_dispatch_account(struct msg_dispatch *md, int slot, u_long sent,
+		     u_long start, int error)
+{
+	struct msg_stat *ms;
+	u_long now, wait, service;
+
+	sys_time(&now);
+	wait = start - sent;
+	service = now - start;
+
+	ms = &md->md_stat[slot];
+	ms->count++;
+	if (error)
+		ms->errors++;
+	ms->wait += wait;
+	ms->service += service;
+	ms->wait_hist[bucket(wait)]++;
+	ms->service_hist[bucket(service)]++;
+}
+
+/*
+ * Handle STD_MSGSTAT request.
+ *
+ * Returns the statistics for the first used slot at or
+ * after the requested index.
+ */
+int
+msg_dispatch_getstat(struct msg_dispatch *md, struct msgstat_msg *msg)
+{
+	int slot;
+
+	for (slot = msg->index; slot >= 0 && slot < md->md_nslot; slot++) {
+		if (md->md_index[slot] != -1) {
+			msg->index = slot;
+			msg->code = slot_to_code(md, slot);
+			msg->stat = md->md_stat[slot];
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+/*
+ * Dump the statistics.
+ */
+void
+msg_dispatch_dump(struct msg_dispatch *md)
+{
+	struct msg_stat *ms;
+	int slot;
+
+	dprintf(" code     count    errors  avg wait  avg serv\n");
+	dprintf(" -------- -------- -------- --------- ---------\n");
+	for (slot = 0; slot < md->md_nslot; slot++) {
+		ms = &md->md_stat[slot];
+		if (md->md_index[slot] == -1 || ms->count == 0)
+			continue;
+		dprintf(" %08x %8lu %8lu %9lu %9lu\n", slot_to_code(md, slot),
+			ms->count, ms->errors, ms->wait / ms->count,
+			ms->service / ms->count);
+	}
+}
@@ -94,5 +94,6 @@
 #define SYS_sys_info		57
 #define SYS_sys_time		58
 #define SYS_sys_debug		59
+#define SYS_vm_share		60
 
 #endif /* _SYSCALL_H */
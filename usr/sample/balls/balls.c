@@ -32,6 +32,7 @@
  */
 
 #include <sys/prex.h>
+#include <sys/ioctl.h>
 
 #include <termios.h>
 #include <stdio.h>
@@ -43,6 +44,10 @@
 /* Screen size */
 static int max_x;
 static int max_y;
+static int cols;
+
+/* Text screen mapped from the video device, if we have one */
+static u_short *vram;
 
 static char stack[NBALLS][STACKLEN];
 
@@ -60,6 +65,19 @@ thread_run(void (*start)(void), char *stack)
 	return t;
 }
 
+/*
+ * Draw a character on the screen.
+ */
+static void
+draw(int x, int y, int c)
+{
+
+	if (vram != NULL)
+		vram[y * cols + x] = (u_short)(c | 0x0f00);
+	else
+		printf("\33[%d;%dH%c", y, x, c);
+}
+
 /*
  * A thread to move one ball.
  */
@@ -81,10 +99,10 @@ move_ball(void)
 
 	for (;;) {
 		/* Erase ball at old position */
-		printf("\33[%d;%dH ", old_y / 10, old_x / 10);
+		draw(old_x / 10, old_y / 10, ' ');
 
 		/* Print ball at new position */
-		printf("\33[%d;%dH*", y / 10, x / 10);
+		draw(x / 10, y / 10, '*');
 
 		/* Wait msec */
 		timer_sleep(wait_msec, 0);
@@ -106,8 +124,9 @@ int
 main(int argc, char *argv[])
 {
 	struct winsize ws;
-	int rows, cols, i;
-	device_t cons;
+	struct devmap dm;
+	int rows, i;
+	device_t cons, vga;
 
 	/* Get screen size */
 	device_open("tty", 0, &cons);
@@ -127,6 +146,18 @@ main(int argc, char *argv[])
 	/* Clear screen */
 	printf("\33[2J");
 
+	/*
+	 * Draw into the video memory directly if we can map it.
+	 * The device stays open while we use the mapping.
+	 */
+	if (device_open("vga", 0, &vga) == 0) {
+		dm.dm_prot = PROT_READ | PROT_WRITE;
+		if (device_ioctl(vga, DMIOC_MAP, &dm) == 0)
+			vram = dm.dm_addr;
+		else
+			device_close(vga);
+	}
+
 	/* Create threads and run them. */
 	for (i = 0; i < NBALLS; i++) {
 		if (thread_run(move_ball, stack[i]+STACKLEN) == 0)
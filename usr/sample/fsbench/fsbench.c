@@ -0,0 +1,560 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * fsbench.c - file system benchmark suite
+ */
+
+/*
+ * fsbench runs a fixed set of workloads against one or more
+ * mounted file systems and writes the results as comma separated
+ * lines, one line per measurement:
+ *
+ *   target,test,bsize,ops,bytes,msec,kbps,usop
+ *
+ * Each target is given as "label:directory".  If the directory
+ * is not writable (e.g. arfs), only the read-only workloads are
+ * run against the largest regular file found in it.
+ *
+ * All random offsets come from a fixed-seed generator so that
+ * every run issues exactly the same requests.  Times are taken
+ * from the kernel tick counter, so the resolution is 1/HZ.
+ */
+
+#include <sys/prex.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define DEF_SIZE	1024		/* file size for data tests (KB) */
+#define DEF_FILES	1000		/* files for metadata tests */
+#define DEF_EXECS	100		/* iterations of execve test */
+#define DEF_PIPE	4096		/* bytes through the pipe (KB) */
+#define MAX_RANDOPS	1024		/* max random I/Os per test */
+#define NR_LISTS	4		/* passes over the directory */
+#define MAXBUF		32768
+#define MAXARGS		32
+
+#define BENCH_FILE	"FSBENCH.DAT"
+#define BENCH_DIR	"FSBDIR"
+#define DEF_SELF	"/boot/fsbench"
+
+static const size_t bsizes[] = { 512, 4096, 32768, 0 };
+
+static FILE *out;		/* result file */
+static u_long hz;		/* ticks per second */
+static u_long seed;		/* random seed */
+static char *buf;		/* I/O buffer */
+static const char *label;	/* current target */
+static const char *self = DEF_SELF;
+static size_t filesize = DEF_SIZE * 1024;
+static int nfiles = DEF_FILES;
+static int nexecs = DEF_EXECS;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: fsbench [-N] [-o file] [-s kbytes] [-n files] "
+	    "[-x execs]\n"
+	    "               [-e path] label:dir ...\n"
+	    "       fsbench -a runfile\n");
+	exit(1);
+	/* NOTREACHED */
+}
+
+static void
+fail(const char *msg)
+{
+
+	perror(msg);
+	exit(1);
+	/* NOTREACHED */
+}
+
+static u_long
+ticks(void)
+{
+	u_long t;
+
+	sys_time(&t);
+	return t;
+}
+
+/*
+ * Park-Miller generator.  Reseeded before every random test
+ * so that each test sees the same offset sequence.
+ */
+static u_long
+nextrand(void)
+{
+
+	seed = (seed * 16807) % 2147483647;
+	return seed;
+}
+
+static void
+report(const char *test, size_t bsize, u_long ops, u_long bytes,
+       u_long start)
+{
+	u_long msec, kbps, usop;
+
+	msec = (ticks() - start) * 1000 / hz;
+	kbps = msec ? (bytes / 1024) * 1000 / msec : 0;
+	usop = ops ? msec * 1000 / ops : 0;
+
+	fprintf(out, "%s,%s,%u,%lu,%lu,%lu,%lu,%lu\n", label, test,
+		(u_int)bsize, ops, bytes, msec, kbps, usop);
+	fflush(out);
+	if (out != stdout)
+		printf("%-10s %-10s %6u %7lu ops %6lu ms %7lu KB/s %7lu us/op\n",
+		       label, test, (u_int)bsize, ops, msec, kbps, usop);
+}
+
+static void
+seq_write(const char *path, size_t bsize)
+{
+	u_long start, nbytes;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+		fail(path);
+
+	start = ticks();
+	for (nbytes = 0; nbytes < filesize; nbytes += bsize) {
+		if (write(fd, buf, bsize) != (ssize_t)bsize)
+			fail("write");
+	}
+	fsync(fd);
+	close(fd);
+	report("seqwrite", bsize, filesize / bsize, nbytes, start);
+}
+
+static void
+seq_read(const char *path, size_t bsize)
+{
+	u_long start, nbytes, nops;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		fail(path);
+
+	nbytes = nops = 0;
+	start = ticks();
+	while ((n = read(fd, buf, bsize)) > 0) {
+		nbytes += n;
+		nops++;
+	}
+	if (n == -1)
+		fail("read");
+	close(fd);
+	report("seqread", bsize, nops, nbytes, start);
+}
+
+static void
+rand_io(const char *path, size_t size, size_t bsize, int writing)
+{
+	u_long start, nblocks, nops, i;
+	off_t off;
+	ssize_t n;
+	int fd;
+
+	if ((nblocks = size / bsize) == 0)
+		return;
+	nops = nblocks;
+	if (nops > MAX_RANDOPS)
+		nops = MAX_RANDOPS;
+
+	if ((fd = open(path, writing ? O_RDWR : O_RDONLY)) == -1)
+		fail(path);
+
+	seed = 1;
+	start = ticks();
+	for (i = 0; i < nops; i++) {
+		off = (off_t)(nextrand() % nblocks) * bsize;
+		if (lseek(fd, off, SEEK_SET) == -1)
+			fail("lseek");
+		if (writing)
+			n = write(fd, buf, bsize);
+		else
+			n = read(fd, buf, bsize);
+		if (n != (ssize_t)bsize)
+			fail(writing ? "write" : "read");
+	}
+	if (writing)
+		fsync(fd);
+	close(fd);
+	report(writing ? "randwrite" : "randread", bsize, nops,
+	       nops * bsize, start);
+}
+
+static void
+list_dir(const char *dir)
+{
+	struct dirent *dp;
+	u_long start, nents;
+	DIR *dirp;
+	int i;
+
+	nents = 0;
+	start = ticks();
+	for (i = 0; i < NR_LISTS; i++) {
+		if ((dirp = opendir(dir)) == NULL)
+			fail(dir);
+		while ((dp = readdir(dirp)) != NULL)
+			nents++;
+		closedir(dirp);
+	}
+	report("readdir", 0, nents, 0, start);
+}
+
+/*
+ * Metadata storm: create, stat, list and unlink a large
+ * number of empty files in a private directory.  Names are
+ * kept within 8.3 for the benefit of fatfs.
+ */
+static void
+meta_storm(const char *base)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	struct stat st;
+	u_long start;
+	int i, fd;
+
+	snprintf(dir, sizeof(dir), "%s/%s", base, BENCH_DIR);
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		fail(dir);
+
+	start = ticks();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/F%05d", dir, i);
+		if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+			fail(path);
+		close(fd);
+	}
+	report("create", 0, nfiles, 0, start);
+
+	start = ticks();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/F%05d", dir, i);
+		if (stat(path, &st) == -1)
+			fail(path);
+	}
+	report("stat", 0, nfiles, 0, start);
+
+	list_dir(dir);
+
+	start = ticks();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/F%05d", dir, i);
+		if (unlink(path) == -1)
+			fail(path);
+	}
+	report("unlink", 0, nfiles, 0, start);
+
+	rmdir(dir);
+}
+
+/*
+ * Find the largest regular file in a read-only directory.
+ */
+static int
+find_file(const char *dir, char *path, size_t len, size_t *size)
+{
+	char name[PATH_MAX];
+	struct dirent *dp;
+	struct stat st;
+	DIR *dirp;
+
+	*size = 0;
+	if ((dirp = opendir(dir)) == NULL)
+		return -1;
+	while ((dp = readdir(dirp)) != NULL) {
+		snprintf(name, sizeof(name), "%s/%s", dir, dp->d_name);
+		if (stat(name, &st) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if ((size_t)st.st_size > *size) {
+			*size = (size_t)st.st_size;
+			strlcpy(path, name, len);
+		}
+	}
+	closedir(dirp);
+	return *size ? 0 : -1;
+}
+
+static void
+run_target(char *arg)
+{
+	char path[PATH_MAX];
+	char *dir;
+	size_t size;
+	int i, fd;
+
+	if ((dir = strchr(arg, ':')) == NULL)
+		usage();
+	*dir++ = '\0';
+	label = arg;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, BENCH_FILE);
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) != -1) {
+		close(fd);
+		for (i = 0; bsizes[i] != 0; i++) {
+			seq_write(path, bsizes[i]);
+			seq_read(path, bsizes[i]);
+			rand_io(path, filesize, bsizes[i], 1);
+			rand_io(path, filesize, bsizes[i], 0);
+		}
+		unlink(path);
+		meta_storm(dir);
+		return;
+	}
+
+	/* Read-only file system */
+	if (find_file(dir, path, sizeof(path), &size) == -1) {
+		fprintf(stderr, "fsbench: no file to read in %s\n", dir);
+		return;
+	}
+	for (i = 0; bsizes[i] != 0; i++) {
+		seq_read(path, bsizes[i]);
+		rand_io(path, size, bsizes[i], 0);
+	}
+	list_dir(dir);
+}
+
+/*
+ * Pipe throughput.  The writer is a fresh image of this
+ * program so that the test also works with vfork on no-MMU
+ * systems, where the parent sleeps until the child execs.
+ */
+static void
+run_pipe(void)
+{
+	char nbytes[16], bsize[16];
+	u_long start, total;
+	ssize_t n;
+	int fd[2], i, status;
+
+	label = "pipe";
+	for (i = 0; bsizes[i] != 0; i++) {
+		snprintf(nbytes, sizeof(nbytes), "%u", DEF_PIPE * 1024);
+		snprintf(bsize, sizeof(bsize), "%u", (u_int)bsizes[i]);
+		if (pipe(fd) == -1)
+			fail("pipe");
+
+		start = ticks();
+		switch (vfork()) {
+		case -1:
+			fail("vfork");
+			break;
+		case 0:
+			dup2(fd[1], STDOUT_FILENO);
+			close(fd[0]);
+			close(fd[1]);
+			execl(self, "fsbench", "-P", nbytes, bsize, NULL);
+			_exit(1);
+			/* NOTREACHED */
+		}
+		close(fd[1]);
+		total = 0;
+		while ((n = read(fd[0], buf, bsizes[i])) > 0)
+			total += n;
+		close(fd[0]);
+		wait(&status);
+		report("pipe", bsizes[i], total / bsizes[i], total, start);
+	}
+}
+
+static void
+pipe_writer(size_t nbytes, size_t bsize)
+{
+	size_t done;
+
+	if (bsize == 0 || bsize > MAXBUF)
+		exit(1);
+	for (done = 0; done < nbytes; done += bsize) {
+		if (write(STDOUT_FILENO, buf, bsize) != (ssize_t)bsize)
+			exit(1);
+	}
+	exit(0);
+}
+
+/*
+ * execve latency: spawn a trivial image of this program
+ * and wait for it to exit.
+ */
+static void
+run_exec(void)
+{
+	u_long start;
+	int i, status;
+
+	label = "exec";
+	start = ticks();
+	for (i = 0; i < nexecs; i++) {
+		switch (vfork()) {
+		case -1:
+			fail("vfork");
+			break;
+		case 0:
+			execl(self, "fsbench", "-Z", NULL);
+			_exit(1);
+			/* NOTREACHED */
+		}
+		if (wait(&status) == -1 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "fsbench: exec of %s failed\n", self);
+			return;
+		}
+	}
+	report("execve", 0, nexecs, 0, start);
+}
+
+/*
+ * Automatic mode for unattended runs: if the run file exists,
+ * its first line holds the arguments for the real run.  The
+ * file is removed before the run starts so that a crash does
+ * not lead to a boot loop.
+ */
+static void
+auto_run(const char *runfile)
+{
+	char line[256];
+	char *args[MAXARGS + 2];
+	char *p;
+	FILE *fp;
+	int n;
+
+	if ((fp = fopen(runfile, "r")) == NULL)
+		exit(0);
+	p = fgets(line, sizeof(line), fp);
+	fclose(fp);
+	unlink(runfile);
+	sync();
+	if (p == NULL)
+		exit(0);
+
+	n = 0;
+	args[n++] = "fsbench";
+	for (p = strtok(line, " \t\r\n"); p != NULL && n <= MAXARGS;
+	     p = strtok(NULL, " \t\r\n"))
+		args[n++] = p;
+	args[n] = NULL;
+	execv(self, args);
+	fail(self);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timerinfo info;
+	char *outfile = NULL;
+	int ch, i, noproc = 0;
+
+	if ((buf = malloc(MAXBUF)) == NULL)
+		fail("malloc");
+	memset(buf, 0x5a, MAXBUF);
+
+	while ((ch = getopt(argc, argv, "a:e:n:o:s:x:NP:Z")) != -1) {
+		switch (ch) {
+		case 'a':
+			auto_run(optarg);
+			break;
+		case 'e':
+			self = optarg;
+			break;
+		case 'n':
+			nfiles = atoi(optarg);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 's':
+			filesize = (size_t)atoi(optarg) * 1024;
+			break;
+		case 'x':
+			nexecs = atoi(optarg);
+			break;
+		case 'N':
+			noproc = 1;
+			break;
+		case 'P':
+			/* internal: pipe writer */
+			if (optind >= argc)
+				exit(1);
+			pipe_writer((size_t)atoi(optarg),
+				    (size_t)atoi(argv[optind]));
+			break;
+		case 'Z':
+			/* internal: exec target */
+			exit(0);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0 && noproc)
+		usage();
+	if (filesize < MAXBUF || nfiles <= 0 || nexecs <= 0)
+		usage();
+
+	sys_info(INFO_TIMER, &info);
+	if (info.hz == 0)
+		exit(1);
+	hz = (u_long)info.hz;
+
+	out = stdout;
+	if (outfile != NULL && (out = fopen(outfile, "w")) == NULL)
+		fail(outfile);
+	fprintf(out, "# fsbench 1 hz=%lu size=%u files=%d execs=%d\n",
+		hz, (u_int)filesize, nfiles, nexecs);
+	fprintf(out, "# target,test,bsize,ops,bytes,msec,kbps,usop\n");
+
+	for (i = 0; i < argc; i++)
+		run_target(argv[i]);
+	if (!noproc) {
+		run_pipe();
+		run_exec();
+	}
+	if (out != stdout)
+		fclose(out);
+	sync();
+	return 0;
+}
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# fsbench.sh - run the file system benchmark suite under QEMU
+#
+# usage: fsbench.sh [-b baseline.csv] [-t threshold%] [result.csv]
+#
+# Boots fd.img with a scratch FAT16 hard disk that carries a run
+# file for 'fsbench -a'.  fd.img must be built with the rc of the
+# benchmark (make _FSBENCH_=1 fd.img), which runs the suite and
+# reboots the machine.  This ends QEMU because of -no-reboot.
+# The results are copied back from the disk.  If a baseline file
+# is given, every measurement is compared against it and tests
+# that got slower by more than the threshold are listed.
+#
+# Must be run from the top of the source tree; 'make fsbench' does
+# both steps.
+#
+
+QEMU=${QEMU:-qemu-system-i386}
+TIMEOUT=${TIMEOUT:-1800}
+DISK=fsbench.raw
+ARGS=${FSBENCH_ARGS:-"-o /mnt/hdd/RESULTS.CSV ramfs:/tmp fatfs-ata:/mnt/hdd arfs:/boot"}
+
+baseline=
+threshold=10
+while getopts b:t: ch; do
+	case $ch in
+	b)	baseline=$OPTARG ;;
+	t)	threshold=$OPTARG ;;
+	*)	echo "usage: $0 [-b baseline.csv] [-t threshold] [result.csv]"
+		exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+result=${1:-fsbench-$(date +%Y%m%d-%H%M%S).csv}
+
+if [ ! -f fd.img ]; then
+	echo "fsbench: fd.img not found; run 'make _FSBENCH_=1 fd.img' first"
+	exit 1
+fi
+
+#
+# Build a fresh disk every time so that the fatfs numbers do
+# not depend on the history of the image.  The geometry and
+# partition type match hd.raw in the top level Makefile.
+#
+rm -f $DISK
+qemu-img create -q $DISK 20M || exit 1
+printf ",,6\n" | sfdisk -q -C 320 -H 8 -S 16 $DISK >/dev/null 2>&1 || exit 1
+start=$(sfdisk -d $DISK | sed -n 's/.*start= *\([0-9]*\).*/\1/p' | head -n 1)
+size=$(sfdisk -d $DISK | sed -n 's/.*size= *\([0-9]*\).*/\1/p' | head -n 1)
+part="$DISK@@$((start * 512))"
+mformat -i "$part" -T $size -h 8 -s 16 -H $start :: || exit 1
+echo "$ARGS" | mcopy -i "$part" - ::FSBENCH.RUN || exit 1
+
+timeout $TIMEOUT $QEMU -boot order=adc -fda fd.img -hda $DISK \
+	-no-reboot -display none -serial null
+if ! mcopy -n -i "$part" ::RESULTS.CSV "$result" 2>/dev/null; then
+	echo "fsbench: no results (timeout or crash)"
+	exit 1
+fi
+rm -f $DISK
+echo "fsbench: results in $result"
+
+[ -z "$baseline" ] && exit 0
+
+#
+# Compare against the baseline.  Throughput is compared for
+# data tests and time per operation for everything else.
+#
+awk -F, -v thr=$threshold '
+/^#/	{ next }
+NR == FNR { base[$1 "," $2 "," $3] = ($7 > 0) ? $7 : -$8; next }
+{
+	key = $1 "," $2 "," $3
+	if (!(key in base) || base[key] == 0)
+		next
+	cur = ($7 > 0) ? $7 : -$8
+	if (cur > 0)
+		change = (cur - base[key]) * 100 / base[key]
+	else
+		change = (base[key] - cur) * 100 / base[key]
+	flag = (change < -thr) ? "  REGRESSION" : ""
+	if (flag != "")
+		bad++
+	printf("%-10s %-10s %6s %+7.1f%%%s\n", $1, $2, $3, change, flag)
+}
+END	{ exit bad ? 2 : 0 }
+' "$baseline" "$result"
@@ -1,23 +1,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 
 #define LARGE_BUFFER	(1024*1024)
 #define SMALL_BUFFER	1
+#define MAX_CLIENTS	16
+#define SELF		"/boot/fsperf"
+
+static int verbose = 1;
 
 static void usage(void) {
-  fprintf(stderr, "usage: fsperf -n <filename> [ -w <bytecount> | -r | -t | -l ]\n");
+  fprintf(stderr, "usage: fsperf -n <filename> [ -w <bytecount> | -r | -t | -l ] [ -c <clients> ]\n");
   fprintf(stderr, "  -n <filename>   Specifies filename on which to write\n");
   fprintf(stderr, "  -w <bytecount>  Tests write throughput/latency (default; 1MB)\n");
   fprintf(stderr, "  -r              Tests read throughput/latency\n");
   fprintf(stderr, "  -t              Selects throughput mode (default)\n");
   fprintf(stderr, "  -l              Selects latency mode\n");
+  fprintf(stderr, "  -c <clients>    Runs concurrent clients on <filename>.<n>\n");
+  fprintf(stderr, "                  (run write mode first to create files for read)\n");
   exit(1);
 }
 
@@ -48,7 +56,7 @@ static void do_write(char *filename, int throughputmode, size_t bytecount) {
     size_t remaining = bytecount - count_written;
     size_t xferlen = (remaining > buflen) ? buflen : remaining;
     int result;
-    if (throughputmode) {
+    if (throughputmode && verbose) {
       fprintf(stderr, "count_written = %u...\n", count_written);
     }
     result = write(fd, buffer, xferlen);
@@ -99,7 +107,7 @@ static void do_read(char *filename, int throughputmode) {
   starttime = now();
   while (1) {
     int result;
-    if (throughputmode) {
+    if (throughputmode && verbose) {
       fprintf(stderr, "count_read = %u...\n", count_read);
     }
     result = read(fd, buffer, buflen);
@@ -132,14 +140,75 @@ static void do_read(char *filename, int throughputmode) {
   }
 }
 
+/*
+ * Run the test in several processes at once, each on its own
+ * file, and report the total throughput seen by all clients.
+ * Each client is a fresh image of this program, so that the
+ * clients also run at once with vfork on no-MMU systems, where
+ * the parent sleeps until the child execs.
+ */
+static void do_concurrent(char *filename, int writemode, int throughputmode,
+			  size_t bytecount, int clients) {
+  char name[PATH_MAX], count[16];
+  struct stat st;
+  size_t total = 0;
+  double starttime, stoptime;
+  pid_t pid;
+  int i, status;
+
+  snprintf(count, sizeof(count), "%u", (unsigned) bytecount);
+  fflush(NULL);
+  starttime = now();
+  for (i = 0; i < clients; i++) {
+    snprintf(name, sizeof(name), "%s.%d", filename, i);
+    pid = vfork();
+    if (pid == -1) {
+      perror("vfork");
+      exit(1);
+    }
+    if (pid == 0) {
+      if (writemode) {
+	execl(SELF, "fsperf", "-q", "-n", name, "-w", count,
+	      throughputmode ? "-t" : "-l", NULL);
+      } else {
+	execl(SELF, "fsperf", "-q", "-n", name, "-r",
+	      throughputmode ? "-t" : "-l", NULL);
+      }
+      _exit(1);
+    }
+  }
+  for (i = 0; i < clients; i++) {
+    if (wait(&status) == -1 || !WIFEXITED(status) ||
+	WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "client failed\n");
+      exit(1);
+    }
+  }
+  stoptime = now();
+
+  for (i = 0; i < clients; i++) {
+    snprintf(name, sizeof(name), "%s.%d", filename, i);
+    if (stat(name, &st) == 0) {
+      total += st.st_size;
+    }
+  }
+  printf("%d clients %s %u bytes in %u milliseconds = %u bytes/second\n",
+	 clients,
+	 writemode ? "wrote" : "read",
+	 total,
+	 (unsigned) ((stoptime - starttime) * 1000),
+	 (unsigned) (total / (stoptime - starttime)));
+}
+
 int main(int argc, char *argv[]) {
   int ch;
   char *filename = NULL;
   size_t bytecount = 1024*1024;
   int writemode = 1;
   int throughputmode = 1;
+  int clients = 0;
 
-  while ((ch = getopt(argc, argv, "n:w:rtl")) != -1) {
+  while ((ch = getopt(argc, argv, "n:w:rtlc:q")) != -1) {
     switch (ch) {
       case 'n': {
 	filename = strdup(optarg);
@@ -162,6 +231,18 @@ int main(int argc, char *argv[]) {
 	throughputmode = 0;
 	break;
       }
+      case 'q': {
+	/* internal: run as a client of -c */
+	verbose = 0;
+	break;
+      }
+      case 'c': {
+	clients = atoi(optarg);
+	if (clients < 1 || clients > MAX_CLIENTS) {
+	  usage();
+	}
+	break;
+      }
       default:
       case '?':
 	usage();
@@ -172,16 +253,20 @@ int main(int argc, char *argv[]) {
     usage();
   }
 
-  printf("FSperf\n");
-  printf("filename %s\n", filename);
-  printf("%s mode measuring %s\n",
-	 writemode ? "write" : "read",
-	 throughputmode ? "throughput" : "latency");
-  if (writemode) {
-    printf("bytecount %u\n", (unsigned int) bytecount);
+  if (verbose) {
+    printf("FSperf\n");
+    printf("filename %s\n", filename);
+    printf("%s mode measuring %s\n",
+	   writemode ? "write" : "read",
+	   throughputmode ? "throughput" : "latency");
+    if (writemode) {
+      printf("bytecount %u\n", (unsigned int) bytecount);
+    }
   }
 
-  if (writemode) {
+  if (clients > 0) {
+    do_concurrent(filename, writemode, throughputmode, bytecount, clients);
+  } else if (writemode) {
     do_write(filename, throughputmode, bytecount);
   } else {
     do_read(filename, throughputmode);
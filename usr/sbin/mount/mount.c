@@ -181,7 +181,6 @@ int mount_on_name(dev_t dev, char *result) {
       snprintf(result, MAX_FS_SPECIAL, "/dev/%s", itr.name);
       return 1; /* found */
     }
-    itr.cookie++;
   }
   return 0; /* not found */
 }
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * msgstat.c - display message statistics of a server.
+ */
+
+#include <sys/prex.h>
+#include <ipc/ipc.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: msgstat [-h] [object]\n");
+	exit(1);
+}
+
+static const char *bucket_label[MSGSTAT_NBUCKET] = {
+	"<1", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-"
+};
+
+static void
+print_hist(const char *title, u_long *hist)
+{
+	int i;
+
+	printf("  %-7s", title);
+	for (i = 0; i < MSGSTAT_NBUCKET; i++)
+		printf(" %7lu", hist[i]);
+	printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct msgstat_msg m;
+	struct msg_stat *ms;
+	object_t obj;
+	const char *name = "!fs";
+	int ch, i, hflag = 0;
+
+	while ((ch = getopt(argc, argv, "h")) != -1) {
+		switch (ch) {
+		case 'h':
+			hflag = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1)
+		usage();
+	if (argc == 1)
+		name = argv[0];
+
+	if (object_lookup(name, &obj) != 0) {
+		fprintf(stderr, "msgstat: can not find object %s\n", name);
+		exit(1);
+	}
+
+	printf("code     count    errors   avg wait avg serv\n");
+	if (hflag) {
+		printf("  %-7s", "ticks");
+		for (i = 0; i < MSGSTAT_NBUCKET; i++)
+			printf(" %7s", bucket_label[i]);
+		printf("\n");
+	}
+
+	m.index = 0;
+	for (;;) {
+		m.hdr.code = STD_MSGSTAT;
+		if (msg_send(obj, &m, sizeof(m)) != 0 || m.hdr.status != 0)
+			break;
+
+		ms = &m.stat;
+		if (ms->count != 0) {
+			printf("%08x %8lu %8lu %8lu %8lu\n", m.code,
+			       ms->count, ms->errors, ms->wait / ms->count,
+			       ms->service / ms->count);
+			if (hflag) {
+				print_hist("wait", ms->wait_hist);
+				print_hist("service", ms->service_hist);
+			}
+		}
+		m.index++;
+	}
+	exit(0);
+}
@@ -123,7 +123,7 @@ mount_fs(void)
 {
 	char line[128];
 	FILE *fp;
-	char *spec, *file, *type, *p;
+	char *spec, *file, *type, *opts, *p;
 	char nodev[] = "";
 	int i;
 
@@ -165,6 +165,7 @@ mount_fs(void)
 			continue;
 		file = strtok(NULL, " \t\n");
 		type = strtok(NULL, " \t\n");
+		opts = strtok(NULL, " \t\n");
 		if (!strcmp(file, "/") || !strcmp(file, "/boot"))
 			continue;
 		if (!strcmp(spec, "none"))
@@ -172,7 +173,7 @@ mount_fs(void)
 
 		/* We create the mount point automatically */
 		mkdir(file, 0);
-		mount(spec, file, type, 0, 0);
+		mount(spec, file, type, 0, opts);
 	}
 	fclose(fp);
 }
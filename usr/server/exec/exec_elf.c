@@ -32,6 +32,8 @@
  */
 
 #include <sys/prex.h>
+#include <sys/posix.h>
+#include <sys/mman.h>
 #include <ipc/fs.h>
 #include <ipc/proc.h>
 #include <sys/elf.h>
@@ -52,6 +54,34 @@ static char *sect_addr[32];	/* Array of section address */
 #endif
 
 #ifdef CONFIG_MMU
+/*
+ * Map a read-only segment from the file.  The pages are
+ * shared by all tasks running the same program.
+ */
+static int
+map_segment(Elf32_Phdr *phdr, task_t task, int fd)
+{
+	struct mmap_msg m;
+	size_t offset;
+
+	offset = phdr->p_vaddr & PAGE_MASK;
+	if ((phdr->p_offset & PAGE_MASK) != offset ||
+	    phdr->p_filesz != phdr->p_memsz)
+		return EINVAL;
+
+	m.hdr.code = FS_MMAP;
+	m.task = task;
+	m.fd = fd;
+	m.addr = (void *)trunc_page(phdr->p_vaddr);
+	m.len = phdr->p_filesz + offset;
+	m.prot = PROT_READ | PROT_EXEC;
+	m.flags = MAP_SHARED | MAP_FIXED;
+	m.off = (off_t)trunc_page(phdr->p_offset);
+	if (__posix_call(__fs_obj, &m, sizeof(m), 1) != 0)
+		return errno;
+	return 0;
+}
+
 /*
  * Load executable ELF file
  */
@@ -76,6 +106,11 @@ load_exec(Elf32_Ehdr *ehdr, task_t task, int fd, vaddr_t *entry)
 		if (size == 0)
 			continue;
 
+		/* Share the text with other tasks if we can. */
+		if (!(phdr->p_flags & PF_W) &&
+		    map_segment(phdr, task, fd) == 0)
+			continue;
+
 		if (vm_allocate(task, &addr, size, 0) != 0)
 			return ENOMEM;
 
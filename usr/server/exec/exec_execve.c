@@ -33,6 +33,7 @@
 
 #include <sys/prex.h>
 #include <sys/capability.h>
+#include <sys/posix.h>
 #include <ipc/fs.h>
 #include <ipc/proc.h>
 #include <ipc/ipc.h>
@@ -58,6 +59,7 @@ static int	build_args(task_t, void *, char *, struct exec_msg *,
 			   char *, char *, void **);
 static int	conv_path(char *, char *, char *);
 static void	notify_server(task_t, task_t, void *);
+static void	unmap_files(task_t);
 static int	read_header(char *);
 
 /*
@@ -213,6 +215,7 @@ exec_execve(struct exec_msg *msg)
 	DPRINTF(("exec done\n"));
 	return 0;
  err5:
+	unmap_files(new_task);
 	vm_free(new_task, stack);
  err4:
 	thread_terminate(t);
@@ -439,6 +442,20 @@ notify_server(task_t org_task, task_t new_task, void *stack)
 	} while (error == EINTR);
 }
 
+/*
+ * Release the files mapped to the task which failed to start.
+ */
+static void
+unmap_files(task_t task)
+{
+	struct mmap_msg m;
+
+	m.hdr.code = FS_MUNMAP;
+	m.task = task;
+	m.addr = NULL;
+	__posix_call(__fs_obj, &m, sizeof(m), 1);
+}
+
 static int
 read_header(char *path)
 {
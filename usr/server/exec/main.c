@@ -36,6 +36,7 @@
 #include <ipc/fs.h>
 #include <ipc/proc.h>
 #include <ipc/ipc.h>
+#include <ipc/dispatch.h>
 #include <sys/list.h>
 
 #include <limits.h>
@@ -55,6 +56,7 @@ static int exec_null(struct msg *);
 static int exec_debug(struct msg *);
 static int exec_boot(struct msg *);
 static int exec_shutdown(struct msg *);
+static int exec_msgstat(struct msg *);
 
 /*
  * Message mapping
@@ -72,9 +74,12 @@ static const struct msg_map execmsg_map[] = {
 	MSGMAP(STD_BOOT,	exec_boot),
 	MSGMAP(STD_SHUTDOWN,	exec_shutdown),
 	MSGMAP(STD_DEBUG,	exec_debug),
+	MSGMAP(STD_MSGSTAT,	exec_msgstat),
 	MSGMAP(0,		exec_null),
 };
 
+static struct msg_dispatch exec_dispatch;	/* dispatch table */
+
 static void
 register_process(void)
 {
@@ -120,10 +125,19 @@ exec_debug(struct msg *msg)
 
 #ifdef DEBUG
 	/* mstat(); */
+	msg_dispatch_dump(&exec_dispatch);
 #endif
 	return 0;
 }
 
+static int
+exec_msgstat(struct msg *msg)
+{
+
+	return msg_dispatch_getstat(&exec_dispatch,
+				    (struct msgstat_msg *)msg);
+}
+
 static int
 exec_shutdown(struct msg *msg)
 {
@@ -148,6 +162,24 @@ exec_init(void)
 	}
 }
 
+/*
+ * Build the dispatch table from the message map.
+ */
+static void
+dispatch_init(void)
+{
+	const struct msg_map *map;
+
+	if (msg_dispatch_init(&exec_dispatch, EXEC_EXECVE,
+			      MSG_NUMBER(EXEC_BINDCAP) + 1) != 0)
+		sys_panic("exec: no memory for dispatch table");
+	for (map = &execmsg_map[0]; map->code != 0; map++) {
+		if (msg_dispatch_add(&exec_dispatch, map->code,
+				     map - execmsg_map) != 0)
+			sys_panic("exec: bad message code");
+	}
+}
+
 static void
 exception_handler(int sig)
 {
@@ -164,7 +196,8 @@ main(int argc, char *argv[])
 	const struct msg_map *map;
 	struct msg *msg;
 	object_t obj;
-	int error;
+	u_long sent, start;
+	int error, slot;
 
 	sys_log("Starting exec server\n");
 
@@ -186,6 +219,11 @@ main(int argc, char *argv[])
 	 */
 	exec_init();
 
+	/*
+	 * Build the message dispatch table.
+	 */
+	dispatch_init();
+
 	/*
 	 * Create an object to expose our service.
 	 */
@@ -207,14 +245,16 @@ main(int argc, char *argv[])
 		if (error)
 			continue;
 
+		sys_time(&start);
+		sent = msg->hdr.time;
+
 		error = EINVAL;
-		map = &execmsg_map[0];
-		while (map->code != 0) {
-			if (map->code == msg->hdr.code) {
-				error = (*map->func)(msg);
-				break;
-			}
-			map++;
+		slot = msg_dispatch_slot(&exec_dispatch, msg->hdr.code);
+		if (slot != -1) {
+			map = &execmsg_map[exec_dispatch.md_index[slot]];
+			error = (*map->func)(msg);
+			msg_dispatch_account(&exec_dispatch, slot, sent, start,
+					     error);
 		}
 #ifdef DEBUG_EXEC
 		if (error)
@@ -48,12 +48,41 @@
 #if CONFIG_FS_THREADS > 1
 #define malloc(s)	malloc_r(s)
 #define free(p)		free_r(p)
-#else
-#define mutex_init(m)		do {} while (0)
-#define mutex_destroy(m)	do {} while (0)
-#define mutex_lock(m)		do {} while (0)
-#define mutex_unlock(m)		do {} while (0)
-#define mutex_trylock(m)	do {} while (0)
 #endif
 
+#define AR_NAMESZ	16		/* size of name in archive header */
+
+/*
+ * Archive member.
+ * The member table is built at mount time, and it is not
+ * changed until unmount.  So no lock is needed to access it.
+ */
+struct arfs_node {
+	struct arfs_node *next;		/* next node in hash chain */
+	char	name[AR_NAMESZ + 1];	/* file name */
+	off_t	offset;			/* offset of data in image */
+	size_t	size;			/* file size */
+};
+
+/*
+ * Mount data
+ *
+ * If the device can map its memory (a RAM disk), the whole image
+ * is mapped read-only at mount time, and data is copied straight
+ * from it instead of going through device reads and the buffer
+ * cache.
+ */
+struct arfsmount {
+	struct arfs_node *nodes;	/* member table */
+	int	nr_nodes;		/* number of members */
+	struct arfs_node **hash;	/* hash table for file name */
+	u_int	hash_mask;		/* size of hash table - 1 */
+	char	*image;			/* mapped image, or NULL */
+	size_t	image_size;		/* size of mapped image */
+};
+
+__BEGIN_DECLS
+struct arfs_node *arfs_lookup_node(struct arfsmount *, char *);
+__END_DECLS
+
 #endif /* !_ARFS_H */
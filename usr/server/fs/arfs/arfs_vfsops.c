@@ -35,6 +35,8 @@
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -64,12 +66,174 @@ const struct vfsops arfs_vfsops = {
 	&arfs_vnops,		/* vnops */
 };
 
+#define ARFS_MINHASH	16		/* minimum size of hash table */
+
+static u_int
+arfs_hash(char *name)
+{
+	u_int val = 0;
+
+	while (*name)
+		val = ((val << 5) + val) + *name++;
+	return val;
+}
+
+/*
+ * Find the archive member by name.
+ */
+struct arfs_node *
+arfs_lookup_node(struct arfsmount *amp, char *name)
+{
+	struct arfs_node *np;
+
+	np = amp->hash[arfs_hash(name) & amp->hash_mask];
+	for (; np != NULL; np = np->next) {
+		if (strcmp(np->name, name) == 0)
+			break;
+	}
+	return np;
+}
+
+/*
+ * Read the archive header at the offset in image.
+ * The header may cross the block boundary.
+ */
+static int
+arfs_read_hdr(mount_t mp, struct arfsmount *amp, off_t off,
+	      struct ar_hdr *hdr)
+{
+	struct buf *bp;
+	char *p;
+	size_t len, n;
+	int error;
+
+	if (amp->image != NULL) {
+		if (off + (off_t)sizeof(struct ar_hdr) >
+		    (off_t)amp->image_size)
+			return EIO;
+		memcpy(hdr, amp->image + off, sizeof(struct ar_hdr));
+		return 0;
+	}
+
+	p = (char *)hdr;
+	len = sizeof(struct ar_hdr);
+	while (len > 0) {
+		if ((error = bread(mp->m_dev, (int)(off / BSIZE), &bp)) != 0)
+			return error;
+		n = BSIZE - (size_t)(off % BSIZE);
+		if (n > len)
+			n = len;
+		memcpy(p, bp->b_data + (off % BSIZE), n);
+		brelse(bp);
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Build the member table and its hash table by reading all
+ * archive headers.
+ */
+static int
+arfs_build_index(mount_t mp, struct arfsmount *amp)
+{
+	struct ar_hdr hdr;
+	struct arfs_node *np, *tmp;
+	off_t off;
+	size_t size;
+	int i, max;
+	u_int hsize, h;
+	char *p;
+
+	max = 0;
+	off = SARMAG;	/* offset in archive image */
+	for (;;) {
+		/* Stop at the end of image or at a broken header. */
+		if (arfs_read_hdr(mp, amp, off, &hdr) != 0)
+			break;
+		if (strncmp(hdr.ar_fmag, ARFMAG, sizeof(ARFMAG) - 1))
+			break;
+		size = (size_t)atol(hdr.ar_size);
+		if (size == 0)
+			break;
+
+		if (amp->nr_nodes == max) {
+			max = (max == 0) ? 32 : max * 2;
+			tmp = malloc(max * sizeof(struct arfs_node));
+			if (tmp == NULL)
+				return ENOMEM;
+			if (amp->nodes != NULL) {
+				memcpy(tmp, amp->nodes,
+				       amp->nr_nodes * sizeof(struct arfs_node));
+				free(amp->nodes);
+			}
+			amp->nodes = tmp;
+		}
+		np = &amp->nodes[amp->nr_nodes];
+
+		/* Convert archive name */
+		memcpy(np->name, hdr.ar_name, AR_NAMESZ);
+		np->name[AR_NAMESZ] = '\0';
+		if ((p = memchr(np->name, '/', AR_NAMESZ)) != NULL)
+			*p = '\0';
+		i = (int)strlen(np->name);
+		while (i > 0 && np->name[i - 1] == ' ')
+			np->name[--i] = '\0';
+
+		np->offset = off + (off_t)sizeof(struct ar_hdr);
+		np->size = size;
+
+		/* Skip the symbol table which has no name. */
+		if (np->name[0] != '\0')
+			amp->nr_nodes++;
+
+		/* Proceed to next archive header */
+		off = np->offset + (off_t)size;
+		off += (off % 2); /* Pad to even boundary */
+	}
+	DPRINTF(("arfs_build_index: %d files\n", amp->nr_nodes));
+
+	for (hsize = ARFS_MINHASH; hsize < (u_int)amp->nr_nodes; hsize <<= 1)
+		;
+	if ((amp->hash = malloc(hsize * sizeof(struct arfs_node *))) == NULL)
+		return ENOMEM;
+	memset(amp->hash, 0, hsize * sizeof(struct arfs_node *));
+	amp->hash_mask = hsize - 1;
+
+	for (i = 0; i < amp->nr_nodes; i++) {
+		np = &amp->nodes[i];
+		h = arfs_hash(np->name) & amp->hash_mask;
+		np->next = amp->hash[h];
+		amp->hash[h] = np;
+	}
+	return 0;
+}
+
+static void
+arfs_free_index(struct arfsmount *amp)
+{
+
+	/* The image may not start at the top of the mapped pages. */
+	if (amp->image != NULL)
+		vm_free(task_self(),
+			(void *)trunc_page((vaddr_t)amp->image));
+	if (amp->hash != NULL)
+		free(amp->hash);
+	if (amp->nodes != NULL)
+		free(amp->nodes);
+	free(amp);
+}
+
 /*
  * Mount a file system.
  */
 static int
 arfs_mount(mount_t mp, char *dev, int flags, void *data)
 {
+	struct arfsmount *amp;
+	struct devmap dm;
 	size_t size;
 	char *buf;
 	int error = 0;
@@ -95,6 +259,24 @@ arfs_mount(mount_t mp, char *dev, int flags, void *data)
 	}
 
 	/* Ok, we find the archive */
+	if ((amp = malloc(sizeof(struct arfsmount))) == NULL) {
+		error = ENOMEM;
+		goto out;
+	}
+	memset(amp, 0, sizeof(struct arfsmount));
+
+	/* Use the memory of the device directly if we can. */
+	dm.dm_prot = PROT_READ;
+	if (device_ioctl((device_t)mp->m_dev, DMIOC_MAP, &dm) == 0) {
+		amp->image = dm.dm_addr;
+		amp->image_size = dm.dm_size;
+		DPRINTF(("arfs_mount: image mapped at %x\n", dm.dm_addr));
+	}
+	if ((error = arfs_build_index(mp, amp)) != 0) {
+		arfs_free_index(amp);
+		goto out;
+	}
+	mp->m_data = amp;
 	mp->m_flags |= MNT_RDONLY;
  out:
 	free(buf);
@@ -104,5 +286,8 @@ arfs_mount(mount_t mp, char *dev, int flags, void *data)
 static int
 arfs_unmount(mount_t mp)
 {
+
+	arfs_free_index(mp->m_data);
+	mp->m_data = NULL;
 	return 0;
 }
@@ -79,12 +79,8 @@ static int arfs_lookup	(vnode_t, char *, vnode_t);
 #define arfs_setattr	((vnop_setattr_t)vop_nullop)
 #define arfs_inactive	((vnop_inactive_t)vop_nullop)
 #define arfs_truncate	((vnop_truncate_t)vop_nullop)
-
-static char iobuf[BSIZE*2];
-
-#if CONFIG_FS_THREADS > 1
-static mutex_t arfs_lock = MUTEX_INITIALIZER;
-#endif
+#define arfs_getpages	((vnop_getpages_t)NULL)
+#define arfs_putpages	((vnop_putpages_t)NULL)
 
 /*
  * vnode operations
@@ -108,34 +104,10 @@ const struct vnops arfs_vnops = {
 	arfs_setattr,		/* setattr */
 	arfs_inactive,		/* inactive */
 	arfs_truncate,		/* truncate */
+	arfs_getpages,		/* getpages */
+	arfs_putpages,		/* putpages */
 };
 
-/*
- * Read blocks.
- * iobuf is filled by read data.
- */
-static int
-arfs_readblk(mount_t mp, int blkno)
-{
-	struct buf *bp;
-	int error;
-
-	/*
-	 * Read two blocks for archive header
-	 */
-	if ((error = bread(mp->m_dev, blkno, &bp)) != 0)
-		return error;
-	memcpy(iobuf, bp->b_data, BSIZE);
-	brelse(bp);
-
-	if ((error = bread(mp->m_dev, blkno + 1, &bp)) != 0)
-		return error;
-	memcpy(iobuf + BSIZE, bp->b_data, BSIZE);
-	brelse(bp);
-
-	return 0;
-}
-
 /*
  * Lookup vnode for the specified file/directory.
  * The vnode is filled properly.
@@ -143,128 +115,103 @@ arfs_readblk(mount_t mp, int blkno)
 static int
 arfs_lookup(vnode_t dvp, char *name, vnode_t vp)
 {
-	struct ar_hdr *hdr;
-	int blkno, error;
-	off_t off;
-	size_t size;
-	mount_t mp;
-	char *p;
+	struct arfs_node *np;
 
 	DPRINTF(("arfs_lookup: name=%s\n", name));
 	if (*name == '\0')
 		return ENOENT;
 
-	mutex_lock(&arfs_lock);
-
-	error = ENOENT;
-	mp = vp->v_mount;
-	blkno = 0;
-	off = SARMAG;	/* offset in archive image */
-	for (;;) {
-		/* Read two blocks for archive header */
-		if (arfs_readblk(mp, blkno) != 0)
-			goto out;
-
-		/* Check file header */
-		hdr = (struct ar_hdr *)(iobuf + (off % BSIZE));
-		if (strncmp(hdr->ar_fmag, ARFMAG, sizeof(ARFMAG) - 1))
-			goto out;
-
-		/* Get file size */
-		size = (size_t)atol((char *)&hdr->ar_size);
-		if (size == 0)
-			goto out;
-
-		/* Convert archive name */
-		if ((p = memchr(&hdr->ar_name, '/', 16)) != NULL)
-			*p = '\0';
-
-		if (strncmp(name, (char *)&hdr->ar_name, 16) == 0)
-			break;
-
-		/* Proceed to next archive header */
-		off += (sizeof(struct ar_hdr) + size);
-		off += (off % 2); /* Pad to even boundary */
+	np = arfs_lookup_node(vp->v_mount->m_data, name);
+	if (np == NULL)
+		return ENOENT;
 
-		blkno = (int)(off / BSIZE);
-	}
 	vp->v_type = VREG;
 
 	/* No write access */
 	vp->v_mode = (mode_t)(S_IRUSR | S_IXUSR);
-	vp->v_size = size;
-	vp->v_blkno = blkno;
-	vp->v_data = (void *)(off + sizeof(struct ar_hdr));
-	error = 0;
- out:
-	mutex_unlock(&arfs_lock);
-	DPRINTF(("arfs_lookup: error=%d\n\n", error));
-	return error;
+	vp->v_size = np->size;
+	vp->v_blkno = (int)(np->offset / BSIZE);
+	vp->v_data = np;
+	return 0;
 }
 
+/*
+ * Read file data.
+ * If the image is mapped, the data is copied from it in one go.
+ * Otherwise the whole blocks are read from the device to the
+ * caller's buffer directly, and only the partial blocks at both
+ * ends of the request are copied through the buffer cache.
+ */
 static int
 arfs_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
+	struct arfsmount *amp;
+	struct arfs_node *np;
+	struct buf *bp;
 	off_t off, file_pos, buf_pos;
-	int blkno, error;
 	size_t nr_read, nr_copy;
 	mount_t mp;
-	struct buf *bp;
+	int blkno, error;
 
 	DPRINTF(("arfs_read: start size=%d\n", size));
-	mutex_lock(&arfs_lock);
 
 	*result = 0;
 	mp = vp->v_mount;
+	np = vp->v_data;
 
 	/* Check if current file position is already end of file. */
 	file_pos = fp->f_offset;
-	if (file_pos >= (off_t)vp->v_size) {
-		error = 0;
-		goto out;
-	}
+	if (file_pos >= (off_t)vp->v_size)
+		return 0;
+
 	/* Get the actual read size. */
 	if (vp->v_size - file_pos < size)
 		size = vp->v_size - file_pos;
 
+	off = np->offset + file_pos;
+	amp = mp->m_data;
+	if (amp->image != NULL) {
+		if (off + (off_t)size > (off_t)amp->image_size)
+			return EIO;
+		memcpy(buf, amp->image + off, size);
+		fp->f_offset = file_pos + size;
+		*result = size;
+		return 0;
+	}
+
 	/* Read and copy data */
-	off = (off_t)vp->v_data;
 	nr_read = 0;
-	for (;;) {
-		DPRINTF(("arfs_read: file_pos=%d buf=%x size=%d\n",
-			 file_pos, buf, size));
-
-		blkno = (off + file_pos) / BSIZE;
-		buf_pos = (off + file_pos) % BSIZE;
-		if ((error = bread(mp->m_dev, blkno, &bp)) != 0)
-			goto out;
-		nr_copy = BSIZE;
-		if (buf_pos > 0)
-			nr_copy -= buf_pos;
-		if (buf_pos + size < BSIZE)
-			nr_copy = size;
-		ASSERT(nr_copy > 0);
-		memcpy(buf, bp->b_data + buf_pos, nr_copy);
-		brelse(bp);
-
-		file_pos += nr_copy;
-		DPRINTF(("arfs_read: file_pos=%d nr_copy=%d\n",
-			 file_pos, nr_copy));
+	while (size > 0) {
+		DPRINTF(("arfs_read: off=%d buf=%x size=%d\n",
+			 off, buf, size));
 
+		blkno = (int)(off / BSIZE);
+		buf_pos = off % BSIZE;
+		if (buf_pos == 0 && size >= BSIZE) {
+			nr_copy = size & ~(BSIZE - 1);
+			error = device_read((device_t)mp->m_dev, buf,
+					    &nr_copy, blkno);
+			if (error)
+				return error;
+			if (nr_copy == 0)
+				return EIO;
+		} else {
+			if ((error = bread(mp->m_dev, blkno, &bp)) != 0)
+				return error;
+			nr_copy = BSIZE - buf_pos;
+			if (nr_copy > size)
+				nr_copy = size;
+			memcpy(buf, bp->b_data + buf_pos, nr_copy);
+			brelse(bp);
+		}
+		off += nr_copy;
 		nr_read += nr_copy;
 		size -= nr_copy;
-		if (size <= 0)
-			break;
 		buf = (void *)((u_long)buf + nr_copy);
-		buf_pos = 0;
 	}
-	fp->f_offset = file_pos;
+	fp->f_offset = file_pos + nr_read;
 	*result = nr_read;
-	error = 0;
- out:
-	mutex_unlock(&arfs_lock);
-	DPRINTF(("arfs_read: error=%d\n\n", error));
-	return error;
+	return 0;
 }
 
 /*
@@ -283,59 +230,23 @@ arfs_seek(vnode_t vp, file_t fp, off_t oldoff, off_t newoff)
 static int
 arfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 {
-	struct ar_hdr *hdr;
-	int blkno, i, error;
-	off_t off;
-	size_t size;
-	mount_t mp;
-	char *p;
+	struct arfsmount *amp;
+	struct arfs_node *np;
 
 	DPRINTF(("arfs_readdir: start\n"));
-	mutex_lock(&arfs_lock);
 
-	i = 0;
-	mp = vp->v_mount;
-	blkno = 0;
-	off = SARMAG;	/* offset in archive image */
-	for (;;) {
-		/* Read two blocks for archive header */
-		if ((error = arfs_readblk(mp, blkno)) != 0)
-			goto out;
-
-		hdr = (struct ar_hdr *)(iobuf + (off % BSIZE));
-
-		/* Get file size */
-		size = (size_t)atol((char *)&hdr->ar_size);
-		if (size == 0) {
-			error = ENOENT;
-			goto out;
-		}
-		if (i == fp->f_offset)
-			break;
-
-		/* Proceed to next archive header */
-		off += (sizeof(struct ar_hdr) + size);
-		off += (off % 2); /* Pad to even boundary */
-
-		blkno = off / BSIZE;
-		i++;
-	}
-
-	/* Convert archive name */
-	if ((p = memchr(&hdr->ar_name, '/', 16)) != NULL)
-		*p = '\0';
+	amp = vp->v_mount->m_data;
+	if (fp->f_offset >= amp->nr_nodes)
+		return ENOENT;
+	np = &amp->nodes[fp->f_offset];
 
-	strlcpy((char *)&dir->d_name, (char *)&hdr->ar_name,
-		sizeof(dir->d_name));
+	strlcpy((char *)&dir->d_name, np->name, sizeof(dir->d_name));
 	dir->d_namlen = (uint16_t)strlen(dir->d_name);
 	dir->d_fileno = (uint32_t)fp->f_offset;
 	dir->d_type = DT_REG;
 
 	fp->f_offset++;
-	error = 0;
- out:
-	mutex_unlock(&arfs_lock);
-	return error;
+	return 0;
 }
 
 
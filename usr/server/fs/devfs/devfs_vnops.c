@@ -74,6 +74,8 @@ static int devfs_lookup	(vnode_t, char *, vnode_t);
 #define devfs_setattr	((vnop_setattr_t)vop_nullop)
 #define devfs_inactive	((vnop_inactive_t)vop_nullop)
 #define devfs_truncate	((vnop_truncate_t)vop_nullop)
+#define devfs_getpages	((vnop_getpages_t)NULL)
+#define devfs_putpages	((vnop_putpages_t)NULL)
 
 /*
  * vnode operations
@@ -97,6 +99,8 @@ struct vnops devfs_vnops = {
 	devfs_setattr,		/* setattr */
 	devfs_inactive,		/* inactive */
 	devfs_truncate,		/* truncate */
+	devfs_getpages,		/* getpages */
+	devfs_putpages,		/* putpages */
 };
 
 /*
@@ -38,6 +38,7 @@
 #include <sys/mount.h>
 #include <sys/syslog.h>
 #include <sys/buf.h>
+#include <sys/syslimits.h>
 
 /* #define DEBUG_FATFS 1 */
 
@@ -64,6 +65,7 @@
 
 #define SEC_SIZE	512		/* sector size */
 #define SEC_INVAL	0xffffffff	/* invalid sector */
+#define FAT_MAXIO	32768		/* max size of data transfer */
 
 /*
  * Pre-defined cluster number
@@ -78,6 +80,7 @@
 
 #define FAT12_MASK	0x00000fff
 #define FAT16_MASK	0x0000ffff
+#define FAT32_MASK	0x0fffffff
 
 #if defined(__SUNPRO_C)
 #pragma pack(1)
@@ -110,28 +113,146 @@ struct fat_bpb {
 	uint8_t		file_sys_id[8];
 } __packed;
 
+/*
+ * Extended BIOS parameter block for FAT32.
+ * This follows big_total_sectors of the BIOS parameter block.
+ */
+struct fat_bpb32 {
+	uint32_t	sectors_per_fat;
+	uint16_t	ext_flags;
+	uint16_t	fs_version;
+	uint32_t	root_cluster;
+	uint16_t	fs_info;
+	uint16_t	backup_boot;
+	uint8_t		reserved[12];
+	uint8_t		physical_drive;
+	uint8_t		reserved1;
+	uint8_t		ext_boot_signature;
+	uint32_t	serial_no;
+	uint8_t		volume_id[11];
+	uint8_t		file_sys_id[8];
+} __packed;
+
+#define BPB32_OFFSET	36		/* offset of FAT32 extension */
+#define BPB32_MIRROR	0x0080		/* ext_flags: only one FAT is active */
+#define BPB32_ACTIVE	0x000f		/* ext_flags: active FAT */
+
+/*
+ * FAT32 file system information sector
+ */
+struct fat_fsinfo {
+	uint32_t	lead_sig;
+	uint8_t		reserved[480];
+	uint32_t	struct_sig;
+	uint32_t	free_count;
+	uint32_t	next_free;
+	uint8_t		reserved1[12];
+	uint32_t	trail_sig;
+} __packed;
+
+#define FSI_LEAD_SIG	0x41615252
+#define FSI_STRUCT_SIG	0x61417272
+#define FSI_TRAIL_SIG	0xaa550000
+#define FSI_UNKNOWN	0xffffffff
+
 /*
  * FAT directory entry
  */
 struct fat_dirent {
 	uint8_t		name[11];
 	uint8_t		attr;
-	uint8_t		reserve[10];
+	uint8_t		ntres;
+	uint8_t		reserve[7];
+	uint16_t	cluster_hi;
 	uint16_t	time;
 	uint16_t	date;
-	uint16_t	cluster;
+	uint16_t	cluster_lo;
 	uint32_t	size;
 } __packed;
 
+/*
+ * VFAT long file name entry
+ * The characters of the name are stored in UCS-2.
+ */
+struct fat_lfnent {
+	uint8_t		ord;
+	uint8_t		name1[10];
+	uint8_t		attr;
+	uint8_t		type;
+	uint8_t		checksum;
+	uint8_t		name2[12];
+	uint16_t	cluster;
+	uint8_t		name3[4];
+} __packed;
+
+/*
+ * Journal header and record
+ *
+ * The first sector of the journal holds the header, and the
+ * records follow it.  A record is a descriptor sector and the
+ * logged sectors.  A transaction larger than one record is
+ * written as several records, and all of them except the last
+ * one have JR_MORE set.
+ */
+struct fat_jhdr {
+	uint32_t	magic;		/* FAT_JMAGIC */
+	uint32_t	seq;		/* sequence# of first record */
+} __packed;
+
+struct fat_jrec {
+	uint32_t	magic;		/* FAT_JRMAGIC */
+	uint32_t	seq;		/* sequence# of this record */
+	uint16_t	nblocks;	/* number of logged sectors */
+	uint16_t	flags;		/* JR_* */
+	uint32_t	cksum;		/* checksum of record */
+	uint32_t	sec[1];		/* home sector# of blocks */
+} __packed;
+
 #if defined(__SUNPRO_C)
 #pragma pack()
 #endif
 
+#define FAT_JNAME	"FATFS.JNL"	/* name of journal file */
+#define FAT_JSIZE	(128 * 1024)	/* default size of journal */
+#define FAT_JMAGIC	0x4c4e4a46	/* "FJNL" */
+#define FAT_JRMAGIC	0x43524a46	/* "FJRC" */
+#define FAT_JRECMAX	63		/* max blocks in record */
+#define FAT_JHASH	32		/* hash buckets of blocks */
+
+#define JR_MORE		0x0001		/* transaction continues */
+
+/*
+ *  Time bits: 15-11 hours (0-23), 10-5 min, 4-0 sec /2
+ *  Date bits: 15-9 year - 1980, 8-5 month, 4-0 day
+ */
+#define TEMP_DATE   0x3021
+#define TEMP_TIME   0
+
 #define SLOT_EMPTY	0x00
 #define SLOT_DELETED	0xe5
 
 #define DIR_PER_SEC     (SEC_SIZE / sizeof(struct fat_dirent))
 
+/*
+ * Long file name entries.  The entries of a name are placed
+ * in reverse order just before its short name entry.
+ */
+#define LFN_LAST	0x40		/* last entry of the name */
+#define LFN_ORD_MASK	0x1f		/* order of the entry */
+#define LFN_CHARS	13		/* characters per entry */
+#define LFN_MAXENT	20		/* max entries per name */
+
+/*
+ * Names longer than this are accessed with their short name.
+ */
+#define FAT_MAXNAME	(NAME_MAX - 1)
+
+/*
+ * Case of the short name (for ntres)
+ */
+#define NT_LOWER_BASE	0x08		/* base name is lower case */
+#define NT_LOWER_EXT	0x10		/* extension is lower case */
+
 /*
  * FAT attribute for attr
  */
@@ -142,44 +263,132 @@ struct fat_dirent {
 #define FA_SUBDIR	0x10
 #define FA_ARCH		0x20
 #define FA_DEVICE	0x40
+#define FA_LFN		0x0f	/* long file name entry */
 
 #define IS_DIR(de)	(((de)->attr) & FA_SUBDIR)
 #define IS_VOL(de)	(((de)->attr) & FA_VOLID)
 #define IS_FILE(de)	(!IS_DIR(de) && !IS_VOL(de))
+#define IS_LFN(de)	(((de)->attr & 0x3f) == FA_LFN)
 
 #define IS_DELETED(de)  ((de)->name[0] == 0xe5)
 #define IS_EMPTY(de)    ((de)->name[0] == 0)
 
+#define DE_CLUSTER(de) \
+	((u_long)(de)->cluster_lo | ((u_long)(de)->cluster_hi << 16))
+#define DE_SET_CLUSTER(de, cl) \
+	do { \
+		(de)->cluster_lo = (uint16_t)(cl); \
+		(de)->cluster_hi = (uint16_t)((cl) >> 16); \
+	} while (0)
+
+/*
+ * Name index of directory
+ * The names in directory are hashed when the directory is
+ * accessed first.  A file with a long name is entered with
+ * both of its long name and short name.
+ */
+struct fat_hashent {
+	struct fat_hashent *next;	/* next entry in bucket */
+	u_long	slot;			/* slot# of short name entry */
+	int	nlong;			/* number of long name entries */
+	char	name[1];		/* name (variable length) */
+};
+
+struct fat_dirhash {
+	struct fat_dirhash *next;	/* next index in mount */
+	u_long	dcl;			/* cluster# of directory */
+	u_long	size;			/* number of slots in directory */
+	u_long	end;			/* slot# of end of entries */
+	u_long	ndeleted;		/* number of deleted slots */
+	u_long	nofit;			/* deleted slots can not fit this */
+	int	count;			/* number of names */
+	int	nbuckets;		/* number of hash buckets */
+	struct fat_hashent **hash;	/* hash buckets */
+};
+
+/*
+ * Logged directory sector
+ */
+struct fat_jblock {
+	struct fat_jblock *next;	/* next block in bucket */
+	u_long	sec;			/* home sector# */
+	int	dirty;			/* not committed yet */
+	char	data[SEC_SIZE];		/* sector data */
+};
+
+/*
+ * Metadata journal
+ * The logged sectors are held in memory until they are
+ * written to their home location at the checkpoint.
+ */
+struct fat_journal {
+	u_long	*clusters;	/* clusters of journal file */
+	u_long	nclusters;	/* number of clusters */
+	u_long	size;		/* journal size in sectors */
+	u_long	pos;		/* sector to write next record */
+	uint32_t seq;		/* sequence# of next record */
+	u_long	ndirty;		/* number of uncommitted blocks */
+	int	revoked;	/* logged cluster was freed */
+	char	*rec_buf;	/* buffer for a record */
+	u_char	*fat_ckpt;	/* bitmap of FAT sectors to write home */
+	u_long	fat_nckpt;	/* number of them */
+	struct fat_jblock *hash[FAT_JHASH]; /* logged sectors */
+};
+
 /*
  * Mount data
  */
 struct fatfsmount {
-	int	fat_type;	/* 12 or 16 */
+	int	fat_type;	/* 12, 16 or 32 */
 	u_long	root_start;	/* start sector for root directory */
+	u_long	root_cluster;	/* first cluster# of root for FAT32 */
+	u_long	root_slots;	/* number of slots in root for FAT12/16 */
+	u_long	fsinfo_sec;	/* sector# for FSInfo, or 0 */
 	u_long	fat_start;	/* start sector for fat entries */
 	u_long	data_start;	/* start sector for data */
 	u_long	fat_eof;	/* id of end cluster */
 	u_long	sec_per_cl;	/* sectors per cluster */
 	u_long	cluster_size;	/* cluster size */
+	u_long	io_size;	/* size of data buffer */
 	u_long	last_cluster;	/* last cluser */
 	u_long	fat_mask;	/* mask for cluster# */
 	u_long	free_scan;	/* start cluster# to free search */
+	u_long	free_count;	/* number of free clusters */
+	u_long	fat_sectors;	/* sectors per fat */
+	u_long	num_fats;	/* number of fat copies */
+	u_long	fat_ndirty;	/* number of dirty fat sectors */
+	char	*fat_cache;	/* fat entries in memory */
+	u_char	*fat_dirty;	/* bitmap of dirty fat sectors */
+	u_char	*free_map;	/* bitmap of free clusters */
 	vnode_t	root_vnode;	/* vnode for root */
-	char	*io_buf;	/* local data buffer */
-	char	*fat_buf;	/* buffer for fat entry */
 	char	*dir_buf;	/* buffer for directory entry */
+	u_long	dir_sec;	/* sector# in directory buffer */
+	struct fat_dirhash *dirhash; /* name index of directories */
+	int	ndirhash;	/* number of name indexes */
+	char	*free_bufs;	/* list of free data buffers */
+	struct fat_journal *jnl; /* metadata journal, or NULL */
 	dev_t	dev;		/* mounted device */
 #if CONFIG_FS_THREADS > 1
-	mutex_t lock;		/* file system lock */
+	mutex_t lock;		/* lock for fat, directories and buffers */
 #endif
 };
 
 #define FAT12(fat)	((fat)->fat_type == 12)
 #define FAT16(fat)	((fat)->fat_type == 16)
+#define FAT32(fat)	((fat)->fat_type == 32)
 
 #define IS_EOFCL(fat, cl) \
 	(((cl) & EOF_MASK) == ((fat)->fat_mask & EOF_MASK))
 
+/*
+ * Run of contiguous clusters in file
+ */
+struct fat_extent {
+	u_long	e_lcn;		/* cluster index in file */
+	u_long	e_pcn;		/* cluster# on disk */
+	u_long	e_len;		/* number of clusters */
+};
+
 /*
  * File/directory node
  */
@@ -187,6 +396,12 @@ struct fatfs_node {
 	struct fat_dirent dirent; /* copy of directory entry */
 	u_long	sector;		/* sector# for directory entry */
 	u_long	offset;		/* offset of directory entry in sector */
+	u_long	slot;		/* slot# of directory entry */
+	int	nlong;		/* number of long name entries */
+	struct rwlock lock;	/* lock for file data */
+	struct fat_extent *extents; /* cached cluster runs */
+	int	nextents;	/* number of cached runs */
+	int	maxextents;	/* number of allocated runs */
 };
 
 extern struct vnops fatfs_vnops;
@@ -196,26 +411,62 @@ extern struct vnops fatfs_vnops;
             (fat->data_start + (cl - 2) * fat->sec_per_cl)
 
 __BEGIN_DECLS
+int	 fat_load(struct fatfsmount *fmp);
+int	 fat_reload(struct fatfsmount *fmp);
+void	 fat_unload(struct fatfsmount *fmp);
+int	 fat_sync(struct fatfsmount *fmp);
+int	 fat_write_fat(struct fatfsmount *fmp, u_char *map, u_long *count);
 int	 fat_next_cluster(struct fatfsmount *fmp, u_long cl, u_long *next);
 int	 fat_set_cluster(struct fatfsmount *fmp, u_long cl, u_long next);
 int	 fat_alloc_cluster(struct fatfsmount *fmp, u_long scan_start, u_long *free);
+void	 fat_release_cluster(struct fatfsmount *fmp, u_long cl);
 int	 fat_free_clusters(struct fatfsmount *fmp, u_long start);
 int	 fat_seek_cluster(struct fatfsmount *fmp, u_long start, u_long offset,
 			    u_long *cl);
+int	 fat_map_cluster(struct fatfsmount *fmp, struct fatfs_node *np,
+			 u_long lcn, u_long count, u_long *pcn, u_long *run);
+void	 fat_flush_extents(struct fatfs_node *np);
 int	 fat_expand_file(struct fatfsmount *fmp, u_long cl, int size);
 int	 fat_expand_dir(struct fatfsmount *fmp, u_long cl, u_long *new_cl);
 
-void	 fat_convert_name(char *org, char *name);
-void	 fat_restore_name(char *org, char *name);
+void	 fat_restore_name(struct fat_dirent *de, char *name);
 int	 fat_valid_name(char *name);
-int	 fat_compare_name(char *n1, char *n2);
+int	 fat_short_name(char *name, u_char *sname, u_char *ntres);
+void	 fat_basis_name(char *name, u_char *sname);
+void	 fat_numeric_tail(u_char *sname, u_long n);
+u_char	 fat_checksum(u_char *sname);
+int	 fat_get_lfn(struct fat_lfnent *lde, char *name);
+void	 fat_put_lfn(struct fat_lfnent *lde, char *name);
 void	 fat_mode_to_attr(mode_t mode, u_char *attr);
 void	 fat_attr_to_mode(u_char attr, mode_t *mode);
 
+struct fat_dirhash *fat_dirhash_find(struct fatfsmount *fmp, u_long dcl);
+int	 fat_dirhash_create(struct fatfsmount *fmp, u_long dcl,
+			    struct fat_dirhash **dhp);
+int	 fat_dirhash_add(struct fat_dirhash *dh, char *name, u_long slot,
+			 int nlong);
+void	 fat_dirhash_remove(struct fat_dirhash *dh, char *name, u_long slot);
+struct fat_hashent *fat_dirhash_lookup(struct fat_dirhash *dh, char *name);
+void	 fat_dirhash_drop(struct fatfsmount *fmp, u_long dcl);
+void	 fat_dirhash_flush(struct fatfsmount *fmp);
+
+int	 fat_journal_open(struct fatfsmount *fmp, vnode_t rvp, u_long size);
+void	 fat_journal_close(struct fatfsmount *fmp);
+int	 fat_journal_commit(struct fatfsmount *fmp);
+int	 fat_journal_flush(struct fatfsmount *fmp);
+char	*fat_journal_get(struct fatfsmount *fmp, u_long sec);
+int	 fat_journal_put(struct fatfsmount *fmp, u_long sec, char *data);
+void	 fat_journal_revoke(struct fatfsmount *fmp, u_long cl);
+int	 fat_journal_file(struct fatfsmount *fmp, struct fat_dirent *de);
+
 int	 fatfs_lookup_node(vnode_t dvp, char *name, struct fatfs_node *node);
-int	 fatfs_get_node(vnode_t dvp, int index, struct fatfs_node *node);
+int	 fatfs_get_node(vnode_t dvp, u_long *slot, char *name,
+			struct fatfs_node *node);
 int	 fatfs_put_node(struct fatfsmount *fmp, struct fatfs_node *node);
-int	 fatfs_add_node(vnode_t dvp, struct fatfs_node *node);
+int	 fatfs_add_node(vnode_t dvp, char *name, struct fatfs_node *node);
+int	 fatfs_del_node(vnode_t dvp, struct fatfs_node *node);
+int	 fatfs_init_dir(struct fatfsmount *fmp, u_long cl, u_long parent);
+int	 fatfs_set_parent(struct fatfsmount *fmp, u_long cl, u_long parent);
 __END_DECLS
 
 #endif /* !_FATFS_H */
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/prex.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fatfs.h"
+
+#define DIRHASH_MIN	32	/* initial number of hash buckets */
+#define DIRHASH_MAX	16	/* max number of indexes per mount */
+
+/*
+ * Get the hash value of name.  The case of name is ignored.
+ */
+static u_int
+fat_hash_name(char *name)
+{
+	u_int h = 0;
+
+	while (*name != '\0')
+		h = h * 31 + (u_int)toupper((u_char)*name++);
+	return h;
+}
+
+/*
+ * Release the name index.
+ */
+static void
+fat_dirhash_free(struct fat_dirhash *dh)
+{
+	struct fat_hashent *he, *next;
+	int i;
+
+	for (i = 0; i < dh->nbuckets; i++) {
+		for (he = dh->hash[i]; he != NULL; he = next) {
+			next = he->next;
+			free(he);
+		}
+	}
+	free(dh->hash);
+	free(dh);
+}
+
+/*
+ * Find the name index of the directory.
+ * The index is moved to the head of list to keep the recently
+ * used indexes.
+ */
+struct fat_dirhash *
+fat_dirhash_find(struct fatfsmount *fmp, u_long dcl)
+{
+	struct fat_dirhash *dh, **pp;
+
+	for (pp = &fmp->dirhash; (dh = *pp) != NULL; pp = &dh->next) {
+		if (dh->dcl == dcl) {
+			*pp = dh->next;
+			dh->next = fmp->dirhash;
+			fmp->dirhash = dh;
+			return dh;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Create an empty name index for the directory.
+ * The least recently used index is dropped if there are too
+ * many indexes.
+ */
+int
+fat_dirhash_create(struct fatfsmount *fmp, u_long dcl,
+		   struct fat_dirhash **dhp)
+{
+	struct fat_dirhash *dh, **pp;
+
+	if (fmp->ndirhash >= DIRHASH_MAX) {
+		for (pp = &fmp->dirhash; (*pp)->next != NULL;
+		     pp = &(*pp)->next)
+			;
+		fat_dirhash_free(*pp);
+		*pp = NULL;
+		fmp->ndirhash--;
+	}
+
+	dh = malloc(sizeof(struct fat_dirhash));
+	if (dh == NULL)
+		return ENOMEM;
+	dh->hash = malloc(DIRHASH_MIN * sizeof(struct fat_hashent *));
+	if (dh->hash == NULL) {
+		free(dh);
+		return ENOMEM;
+	}
+	memset(dh->hash, 0, DIRHASH_MIN * sizeof(struct fat_hashent *));
+	dh->nbuckets = DIRHASH_MIN;
+	dh->count = 0;
+	dh->dcl = dcl;
+	dh->size = 0;
+	dh->end = 0;
+	dh->ndeleted = 0;
+	dh->nofit = 0;
+
+	dh->next = fmp->dirhash;
+	fmp->dirhash = dh;
+	fmp->ndirhash++;
+	*dhp = dh;
+	return 0;
+}
+
+/*
+ * Double the hash buckets.
+ * If there is no memory, the current buckets are used.
+ */
+static void
+fat_dirhash_grow(struct fat_dirhash *dh)
+{
+	struct fat_hashent **hash, *he, *next;
+	int i, n, h;
+
+	n = dh->nbuckets * 2;
+	hash = malloc(n * sizeof(struct fat_hashent *));
+	if (hash == NULL)
+		return;
+	memset(hash, 0, n * sizeof(struct fat_hashent *));
+
+	for (i = 0; i < dh->nbuckets; i++) {
+		for (he = dh->hash[i]; he != NULL; he = next) {
+			next = he->next;
+			h = fat_hash_name(he->name) & (n - 1);
+			he->next = hash[h];
+			hash[h] = he;
+		}
+	}
+	free(dh->hash);
+	dh->hash = hash;
+	dh->nbuckets = n;
+}
+
+/*
+ * Enter the name to the index.
+ *
+ * @dh: name index
+ * @name: file name
+ * @slot: slot# of short name entry
+ * @nlong: number of long name entries
+ */
+int
+fat_dirhash_add(struct fat_dirhash *dh, char *name, u_long slot, int nlong)
+{
+	struct fat_hashent *he;
+	size_t len;
+	int h;
+
+	len = strlen(name);
+	he = malloc(sizeof(struct fat_hashent) + len);
+	if (he == NULL)
+		return ENOMEM;
+	strlcpy(he->name, name, len + 1);
+	he->slot = slot;
+	he->nlong = nlong;
+
+	if (dh->count >= dh->nbuckets * 2)
+		fat_dirhash_grow(dh);
+
+	h = fat_hash_name(name) & (dh->nbuckets - 1);
+	he->next = dh->hash[h];
+	dh->hash[h] = he;
+	dh->count++;
+	return 0;
+}
+
+/*
+ * Remove the name of the slot from the index.
+ */
+void
+fat_dirhash_remove(struct fat_dirhash *dh, char *name, u_long slot)
+{
+	struct fat_hashent *he, **pp;
+
+	pp = &dh->hash[fat_hash_name(name) & (dh->nbuckets - 1)];
+	for (; (he = *pp) != NULL; pp = &he->next) {
+		if (he->slot == slot && !strcasecmp(he->name, name)) {
+			*pp = he->next;
+			free(he);
+			dh->count--;
+			return;
+		}
+	}
+}
+
+/*
+ * Look up the name in the index.
+ */
+struct fat_hashent *
+fat_dirhash_lookup(struct fat_dirhash *dh, char *name)
+{
+	struct fat_hashent *he;
+
+	he = dh->hash[fat_hash_name(name) & (dh->nbuckets - 1)];
+	for (; he != NULL; he = he->next) {
+		if (!strcasecmp(he->name, name))
+			return he;
+	}
+	return NULL;
+}
+
+/*
+ * Drop the name index of the directory.
+ * This is called when the directory is removed, or when the
+ * index can not be updated.
+ */
+void
+fat_dirhash_drop(struct fatfsmount *fmp, u_long dcl)
+{
+	struct fat_dirhash *dh, **pp;
+
+	for (pp = &fmp->dirhash; (dh = *pp) != NULL; pp = &dh->next) {
+		if (dh->dcl == dcl) {
+			*pp = dh->next;
+			fat_dirhash_free(dh);
+			fmp->ndirhash--;
+			return;
+		}
+	}
+}
+
+/*
+ * Drop all name indexes in the mount.
+ */
+void
+fat_dirhash_flush(struct fatfsmount *fmp)
+{
+	struct fat_dirhash *dh;
+
+	while ((dh = fmp->dirhash) != NULL) {
+		fmp->dirhash = dh->next;
+		fat_dirhash_free(dh);
+	}
+	fmp->ndirhash = 0;
+}
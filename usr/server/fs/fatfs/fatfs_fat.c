@@ -28,6 +28,7 @@
  */
 
 #include <sys/prex.h>
+#include <sys/param.h>
 #include <sys/buf.h>
 
 #include <ctype.h>
@@ -38,84 +39,241 @@
 #include "fatfs.h"
 
 /*
- * Read the FAT entry for specified cluster.
+ * The FAT is kept in memory while the file system is mounted.
+ * A FAT entry is read and modified in memory, and the modified
+ * sectors are written to all FAT copies by fat_sync(), or are
+ * logged to the journal if it is enabled.  The free clusters
+ * are tracked with a bitmap to find a free cluster without
+ * scanning the FAT.
  */
-static int
-read_fat_entry(struct fatfsmount *fmp, u_long cl)
+
+/*
+ * Get the byte offset of the FAT entry for specified cluster.
+ */
+static u_long
+fat_entry_offset(struct fatfsmount *fmp, u_long cl)
 {
-	u_long sec;
-	char *buf = fmp->fat_buf;
-	int error, border = 0;
-	struct buf *bp;
 
-	/* Get the sector number in FAT entry. */
+	if (FAT32(fmp))
+		return cl * 4;
 	if (FAT16(fmp))
-		sec = (cl * 2) / SEC_SIZE;
-	else {
-		sec = (cl * 3 / 2) / SEC_SIZE;
-		/*
-		 * Check if the entry data is placed at the
-		 * end of sector. If so, we have to read one
-		 * more sector to get complete FAT12 entry.
-		 */
-		if ((cl * 3 / 2) % SEC_SIZE == SEC_SIZE - 1)
-			border = 1;
+		return cl * 2;
+	return cl + cl / 2;
+}
+
+/*
+ * Read the FAT entry for specified cluster.
+ */
+static u_long
+fat_get_entry(struct fatfsmount *fmp, u_long cl)
+{
+	u_char *p;
+	u_long val;
+
+	p = (u_char *)fmp->fat_cache + fat_entry_offset(fmp, cl);
+	val = (u_long)p[0] | ((u_long)p[1] << 8);
+	if (FAT32(fmp))
+		val = (val | ((u_long)p[2] << 16) | ((u_long)p[3] << 24)) &
+			FAT32_MASK;
+
+	/* Adjust data for FAT12 entry */
+	if (FAT12(fmp)) {
+		if (cl & 1)
+			val >>= 4;
+		else
+			val &= 0xfff;
 	}
-	sec += fmp->fat_start;
+	return val;
+}
 
-	/* Read first sector. */
-	if ((error = bread(fmp->dev, sec, &bp)) != 0)
-		return error;
-	memcpy(buf, bp->b_data, SEC_SIZE);
-	brelse(bp);
+/*
+ * Write the FAT entry for specified cluster.
+ * The sectors holding the entry are marked dirty.
+ */
+static void
+fat_put_entry(struct fatfsmount *fmp, u_long cl, u_long val)
+{
+	u_long offset, sec;
+	u_char *p;
+
+	offset = fat_entry_offset(fmp, cl);
+	p = (u_char *)fmp->fat_cache + offset;
+	val &= fmp->fat_mask;
+
+	if (FAT32(fmp)) {
+		/* The upper 4 bits are reserved. */
+		p[0] = (u_char)val;
+		p[1] = (u_char)(val >> 8);
+		p[2] = (u_char)(val >> 16);
+		p[3] = (u_char)((p[3] & 0xf0) | ((val >> 24) & 0x0f));
+	} else if (FAT16(fmp)) {
+		p[0] = (u_char)val;
+		p[1] = (u_char)(val >> 8);
+	} else if (cl & 1) {
+		p[0] = (u_char)((p[0] & 0x0f) | (val << 4));
+		p[1] = (u_char)(val >> 4);
+	} else {
+		p[0] = (u_char)val;
+		p[1] = (u_char)((p[1] & 0xf0) | ((val >> 8) & 0x0f));
+	}
 
-	if (!FAT12(fmp) || border == 0)
-		return 0;
+	/* A FAT12 entry can be placed across the sectors. */
+	for (sec = offset / SEC_SIZE; sec <= (offset + 1) / SEC_SIZE; sec++) {
+		if (!isset(fmp->fat_dirty, sec)) {
+			setbit(fmp->fat_dirty, sec);
+			fmp->fat_ndirty++;
+		}
+	}
 
-	/* Read second sector for the border entry of FAT12. */
-	if ((error = bread(fmp->dev, sec + 1, &bp)) != 0)
-		return error;
-	memcpy(buf + SEC_SIZE, bp->b_data, SEC_SIZE);
-	brelse(bp);
+	if (val == CL_FREE) {
+		if (!isset(fmp->free_map, cl)) {
+			setbit(fmp->free_map, cl);
+			fmp->free_count++;
+		}
+	} else if (isset(fmp->free_map, cl)) {
+		clrbit(fmp->free_map, cl);
+		fmp->free_count--;
+	}
+}
+
+/*
+ * Load the FAT into memory, and build the map of free clusters.
+ */
+int
+fat_load(struct fatfsmount *fmp)
+{
+	u_long max;
+	int error;
+
+	if (vm_allocate(task_self(), (void **)&fmp->fat_cache,
+			fmp->fat_sectors * SEC_SIZE, 1))
+		return ENOMEM;
+
+	/* Ignore the clusters which the FAT can not hold. */
+	if (FAT32(fmp))
+		max = fmp->fat_sectors * SEC_SIZE / 4;
+	else if (FAT16(fmp))
+		max = fmp->fat_sectors * SEC_SIZE / 2;
+	else
+		max = fmp->fat_sectors * SEC_SIZE * 2 / 3;
+	if (fmp->last_cluster > max)
+		fmp->last_cluster = max;
+
+	error = ENOMEM;
+	fmp->fat_dirty = malloc(fmp->fat_sectors / 8 + 1);
+	if (fmp->fat_dirty == NULL)
+		goto err1;
+	fmp->free_map = malloc(fmp->last_cluster / 8 + 1);
+	if (fmp->free_map == NULL)
+		goto err2;
+	if ((error = fat_reload(fmp)) != 0)
+		goto err3;
 	return 0;
+ err3:
+	free(fmp->free_map);
+ err2:
+	free(fmp->fat_dirty);
+ err1:
+	vm_free(task_self(), fmp->fat_cache);
+	return error;
 }
 
 /*
- * Write fat entry from buffer.
+ * Read the FAT from the disk, and build the map of free
+ * clusters.  The changes in memory are discarded.
  */
-static int
-write_fat_entry(struct fatfsmount *fmp, u_long cl)
+int
+fat_reload(struct fatfsmount *fmp)
 {
-	u_long sec;
-	char *buf = fmp->fat_buf;
-	int error, border = 0;
-	struct buf *bp;
+	size_t size;
+	u_long cl;
+	int error;
 
-	/* Get the sector number in FAT entry. */
-	if (FAT16(fmp))
-		sec = (cl * 2) / SEC_SIZE;
-	else {
-		sec = (cl * 3 / 2) / SEC_SIZE;
-		/* Check if border entry for FAT12 */
-		if ((cl * 3 / 2) % SEC_SIZE == SEC_SIZE - 1)
-			border = 1;
+	size = fmp->fat_sectors * SEC_SIZE;
+	if ((error = device_read(fmp->dev, fmp->fat_cache, &size,
+				 fmp->fat_start)) != 0)
+		return error;
+
+	memset(fmp->fat_dirty, 0, fmp->fat_sectors / 8 + 1);
+	memset(fmp->free_map, 0, fmp->last_cluster / 8 + 1);
+	fmp->fat_ndirty = 0;
+
+	fmp->free_count = 0;
+	for (cl = CL_FIRST; cl < fmp->last_cluster; cl++) {
+		if (fat_get_entry(fmp, cl) == CL_FREE) {
+			setbit(fmp->free_map, cl);
+			fmp->free_count++;
+		}
 	}
-	sec += fmp->fat_start;
+	DPRINTF(("fat_reload: %d free clusters\n", fmp->free_count));
+	return 0;
+}
 
-	/* Write first sector. */
-	bp = getblk(fmp->dev, sec);
-	memcpy(bp->b_data, buf, SEC_SIZE);
-	if ((error = bwrite(bp)) != 0)
-		return error;
+/*
+ * Release the FAT in memory.
+ */
+void
+fat_unload(struct fatfsmount *fmp)
+{
+
+	free(fmp->free_map);
+	free(fmp->fat_dirty);
+	vm_free(task_self(), fmp->fat_cache);
+}
+
+/*
+ * Write the FAT sectors marked in the bitmap to all FAT copies.
+ * Contiguous sectors are written at once.
+ */
+int
+fat_write_fat(struct fatfsmount *fmp, u_char *map, u_long *count)
+{
+	u_long sec, end, copy;
+	size_t size;
+	int error;
 
-	if (!FAT12(fmp) || border == 0)
+	if (*count == 0)
 		return 0;
 
-	/* Write second sector for the border entry of FAT12. */
-	bp = getblk(fmp->dev, sec + 1);
-	memcpy(bp->b_data, buf + SEC_SIZE, SEC_SIZE);
-	error = bwrite(bp);
-	return error;
+	for (sec = 0; sec < fmp->fat_sectors; sec = end) {
+		if (!isset(map, sec)) {
+			end = sec + 1;
+			continue;
+		}
+		for (end = sec; end < fmp->fat_sectors &&
+			     isset(map, end); end++)
+			clrbit(map, end);
+
+		for (copy = 0; copy < fmp->num_fats; copy++) {
+			size = (end - sec) * SEC_SIZE;
+			error = device_write(fmp->dev,
+					     fmp->fat_cache + sec * SEC_SIZE,
+					     &size, fmp->fat_start +
+					     copy * fmp->fat_sectors + sec);
+			if (error) {
+				/* Try again at next sync. */
+				for (; sec < end; sec++)
+					setbit(map, sec);
+				return error;
+			}
+		}
+		*count -= end - sec;
+	}
+	return 0;
+}
+
+/*
+ * Write the modified FAT sectors.  If the journal is enabled,
+ * the changes of the FAT and directories are committed to it
+ * as one transaction.
+ */
+int
+fat_sync(struct fatfsmount *fmp)
+{
+
+	if (fmp->jnl != NULL)
+		return fat_journal_commit(fmp);
+	return fat_write_fat(fmp, fmp->fat_dirty, &fmp->fat_ndirty);
 }
 
 /*
@@ -127,32 +285,11 @@ write_fat_entry(struct fatfsmount *fmp, u_long cl)
 int
 fat_next_cluster(struct fatfsmount *fmp, u_long cl, u_long *next)
 {
-	u_int offset;
-	uint16_t val;
-	int error;
-
-	/* Read FAT entry */
-	error = read_fat_entry(fmp, cl);
-	if (error)
-		return error;
-
-	/* Get offset in buffer. */
-	if (FAT16(fmp))
-		offset = (cl * 2) % SEC_SIZE;
-	else
-		offset = (cl * 3 / 2) % SEC_SIZE;
 
-	/* Pick up cluster# */
-	val = *((uint16_t *)(fmp->fat_buf + offset));
+	if (cl < CL_FIRST || cl >= fmp->last_cluster)
+		return EIO;
 
-	/* Adjust data for FAT12 entry */
-	if (FAT12(fmp)) {
-		if (cl & 1)
-			val >>= 4;
-		else
-			val &= 0xfff;
-	}
-	*next = (u_long)val;
+	*next = fat_get_entry(fmp, cl);
 	DPRINTF(("fat_next_cluster: %d => %d\n", cl, *next));
 	return 0;
 }
@@ -166,43 +303,17 @@ fat_next_cluster(struct fatfsmount *fmp, u_long cl, u_long *next)
 int
 fat_set_cluster(struct fatfsmount *fmp, u_long cl, u_long next)
 {
-	u_int offset;
-	char *buf = fmp->fat_buf;
-	int error;
-	uint16_t val, tmp;
 
-	/* Read FAT entry */
-	error = read_fat_entry(fmp, cl);
-	if (error)
-		return error;
-
-	/* Get offset in buffer. */
-	if (FAT16(fmp))
-		offset = (cl * 2) % SEC_SIZE;
-	else
-		offset = (cl * 3 / 2) % SEC_SIZE;
-
-	/* Modify FAT entry for target cluster. */
-	val = (uint16_t)(next & fmp->fat_mask);
-	if (FAT12(fmp)) {
-		tmp = *((uint16_t *)(buf + offset));
-		if (cl & 1) {
-			val <<= 4;
-			val |= (tmp & 0xf);
-		} else {
-			tmp &= 0xf000;
-			val |= tmp;
-		}
-	}
-	*((uint16_t *)(buf + offset)) = val;
+	if (cl < CL_FIRST || cl >= fmp->last_cluster)
+		return EIO;
 
-	/* Write FAT entry */
-	error = write_fat_entry(fmp, cl);
-	return error;
+	fat_put_entry(fmp, cl, next);
+	return 0;
 }
 
 /*
  * Allocate free cluster in FAT chain.
+ * The cluster is reserved until the caller sets its FAT entry.
  *
  * @fmp: fat mount data
  * @scan_start: cluster# to scan first. If 0, use the previous used value.
@@ -211,30 +322,52 @@ fat_set_cluster(struct fatfsmount *fmp, u_long cl, u_long next)
 int
 fat_alloc_cluster(struct fatfsmount *fmp, u_long scan_start, u_long *free)
 {
-	u_long cl, next;
-	int error;
+	u_long cl, n;
 
 	if (scan_start == 0)
 		scan_start = fmp->free_scan;
 
 	DPRINTF(("fat_alloc_cluster: start=%d\n", scan_start));
 
-	cl = scan_start + 1;
-	while (cl != scan_start) {
-		error = fat_next_cluster(fmp, cl, &next);
-		if (error)
-			return error;
-		if (next == CL_FREE) {	/* free ? */
+	if (fmp->free_count == 0)
+		return ENOSPC;		/* no space */
+
+	cl = scan_start;
+	for (n = fmp->last_cluster - CL_FIRST; n > 0; n--) {
+		if (++cl >= fmp->last_cluster)
+			cl = CL_FIRST;
+		if ((cl & 7) == 0 && n > 8 && fmp->free_map[cl >> 3] == 0) {
+			/* Skip 8 clusters in use at once. */
+			cl += 7;
+			n -= 7;
+			continue;
+		}
+		if (isset(fmp->free_map, cl)) {
 			DPRINTF(("fat_alloc_cluster: free cluster=%d\n", cl));
+			clrbit(fmp->free_map, cl);
+			fmp->free_count--;
+			fmp->free_scan = cl;
 			*free = cl;
 			return 0;
 		}
-		if (++cl >= fmp->last_cluster)
-			cl = CL_FIRST;
 	}
 	return ENOSPC;		/* no space */
 }
 
+/*
+ * Release the cluster reserved by fat_alloc_cluster(), when
+ * its FAT entry has not been set.
+ */
+void
+fat_release_cluster(struct fatfsmount *fmp, u_long cl)
+{
+
+	if (!isset(fmp->free_map, cl)) {
+		setbit(fmp->free_map, cl);
+		fmp->free_count++;
+	}
+}
+
 /*
  * Deallocate needless cluster.
  * @fmp: fat mount data
@@ -257,12 +390,10 @@ fat_free_clusters(struct fatfsmount *fmp, u_long start)
 		error = fat_set_cluster(fmp, cl, CL_FREE);
 		if (error)
 			return error;
+		if (fmp->jnl != NULL)
+			fat_journal_revoke(fmp, cl);
 		cl = next;
 	}
-	/* Clear eof */
-	error = fat_set_cluster(fmp, cl, CL_FREE);
-	if (error)
-		return error;
 	return 0;
 }
 
@@ -297,6 +428,120 @@ fat_seek_cluster(struct fatfsmount *fmp, u_long start, u_long offset,
 	return 0;
 }
 
+/*
+ * The clusters of a file are cached in its node as runs of
+ * contiguous clusters.  The runs are built while walking the
+ * FAT chain, and the cluster for a file offset is found by a
+ * binary search.  The runs must be flushed when the chain is
+ * shortened.
+ */
+
+/*
+ * Append the cluster to the cached runs of the file.
+ */
+static int
+fat_add_extent(struct fatfs_node *np, u_long lcn, u_long pcn)
+{
+	struct fat_extent *ep, *tmp;
+	int n;
+
+	if (np->nextents > 0) {
+		ep = &np->extents[np->nextents - 1];
+		if (ep->e_pcn + ep->e_len == pcn) {
+			ep->e_len++;
+			return 0;
+		}
+	}
+	if (np->nextents == np->maxextents) {
+		n = (np->maxextents == 0) ? 4 : np->maxextents * 2;
+		tmp = malloc(n * sizeof(struct fat_extent));
+		if (tmp == NULL)
+			return ENOMEM;
+		if (np->extents != NULL) {
+			memcpy(tmp, np->extents,
+			       np->nextents * sizeof(struct fat_extent));
+			free(np->extents);
+		}
+		np->extents = tmp;
+		np->maxextents = n;
+	}
+	ep = &np->extents[np->nextents++];
+	ep->e_lcn = lcn;
+	ep->e_pcn = pcn;
+	ep->e_len = 1;
+	return 0;
+}
+
+/*
+ * Get the cluster# for the cluster index in file.
+ *
+ * @fmp: fat mount data
+ * @np: fat node of file
+ * @lcn: cluster index in file
+ * @count: number of clusters to be accessed from @lcn
+ * @pcn: cluster# to return
+ * @run: number of contiguous clusters from @pcn to return
+ */
+int
+fat_map_cluster(struct fatfsmount *fmp, struct fatfs_node *np,
+		u_long lcn, u_long count, u_long *pcn, u_long *run)
+{
+	struct fat_extent *ep;
+	u_long next, end;
+	int lo, hi, mid, error;
+
+	if (np->nextents == 0) {
+		next = DE_CLUSTER(&np->dirent);
+		if (next < CL_FIRST || next >= fmp->last_cluster)
+			return EIO;
+		if ((error = fat_add_extent(np, 0, next)) != 0)
+			return error;
+	}
+
+	/* Walk the chain until the clusters to access are cached. */
+	for (;;) {
+		ep = &np->extents[np->nextents - 1];
+		end = ep->e_lcn + ep->e_len;
+		if (end >= lcn + count)
+			break;
+		error = fat_next_cluster(fmp, ep->e_pcn + ep->e_len - 1,
+					 &next);
+		if (error)
+			return error;
+		if (IS_EOFCL(fmp, next) ||
+		    next < CL_FIRST || next >= fmp->last_cluster)
+			break;
+		if ((error = fat_add_extent(np, end, next)) != 0)
+			return error;
+	}
+	if (lcn >= end)
+		return EIO;
+
+	lo = 0;
+	hi = np->nextents - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (np->extents[mid].e_lcn <= lcn)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	ep = &np->extents[lo];
+	*pcn = ep->e_pcn + (lcn - ep->e_lcn);
+	*run = ep->e_len - (lcn - ep->e_lcn);
+	return 0;
+}
+
+/*
+ * Drop the cached runs of the file.
+ */
+void
+fat_flush_extents(struct fatfs_node *np)
+{
+
+	np->nextents = 0;
+}
+
 /*
  * Expand file size.
  *
@@ -307,33 +552,45 @@ fat_seek_cluster(struct fatfsmount *fmp, u_long start, u_long offset,
 int
 fat_expand_file(struct fatfsmount *fmp, u_long cl, int size)
 {
-	int i, cl_len, alloc, error;
-	u_long next;
+	int i, cl_len, error;
+	u_long next, tail;
 
-	alloc = 0;
+	tail = 0;		/* last cluster before expansion */
 	cl_len = size / fmp->cluster_size + 1;
 
 	for (i = 0; i < cl_len; i++) {
-		error = fat_next_cluster(fmp, cl, &next);
-		if (error)
-			return error;
-		if (alloc || next >= fmp->fat_eof) {
-			error = fat_alloc_cluster(fmp, cl, &next);
+		if (tail == 0) {
+			error = fat_next_cluster(fmp, cl, &next);
 			if (error)
 				return error;
-			alloc = 1;
+			if (IS_EOFCL(fmp, next))
+				tail = cl;
 		}
-		if (alloc) {
-			error = fat_set_cluster(fmp, cl, next);
+		if (tail != 0) {
+			error = fat_alloc_cluster(fmp, cl, &next);
 			if (error)
-				return error;
+				goto err;
+			error = fat_set_cluster(fmp, cl, next);
+			if (error) {
+				fat_release_cluster(fmp, next);
+				goto err;
+			}
 		}
 		cl = next;
 	}
-	if (alloc)
+	if (tail != 0)
 		fat_set_cluster(fmp, cl, fmp->fat_eof);	/* add eof */
 	DPRINTF(("fat_expand_file: new size=%d\n", size));
 	return 0;
+ err:
+	/* Free the clusters added to the chain. */
+	fat_set_cluster(fmp, cl, fmp->fat_eof);
+	if (cl != tail) {
+		fat_next_cluster(fmp, tail, &next);
+		fat_free_clusters(fmp, next);
+		fat_set_cluster(fmp, tail, fmp->fat_eof);
+	}
+	return error;
 }
 
 /*
@@ -352,10 +609,12 @@ fat_expand_dir(struct fatfsmount *fmp, u_long cl, u_long *new_cl)
 	u_long next;
 
 	/* Find last cluster number of FAT chain. */
-	while (!IS_EOFCL(fmp, cl)) {
+	for (;;) {
 		error = fat_next_cluster(fmp, cl, &next);
 		if (error)
 			return error;
+		if (IS_EOFCL(fmp, next))
+			break;
 		cl = next;
 	}
 
@@ -363,13 +622,17 @@ fat_expand_dir(struct fatfsmount *fmp, u_long cl, u_long *new_cl)
 	if (error)
 		return error;
 
-	error = fat_set_cluster(fmp, cl, next);
-	if (error)
+	error = fat_set_cluster(fmp, next, fmp->fat_eof);
+	if (error) {
+		fat_release_cluster(fmp, next);
 		return error;
+	}
 
-	error = fat_set_cluster(fmp, next, fmp->fat_eof);
-	if (error)
+	error = fat_set_cluster(fmp, cl, next);
+	if (error) {
+		fat_set_cluster(fmp, next, CL_FREE);
 		return error;
+	}
 
 	*new_cl = next;
 	return 0;
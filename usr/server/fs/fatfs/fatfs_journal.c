@@ -0,0 +1,679 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * fatfs_journal.c - metadata journal
+ */
+
+/*
+ * When the journal is enabled, the FAT and directory sectors
+ * are not written to their home location by each operation.
+ * The sectors changed by an operation are collected in memory,
+ * and fat_sync() commits them as one transaction with a single
+ * sequential write to the journal.  The logged sectors are
+ * written to their home location at the checkpoint, which is
+ * done when a half of the journal is used, or when the file
+ * system is synced or unmounted.  The committed transactions
+ * are replayed at mount time, so the FAT and the directories
+ * are kept consistent even if the power is lost.
+ *
+ * The journal is a hidden file in the root directory.  Its
+ * clusters are allocated when it is created, and never change.
+ * A transaction larger than the free space of the journal is
+ * written to the home location directly without the guarantee.
+ */
+
+#include <sys/prex.h>
+#include <sys/param.h>
+#include <sys/buf.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fatfs.h"
+
+#define JNL_HASH(sec)	((sec) & (FAT_JHASH - 1))
+
+/*
+ * Compute the checksum of the record.
+ */
+static uint32_t
+jnl_cksum(uint32_t sum, char *buf, size_t size)
+{
+	uint32_t *p;
+
+	for (p = (uint32_t *)buf; size >= 4; size -= 4, p++)
+		sum = ((sum << 1) | (sum >> 31)) + *p;
+	return sum;
+}
+
+/*
+ * Read or write the sectors in the journal file.
+ * Contiguous clusters are accessed at once.
+ */
+static int
+jnl_io(struct fatfsmount *fmp, u_long pos, char *buf, u_long nsec,
+       int write)
+{
+	struct fat_journal *jp = fmp->jnl;
+	u_long idx, sec, n;
+	size_t size;
+	int error;
+
+	while (nsec > 0) {
+		idx = pos / fmp->sec_per_cl;
+		sec = cl_to_sec(fmp, jp->clusters[idx]) + pos % fmp->sec_per_cl;
+		n = fmp->sec_per_cl - pos % fmp->sec_per_cl;
+		while (n < nsec && idx + 1 < jp->nclusters &&
+		       jp->clusters[idx + 1] == jp->clusters[idx] + 1) {
+			n += fmp->sec_per_cl;
+			idx++;
+		}
+		if (n > nsec)
+			n = nsec;
+		size = n * SEC_SIZE;
+		if (write)
+			error = device_write(fmp->dev, buf, &size, sec);
+		else
+			error = device_read(fmp->dev, buf, &size, sec);
+		if (error)
+			return error;
+		pos += n;
+		buf += n * SEC_SIZE;
+		nsec -= n;
+	}
+	return 0;
+}
+
+/*
+ * Write the sector to its home location.
+ * A FAT sector is written to all FAT copies.
+ */
+static int
+jnl_write_home(struct fatfsmount *fmp, u_long sec, char *data)
+{
+	struct buf *bp;
+	u_long copy;
+	size_t size;
+	int error;
+
+	if (sec >= fmp->fat_start && sec < fmp->fat_start + fmp->fat_sectors) {
+		for (copy = 0; copy < fmp->num_fats; copy++) {
+			size = SEC_SIZE;
+			error = device_write(fmp->dev, data, &size,
+					     sec + copy * fmp->fat_sectors);
+			if (error)
+				return error;
+		}
+		return 0;
+	}
+	bp = getblk(fmp->dev, sec);
+	memcpy(bp->b_data, data, SEC_SIZE);
+	return bwrite(bp);
+}
+
+/*
+ * Write the journal header.  The records older than the
+ * sequence# in the header are ignored at replay.
+ */
+static int
+jnl_write_header(struct fatfsmount *fmp)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jhdr *hdr;
+
+	memset(jp->rec_buf, 0, SEC_SIZE);
+	hdr = (struct fat_jhdr *)jp->rec_buf;
+	hdr->magic = FAT_JMAGIC;
+	hdr->seq = jp->seq;
+	return jnl_io(fmp, 0, jp->rec_buf, 1, 1);
+}
+
+static struct fat_jblock *
+jnl_lookup(struct fat_journal *jp, u_long sec)
+{
+	struct fat_jblock *blk;
+
+	for (blk = jp->hash[JNL_HASH(sec)]; blk != NULL; blk = blk->next) {
+		if (blk->sec == sec)
+			return blk;
+	}
+	return NULL;
+}
+
+/*
+ * Return the logged data of the sector, or NULL.
+ */
+char *
+fat_journal_get(struct fatfsmount *fmp, u_long sec)
+{
+	struct fat_jblock *blk;
+
+	if ((blk = jnl_lookup(fmp->jnl, sec)) == NULL)
+		return NULL;
+	return blk->data;
+}
+
+/*
+ * Put the sector to the current transaction.
+ */
+int
+fat_journal_put(struct fatfsmount *fmp, u_long sec, char *data)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jblock *blk;
+
+	if ((blk = jnl_lookup(jp, sec)) == NULL) {
+		if ((blk = malloc(sizeof(struct fat_jblock))) == NULL)
+			return ENOMEM;
+		blk->sec = sec;
+		blk->dirty = 0;
+		blk->next = jp->hash[JNL_HASH(sec)];
+		jp->hash[JNL_HASH(sec)] = blk;
+	}
+	if (!blk->dirty) {
+		blk->dirty = 1;
+		jp->ndirty++;
+	}
+	memcpy(blk->data, data, SEC_SIZE);
+	return 0;
+}
+
+/*
+ * Called when the cluster is freed.  If a sector of the
+ * cluster is logged, the journal must be cleared before the
+ * cluster is reused for file data.  Otherwise the replay
+ * would overwrite the data.
+ */
+void
+fat_journal_revoke(struct fatfsmount *fmp, u_long cl)
+{
+	u_long sec, i;
+
+	sec = cl_to_sec(fmp, cl);
+	for (i = 0; i < fmp->sec_per_cl; i++) {
+		if (jnl_lookup(fmp->jnl, sec + i) != NULL) {
+			fmp->jnl->revoked = 1;
+			return;
+		}
+	}
+}
+
+/*
+ * Return true if the directory entry is the journal file.
+ */
+int
+fat_journal_file(struct fatfsmount *fmp, struct fat_dirent *de)
+{
+
+	return fmp->jnl != NULL && IS_FILE(de) &&
+		DE_CLUSTER(de) == fmp->jnl->clusters[0];
+}
+
+/*
+ * Write all logged sectors to their home location, and
+ * clear the journal.  This must be called when no change
+ * is left uncommitted.
+ */
+static int
+jnl_checkpoint(struct fatfsmount *fmp)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jblock *blk;
+	int i, error;
+
+	error = fat_write_fat(fmp, jp->fat_ckpt, &jp->fat_nckpt);
+	if (error)
+		return error;
+
+	for (i = 0; i < FAT_JHASH; i++) {
+		while ((blk = jp->hash[i]) != NULL) {
+			error = jnl_write_home(fmp, blk->sec, blk->data);
+			if (error)
+				return error;
+			jp->hash[i] = blk->next;
+			free(blk);
+		}
+	}
+	jp->revoked = 0;
+	jp->pos = 1;
+	return jnl_write_header(fmp);
+}
+
+/*
+ * Write one record holding the blocks.
+ */
+static int
+jnl_write_record(struct fatfsmount *fmp, u_long *secs, int nblocks,
+		 int more)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jrec *rec;
+	struct fat_jblock *blk;
+	char *data;
+	u_long sec;
+	int i, error;
+
+	memset(jp->rec_buf, 0, SEC_SIZE);
+	rec = (struct fat_jrec *)jp->rec_buf;
+	rec->magic = FAT_JRMAGIC;
+	rec->seq = jp->seq;
+	rec->nblocks = (uint16_t)nblocks;
+	rec->flags = more ? JR_MORE : 0;
+
+	data = jp->rec_buf + SEC_SIZE;
+	for (i = 0; i < nblocks; i++) {
+		sec = secs[i];
+		rec->sec[i] = (uint32_t)sec;
+		if (sec >= fmp->fat_start &&
+		    sec < fmp->fat_start + fmp->fat_sectors) {
+			memcpy(data, fmp->fat_cache +
+			       (sec - fmp->fat_start) * SEC_SIZE, SEC_SIZE);
+		} else {
+			blk = jnl_lookup(jp, sec);
+			memcpy(data, blk->data, SEC_SIZE);
+		}
+		data += SEC_SIZE;
+	}
+	rec->cksum = jnl_cksum(0, jp->rec_buf,
+			       (size_t)(nblocks + 1) * SEC_SIZE);
+
+	error = jnl_io(fmp, jp->pos, jp->rec_buf, (u_long)nblocks + 1, 1);
+	if (error)
+		return error;
+	jp->pos += nblocks + 1;
+	jp->seq++;
+	return 0;
+}
+
+/*
+ * Add the sector to the record being built.  The record is
+ * written when it is full, or when the last sector is added.
+ */
+static int
+jnl_add(struct fatfsmount *fmp, u_long *secs, int *n, u_long sec,
+	u_long *left)
+{
+	int error;
+
+	secs[(*n)++] = sec;
+	(*left)--;
+	if (*n < FAT_JRECMAX && *left > 0)
+		return 0;
+	error = jnl_write_record(fmp, secs, *n, *left > 0);
+	*n = 0;
+	return error;
+}
+
+/*
+ * Mark the changes as committed.  The FAT sectors are
+ * written to the home location at the checkpoint.
+ */
+static void
+jnl_committed(struct fatfsmount *fmp)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jblock *blk;
+	u_long sec;
+	int i;
+
+	for (sec = 0; fmp->fat_ndirty > 0; sec++) {
+		if (!isset(fmp->fat_dirty, sec))
+			continue;
+		clrbit(fmp->fat_dirty, sec);
+		fmp->fat_ndirty--;
+		if (!isset(jp->fat_ckpt, sec)) {
+			setbit(jp->fat_ckpt, sec);
+			jp->fat_nckpt++;
+		}
+	}
+	for (i = 0; i < FAT_JHASH; i++) {
+		for (blk = jp->hash[i]; blk != NULL; blk = blk->next)
+			blk->dirty = 0;
+	}
+	jp->ndirty = 0;
+}
+
+/*
+ * Commit the changes of the FAT and directories as one
+ * transaction.
+ */
+int
+fat_journal_commit(struct fatfsmount *fmp)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jblock *blk;
+	u_long secs[FAT_JRECMAX];
+	u_long left, need, sec;
+	int i, n, error;
+
+	left = fmp->fat_ndirty + jp->ndirty;
+	if (left == 0)
+		return 0;
+
+	need = left + (left + FAT_JRECMAX - 1) / FAT_JRECMAX;
+	if (jp->pos + need > jp->size) {
+		/* Too large for the journal. */
+		jnl_committed(fmp);
+		return jnl_checkpoint(fmp);
+	}
+
+	n = 0;
+	for (sec = 0; sec < fmp->fat_sectors && left > 0; sec++) {
+		if (!isset(fmp->fat_dirty, sec))
+			continue;
+		error = jnl_add(fmp, secs, &n, fmp->fat_start + sec, &left);
+		if (error)
+			return error;
+	}
+	for (i = 0; i < FAT_JHASH && left > 0; i++) {
+		for (blk = jp->hash[i]; blk != NULL; blk = blk->next) {
+			if (!blk->dirty)
+				continue;
+			error = jnl_add(fmp, secs, &n, blk->sec, &left);
+			if (error)
+				return error;
+		}
+	}
+	jnl_committed(fmp);
+
+	if (jp->revoked || jp->pos > jp->size / 2)
+		return jnl_checkpoint(fmp);
+	return 0;
+}
+
+/*
+ * Commit the changes, and write all logged sectors to their
+ * home location.
+ */
+int
+fat_journal_flush(struct fatfsmount *fmp)
+{
+	int error;
+
+	if ((error = fat_journal_commit(fmp)) != 0)
+		return error;
+	if (fmp->jnl->pos == 1)
+		return 0;
+	return jnl_checkpoint(fmp);
+}
+
+/*
+ * Read the record at the position, and check it.
+ * Returns the number of its blocks, or 0 if it is not valid.
+ */
+static int
+jnl_read_record(struct fatfsmount *fmp, u_long pos, uint32_t seq)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jrec *rec;
+	uint32_t sum;
+	u_long end;
+	int i, n;
+
+	if (pos >= jp->size || jnl_io(fmp, pos, jp->rec_buf, 1, 0) != 0)
+		return 0;
+	rec = (struct fat_jrec *)jp->rec_buf;
+	n = rec->nblocks;
+	if (rec->magic != FAT_JRMAGIC || rec->seq != seq ||
+	    n == 0 || n > FAT_JRECMAX || pos + 1 + n > jp->size)
+		return 0;
+
+	/* All sectors must be in the FAT or in the directories. */
+	end = cl_to_sec(fmp, fmp->last_cluster);
+	for (i = 0; i < n; i++) {
+		if (rec->sec[i] < fmp->fat_start || rec->sec[i] >= end)
+			return 0;
+	}
+	if (jnl_io(fmp, pos + 1, jp->rec_buf + SEC_SIZE, (u_long)n, 0) != 0)
+		return 0;
+
+	sum = rec->cksum;
+	rec->cksum = 0;
+	if (jnl_cksum(0, jp->rec_buf, (size_t)(n + 1) * SEC_SIZE) != sum)
+		return 0;
+	return n;
+}
+
+/*
+ * Replay the committed transactions in the journal.
+ * The number of the replayed records is returned in nrecs.
+ */
+static int
+jnl_replay(struct fatfsmount *fmp, int *nrecs)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jrec *rec;
+	struct fat_jhdr *hdr;
+	u_long pos, end;
+	uint32_t seq, endseq;
+	int i, n, error;
+
+	*nrecs = 0;
+	if ((error = jnl_io(fmp, 0, jp->rec_buf, 1, 0)) != 0)
+		return error;
+	hdr = (struct fat_jhdr *)jp->rec_buf;
+	if (hdr->magic != FAT_JMAGIC) {
+		/* New journal */
+		jp->seq = 1;
+		return 0;
+	}
+	jp->seq = hdr->seq;
+
+	/*
+	 * Find the end of the last complete transaction.
+	 */
+	pos = end = 1;
+	seq = endseq = jp->seq;
+	while ((n = jnl_read_record(fmp, pos, seq)) != 0) {
+		rec = (struct fat_jrec *)jp->rec_buf;
+		pos += n + 1;
+		seq++;
+		if (!(rec->flags & JR_MORE)) {
+			end = pos;
+			endseq = seq;
+		}
+	}
+
+	/*
+	 * Write the logged sectors in order.
+	 */
+	pos = 1;
+	seq = jp->seq;
+	while (pos < end) {
+		if ((n = jnl_read_record(fmp, pos, seq)) == 0)
+			return EIO;
+		rec = (struct fat_jrec *)jp->rec_buf;
+		for (i = 0; i < n; i++) {
+			error = jnl_write_home(fmp, rec->sec[i],
+					       jp->rec_buf + (i + 1) * SEC_SIZE);
+			if (error)
+				return error;
+		}
+		pos += n + 1;
+		seq++;
+		(*nrecs)++;
+	}
+	jp->seq = endseq;
+	return 0;
+}
+
+/*
+ * Create the journal file in the root directory.
+ */
+static int
+jnl_create(struct fatfsmount *fmp, vnode_t rvp, u_long size,
+	   struct fatfs_node *np)
+{
+	struct fat_dirent *de;
+	u_long first, prev, cl, i, ncl;
+	int error;
+
+	ncl = (size + fmp->cluster_size - 1) / fmp->cluster_size;
+	first = prev = 0;
+	for (i = 0; i < ncl; i++) {
+		if ((error = fat_alloc_cluster(fmp, prev, &cl)) != 0)
+			goto err;
+		if (prev == 0)
+			first = cl;
+		else
+			fat_set_cluster(fmp, prev, cl);
+		fat_set_cluster(fmp, cl, fmp->fat_eof);
+		prev = cl;
+	}
+
+	de = &np->dirent;
+	memset(de, 0, sizeof(struct fat_dirent));
+	DE_SET_CLUSTER(de, first);
+	de->time = TEMP_TIME;
+	de->date = TEMP_DATE;
+	de->attr = FA_RDONLY | FA_HIDDEN | FA_SYSTEM;
+	de->size = ncl * fmp->cluster_size;
+	if ((error = fatfs_add_node(rvp, FAT_JNAME, np)) != 0)
+		goto err;
+	return fat_sync(fmp);
+ err:
+	if (first != 0)
+		fat_free_clusters(fmp, first);
+	fat_sync(fmp);
+	return error;
+}
+
+/*
+ * Start the journal.  The journal file is created if it
+ * does not exist and the size is given.  The committed
+ * transactions are replayed if the journal exists.
+ */
+int
+fat_journal_open(struct fatfsmount *fmp, vnode_t rvp, u_long size)
+{
+	struct fat_journal *jp;
+	struct fatfs_node np;
+	u_long cl, i;
+	int nrecs, error;
+
+	error = fatfs_lookup_node(rvp, FAT_JNAME, &np);
+	if (error == ENOENT && size != 0)
+		error = jnl_create(fmp, rvp, size, &np);
+	if (error)
+		return (error == ENOENT) ? 0 : error;
+	if (!IS_FILE(&np.dirent))
+		return 0;
+
+	if ((jp = malloc(sizeof(struct fat_journal))) == NULL)
+		return ENOMEM;
+	memset(jp, 0, sizeof(struct fat_journal));
+	jp->nclusters = np.dirent.size / fmp->cluster_size;
+	jp->size = jp->nclusters * fmp->sec_per_cl;
+	if (jp->size < (FAT_JRECMAX + 1) * 2 + 1) {
+		/* Not a journal.  Use the file system without it. */
+		DPRINTF(("fatfs: journal too small\n"));
+		error = 0;
+		goto err1;
+	}
+
+	error = ENOMEM;
+	jp->clusters = malloc(jp->nclusters * sizeof(u_long));
+	if (jp->clusters == NULL)
+		goto err1;
+	jp->fat_ckpt = malloc(fmp->fat_sectors / 8 + 1);
+	if (jp->fat_ckpt == NULL)
+		goto err2;
+	memset(jp->fat_ckpt, 0, fmp->fat_sectors / 8 + 1);
+	if (vm_allocate(task_self(), (void **)&jp->rec_buf,
+			(FAT_JRECMAX + 1) * SEC_SIZE, 1) != 0)
+		goto err3;
+
+	/* Map the clusters of the journal. */
+	cl = DE_CLUSTER(&np.dirent);
+	for (i = 0; i < jp->nclusters; i++) {
+		if (cl < CL_FIRST || cl >= fmp->last_cluster) {
+			error = EIO;
+			goto err4;
+		}
+		jp->clusters[i] = cl;
+		if ((error = fat_next_cluster(fmp, cl, &cl)) != 0)
+			goto err4;
+	}
+
+	fmp->jnl = jp;
+	if ((error = jnl_replay(fmp, &nrecs)) != 0)
+		goto err5;
+	if (nrecs > 0) {
+		/*
+		 * The FAT and directories were changed.  Reload
+		 * the FAT, and drop the cached directories.
+		 */
+		DPRINTF(("fatfs: %d records replayed\n", nrecs));
+		fat_dirhash_flush(fmp);
+		fmp->dir_sec = SEC_INVAL;
+		if ((error = fat_reload(fmp)) != 0)
+			goto err5;
+	}
+	jp->pos = 1;
+	if ((error = jnl_write_header(fmp)) != 0)
+		goto err5;
+	return 0;
+ err5:
+	fmp->jnl = NULL;
+ err4:
+	vm_free(task_self(), jp->rec_buf);
+ err3:
+	free(jp->fat_ckpt);
+ err2:
+	free(jp->clusters);
+ err1:
+	free(jp);
+	return error;
+}
+
+/*
+ * Stop the journal.  All changes must be flushed by
+ * fat_journal_flush() before.
+ */
+void
+fat_journal_close(struct fatfsmount *fmp)
+{
+	struct fat_journal *jp = fmp->jnl;
+	struct fat_jblock *blk;
+	int i;
+
+	for (i = 0; i < FAT_JHASH; i++) {
+		while ((blk = jp->hash[i]) != NULL) {
+			jp->hash[i] = blk->next;
+			free(blk);
+		}
+	}
+	vm_free(task_self(), jp->rec_buf);
+	free(jp->fat_ckpt);
+	free(jp->clusters);
+	free(jp);
+	fmp->jnl = NULL;
+}
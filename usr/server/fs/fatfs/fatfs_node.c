@@ -38,75 +38,349 @@
 
 #include "fatfs.h"
 
+/*
+ * A directory is an array of 32-byte slots.  The slots of the
+ * root directory of FAT12/16 are placed in the fixed area, and
+ * the slots of other directories are placed in their cluster
+ * chain.  A name is stored in a short name entry and the long
+ * name entries just before it.
+ *
+ * The names in directory are entered to the name index when
+ * the directory is accessed first, so that a name can be found
+ * without reading the whole directory.
+ */
+
+#define SLOTS_PER_CL(fmp)	(DIR_PER_SEC * (fmp)->sec_per_cl)
+
+/*
+ * Position in directory
+ */
+struct fat_dirpos {
+	u_long	start;		/* first cluster#, or CL_ROOT */
+	u_long	cl;		/* current cluster# */
+	u_long	index;		/* index of current cluster */
+};
+
 /*
  * Read directory entry to buffer, with cache.
+ * The sector logged to the journal is newer than the disk.
  */
 static int
 fat_read_dirent(struct fatfsmount *fmp, u_long sec)
 {
 	struct buf *bp;
+	char *data;
 	int error;
 
+	if (fmp->jnl != NULL && (data = fat_journal_get(fmp, sec)) != NULL) {
+		memcpy(fmp->dir_buf, data, SEC_SIZE);
+		fmp->dir_sec = sec;
+		return 0;
+	}
+	fmp->dir_sec = SEC_INVAL;
 	if ((error = bread(fmp->dev, sec, &bp)) != 0)
 		return error;
 	memcpy(fmp->dir_buf, bp->b_data, SEC_SIZE);
 	brelse(bp);
+	fmp->dir_sec = sec;
 	return 0;
 }
 
 /*
  * Write directory entry from buffer.
+ * If the journal is enabled, the sector is logged to it by
+ * the next fat_sync().
  */
 static int
 fat_write_dirent(struct fatfsmount *fmp, u_long sec)
 {
 	struct buf *bp;
+	int error;
 
+	if (fmp->jnl != NULL) {
+		error = fat_journal_put(fmp, sec, fmp->dir_buf);
+		fmp->dir_sec = error ? SEC_INVAL : sec;
+		return error;
+	}
 	bp = getblk(fmp->dev, sec);
 	memcpy(bp->b_data, fmp->dir_buf, SEC_SIZE);
+	fmp->dir_sec = sec;
 	return bwrite(bp);
 }
 
 /*
- * Find directory entry in specified sector.
- * The fat vnode data is filled if success.
+ * Fill all sectors of the cluster with zero.
+ */
+static int
+fat_clear_cluster(struct fatfsmount *fmp, u_long cl)
+{
+	u_long sec;
+	int i, error;
+
+	memset(fmp->dir_buf, 0, SEC_SIZE);
+	sec = cl_to_sec(fmp, cl);
+	for (i = 0; i < fmp->sec_per_cl; i++) {
+		error = fat_write_dirent(fmp, sec);
+		if (error)
+			return error;
+		sec++;
+	}
+	return 0;
+}
+
+/*
+ * Start to access the directory.
+ * The root directory of FAT32 is accessed as a cluster chain.
+ */
+static void
+fat_dir_start(struct fatfsmount *fmp, u_long dcl, struct fat_dirpos *pos)
+{
+
+	if (dcl == CL_ROOT && FAT32(fmp))
+		dcl = fmp->root_cluster;
+	pos->start = dcl;
+	pos->cl = dcl;
+	pos->index = 0;
+	fmp->dir_sec = SEC_INVAL;
+}
+
+/*
+ * Get the sector# holding the slot.
+ * Returns ENOENT if the slot is beyond the end of directory.
+ */
+static int
+fat_slot_sector(struct fatfsmount *fmp, struct fat_dirpos *pos,
+		u_long slot, u_long *sec)
+{
+	u_long index, next;
+	int error;
+
+	if (pos->start == CL_ROOT) {
+		if (slot >= fmp->root_slots)
+			return ENOENT;
+		*sec = fmp->root_start + slot / DIR_PER_SEC;
+		return 0;
+	}
+
+	index = slot / SLOTS_PER_CL(fmp);
+	if (index < pos->index) {
+		pos->cl = pos->start;
+		pos->index = 0;
+	}
+	while (pos->index < index) {
+		error = fat_next_cluster(fmp, pos->cl, &next);
+		if (error)
+			return error;
+		if (IS_EOFCL(fmp, next))
+			return ENOENT;
+		pos->cl = next;
+		pos->index++;
+	}
+	*sec = cl_to_sec(fmp, pos->cl) +
+		(slot % SLOTS_PER_CL(fmp)) / DIR_PER_SEC;
+	return 0;
+}
+
+/*
+ * Read the slot in directory.
+ * The entry is returned in the directory buffer.
+ */
+static int
+fat_read_slot(struct fatfsmount *fmp, struct fat_dirpos *pos,
+	      u_long slot, struct fat_dirent **dep)
+{
+	u_long sec;
+	int error;
+
+	error = fat_slot_sector(fmp, pos, slot, &sec);
+	if (error)
+		return error;
+	if (sec != fmp->dir_sec) {
+		error = fat_read_dirent(fmp, sec);
+		if (error)
+			return error;
+	}
+	*dep = (struct fat_dirent *)fmp->dir_buf + slot % DIR_PER_SEC;
+	return 0;
+}
+
+/*
+ * Get the next entry from the slot in directory.
+ * The name of the entry is its long name if it has a valid
+ * one, otherwise its short name.
  *
  * @fmp: fatfs mount point
- * @sec: sector#
- * @name: file name
- * @node: pointer to fat node
+ * @pos: position in directory
+ * @slot: slot# to start, and slot# of the entry to return
+ * @name: file name to return (NAME_MAX bytes)
+ * @np: pointer to fat node
  */
 static int
-fat_lookup_dirent(struct fatfsmount *fmp, u_long sec, char *name,
-		  struct fatfs_node *np)
+fat_next_entry(struct fatfsmount *fmp, struct fat_dirpos *pos,
+	       u_long *slot, char *name, struct fatfs_node *np)
 {
 	struct fat_dirent *de;
-	int error, i;
+	struct fat_lfnent *lde;
+	u_long s;
+	u_char sum = 0;
+	int nlong, ord, toolong, error;
+
+	nlong = ord = toolong = 0;
+	for (s = *slot; ; s++) {
+		error = fat_read_slot(fmp, pos, s, &de);
+		if (error == 0 && IS_EMPTY(de))
+			error = ENOENT;
+		if (error) {
+			*slot = s;
+			return error;
+		}
+		if (IS_DELETED(de)) {
+			nlong = 0;
+			continue;
+		}
+		if (IS_LFN(de)) {
+			/* Collect the characters of long name */
+			lde = (struct fat_lfnent *)de;
+			if (lde->ord & LFN_LAST) {
+				nlong = ord = lde->ord & LFN_ORD_MASK;
+				if (nlong > LFN_MAXENT)
+					nlong = 0;
+				sum = lde->checksum;
+				toolong = 0;
+				memset(name, 0, NAME_MAX);
+			}
+			if (nlong == 0 || ord != (lde->ord & LFN_ORD_MASK) ||
+			    lde->checksum != sum) {
+				nlong = 0;
+				continue;
+			}
+			if (fat_get_lfn(lde, name))
+				toolong = 1;
+			ord--;
+			continue;
+		}
+		if (IS_VOL(de)) {
+			nlong = 0;
+			continue;
+		}
 
-	error = fat_read_dirent(fmp, sec);
-	if (error)
+		/* Use the long name if it belongs to this entry. */
+		if (nlong > 0 &&
+		    (ord != 0 || toolong || fat_checksum(de->name) != sum))
+			nlong = 0;
+		if (nlong == 0)
+			fat_restore_name(de, name);
+
+		np->dirent = *de;
+		np->sector = fmp->dir_sec;
+		np->offset = sizeof(struct fat_dirent) * (s % DIR_PER_SEC);
+		np->slot = s;
+		np->nlong = nlong;
+		*slot = s;
+		DPRINTF(("fat_next_entry: %s slot=%d\n", name, s));
+		return 0;
+	}
+}
+
+/*
+ * Get the name index of directory.
+ * The index is built by reading the directory if it is not
+ * indexed yet.
+ */
+static int
+fat_get_dirhash(struct fatfsmount *fmp, u_long dcl, struct fat_dirhash **dhp)
+{
+	struct fat_dirhash *dh;
+	struct fat_dirpos pos;
+	struct fatfs_node np;
+	char name[NAME_MAX];
+	char alias[13];
+	u_long slot, used, cl;
+	int error;
+
+	if ((dh = fat_dirhash_find(fmp, dcl)) != NULL) {
+		*dhp = dh;
+		return 0;
+	}
+	if ((error = fat_dirhash_create(fmp, dcl, &dh)) != 0)
 		return error;
 
-	de = (struct fat_dirent *)fmp->dir_buf;
+	DPRINTF(("fat_get_dirhash: build index for cl=%d\n", dcl));
 
-	for (i = 0; i < DIR_PER_SEC; i++) {
-		/* Find specific file or directory name */
-		if (IS_EMPTY(de))
-			return ENOENT;
-		if (!IS_VOL(de) &&
-		    !fat_compare_name((char *)de->name, name)) {
-			/* Found. Fill the fat vnode data. */
-			*(&np->dirent) = *de;
-			np->sector = sec;
-			np->offset = sizeof(struct fat_dirent) * i;
-			DPRINTF(("fat_lookup_dirent: found sec=%d\n", sec));
+	fat_dir_start(fmp, dcl, &pos);
+	used = 0;
+	for (slot = 0; ; slot++) {
+		error = fat_next_entry(fmp, &pos, &slot, name, &np);
+		if (error == ENOENT)
+			break;
+		if (error)
+			goto err;
+		error = fat_dirhash_add(dh, name, slot, np.nlong);
+		if (error)
+			goto err;
+		if (np.nlong > 0) {
+			fat_restore_name(&np.dirent, alias);
+			if (strcasecmp(alias, name)) {
+				error = fat_dirhash_add(dh, alias, slot,
+							np.nlong);
+				if (error)
+					goto err;
+			}
+		}
+		used += np.nlong + 1;
+	}
+	dh->end = slot;
+	dh->ndeleted = slot - used;
+
+	/* Get the size of directory */
+	if (pos.start == CL_ROOT)
+		dh->size = fmp->root_slots;
+	else {
+		cl = pos.start;
+		dh->size = SLOTS_PER_CL(fmp);
+		for (;;) {
+			error = fat_next_cluster(fmp, cl, &cl);
+			if (error)
+				goto err;
+			if (IS_EOFCL(fmp, cl))
+				break;
+			dh->size += SLOTS_PER_CL(fmp);
+		}
+	}
+	*dhp = dh;
+	return 0;
+ err:
+	fat_dirhash_drop(fmp, dcl);
+	return error;
+}
+
+/*
+ * Find the name by reading the directory.
+ * This is used when the directory can not be indexed.
+ */
+static int
+fat_scan_name(struct fatfsmount *fmp, u_long dcl, char *name,
+	      struct fatfs_node *np)
+{
+	struct fat_dirpos pos;
+	char buf[NAME_MAX];
+	char alias[13];
+	u_long slot;
+	int error;
+
+	fat_dir_start(fmp, dcl, &pos);
+	for (slot = 0; ; slot++) {
+		error = fat_next_entry(fmp, &pos, &slot, buf, np);
+		if (error)
+			return error;
+		if (!strcasecmp(buf, name))
 			return 0;
+		if (np->nlong > 0) {
+			fat_restore_name(&np->dirent, alias);
+			if (!strcasecmp(alias, name))
+				return 0;
 		}
-		if (!IS_DELETED(de))
-			DPRINTF(("fat_lookup_dirent: %s\n", de->name));
-		de++;
 	}
-	return EAGAIN;
 }
 
 /*
@@ -121,229 +395,324 @@ int
 fatfs_lookup_node(vnode_t dvp, char *name, struct fatfs_node *np)
 {
 	struct fatfsmount *fmp;
-	char fat_name[12];
-	u_long cl, sec;
-	int i, error;
+	struct fat_dirhash *dh;
+	struct fat_hashent *he;
+	struct fat_dirpos pos;
+	struct fat_dirent *de;
+	int error;
 
 	if (name == NULL)
 		return ENOENT;
 
-	DPRINTF(("fat_lookup_denode: cl=%d name=%s\n", dvp->v_blkno, name));
-
-	fat_convert_name(name, fat_name);
-	*(fat_name + 11) = '\0';
+	DPRINTF(("fatfs_lookup_node: cl=%d name=%s\n", dvp->v_blkno, name));
 
 	fmp = (struct fatfsmount *)dvp->v_mount->m_data;
-	cl = dvp->v_blkno;
-	if (cl == CL_ROOT) {
-		/* Search entry in root directory */
-		for (sec = fmp->root_start; sec < fmp->data_start; sec++) {
-			error = fat_lookup_dirent(fmp, sec, fat_name, np);
-			if (error != EAGAIN)
-				return error;
-		}
-	} else {
-		/* Search entry in sub directory */
-		while (!IS_EOFCL(fmp, cl)) {
-			sec = cl_to_sec(fmp, cl);
-			for (i = 0; i < fmp->sec_per_cl; i++) {
-				error = fat_lookup_dirent(fmp, sec, fat_name,
-						   np);
-				if (error != EAGAIN)
-					return error;
-				sec++;
-			}
-			error = fat_next_cluster(fmp, cl, &cl);
-			if (error)
-				return error;
-		}
-	}
-	return ENOENT;
-}
+	error = fat_get_dirhash(fmp, dvp->v_blkno, &dh);
+	if (error == ENOMEM)
+		return fat_scan_name(fmp, dvp->v_blkno, name, np);
+	if (error)
+		return error;
 
-/*
- * Get directory entry for specified index in sector.
- * The directory entry is filled if success.
- *
- * @fmp: fatfs mount point
- * @sec: sector#
- * @target: target index
- * @index: current index
- * @np: pointer to fat node
- */
-static int
-fat_get_dirent(struct fatfsmount *fmp, u_long sec, int target, int *index,
-	       struct fatfs_node *np)
-{
-	struct fat_dirent *de;
-	int error, i;
+	if ((he = fat_dirhash_lookup(dh, name)) == NULL)
+		return ENOENT;
 
-	error = fat_read_dirent(fmp, sec);
+	fat_dir_start(fmp, dvp->v_blkno, &pos);
+	error = fat_read_slot(fmp, &pos, he->slot, &de);
 	if (error)
 		return error;
-
-	de = (struct fat_dirent *)fmp->dir_buf;
-	for (i = 0; i < DIR_PER_SEC; i++) {
-		if (IS_EMPTY(de))
-			return ENOENT;
-		if (!IS_DELETED(de) && !IS_VOL(de)) {
-			/* valid file */
-			if (*index == target) {
-				*(&np->dirent) = *de;
-				np->sector = sec;
-				np->offset = sizeof(struct fat_dirent) * i;
-				DPRINTF(("fat_get_dirent: found index=%d\n", *index));
-				return 0;
-			}
-			(*index)++;
-		}
-		DPRINTF(("fat_get_dirent: %s\n", de->name));
-		de++;
-	}
-	return EAGAIN;
+	np->dirent = *de;
+	np->sector = fmp->dir_sec;
+	np->offset = sizeof(struct fat_dirent) * (he->slot % DIR_PER_SEC);
+	np->slot = he->slot;
+	np->nlong = he->nlong;
+	return 0;
 }
 
 /*
- * Get directory entry for specified index.
+ * Get the directory entry at or after the specified slot.
+ * The directory entry and its name are filled if success.
  *
  * @dvp: vnode for directory.
- * @index: index of the entry
+ * @slot: slot# to start, and slot# of the entry to return
+ * @name: file name to return (NAME_MAX bytes)
  * @np: pointer to fat node
  */
 int
-fatfs_get_node(vnode_t dvp, int index, struct fatfs_node *np)
+fatfs_get_node(vnode_t dvp, u_long *slot, char *name, struct fatfs_node *np)
 {
 	struct fatfsmount *fmp;
-	u_long cl, sec;
-	int i, cur_index, error;
+	struct fat_dirpos pos;
 
 	fmp = (struct fatfsmount *)dvp->v_mount->m_data;
-	cl = dvp->v_blkno;
-	cur_index = 0;
 
-	DPRINTF(("fatfs_get_node: index=%d\n", index));
+	DPRINTF(("fatfs_get_node: slot=%d\n", *slot));
+
+	fat_dir_start(fmp, dvp->v_blkno, &pos);
+	return fat_next_entry(fmp, &pos, slot, name, np);
+}
+
+/*
+ * Make a unique short name for the long name.
+ * The names in directory are checked with its index.  The
+ * numeric tail is made from the hash of long name after a few
+ * tries, not to search too many names.
+ */
+static int
+fat_make_alias(struct fat_dirhash *dh, char *name, u_char *sname)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	struct fat_dirent de;
+	u_char basis[11];
+	char alias[13];
+	u_int h;
+	char *p;
+	int i, n;
+
+	fat_basis_name(name, basis);
+	for (h = 0, p = name; *p != '\0'; p++)
+		h = h * 31 + (u_char)*p;
+
+	memset(&de, 0, sizeof(de));
+	for (n = 1; n < 0x10000; n++) {
+		memcpy(sname, basis, 11);
+		if (n > 4) {
+			if (sname[1] == ' ')
+				sname[1] = '_';
+			for (i = 0; i < 4; i++)
+				sname[2 + i] =
+					hex[((h + n) >> (12 - i * 4)) & 0xf];
+			fat_numeric_tail(sname, 1);
+		} else
+			fat_numeric_tail(sname, (u_long)n);
+
+		memcpy(de.name, sname, 11);
+		fat_restore_name(&de, alias);
+		if (fat_dirhash_lookup(dh, alias) == NULL)
+			return 0;
+	}
+	return EEXIST;
+}
+
+/*
+ * Find free slots for new entries.
+ * The slots after the last entry are used first, then the
+ * deleted slots are searched.  The directory is expanded if
+ * no free slots are found.
+ */
+static int
+fat_alloc_slots(struct fatfsmount *fmp, u_long dcl, struct fat_dirhash *dh,
+		int need, u_long *slot)
+{
+	struct fat_dirpos pos;
+	struct fat_dirent *de;
+	u_long s, run, cl, first, next, size;
+	int error;
 
-	if (cl == CL_ROOT) {
-		/* Get entry from the root directory */
-		for (sec = fmp->root_start; sec < fmp->data_start; sec++) {
-			error = fat_get_dirent(fmp, sec, index, &cur_index, np);
-			if (error != EAGAIN)
+	if (dh->end + need <= dh->size) {
+		*slot = dh->end;
+		dh->end += need;
+		return 0;
+	}
+
+	fat_dir_start(fmp, dcl, &pos);
+	if (dh->ndeleted >= need && (dh->nofit == 0 || need < dh->nofit)) {
+		run = 0;
+		for (s = 0; s < dh->end; s++) {
+			error = fat_read_slot(fmp, &pos, s, &de);
+			if (error)
 				return error;
+			if (!IS_DELETED(de)) {
+				run = 0;
+				continue;
+			}
+			if (++run == need) {
+				*slot = s + 1 - need;
+				dh->ndeleted -= need;
+				return 0;
+			}
+		}
+		/* Do not search again until an entry is removed. */
+		dh->nofit = need;
+	}
+
+	/*
+	 * No free slots.  Add clusters for directory until the
+	 * new entries fit.  A long name may need more than one.
+	 */
+	if (pos.start == CL_ROOT)
+		return ENOSPC;
+	DPRINTF(("fat_alloc_slots: expand dir\n"));
+	first = 0;
+	cl = pos.start;
+	for (size = dh->size; dh->end + need > size;
+	     size += SLOTS_PER_CL(fmp)) {
+		error = fat_expand_dir(fmp, cl, &cl);
+		if (error == 0) {
+			if (first == 0)
+				first = cl;
+			error = fat_clear_cluster(fmp, cl);
 		}
-	} else {
-		/* Get entry from the sub directory */
-		while (!IS_EOFCL(fmp, cl)) {
-			sec = cl_to_sec(fmp, cl);
-			for (i = 0; i < fmp->sec_per_cl; i++) {
-				error = fat_get_dirent(fmp, sec, index,
-						     &cur_index, np);
-				if (error != EAGAIN)
-					return error;
-				sec++;
+		if (error) {
+			/* Free the clusters added. */
+			if (first != 0) {
+				for (cl = pos.start;
+				     fat_next_cluster(fmp, cl, &next) == 0 &&
+					     next != first;
+				     cl = next)
+					;
+				fat_free_clusters(fmp, first);
+				fat_set_cluster(fmp, cl, fmp->fat_eof);
 			}
-			error = fat_next_cluster(fmp, cl, &cl);
-			if (error)
-				return error;
+			return error;
 		}
 	}
-	return ENOENT;
+	dh->size = size;
+	*slot = dh->end;
+	dh->end += need;
+	return 0;
 }
 
 /*
- * Find empty directory entry and put new entry on it.
+ * Put new entry to the directory.
+ * The long name entries are added if the name can not be
+ * stored in the short name entry.
  *
- * @fmp: fatfs mount point
- * @sec: sector#
+ * @dvp: vnode for directory.
+ * @name: file name
  * @np: pointer to fat node
  */
-static int
-fat_add_dirent(struct fatfsmount *fmp, u_long sec, struct fatfs_node *np)
+int
+fatfs_add_node(vnode_t dvp, char *name, struct fatfs_node *np)
 {
+	struct fatfsmount *fmp;
+	struct fat_dirhash *dh;
+	struct fat_dirpos pos;
 	struct fat_dirent *de;
-	int error, i;
+	struct fat_lfnent *lde;
+	u_char sname[11], ntres, sum;
+	char alias[13];
+	u_long slot;
+	int i, nlong, error;
 
-	error = fat_read_dirent(fmp, sec);
+	fmp = (struct fatfsmount *)dvp->v_mount->m_data;
+
+	DPRINTF(("fatfs_add_node: cl=%d name=%s\n", dvp->v_blkno, name));
+
+	error = fat_get_dirhash(fmp, dvp->v_blkno, &dh);
 	if (error)
 		return error;
 
-	de = (struct fat_dirent *)fmp->dir_buf;
-	for (i = 0; i < DIR_PER_SEC; i++) {
-		if (IS_DELETED(de) || IS_EMPTY(de))
-			goto found;
-		DPRINTF(("fat_add_dirent: scan %s\n", de->name));
-		de++;
+	/* Make the short name, and the long name if needed. */
+	nlong = 0;
+	if (!fat_short_name(name, sname, &ntres)) {
+		nlong = (strlen(name) + LFN_CHARS - 1) / LFN_CHARS;
+		ntres = 0;
+		error = fat_make_alias(dh, name, sname);
+		if (error)
+			return error;
 	}
-	return ENOENT;
+	memcpy(np->dirent.name, sname, 11);
+	np->dirent.ntres = ntres;
+
+	error = fat_alloc_slots(fmp, dvp->v_blkno, dh, nlong + 1, &slot);
+	if (error)
+		goto err;
 
- found:
-	DPRINTF(("fat_add_dirent: found. sec=%d\n", sec));
-	memcpy(de, &np->dirent, sizeof(struct fat_dirent));
-	error = fat_write_dirent(fmp, sec);
+	/* Write the long name entries, then the short name entry. */
+	sum = fat_checksum(sname);
+	fat_dir_start(fmp, dvp->v_blkno, &pos);
+	for (i = 0; i <= nlong; i++) {
+		error = fat_read_slot(fmp, &pos, slot + i, &de);
+		if (error)
+			goto err;
+		if (i < nlong) {
+			lde = (struct fat_lfnent *)de;
+			memset(lde, 0, sizeof(struct fat_lfnent));
+			lde->ord = (u_char)(nlong - i);
+			if (i == 0)
+				lde->ord |= LFN_LAST;
+			lde->attr = FA_LFN;
+			lde->checksum = sum;
+			fat_put_lfn(lde, name);
+		} else
+			*de = np->dirent;
+
+		/* Write the sector when all its entries are set. */
+		if (i == nlong || (slot + i + 1) % DIR_PER_SEC == 0) {
+			error = fat_write_dirent(fmp, fmp->dir_sec);
+			if (error)
+				goto err;
+		}
+	}
+	np->sector = fmp->dir_sec;
+	np->offset = sizeof(struct fat_dirent) * ((slot + nlong) % DIR_PER_SEC);
+	np->slot = slot + nlong;
+	np->nlong = nlong;
+
+	/* Enter the new names to the index. */
+	error = fat_dirhash_add(dh, name, np->slot, nlong);
+	if (error == 0 && nlong > 0) {
+		fat_restore_name(&np->dirent, alias);
+		error = fat_dirhash_add(dh, alias, np->slot, nlong);
+	}
+	if (error)
+		fat_dirhash_drop(fmp, dvp->v_blkno);
+	return 0;
+ err:
+	/* The index may not match the directory now. */
+	fat_dirhash_drop(fmp, dvp->v_blkno);
 	return error;
 }
 
 /*
- * Find empty directory entry and put new entry on it.
- * This search is done only in directory of specified cluster.
+ * Remove directory entry and its long name entries.
+ *
  * @dvp: vnode for directory.
  * @np: pointer to fat node
  */
 int
-fatfs_add_node(vnode_t dvp, struct fatfs_node *np)
+fatfs_del_node(vnode_t dvp, struct fatfs_node *np)
 {
 	struct fatfsmount *fmp;
-	u_long cl, sec;
-	int i, error;
-	u_long next;
+	struct fat_dirhash *dh;
+	struct fat_dirpos pos;
+	struct fat_dirent *de;
+	struct fatfs_node tmp;
+	char name[NAME_MAX];
+	u_long slot;
+	int error;
 
 	fmp = (struct fatfsmount *)dvp->v_mount->m_data;
-	cl = dvp->v_blkno;
 
-	DPRINTF(("fatfs_add_node: cl=%d\n", cl));
+	DPRINTF(("fatfs_del_node: cl=%d slot=%d\n", dvp->v_blkno, np->slot));
 
-	if (cl == CL_ROOT) {
-		/* Add entry in root directory */
-		for (sec = fmp->root_start; sec < fmp->data_start; sec++) {
-			error = fat_add_dirent(fmp, sec, np);
-			if (error != ENOENT)
-				return error;
-		}
-	} else {
-		/* Search entry in sub directory */
-		while (!IS_EOFCL(fmp, cl)) {
-			sec = cl_to_sec(fmp, cl);
-			for (i = 0; i < fmp->sec_per_cl; i++) {
-				error = fat_add_dirent(fmp, sec, np);
-				if (error != ENOENT)
-					return error;
-				sec++;
-			}
-			error = fat_next_cluster(fmp, cl, &next);
-			if (error)
-				return error;
-			cl = next;
-		}
-		/* No entry found, add one more free cluster for directory */
-		DPRINTF(("fatfs_add_node: expand dir\n"));
-		error = fat_expand_dir(fmp, cl, &next);
+	if ((dh = fat_dirhash_find(fmp, dvp->v_blkno)) != NULL) {
+		/* Remove the names from the index. */
+		fat_dir_start(fmp, dvp->v_blkno, &pos);
+		slot = np->slot - np->nlong;
+		error = fat_next_entry(fmp, &pos, &slot, name, &tmp);
 		if (error)
 			return error;
+		fat_dirhash_remove(dh, name, np->slot);
+		fat_restore_name(&np->dirent, name);
+		fat_dirhash_remove(dh, name, np->slot);
+		dh->ndeleted += np->nlong + 1;
+		dh->nofit = 0;
+	}
 
-		/* Initialize free cluster. */
-		memset(fmp->dir_buf, 0, SEC_SIZE);
-		sec = cl_to_sec(fmp, next);
-		for (i = 0; i < fmp->sec_per_cl; i++) {
-			error = fat_write_dirent(fmp, sec);
+	fat_dir_start(fmp, dvp->v_blkno, &pos);
+	for (slot = np->slot - np->nlong; slot <= np->slot; slot++) {
+		error = fat_read_slot(fmp, &pos, slot, &de);
+		if (error)
+			return error;
+		de->name[0] = SLOT_DELETED;
+		if (slot == np->slot || (slot + 1) % DIR_PER_SEC == 0) {
+			error = fat_write_dirent(fmp, fmp->dir_sec);
 			if (error)
 				return error;
-			sec++;
 		}
-		/* Try again */
-		sec = cl_to_sec(fmp, next);
-		error = fat_add_dirent(fmp, sec, np);
-		return error;
 	}
-	return ENOENT;
+	return 0;
 }
 
 /*
@@ -367,3 +736,64 @@ fatfs_put_node(struct fatfsmount *fmp, struct fatfs_node *np)
 	return error;
 }
 
+/*
+ * Initialize the cluster for new directory.
+ * The "." and ".." entries are put to it.
+ *
+ * @fmp: fat mount data
+ * @cl: cluster# of new directory
+ * @parent: cluster# of parent directory
+ */
+int
+fatfs_init_dir(struct fatfsmount *fmp, u_long cl, u_long parent)
+{
+	struct fat_dirent *de;
+	int error;
+
+	error = fat_clear_cluster(fmp, cl);
+	if (error)
+		return error;
+
+	memset(fmp->dir_buf, 0, SEC_SIZE);
+	de = (struct fat_dirent *)fmp->dir_buf;
+	memcpy(de->name, ".          ", 11);
+	de->attr = FA_SUBDIR;
+	DE_SET_CLUSTER(de, cl);
+	de->time = TEMP_TIME;
+	de->date = TEMP_DATE;
+	de++;
+	memcpy(de->name, "..         ", 11);
+	de->attr = FA_SUBDIR;
+	DE_SET_CLUSTER(de, parent);
+	de->time = TEMP_TIME;
+	de->date = TEMP_DATE;
+
+	return fat_write_dirent(fmp, cl_to_sec(fmp, cl));
+}
+
+/*
+ * Change the parent directory in ".." entry.
+ *
+ * @fmp: fat mount data
+ * @cl: cluster# of directory
+ * @parent: cluster# of new parent directory
+ */
+int
+fatfs_set_parent(struct fatfsmount *fmp, u_long cl, u_long parent)
+{
+	struct fat_dirent *de;
+	u_long sec;
+	int error;
+
+	sec = cl_to_sec(fmp, cl);
+	error = fat_read_dirent(fmp, sec);
+	if (error)
+		return error;
+
+	de = (struct fat_dirent *)fmp->dir_buf + 1;
+	DE_SET_CLUSTER(de, parent);
+	de->time = TEMP_TIME;
+	de->date = TEMP_DATE;
+
+	return fat_write_dirent(fmp, sec);
+}
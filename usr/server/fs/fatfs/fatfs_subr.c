@@ -39,118 +39,253 @@
 
 
 /*
- * Convert file name to 8.3 format
- *  Ex. "foo.bar" => "foo     bar"
+ * Byte offset of each character in long file name entry
  */
-void
-fat_convert_name(char *org, char *name)
-{
-	int i;
-
-	memset(name, (int)' ', 11);
-	for (i = 0; i <= 11; i++) {
-		if (!*org)
-			break;
-		if (*org == '/')
-			break;
-		if (*org == '.') {
-			i = 7;
-			org++;
-			continue;
-		}
-		*(name + i) = *org;
-		org++;
-	}
-}
+static const u_char lfn_offset[LFN_CHARS] = {
+	1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+};
 
 /*
  * Restore file name to normal format
- *  Ex. "foo     bar" => "foo.bar"
+ *  Ex. "FOO     BAR" => "FOO.BAR"
+ * The case of the name is restored with the flags in ntres.
  */
 void
-fat_restore_name(char *org, char *name)
+fat_restore_name(struct fat_dirent *de, char *name)
 {
-	int i;
+	u_char *org;
+	int i, lower;
 
 	memset(name, 0, 13);
+	org = de->name;
+	lower = de->ntres & NT_LOWER_BASE;
 	for (i = 0; i < 8; i++) {
 		if (*org != ' ')
-			*name++ = *org;
+			*name++ = lower ? tolower((int)*org) : *org;
 		org++;
 	}
 	if (*org != ' ')
 		*name++ = '.';
+	lower = de->ntres & NT_LOWER_EXT;
 	for (i = 0; i < 3; i++) {
 		if (*org != ' ')
-			*name++ = *org;
+			*name++ = lower ? tolower((int)*org) : *org;
 		org++;
 	}
 }
 
 /*
- * Compare 2 file names.
- *
- * Return 0 if it matches.
- */
-int
-fat_compare_name(char *n1, char *n2)
-{
-	int i;
-
-	for (i = 0; i < 11; i++, n1++, n2++) {
-		if (toupper((int)*n1) != toupper((int)*n2))
-			return -1;
-	}
-	return 0;
-}
-
-/*
- * Check specified name is valid as FAT file name.
+ * Check specified name is valid as VFAT file name.
  * Return true if valid.
  */
 int
 fat_valid_name(char *name)
 {
-	static char invalid_char[] = "*?<>|\"+=,;[] \345";
+	static char invalid_char[] = "\\/:*?\"<>|";
 	int len = 0;
 
 	/* . or .. */
-	if (*name == '.') {
-		name++;
-		if (*name == '.')
-			name++;
-		return (*(name + 1) == '\0') ? 1 : 0;
-	}
-	/* First char must be alphabet or numeric */
-	if (!isalnum((int)*name))
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
 		return 0;
 	while (*name != '\0') {
-		if (strchr(invalid_char, *name))
+		if ((u_char)*name < 0x20 || strchr(invalid_char, *name))
 			return 0;
-		if (*name == '.')
-			break;	/* Start of extension */
-		if (++len > 8)
+		if (++len > FAT_MAXNAME)
 			return 0;	/* Too long name */
 		name++;
 	}
-	if (*name == '\0')
-		return 1;
-	name++;
-	if (*name == '\0')	/* Empty extension */
-		return 1;
-	len = 0;
-	while (*name != '\0') {
-		if (strchr(invalid_char, *name))
+	if (len == 0)
+		return 0;
+	/* Trailing period or space is ignored by other systems */
+	if (*(name - 1) == '.' || *(name - 1) == ' ')
+		return 0;
+	return 1;
+}
+
+/*
+ * Convert file name to 8.3 format, if it can be stored
+ * without long name.  The base name and the extension must
+ * be in upper case or lower case.
+ *  Ex. "foo.bar" => "FOO     BAR" with NT_LOWER_BASE | NT_LOWER_EXT
+ *
+ * Return true if the name is converted.
+ */
+int
+fat_short_name(char *name, u_char *sname, u_char *ntres)
+{
+	static char invalid_char[] = "*?<>|\"+=,;[] \\/:";
+	int c, pos, len, max, lower, upper;
+
+	memset(sname, ' ', 11);
+	*ntres = 0;
+	pos = len = lower = upper = 0;
+	max = 8;
+	for (; *name != '\0'; name++) {
+		c = (u_char)*name;
+		if (c == '.') {
+			/* Start of extension */
+			if (max == 3 || len == 0)
+				return 0;
+			if (lower && upper)
+				return 0;
+			if (lower)
+				*ntres |= NT_LOWER_BASE;
+			pos = 8;
+			len = lower = upper = 0;
+			max = 3;
+			continue;
+		}
+		if (c < 0x20 || c >= 0x7f || strchr(invalid_char, c))
 			return 0;
-		if (*name == '.')
-			return 0;	/* Second extention */
-		if (++len > 3)
+		if (++len > max)
 			return 0;	/* Too long name */
-		name++;
+		if (islower(c)) {
+			lower = 1;
+			c = toupper(c);
+		} else if (isupper(c))
+			upper = 1;
+		sname[pos++] = (u_char)c;
 	}
+	if (len == 0 || (lower && upper))
+		return 0;
+	if (lower)
+		*ntres |= (max == 3) ? NT_LOWER_EXT : NT_LOWER_BASE;
 	return 1;
 }
 
+/*
+ * Convert a character for short name.
+ */
+static int
+fat_short_char(int c)
+{
+
+	if (c < 0x20 || c >= 0x7f || strchr("+,;=[]", c))
+		return '_';
+	return toupper(c);
+}
+
+/*
+ * Make the basis of short name for a long name.
+ * Spaces and leading periods are removed.
+ *  Ex. "Long name.text" => "LONGNAMETEX"
+ */
+void
+fat_basis_name(char *name, u_char *sname)
+{
+	char *ext;
+	int i;
+
+	memset(sname, ' ', 11);
+	while (*name == '.')
+		name++;
+	ext = strrchr(name, '.');
+
+	for (i = 0; *name != '\0' && name != ext && i < 8; name++) {
+		if (*name != ' ' && *name != '.')
+			sname[i++] = (u_char)fat_short_char((u_char)*name);
+	}
+	if (i == 0)
+		sname[0] = '_';
+	if (ext == NULL)
+		return;
+	for (i = 8, ext++; *ext != '\0' && i < 11; ext++) {
+		if (*ext != ' ')
+			sname[i++] = (u_char)fat_short_char((u_char)*ext);
+	}
+}
+
+/*
+ * Add the numeric tail to the basis of short name.
+ *  Ex. "LONGNAMETEX" => "LONGNA~1TEX"
+ */
+void
+fat_numeric_tail(u_char *sname, u_long n)
+{
+	char tail[8];
+	int i, len;
+
+	len = 0;
+	do {
+		tail[len++] = (char)('0' + n % 10);
+		n /= 10;
+	} while (n > 0 && len < 6);
+
+	for (i = 0; i < 8 && sname[i] != ' '; i++)
+		;
+	if (i > 7 - len)
+		i = 7 - len;
+	sname[i++] = '~';
+	while (len > 0)
+		sname[i++] = (u_char)tail[--len];
+}
+
+/*
+ * Get the checksum of short name for long name entries.
+ */
+u_char
+fat_checksum(u_char *sname)
+{
+	u_char sum = 0;
+	int i;
+
+	for (i = 0; i < 11; i++)
+		sum = (u_char)(((sum & 1) << 7) + (sum >> 1) + sname[i]);
+	return sum;
+}
+
+/*
+ * Get the characters of long name from the entry.
+ * The characters are stored at the position of the entry
+ * in the name.  The characters which can not be represented
+ * are converted to '_'.
+ *
+ * Return -1 if the name is too long.
+ */
+int
+fat_get_lfn(struct fat_lfnent *lde, char *name)
+{
+	u_char *p = (u_char *)lde;
+	u_int c;
+	int i, pos;
+
+	pos = ((lde->ord & LFN_ORD_MASK) - 1) * LFN_CHARS;
+	for (i = 0; i < LFN_CHARS; i++, pos++) {
+		c = p[lfn_offset[i]] | (p[lfn_offset[i] + 1] << 8);
+		if (c == 0 || c == 0xffff)
+			break;
+		if (pos >= FAT_MAXNAME)
+			return -1;
+		name[pos] = (c < 0x100) ? (char)c : '_';
+	}
+	return 0;
+}
+
+/*
+ * Put the characters of long name to the entry.
+ * The order of the entry must be set.
+ */
+void
+fat_put_lfn(struct fat_lfnent *lde, char *name)
+{
+	u_char *p = (u_char *)lde;
+	u_int c;
+	int i, pos, len;
+
+	len = strlen(name);
+	pos = ((lde->ord & LFN_ORD_MASK) - 1) * LFN_CHARS;
+	for (i = 0; i < LFN_CHARS; i++, pos++) {
+		if (pos < len)
+			c = (u_char)name[pos];
+		else if (pos == len)
+			c = 0;
+		else
+			c = 0xffff;
+		p[lfn_offset[i]] = (u_char)c;
+		p[lfn_offset[i] + 1] = (u_char)(c >> 8);
+	}
+}
+
 /*
  * mode -> attribute
  */
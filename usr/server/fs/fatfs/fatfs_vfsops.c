@@ -46,7 +46,7 @@
 
 static int fatfs_mount	(mount_t mp, char *dev, int flags, void *data);
 static int fatfs_unmount(mount_t mp);
-#define fatfs_sync	((vfsop_sync_t)vfs_nullop)
+static int fatfs_sync	(mount_t mp);
 static int fatfs_vget	(mount_t mp, vnode_t vp);
 #define fatfs_statfs	((vfsop_statfs_t)vfs_nullop)
 
@@ -70,6 +70,8 @@ static int
 fat_read_bpb(struct fatfsmount *fmp)
 {
 	struct fat_bpb *bpb;
+	struct fat_bpb32 *bpb32;
+	u_long total_sectors, fat_sectors;
 	size_t size;
 	int error;
 
@@ -90,19 +92,53 @@ fat_read_bpb(struct fatfsmount *fmp)
 		return EINVAL;
 	}
 
+	/* The sizes are in the FAT32 extension if they are too large. */
+	bpb32 = (struct fat_bpb32 *)((char *)bpb + BPB32_OFFSET);
+	total_sectors = bpb->total_sectors;
+	if (total_sectors == 0)
+		total_sectors = bpb->big_total_sectors;
+	fat_sectors = bpb->sectors_per_fat;
+	if (fat_sectors == 0)
+		fat_sectors = bpb32->sectors_per_fat;
+
 	/* Build FAT mount data */
 	fmp->fat_start = bpb->hidden_sectors + bpb->reserved_sectors;
 	fmp->root_start = fmp->fat_start +
-		(bpb->num_of_fats * bpb->sectors_per_fat);
+		(bpb->num_of_fats * fat_sectors);
+	fmp->root_slots = bpb->root_entries;
 	fmp->data_start =
 		fmp->root_start + (bpb->root_entries / DIR_PER_SEC);
+	fmp->fat_sectors = fat_sectors;
+	fmp->num_fats = bpb->num_of_fats;
 	fmp->sec_per_cl = bpb->sectors_per_cluster;
 	fmp->cluster_size = bpb->sectors_per_cluster * SEC_SIZE;
-	fmp->last_cluster = (bpb->total_sectors - fmp->data_start) /
+	fmp->io_size = (FAT_MAXIO / fmp->cluster_size) * fmp->cluster_size;
+	if (fmp->io_size == 0)
+		fmp->io_size = fmp->cluster_size;
+	fmp->last_cluster =
+		(total_sectors - (fmp->data_start - bpb->hidden_sectors)) /
 		bpb->sectors_per_cluster + CL_FIRST;
 	fmp->free_scan = CL_FIRST;
+	fmp->root_cluster = CL_ROOT;
+	fmp->fsinfo_sec = 0;
 
-	if (!strncmp((const char *)bpb->file_sys_id, "FAT12   ", 8)) {
+	if (bpb->sectors_per_fat == 0 && bpb->root_entries == 0) {
+		/*
+		 * FAT32: The root directory is a cluster chain,
+		 * and the FAT copies may not be mirrored.
+		 */
+		fmp->fat_type = 32;
+		fmp->fat_mask = FAT32_MASK;
+		fmp->fat_eof = CL_EOF & FAT32_MASK;
+		fmp->root_cluster = bpb32->root_cluster;
+		if (bpb32->ext_flags & BPB32_MIRROR) {
+			fmp->fat_start += (bpb32->ext_flags & BPB32_ACTIVE) *
+				fat_sectors;
+			fmp->num_fats = 1;
+		}
+		if (bpb32->fs_info != 0 && bpb32->fs_info != 0xffff)
+			fmp->fsinfo_sec = bpb->hidden_sectors + bpb32->fs_info;
+	} else if (!strncmp((const char *)bpb->file_sys_id, "FAT12   ", 8)) {
 		fmp->fat_type = 12;
 		fmp->fat_mask = FAT12_MASK;
 		fmp->fat_eof = CL_EOF & FAT12_MASK;
@@ -111,7 +147,6 @@ fat_read_bpb(struct fatfsmount *fmp)
 		fmp->fat_mask = FAT16_MASK;
 		fmp->fat_eof = CL_EOF & FAT16_MASK;
 	} else {
-		/* FAT32 is not supported now! */
 		DPRINTF(("fatfs: invalid FAT type\n"));
 		free(bpb);
 		return EINVAL;
@@ -129,8 +164,94 @@ fat_read_bpb(struct fatfsmount *fmp)
 	return 0;
 }
 
+/*
+ * Read the FSInfo sector of FAT32.
+ * The next free cluster in it is used as a hint to allocate
+ * clusters.  The free count is not used because the count is
+ * taken while loading the FAT.
+ */
+static void
+fat_read_fsinfo(struct fatfsmount *fmp)
+{
+	struct fat_fsinfo *fsi;
+	struct buf *bp;
+
+	if (fmp->fsinfo_sec == 0)
+		return;
+	if (bread(fmp->dev, fmp->fsinfo_sec, &bp) != 0) {
+		fmp->fsinfo_sec = 0;
+		return;
+	}
+	fsi = (struct fat_fsinfo *)bp->b_data;
+	if (fsi->lead_sig != FSI_LEAD_SIG ||
+	    fsi->struct_sig != FSI_STRUCT_SIG ||
+	    fsi->trail_sig != FSI_TRAIL_SIG) {
+		DPRINTF(("fatfs: invalid fsinfo\n"));
+		fmp->fsinfo_sec = 0;
+	} else if (fsi->next_free >= CL_FIRST &&
+		   fsi->next_free < fmp->last_cluster)
+		fmp->free_scan = fsi->next_free;
+	brelse(bp);
+}
+
+/*
+ * Update the free count and the next free cluster in the
+ * FSInfo sector of FAT32.
+ */
+static int
+fat_write_fsinfo(struct fatfsmount *fmp)
+{
+	struct fat_fsinfo *fsi;
+	struct buf *bp;
+	int error;
+
+	if (fmp->fsinfo_sec == 0)
+		return 0;
+	if ((error = bread(fmp->dev, fmp->fsinfo_sec, &bp)) != 0)
+		return error;
+	fsi = (struct fat_fsinfo *)bp->b_data;
+	if (fsi->free_count == fmp->free_count &&
+	    fsi->next_free == fmp->free_scan) {
+		brelse(bp);
+		return 0;
+	}
+	fsi->free_count = (uint32_t)fmp->free_count;
+	fsi->next_free = (uint32_t)fmp->free_scan;
+	return bwrite(bp);
+}
+
+/*
+ * Get the journal size from the mount option.  The option is
+ * "journal" or "journal=<bytes>", and the size can have a
+ * suffix 'k' or 'm'.  Returns 0 if the option is not given.
+ */
+static u_long
+fat_parse_journal(char *opt)
+{
+	u_long size;
+	char *p;
+
+	for (p = opt; p != NULL && *p != '\0'; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		if (strncmp(p, "journal", 7) != 0)
+			continue;
+		if (p[7] != '=')
+			return FAT_JSIZE;
+		size = strtoul(p + 8, &p, 10);
+		if (*p == 'k' || *p == 'K')
+			size *= 1024;
+		else if (*p == 'm' || *p == 'M')
+			size *= 1024 * 1024;
+		return size;
+	}
+	return 0;
+}
+
 /*
  * Mount file system.
+ * If the journal file exists, the journal is replayed and
+ * enabled.  The "journal" option creates the journal file.
  */
 static int
 fatfs_mount(mount_t mp, char *dev, int flags, void *data)
@@ -150,27 +271,41 @@ fatfs_mount(mount_t mp, char *dev, int flags, void *data)
 		goto err1;
 
 	error = ENOMEM;
-	fmp->io_buf = malloc(fmp->sec_per_cl * SEC_SIZE);
-	if (fmp->io_buf == NULL)
+	fmp->dir_buf = malloc(SEC_SIZE);
+	if (fmp->dir_buf == NULL)
 		goto err1;
 
-	fmp->fat_buf = malloc(SEC_SIZE * 2);
-	if (fmp->fat_buf == NULL)
+	if ((error = fat_load(fmp)) != 0)
 		goto err2;
+	if (FAT32(fmp) && (fmp->root_cluster < CL_FIRST ||
+			   fmp->root_cluster >= fmp->last_cluster)) {
+		fat_unload(fmp);
+		error = EINVAL;
+		goto err2;
+	}
+	fat_read_fsinfo(fmp);
 
-	fmp->dir_buf = malloc(SEC_SIZE);
-	if (fmp->dir_buf == NULL)
-		goto err3;
-
+	fmp->dir_sec = SEC_INVAL;
+	fmp->dirhash = NULL;
+	fmp->ndirhash = 0;
+	fmp->free_bufs = NULL;
+	fmp->jnl = NULL;
 	mutex_init(&fmp->lock);
 	mp->m_data = fmp;
 	vp = mp->m_root;
 	vp->v_blkno = CL_ROOT;
+
+	error = fat_journal_open(fmp, vp, fat_parse_journal(data));
+	if (error) {
+		DPRINTF(("fatfs: can not open journal\n"));
+		fat_dirhash_flush(fmp);
+		fat_unload(fmp);
+		mutex_destroy(&fmp->lock);
+		goto err2;
+	}
 	return 0;
- err3:
-	free(fmp->fat_buf);
  err2:
-	free(fmp->io_buf);
+	free(fmp->dir_buf);
  err1:
 	free(fmp);
 	return error;
@@ -183,16 +318,50 @@ static int
 fatfs_unmount(mount_t mp)
 {
 	struct fatfsmount *fmp;
+	char *buf;
 
 	fmp = mp->m_data;
+	while ((buf = fmp->free_bufs) != NULL) {
+		fmp->free_bufs = *(char **)buf;
+		free(buf);
+	}
+	if (fmp->jnl != NULL) {
+		fat_journal_flush(fmp);
+		fat_journal_close(fmp);
+	}
+	fat_sync(fmp);
+	fat_write_fsinfo(fmp);
+	fat_unload(fmp);
+	fat_dirhash_flush(fmp);
 	free(fmp->dir_buf);
-	free(fmp->fat_buf);
-	free(fmp->io_buf);
 	mutex_destroy(&fmp->lock);
 	free(fmp);
 	return 0;
 }
 
+/*
+ * Flush the FAT in memory, and the FSInfo of FAT32.
+ * The logged sectors in the journal are written to their
+ * home location.
+ */
+static int
+fatfs_sync(mount_t mp)
+{
+	struct fatfsmount *fmp;
+	int error;
+
+	fmp = mp->m_data;
+	mutex_lock(&fmp->lock);
+	if (fmp->jnl != NULL)
+		error = fat_journal_flush(fmp);
+	else
+		error = fat_sync(fmp);
+	if (error == 0)
+		error = fat_write_fsinfo(fmp);
+	mutex_unlock(&fmp->lock);
+	return error;
+}
+
 /*
  * Prepare the FAT specific node and fill the vnode.
  */
@@ -204,6 +373,10 @@ fatfs_vget(mount_t mp, vnode_t vp)
 	np = malloc(sizeof(struct fatfs_node));
 	if (np == NULL)
 		return ENOMEM;
+	rw_init(&np->lock);
+	np->extents = NULL;
+	np->nextents = 0;
+	np->maxextents = 0;
 	vp->v_data = np;
 	return 0;
 }
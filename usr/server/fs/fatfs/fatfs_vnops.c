@@ -44,13 +44,6 @@
 
 #include "fatfs.h"
 
-/*
- *  Time bits: 15-11 hours (0-23), 10-5 min, 4-0 sec /2
- *  Date bits: 15-9 year - 1980, 8-5 month, 4-0 day
- */
-#define TEMP_DATE   0x3021
-#define TEMP_TIME   0
-
 #define fatfs_open	((vnop_open_t)vop_nullop)
 #define fatfs_close	((vnop_close_t)vop_nullop)
 static int fatfs_read	(vnode_t, file_t, void *, size_t, size_t *);
@@ -69,6 +62,8 @@ static int fatfs_getattr(vnode_t, struct vattr *);
 static int fatfs_setattr(vnode_t, struct vattr *);
 static int fatfs_inactive(vnode_t);
 static int fatfs_truncate(vnode_t, off_t);
+static int fatfs_getpages(vnode_t, off_t, void *, size_t);
+static int fatfs_putpages(vnode_t, off_t, void *, size_t, size_t *);
 
 /*
  * vnode operations
@@ -92,34 +87,141 @@ struct vnops fatfs_vnops = {
 	fatfs_setattr,		/* setattr */
 	fatfs_inactive,		/* inactive */
 	fatfs_truncate,		/* truncate */
+	fatfs_getpages,		/* getpages */
+	fatfs_putpages,		/* putpages */
 };
 
 /*
- * Read one cluster to buffer.
+ * Read contiguous clusters to buffer.
  */
 static int
-fat_read_cluster(struct fatfsmount *fmp, u_long cluster)
+fat_read_cluster(struct fatfsmount *fmp, u_long cluster, u_long count,
+		 char *buf)
 {
 	u_long sec;
 	size_t size;
 
 	sec = cl_to_sec(fmp, cluster);
-	size = fmp->sec_per_cl * SEC_SIZE;
-	return device_read(fmp->dev, fmp->io_buf, &size, sec);
+	size = count * fmp->cluster_size;
+	return device_read(fmp->dev, buf, &size, sec);
 }
 
 /*
- * Write one cluster from buffer.
+ * Write contiguous clusters from buffer.
  */
 static int
-fat_write_cluster(struct fatfsmount *fmp, u_long cluster)
+fat_write_cluster(struct fatfsmount *fmp, u_long cluster, u_long count,
+		  char *buf)
 {
 	u_long sec;
 	size_t size;
 
 	sec = cl_to_sec(fmp, cluster);
-	size = fmp->sec_per_cl * SEC_SIZE;
-	return device_write(fmp->dev, fmp->io_buf, &size, sec);
+	size = count * fmp->cluster_size;
+	return device_write(fmp->dev, buf, &size, sec);
+}
+
+/*
+ * Get a cluster buffer for file data.
+ * File data is transferred without the file system lock, so
+ * each transfer uses its own buffer.  Released buffers are
+ * kept in the mount data for reuse.
+ */
+static char *
+fat_get_buf(struct fatfsmount *fmp)
+{
+	char *buf;
+
+	mutex_lock(&fmp->lock);
+	if ((buf = fmp->free_bufs) != NULL)
+		fmp->free_bufs = *(char **)buf;
+	mutex_unlock(&fmp->lock);
+
+	if (buf == NULL)
+		buf = malloc(fmp->io_size);
+	return buf;
+}
+
+static void
+fat_put_buf(struct fatfsmount *fmp, char *buf)
+{
+
+	mutex_lock(&fmp->lock);
+	*(char **)buf = fmp->free_bufs;
+	fmp->free_bufs = buf;
+	mutex_unlock(&fmp->lock);
+}
+
+/*
+ * Find the clusters for the data transfer.
+ * Returns the cluster# for the cluster index @lcn in file, and
+ * the number of clusters, up to @count, which can be accessed
+ * at once.  If @staged is set, the count is limited to the size
+ * of the data buffer.
+ */
+static int
+fat_map_data(struct fatfsmount *fmp, struct fatfs_node *np, u_long lcn,
+	     u_long count, int staged, u_long *cl, u_long *ncl)
+{
+	u_long run;
+	int error;
+
+	if (staged && count > fmp->io_size / fmp->cluster_size)
+		count = fmp->io_size / fmp->cluster_size;
+
+	mutex_lock(&fmp->lock);
+	error = fat_map_cluster(fmp, np, lcn, count, cl, &run);
+	mutex_unlock(&fmp->lock);
+
+	*ncl = (run < count) ? run : count;
+	return error;
+}
+
+/*
+ * Write data which does not cover whole clusters.
+ * The clusters written partially must be read first, unless
+ * they are beyond the old end of file.
+ *
+ * @cl: first cluster#
+ * @ncl: number of contiguous clusters
+ * @io_buf: buffer to stage the clusters
+ * @buf_pos: offset in first cluster
+ * @buf: data to write
+ * @size: size of data
+ * @pos: file offset of first cluster
+ * @old_size: file size before it is expanded
+ * @result: number of bytes written
+ */
+static int
+fat_write_partial(struct fatfsmount *fmp, u_long cl, u_long ncl,
+		  char *io_buf, u_long buf_pos, void *buf, size_t size,
+		  u_long pos, u_long old_size, size_t *result)
+{
+	size_t nr_copy;
+	u_long last;
+
+	nr_copy = ncl * fmp->cluster_size - buf_pos;
+	if (nr_copy > size)
+		nr_copy = size;
+
+	if (buf_pos != 0 && pos < old_size) {
+		if (fat_read_cluster(fmp, cl, 1, io_buf))
+			return EIO;
+	}
+	last = (buf_pos + nr_copy - 1) / fmp->cluster_size;
+	if ((buf_pos + nr_copy) % fmp->cluster_size != 0 &&
+	    (last > 0 || buf_pos == 0) &&
+	    pos + last * fmp->cluster_size < old_size) {
+		if (fat_read_cluster(fmp, cl + last, 1,
+				     io_buf + last * fmp->cluster_size))
+			return EIO;
+	}
+	memcpy(io_buf + buf_pos, buf, nr_copy);
+
+	if (fat_write_cluster(fmp, cl, last + 1, io_buf))
+		return EIO;
+	*result = nr_copy;
+	return 0;
 }
 
 /*
@@ -154,9 +256,9 @@ fatfs_lookup(vnode_t dvp, char *name, vnode_t vp)
 	fat_attr_to_mode(de->attr, &vp->v_mode);
 	vp->v_mode = ALLPERMS;
 	vp->v_size = de->size;
-	vp->v_blkno = de->cluster;
+	vp->v_blkno = DE_CLUSTER(de);
 
-	DPRINTF(("fatfs_lookup: cl=%d\n", de->cluster));
+	DPRINTF(("fatfs_lookup: cl=%d\n", vp->v_blkno));
 	mutex_unlock(&fmp->lock);
 	return 0;
 }
@@ -165,8 +267,11 @@ static int
 fatfs_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
 	struct fatfsmount *fmp;
-	int nr_read, nr_copy, buf_pos, error;
-	u_long cl, file_pos;
+	struct fatfs_node *np;
+	size_t nr_read, nr_copy;
+	u_long cl, ncl, file_pos, buf_pos;
+	char *io_buf;
+	int error;
 
 	DPRINTF(("fatfs_read: vp=%x\n", vp));
 
@@ -178,57 +283,78 @@ fatfs_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 	if (vp->v_type != VREG)
 		return EINVAL;
 
+	np = vp->v_data;
+	rw_rlock(&np->lock);
+
 	/* Check if current file position is already end of file. */
 	file_pos = fp->f_offset;
-	if (file_pos >= vp->v_size)
+	if (file_pos >= vp->v_size) {
+		rw_unlock(&np->lock);
 		return 0;
-
-	mutex_lock(&fmp->lock);
+	}
+	io_buf = NULL;
 
 	/* Get the actual read size. */
 	if (vp->v_size - file_pos < size)
 		size = vp->v_size - file_pos;
 
-	/* Seek to the cluster for the file offset */
-	error = fat_seek_cluster(fmp, vp->v_blkno, file_pos, &cl);
-	if (error)
-		goto out;
-
 	/* Read and copy data */
 	nr_read = 0;
-	buf_pos = file_pos % fmp->cluster_size;
-	do {
-		if (fat_read_cluster(fmp, cl)) {
-			error = EIO;
-			goto out;
+	while (size > 0) {
+		buf_pos = file_pos % fmp->cluster_size;
+		if (buf_pos == 0 && size >= fmp->cluster_size) {
+			/*
+			 * Read whole clusters into the caller's
+			 * buffer directly.
+			 */
+			error = fat_map_data(fmp, np,
+					     file_pos / fmp->cluster_size,
+					     size / fmp->cluster_size, 0,
+					     &cl, &ncl);
+			if (error)
+				goto out;
+			if (fat_read_cluster(fmp, cl, ncl, buf)) {
+				error = EIO;
+				goto out;
+			}
+			nr_copy = ncl * fmp->cluster_size;
+		} else {
+			/* Stage the partial cluster in our buffer. */
+			if (io_buf == NULL &&
+			    (io_buf = fat_get_buf(fmp)) == NULL) {
+				error = ENOMEM;
+				goto out;
+			}
+			error = fat_map_data(fmp, np,
+					     file_pos / fmp->cluster_size,
+					     (buf_pos + size +
+					      fmp->cluster_size - 1) /
+					     fmp->cluster_size, 1, &cl, &ncl);
+			if (error)
+				goto out;
+			if (fat_read_cluster(fmp, cl, ncl, io_buf)) {
+				error = EIO;
+				goto out;
+			}
+			nr_copy = ncl * fmp->cluster_size - buf_pos;
+			if (nr_copy > size)
+				nr_copy = size;
+			memcpy(buf, io_buf + buf_pos, nr_copy);
 		}
 
-		nr_copy = fmp->cluster_size;
-		if (buf_pos > 0)
-			nr_copy -= buf_pos;
-		if (buf_pos + size < fmp->cluster_size)
-			nr_copy = size;
-		memcpy(buf, fmp->io_buf + buf_pos, nr_copy);
-
 		file_pos += nr_copy;
 		nr_read += nr_copy;
 		size -= nr_copy;
-		if (size <= 0)
-			break;
-
-		error = fat_next_cluster(fmp, cl, &cl);
-		if (error)
-			goto out;
-
 		buf = (void *)((u_long)buf + nr_copy);
-		buf_pos = 0;
-	} while (!IS_EOFCL(fmp, cl));
+	}
 
 	fp->f_offset = file_pos;
 	*result = nr_read;
 	error = 0;
  out:
-	mutex_unlock(&fmp->lock);
+	if (io_buf != NULL)
+		fat_put_buf(fmp, io_buf);
+	rw_unlock(&np->lock);
 	return error;
 }
 
@@ -238,9 +364,10 @@ fatfs_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 	struct fatfsmount *fmp;
 	struct fatfs_node *np;
 	struct fat_dirent *de;
-	int nr_copy, nr_write, buf_pos, i, cl_size, error;
-	u_long file_pos, end_pos;
-	u_long cl;
+	size_t nr_write, nr_copy;
+	u_long cl, ncl, file_pos, end_pos, buf_pos, old_size;
+	char *io_buf;
+	int error;
 
 	DPRINTF(("fatfs_write: vp=%x\n", vp));
 
@@ -252,72 +379,87 @@ fatfs_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 	if (vp->v_type != VREG)
 		return EINVAL;
 
+	np = vp->v_data;
+	/* The journal is written only by the file system. */
+	if (fat_journal_file(fmp, &np->dirent))
+		return EPERM;
+	rw_wlock(&np->lock);
+	io_buf = NULL;
 	mutex_lock(&fmp->lock);
 
 	/* Check if file position exceeds the end of file. */
-	end_pos = vp->v_size;
+	end_pos = old_size = vp->v_size;
 	file_pos = (fp->f_flags & O_APPEND) ? end_pos : fp->f_offset;
 	if (file_pos + size > end_pos) {
 		/* Expand the file size before writing to it */
 		end_pos = file_pos + size;
 		error = fat_expand_file(fmp, vp->v_blkno, end_pos);
+		if (error == 0 && fmp->jnl == NULL)
+			error = fat_sync(fmp);
 		if (error) {
+			mutex_unlock(&fmp->lock);
 			error = EIO;
 			goto out;
 		}
 
 		/* Update directory entry */
-		np = vp->v_data;
 		de = &np->dirent;
 		de->size = end_pos;
 		error = fatfs_put_node(fmp, np);
-		if (error)
+		if (error == 0)
+			error = fat_sync(fmp);
+		if (error) {
+			mutex_unlock(&fmp->lock);
 			goto out;
+		}
 		vp->v_size = end_pos;
 	}
+	mutex_unlock(&fmp->lock);
 
-	/* Seek to the cluster for the file offset */
-	error = fat_seek_cluster(fmp, vp->v_blkno, file_pos, &cl);
-	if (error)
-		goto out;
-
-	buf_pos = file_pos % fmp->cluster_size;
-	cl_size = size / fmp->cluster_size + 1;
 	nr_write = 0;
-	i = 0;
-	do {
-		/* First and last cluster must be read before write */
-		if (i == 0 || i == cl_size) {
-			if (fat_read_cluster(fmp, cl)) {
+	while (size > 0) {
+		buf_pos = file_pos % fmp->cluster_size;
+		if (buf_pos == 0 && size >= fmp->cluster_size) {
+			/*
+			 * Write whole clusters from the caller's
+			 * buffer directly.
+			 */
+			error = fat_map_data(fmp, np,
+					     file_pos / fmp->cluster_size,
+					     size / fmp->cluster_size, 0,
+					     &cl, &ncl);
+			if (error)
+				goto out;
+			if (fat_write_cluster(fmp, cl, ncl, buf)) {
 				error = EIO;
 				goto out;
 			}
-		}
-		nr_copy = fmp->cluster_size;
-		if (buf_pos > 0)
-			nr_copy -= buf_pos;
-		if (buf_pos + size < fmp->cluster_size)
-			nr_copy = size;
-		memcpy(fmp->io_buf + buf_pos, buf, nr_copy);
-
-		if (fat_write_cluster(fmp, cl)) {
-			error = EIO;
-			goto out;
+			nr_copy = ncl * fmp->cluster_size;
+		} else {
+			/* Stage the partial cluster in our buffer. */
+			if (io_buf == NULL &&
+			    (io_buf = fat_get_buf(fmp)) == NULL) {
+				error = ENOMEM;
+				goto out;
+			}
+			error = fat_map_data(fmp, np,
+					     file_pos / fmp->cluster_size,
+					     (buf_pos + size +
+					      fmp->cluster_size - 1) /
+					     fmp->cluster_size, 1, &cl, &ncl);
+			if (error)
+				goto out;
+			error = fat_write_partial(fmp, cl, ncl, io_buf, buf_pos,
+						  buf, size, file_pos - buf_pos,
+						  old_size, &nr_copy);
+			if (error)
+				goto out;
 		}
 		file_pos += nr_copy;
 		nr_write += nr_copy;
 		size -= nr_copy;
-		if (size <= 0)
-			break;
-
-		error = fat_next_cluster(fmp, cl, &cl);
-		if (error)
-			goto out;
-
 		buf = (void *)((u_long)buf + nr_copy);
-		buf_pos = 0;
-		i++;
-	} while (!IS_EOFCL(fmp, cl));
+	}
 
 	fp->f_offset = file_pos;
 
@@ -331,26 +473,63 @@ fatfs_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 	*result = nr_write;
 	error = 0;
  out:
-	mutex_unlock(&fmp->lock);
+	if (io_buf != NULL)
+		fat_put_buf(fmp, io_buf);
+	rw_unlock(&np->lock);
 	return error;
 }
 
+/*
+ * Page I/O for the page cache.  The data is transferred with
+ * the read/write routines at the given file offset.
+ */
+static int
+fatfs_getpages(vnode_t vp, off_t off, void *buf, size_t size)
+{
+	struct file f;
+	size_t count;
+
+	memset(&f, 0, sizeof(f));
+	f.f_flags = FREAD;
+	f.f_offset = off;
+	f.f_vnode = vp;
+	return fatfs_read(vp, &f, buf, size, &count);
+}
+
+static int
+fatfs_putpages(vnode_t vp, off_t off, void *buf, size_t size,
+	       size_t *count)
+{
+	struct file f;
+
+	memset(&f, 0, sizeof(f));
+	f.f_flags = FWRITE;
+	f.f_offset = off;
+	f.f_vnode = vp;
+	return fatfs_write(vp, &f, buf, size, count);
+}
+
+/*
+ * Read directory entry.
+ * The file offset of directory is the slot# to read next.
+ */
 static int
 fatfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 {
 	struct fatfsmount *fmp;
 	struct fatfs_node np;
 	struct fat_dirent *de;
+	u_long slot;
 	int error;
 
 	fmp = vp->v_mount->m_data;
 	mutex_lock(&fmp->lock);
 
-	error = fatfs_get_node(vp, fp->f_offset, &np);
+	slot = (u_long)fp->f_offset;
+	error = fatfs_get_node(vp, &slot, dir->d_name, &np);
 	if (error)
 		goto out;
 	de = &np.dirent;
-	fat_restore_name((char *)&de->name, dir->d_name);
 
 	if (de->attr & FA_SUBDIR)
 		dir->d_type = DT_DIR;
@@ -359,10 +538,10 @@ fatfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 	else
 		dir->d_type = DT_REG;
 
-	dir->d_fileno = fp->f_offset;
+	dir->d_fileno = slot;
 	dir->d_namlen = strlen(dir->d_name);
 
-	fp->f_offset++;
+	fp->f_offset = slot + 1;
 	error = 0;
  out:
 	mutex_unlock(&fmp->lock);
@@ -399,16 +578,19 @@ fatfs_create(vnode_t dvp, char *name, mode_t mode)
 
 	de = &np.dirent;
 	memset(de, 0, sizeof(struct fat_dirent));
-	fat_convert_name(name, (char *)de->name);
-	de->cluster = cl;
+	DE_SET_CLUSTER(de, cl);
 	de->time = TEMP_TIME;
 	de->date = TEMP_DATE;
 	fat_mode_to_attr(mode, &de->attr);
-	error = fatfs_add_node(dvp, &np);
-	if (error)
+	error = fatfs_add_node(dvp, name, &np);
+	if (error) {
+		fat_release_cluster(fmp, cl);
 		goto out;
+	}
 	error = fat_set_cluster(fmp, cl, fmp->fat_eof);
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
 	return error;
 }
@@ -435,20 +617,21 @@ fatfs_remove(vnode_t dvp, vnode_t vp, char *name)
 		error = EISDIR;
 		goto out;
 	}
-	if (!IS_FILE(de)) {
+	if (!IS_FILE(de) || fat_journal_file(fmp, de)) {
 		error = EPERM;
 		goto out;
 	}
 
 	/* Remove clusters */
-	error = fat_free_clusters(fmp, de->cluster);
+	error = fat_free_clusters(fmp, DE_CLUSTER(de));
 	if (error)
 		goto out;
 
 	/* remove directory */
-	de->name[0] = 0xe5;
-	error = fatfs_put_node(fmp, &np);
+	error = fatfs_del_node(dvp, &np);
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
 	return error;
 }
@@ -458,10 +641,13 @@ fatfs_rename(vnode_t dvp1, vnode_t vp1, char *name1,
 	     vnode_t dvp2, vnode_t vp2, char *name2)
 {
 	struct fatfsmount *fmp;
-	struct fatfs_node np1;
-	struct fat_dirent *de1, *de2;
+	struct fatfs_node np1, np2;
+	struct fat_dirent *de1;
 	int error;
 
+	if (!fat_valid_name(name2))
+		return EINVAL;
+
 	fmp = dvp1->v_mount->m_data;
 	mutex_lock(&fmp->lock);
 
@@ -469,82 +655,44 @@ fatfs_rename(vnode_t dvp1, vnode_t vp1, char *name1,
 	if (error)
 		goto out;
 	de1 = &np1.dirent;
+	if (fat_journal_file(fmp, de1)) {
+		error = EPERM;
+		goto out;
+	}
 
-	if (IS_FILE(de1)) {
-		/* Remove destination file, first */
-		error = fatfs_remove(dvp2, vp1, name2);
-		if (error == EIO)
-			goto out;
-
-		/* Change file name of directory entry */
-		fat_convert_name(name2, (char *)de1->name);
-
-		/* Same directory ? */
-		if (dvp1 == dvp2) {
-			/* Change the name of existing file */
-			error = fatfs_put_node(fmp, &np1);
-			if (error)
-				goto out;
-		} else {
-			/* Create new directory entry */
-			error = fatfs_add_node(dvp2, &np1);
-			if (error)
-				goto out;
-
-			/* Remove souce file */
-			error = fatfs_remove(dvp1, vp2, name1);
-			if (error)
-				goto out;
-		}
-	} else {
-
-		/* remove destination directory */
-		error = fatfs_rmdir(dvp2, NULL, name2);
-		if (error == EIO)
-			goto out;
-
-		/* Change file name of directory entry */
-		fat_convert_name(name2, (char *)de1->name);
-
-		/* Same directory ? */
-		if (dvp1 == dvp2) {
-			/* Change the name of existing directory */
-			error = fatfs_put_node(fmp, &np1);
-			if (error)
-				goto out;
-		} else {
-			/* Create new directory entry */
-			error = fatfs_add_node(dvp2, &np1);
-			if (error)
-				goto out;
-
-			/* Update "." and ".." for renamed directory */
-			if (fat_read_cluster(fmp, de1->cluster)) {
-				error = EIO;
-				goto out;
-			}
-
-			de2 = (struct fat_dirent *)fmp->io_buf;
-			de2->cluster = de1->cluster;
-			de2->time = TEMP_TIME;
-			de2->date = TEMP_DATE;
-			de2++;
-			de2->cluster = dvp2->v_blkno;
-			de2->time = TEMP_TIME;
-			de2->date = TEMP_DATE;
+	/*
+	 * Remove destination, first.  The destination is the
+	 * source itself if only the case of the name is changed.
+	 */
+	error = fatfs_lookup_node(dvp2, name2, &np2);
+	if (error == 0 && (dvp1->v_blkno != dvp2->v_blkno ||
+			   np2.slot != np1.slot)) {
+		if (IS_FILE(de1))
+			error = fatfs_remove(dvp2, vp1, name2);
+		else
+			error = fatfs_rmdir(dvp2, NULL, name2);
+	}
+	if (error != 0 && error != ENOENT)
+		goto out;
 
-			if (fat_write_cluster(fmp, de1->cluster)) {
-				error = EIO;
-				goto out;
-			}
+	/*
+	 * Create new directory entry, and remove source entry.
+	 * The clusters are moved to the new entry.
+	 */
+	np2.dirent = np1.dirent;
+	error = fatfs_add_node(dvp2, name2, &np2);
+	if (error)
+		goto out;
+	error = fatfs_del_node(dvp1, &np1);
+	if (error)
+		goto out;
 
-			/* Remove souce directory */
-			error = fatfs_rmdir(dvp1, NULL, name1);
-			if (error)
-				goto out;
-		}
-	}
+	/* Update ".." for renamed directory */
+	if (IS_DIR(de1) && dvp1->v_blkno != dvp2->v_blkno)
+		error = fatfs_set_parent(fmp, DE_CLUSTER(de1), dvp2->v_blkno);
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
 	return error;
 }
@@ -574,38 +722,28 @@ fatfs_mkdir(vnode_t dvp, char *name, mode_t mode)
 
 	memset(&np, 0, sizeof(struct fatfs_node));
 	de = &np.dirent;
-	fat_convert_name(name, (char *)&de->name);
-	de->cluster = cl;
+	DE_SET_CLUSTER(de, cl);
 	de->time = TEMP_TIME;
 	de->date = TEMP_DATE;
 	fat_mode_to_attr(mode, &de->attr);
-	error = fatfs_add_node(dvp, &np);
-	if (error)
-		goto out;
-
-	/* Initialize "." and ".." for new directory */
-	memset(fmp->io_buf, 0, fmp->cluster_size);
-
-	de = (struct fat_dirent *)fmp->io_buf;
-	memcpy(de->name, ".          ", 11);
-	de->attr = FA_SUBDIR;
-	de->cluster = cl;
-	de->time = TEMP_TIME;
-	de->date = TEMP_DATE;
-	de++;
-	memcpy(de->name, "..         ", 11);
-	de->attr = FA_SUBDIR;
-	de->cluster = dvp->v_blkno;
-	de->time = TEMP_TIME;
-	de->date = TEMP_DATE;
 
-	if (fat_write_cluster(fmp, cl)) {
-		error = EIO;
+	/*
+	 * Initialize "." and ".." for new directory before it
+	 * is linked to the parent.
+	 */
+	error = fatfs_init_dir(fmp, cl, dvp->v_blkno);
+	if (error == 0)
+		error = fatfs_add_node(dvp, name, &np);
+	if (error) {
+		fat_release_cluster(fmp, cl);
 		goto out;
 	}
+
 	/* Add eof */
 	error = fat_set_cluster(fmp, cl, fmp->fat_eof);
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
 	return error;
 }
@@ -638,15 +776,16 @@ fatfs_rmdir(vnode_t dvp, vnode_t vp, char *name)
 	}
 
 	/* Remove clusters */
-	error = fat_free_clusters(fmp, de->cluster);
+	error = fat_free_clusters(fmp, DE_CLUSTER(de));
 	if (error)
 		goto out;
+	fat_dirhash_drop(fmp, DE_CLUSTER(de));
 
 	/* remove directory */
-	de->name[0] = 0xe5;
-
-	error = fatfs_put_node(fmp, &np);
+	error = fatfs_del_node(dvp, &np);
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
 	return error;
 }
@@ -669,8 +808,12 @@ fatfs_setattr(vnode_t vp, struct vattr *vap)
 static int
 fatfs_inactive(vnode_t vp)
 {
+	struct fatfs_node *np = vp->v_data;
 
-	free(vp->v_data);
+	rw_destroy(&np->lock);
+	if (np->extents != NULL)
+		free(np->extents);
+	free(np);
 	return 0;
 }
 
@@ -680,19 +823,36 @@ fatfs_truncate(vnode_t vp, off_t length)
 	struct fatfsmount *fmp;
 	struct fatfs_node *np;
 	struct fat_dirent *de;
+	u_long next;
 	int error;
 
 	fmp = vp->v_mount->m_data;
+	np = vp->v_data;
+	if (fat_journal_file(fmp, &np->dirent))
+		return EPERM;
+	rw_wlock(&np->lock);
 	mutex_lock(&fmp->lock);
 
-	np = vp->v_data;
 	de = &np->dirent;
 
 	if (length == 0) {
-		/* Remove clusters */
-		error = fat_free_clusters(fmp, de->cluster);
+		/*
+		 * Remove clusters.  The first cluster is kept
+		 * because the directory entry still points it.
+		 */
+		error = fat_next_cluster(fmp, DE_CLUSTER(de), &next);
 		if (error)
 			goto out;
+		if (!IS_EOFCL(fmp, next)) {
+			error = fat_free_clusters(fmp, next);
+			if (error)
+				goto out;
+			error = fat_set_cluster(fmp, DE_CLUSTER(de),
+						fmp->fat_eof);
+			if (error)
+				goto out;
+		}
+		fat_flush_extents(np);
 	} else if (length > vp->v_size) {
 		error = fat_expand_file(fmp, vp->v_blkno, length);
 		if (error) {
@@ -708,7 +868,10 @@ fatfs_truncate(vnode_t vp, off_t length)
 		goto out;
 	vp->v_size = length;
  out:
+	if (fat_sync(fmp) != 0 && error == 0)
+		error = EIO;
 	mutex_unlock(&fmp->lock);
+	rw_unlock(&np->lock);
 	return error;
 }
 
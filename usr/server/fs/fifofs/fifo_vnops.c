@@ -39,6 +39,7 @@
 #include <sys/syslog.h>
 #include <sys/dirent.h>
 #include <sys/list.h>
+#include <sys/param.h>
 
 #include <ctype.h>
 #include <unistd.h>
@@ -60,11 +61,29 @@ struct fifo_node {
 	mutex_t	fn_wmtx;	/* mutex for write */
 	int	fn_readers;	/* reader count */
 	int	fn_writers;	/* writer count */
-	int	fn_start;	/* start offset of buffer data */
-	int	fn_size;	/* size of buffer data */
+	int	fn_rwait;	/* number of readers waiting for data */
+	int	fn_wwait;	/* number of writers waiting for space */
+	size_t	fn_start;	/* start offset of buffer data */
+	size_t	fn_size;	/* size of buffer data */
 	char	*fn_buf;	/* pointer to buffer */
+	char	*fn_rbuf;	/* buffer of the reader waiting for data */
+	size_t	fn_rsize;	/* size of fn_rbuf */
+	size_t	*fn_rdone;	/* bytes copied to fn_rbuf */
 };
 
+/*
+ * Size of the pipe buffer.  It is allocated by pages, and it
+ * holds one atomic write at least.
+ */
+#ifdef CONFIG_PIPE_SIZE
+#define FIFO_BUFSZ	round_page(MAX(CONFIG_PIPE_SIZE, PIPE_BUF))
+#else
+#define FIFO_BUFSZ	round_page(PIPE_BUF)
+#endif
+
+/* Free space to wake up the waiting writers */
+#define FIFO_LOWAT	(FIFO_BUFSZ / 2)
+
 #define fifo_mount	((vfsop_mount_t)vfs_nullop)
 #define fifo_unmount	((vfsop_umount_t)vfs_nullop)
 #define fifo_sync	((vfsop_sync_t)vfs_nullop)
@@ -89,6 +108,8 @@ static int fifo_remove	(vnode_t, vnode_t, char *);
 #define fifo_setattr	((vnop_setattr_t)vop_nullop)
 #define fifo_inactive	((vnop_inactive_t)vop_nullop)
 #define fifo_truncate	((vnop_truncate_t)vop_nullop)
+#define fifo_getpages	((vnop_getpages_t)NULL)
+#define fifo_putpages	((vnop_putpages_t)NULL)
 
 static void cleanup_fifo(vnode_t);
 static void wait_reader(vnode_t);
@@ -124,6 +145,8 @@ struct vnops fifofs_vnops = {
 	fifo_setattr,		/* setattr */
 	fifo_inactive,		/* inactive */
 	fifo_truncate,		/* truncate */
+	fifo_getpages,		/* getpages */
+	fifo_putpages,		/* putpages */
 };
 
 /*
@@ -215,12 +238,16 @@ fifo_close(vnode_t vp, file_t fp)
 	return 0;
 }
 
+/*
+ * If the pipe is empty, the reader posts its buffer before it
+ * sleeps.  Then the next writer copies the data into the buffer
+ * directly instead of the pipe buffer.
+ */
 static int
 fifo_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
 	struct fifo_node *np = vp->v_data;
-	char *p = buf;
-	u_int pos, nbytes;
+	size_t len, done;
 
 	DPRINTF(("fifo_read\n"));
 
@@ -235,28 +262,41 @@ fifo_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 			*result = 0;
 			return 0;
 		}
-		/*
- 		 * wait for data
-		 */
+		done = 0;
+		if (np->fn_rbuf == NULL) {
+			np->fn_rbuf = buf;
+			np->fn_rsize = size;
+			np->fn_rdone = &done;
+		}
+		np->fn_rwait++;
 		wait_writer(vp);
+		np->fn_rwait--;
+		if (np->fn_rdone == &done) {
+			/* No data is copied to our buffer. */
+			np->fn_rbuf = NULL;
+			np->fn_rdone = NULL;
+		}
+		if (done > 0) {
+			*result = done;
+			return 0;
+		}
 	}
 	/*
 	 * Read
 	 */
-	nbytes = (np->fn_size < size) ? np->fn_size : size;
-	np->fn_size -= nbytes;
-	*result = nbytes;
-
-	pos = np->fn_start;
-	while (nbytes > 0) {
-		*p++ = np->fn_buf[pos];
-		if (++pos > PIPE_BUF)
-			pos = 0;
-		nbytes--;
-	}
-	np->fn_start = pos;
-
-	wakeup_writer(vp);
+	size = MIN(np->fn_size, size);
+	len = MIN(size, FIFO_BUFSZ - np->fn_start);
+	memcpy(buf, np->fn_buf + np->fn_start, len);
+	memcpy((char *)buf + len, np->fn_buf, size - len);
+
+	np->fn_size -= size;
+	np->fn_start = (np->fn_size == 0) ? 0 :
+		(np->fn_start + size) % FIFO_BUFSZ;
+	*result = size;
+
+	/* Wake up the writers when enough space is available. */
+	if (np->fn_wwait > 0 && FIFO_BUFSZ - np->fn_size >= FIFO_LOWAT)
+		wakeup_writer(vp);
 	return 0;
 }
 
@@ -265,45 +305,70 @@ fifo_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
 	struct fifo_node *np = vp->v_data;
 	char *p = buf;
-	u_int pos, nfree, nbytes, count = 0;
+	size_t pos, nfree, nbytes, len, count = 0;
+	int atomic, error = 0;
 
 	DPRINTF(("fifo_write\n"));
 
- again:
-	/*
-	 * If the pipe is full,
-	 * wait for reads to deplete
-	 * and truncate it.
-	 */
-	while (np->fn_size >= PIPE_BUF)
-		wait_reader(vp);
+	*result = 0;
+	if (np->fn_readers == 0)
+		return EPIPE;
+
+	/* Hand the data to the waiting reader directly. */
+	if (np->fn_size == 0 && np->fn_rbuf != NULL) {
+		nbytes = MIN(size, np->fn_rsize);
+		memcpy(np->fn_rbuf, p, nbytes);
+		*np->fn_rdone = nbytes;
+		np->fn_rbuf = NULL;
+		np->fn_rdone = NULL;
+		p += nbytes;
+		size -= nbytes;
+		count += nbytes;
+	}
 
 	/*
-	 * Write
+	 * The write of PIPE_BUF bytes or less is not interleaved
+	 * with other writes.
 	 */
-	nfree = PIPE_BUF - np->fn_size;
-	nbytes = (nfree < size) ? nfree : size;
-
-	pos = np->fn_start + np->fn_size;
-	if (pos >= PIPE_BUF)
-		pos -= PIPE_BUF;
-	np->fn_size += nbytes;
-	size -= nbytes;
-	while (nbytes > 0) {
-		np->fn_buf[pos] = *p++;
-		if (++pos > PIPE_BUF)
-			pos = 0;
-		nbytes--;
-		count++;
+	atomic = (size <= PIPE_BUF);
+	while (size > 0) {
+		nfree = FIFO_BUFSZ - np->fn_size;
+		if (nfree == 0 || (atomic && nfree < size)) {
+			/*
+			 * If the pipe is full, pass the data to the
+			 * readers and wait for reads to deplete.
+			 */
+			if (np->fn_rwait > 0)
+				wakeup_reader(vp);
+			np->fn_wwait++;
+			wait_reader(vp);
+			np->fn_wwait--;
+			if (np->fn_readers == 0) {
+				error = EPIPE;
+				break;
+			}
+			continue;
+		}
+		/*
+		 * Write
+		 */
+		nbytes = MIN(nfree, size);
+		pos = (np->fn_start + np->fn_size) % FIFO_BUFSZ;
+		len = MIN(nbytes, FIFO_BUFSZ - pos);
+		memcpy(np->fn_buf + pos, p, len);
+		memcpy(np->fn_buf, p + len, nbytes - len);
+
+		np->fn_size += nbytes;
+		p += nbytes;
+		size -= nbytes;
+		count += nbytes;
 	}
 
-	wakeup_reader(vp);
-
-	if (size > 0)
-		goto again;
+	if (count > 0 && np->fn_rwait > 0)
+		wakeup_reader(vp);
 
 	*result = count;
-	return 0;
+	return (count > 0) ? 0 : error;
 }
 
 static int
@@ -364,14 +429,14 @@ fifo_create(vnode_t dvp, char *name, mode_t mode)
 	if ((np = malloc(sizeof(struct fifo_node))) == NULL)
 		return ENOMEM;
 
-	if ((np->fn_buf = malloc(PIPE_BUF)) == NULL) {
+	if (vm_allocate(task_self(), (void **)&np->fn_buf, FIFO_BUFSZ, 1)) {
 		free(np);
 		return ENOMEM;
 	}
 	len = strlen(name) + 1;
 	np->fn_name = malloc(len);
 	if (np->fn_name == NULL) {
-		free(np->fn_buf);
+		vm_free(task_self(), np->fn_buf);
 		free(np);
 		return ENOMEM;
 	}
@@ -383,8 +448,12 @@ fifo_create(vnode_t dvp, char *name, mode_t mode)
 	cond_init(&np->fn_wcond);
 	np->fn_readers = 0;
 	np->fn_writers = 0;
+	np->fn_rwait = 0;
+	np->fn_wwait = 0;
 	np->fn_start = 0;
 	np->fn_size = 0;
+	np->fn_rbuf = NULL;
+	np->fn_rdone = NULL;
 
 	mutex_lock(&fifo_lock);
 	list_insert(&fifo_head, &np->fn_link);
@@ -402,7 +471,7 @@ cleanup_fifo(vnode_t vp)
 	mutex_unlock(&fifo_lock);
 
 	free(np->fn_name);
-	free(np->fn_buf);
+	vm_free(task_self(), np->fn_buf);
 	free(np);
 
 	vp->v_data = NULL;
@@ -470,14 +539,20 @@ fifofs_init(void)
 }
 
 
+/*
+ * The wait routines take the mutex before releasing the vnode
+ * lock.  The state of pipe is changed with the vnode lock held,
+ * and the wakeup routines take the same mutex, so no wakeup is
+ * lost between the check of state and the wait.
+ */
 static void
 wait_reader(vnode_t vp)
 {
 	struct fifo_node *np = vp->v_data;
 
 	DPRINTF(("wait_reader: %x\n", np));
-	vn_unlock(vp);
 	mutex_lock(&np->fn_rmtx);
+	vn_unlock(vp);
 	cond_wait(&np->fn_rcond, &np->fn_rmtx);
 	mutex_unlock(&np->fn_rmtx);
 	vn_lock(vp);
@@ -489,7 +564,9 @@ wakeup_writer(vnode_t vp)
 	struct fifo_node *np = vp->v_data;
 
 	DPRINTF(("wakeup_writer: %x\n", np));
+	mutex_lock(&np->fn_rmtx);
 	cond_broadcast(&np->fn_rcond);
+	mutex_unlock(&np->fn_rmtx);
 }
 
 static void
@@ -498,8 +575,8 @@ wait_writer(vnode_t vp)
 	struct fifo_node *np = vp->v_data;
 
 	DPRINTF(("wait_writer: %x\n", np));
-	vn_unlock(vp);
 	mutex_lock(&np->fn_wmtx);
+	vn_unlock(vp);
 	cond_wait(&np->fn_wcond, &np->fn_wmtx);
 	mutex_unlock(&np->fn_wmtx);
 	vn_lock(vp);
@@ -511,5 +588,7 @@ wakeup_reader(vnode_t vp)
 	struct fifo_node *np = vp->v_data;
 
 	DPRINTF(("wakeup_reader: %x\n", np));
+	mutex_lock(&np->fn_wmtx);
 	cond_broadcast(&np->fn_wcond);
+	mutex_unlock(&np->fn_wmtx);
 }
@@ -33,6 +33,7 @@
 #include <sys/cdefs.h>
 #include <sys/prex.h>
 #include <sys/types.h>
+#include <sys/vnode.h>
 
 /* #define DEBUG_RAMFS 1 */
 
@@ -55,23 +56,50 @@
 #define mutex_trylock(m)	do {} while (0)
 #endif
 
+/*
+ * Mount data for RAMFS
+ */
+struct ramfs_mount {
+	size_t	 rm_maxsize;	/* max size of file data, 0 for no limit */
+	size_t	 rm_size;	/* size of allocated pages */
+	mutex_t	 rm_lock;	/* lock for rm_size */
+};
+
 /*
  * File/directory node for RAMFS
+ *
+ * The file data is stored in pages which are indexed by a radix
+ * tree.  The pages in a hole are not allocated.  The children of
+ * a directory are linked in the creation order, and they are
+ * also put to the hash table of the directory.
  */
 struct ramfs_node {
 	struct	ramfs_node *rn_next;   /* next node in the same directory */
+	struct	ramfs_node *rn_prev;   /* previous node in the same directory */
+	struct	ramfs_node *rn_hnext;  /* next node in the same hash chain */
 	struct	ramfs_node *rn_child;  /* first child node */
+	struct	ramfs_node *rn_last;   /* last child node */
+	struct	ramfs_node **rn_hash;  /* hash table for children */
+	u_int	 rn_nhash;	/* size of hash table */
+	u_int	 rn_nchild;	/* number of children */
+	struct	ramfs_node *rn_rdnode; /* child returned by last readdir */
+	off_t	 rn_rdoff;	/* directory offset of rn_rdnode */
 	int	 rn_type;	/* file or directory */
 	char	*rn_name;	/* name (null-terminated) */
 	size_t	 rn_namelen;	/* length of name not including terminator */
 	size_t	 rn_size;	/* file size */
-	char	*rn_buf;	/* buffer to the file data */
-	size_t	 rn_bufsize;	/* allocated buffer size */
+	void	*rn_pages;	/* root of page tree */
+	int	 rn_height;	/* height of page tree */
+	struct rwlock rn_lock;	/* lock for children or file data */
 };
 
 __BEGIN_DECLS
 struct ramfs_node *ramfs_allocate_node(char *name, int type);
 void ramfs_free_node(struct ramfs_node *node);
+void *ramfs_page_find(struct ramfs_node *, u_long);
+int ramfs_page_alloc(struct ramfs_mount *, struct ramfs_node *, u_long,
+		     void **);
+void ramfs_page_trunc(struct ramfs_mount *, struct ramfs_node *, off_t);
 __END_DECLS
 
 #endif /* !_RAMFS_H */
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ramfs_page.c - page management for RAM file system.
+ */
+
+/*
+ * The pages of a file are indexed by a radix tree.  Each tree
+ * node holds RADIX_SIZE slots, and the slots of the lowest
+ * level point to the data pages.  The height of tree grows as
+ * the file grows, so small files need only one tree node.
+ */
+
+#include <sys/prex.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "ramfs.h"
+
+#define RADIX_SHIFT	6
+#define RADIX_SIZE	(1 << RADIX_SHIFT)
+#define RADIX_MASK	(RADIX_SIZE - 1)
+
+/* Max page index for the tree of the height */
+#define RADIX_MAXIDX(h)	((1UL << ((h) * RADIX_SHIFT)) - 1)
+
+/* Slot index in the tree node of the level */
+#define RADIX_SLOT(idx, h) \
+	(((idx) >> (((h) - 1) * RADIX_SHIFT)) & RADIX_MASK)
+
+struct ramfs_radix {
+	void	*slots[RADIX_SIZE];
+};
+
+static struct ramfs_radix *
+ramfs_radix_alloc(void)
+{
+	struct ramfs_radix *rp;
+
+	if ((rp = malloc(sizeof(struct ramfs_radix))) != NULL)
+		memset(rp, 0, sizeof(struct ramfs_radix));
+	return rp;
+}
+
+/*
+ * Find the page for the page index in file.
+ * Returns NULL if the page is in a hole.
+ */
+void *
+ramfs_page_find(struct ramfs_node *np, u_long idx)
+{
+	struct ramfs_radix *rp;
+	void *p;
+	int h;
+
+	if (np->rn_height == 0 || idx > RADIX_MAXIDX(np->rn_height))
+		return NULL;
+
+	p = np->rn_pages;
+	for (h = np->rn_height; h > 0 && p != NULL; h--) {
+		rp = p;
+		p = rp->slots[RADIX_SLOT(idx, h)];
+	}
+	return p;
+}
+
+/*
+ * Get the page for the page index in file.
+ * A new zero-filled page is allocated if it does not exist.
+ */
+int
+ramfs_page_alloc(struct ramfs_mount *rmp, struct ramfs_node *np,
+		 u_long idx, void **pagep)
+{
+	struct ramfs_radix *rp;
+	void **slot;
+	void *page;
+	int h;
+
+	if ((page = ramfs_page_find(np, idx)) != NULL) {
+		*pagep = page;
+		return 0;
+	}
+
+	/* Grow the tree until it covers the index. */
+	if (np->rn_pages == NULL)
+		np->rn_height = 1;
+	while (idx > RADIX_MAXIDX(np->rn_height)) {
+		if (np->rn_pages != NULL) {
+			if ((rp = ramfs_radix_alloc()) == NULL)
+				return ENOMEM;
+			rp->slots[0] = np->rn_pages;
+			np->rn_pages = rp;
+		}
+		np->rn_height++;
+	}
+
+	/* Walk down the tree, and fill the missing nodes. */
+	slot = &np->rn_pages;
+	for (h = np->rn_height; h > 0; h--) {
+		if (*slot == NULL) {
+			if ((*slot = ramfs_radix_alloc()) == NULL)
+				return ENOMEM;
+		}
+		rp = *slot;
+		slot = &rp->slots[RADIX_SLOT(idx, h)];
+	}
+
+	/* Allocate the page within the limit of the mount. */
+	mutex_lock(&rmp->rm_lock);
+	if (rmp->rm_maxsize != 0 &&
+	    rmp->rm_size + PAGE_SIZE > rmp->rm_maxsize) {
+		mutex_unlock(&rmp->rm_lock);
+		return ENOSPC;
+	}
+	rmp->rm_size += PAGE_SIZE;
+	mutex_unlock(&rmp->rm_lock);
+
+	if (vm_allocate(task_self(), &page, PAGE_SIZE, 1) != 0) {
+		mutex_lock(&rmp->rm_lock);
+		rmp->rm_size -= PAGE_SIZE;
+		mutex_unlock(&rmp->rm_lock);
+		return ENOMEM;
+	}
+	*slot = page;
+	*pagep = page;
+	return 0;
+}
+
+/*
+ * Free the pages at or after the page index under the tree
+ * node.  Returns the number of freed pages.  The tree node is
+ * freed if it becomes empty.
+ */
+static u_long
+ramfs_radix_free(struct ramfs_radix *rp, int h, u_long base, u_long start,
+		 int *empty)
+{
+	u_long n, span;
+	int i, used, sub_empty;
+
+	span = 1UL << ((h - 1) * RADIX_SHIFT);
+	n = 0;
+	used = 0;
+	for (i = 0; i < RADIX_SIZE; i++, base += span) {
+		if (rp->slots[i] == NULL)
+			continue;
+		if (base + span <= start) {
+			used = 1;
+			continue;
+		}
+		if (h == 1) {
+			vm_free(task_self(), rp->slots[i]);
+			rp->slots[i] = NULL;
+			n++;
+			continue;
+		}
+		n += ramfs_radix_free(rp->slots[i], h - 1, base, start,
+				      &sub_empty);
+		if (sub_empty)
+			rp->slots[i] = NULL;
+		else
+			used = 1;
+	}
+	*empty = !used;
+	if (!used)
+		free(rp);
+	return n;
+}
+
+/*
+ * Truncate the pages of file to the length.
+ * The rest of the last page is cleared, so the data beyond the
+ * end of file are read as zero when the file is extended.
+ */
+void
+ramfs_page_trunc(struct ramfs_mount *rmp, struct ramfs_node *np,
+		 off_t length)
+{
+	u_long start, n;
+	size_t off;
+	char *page;
+	int empty;
+
+	if (np->rn_pages == NULL)
+		return;
+
+	start = (u_long)round_page(length) / PAGE_SIZE;
+	n = ramfs_radix_free(np->rn_pages, np->rn_height, 0, start, &empty);
+	if (empty) {
+		np->rn_pages = NULL;
+		np->rn_height = 0;
+	} else if ((off = (size_t)length % PAGE_SIZE) != 0) {
+		page = ramfs_page_find(np, (u_long)length / PAGE_SIZE);
+		if (page != NULL)
+			memset(page + off, 0, PAGE_SIZE - off);
+	}
+
+	mutex_lock(&rmp->rm_lock);
+	rmp->rm_size -= n * PAGE_SIZE;
+	mutex_unlock(&rmp->rm_lock);
+}
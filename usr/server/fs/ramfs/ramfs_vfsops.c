@@ -29,8 +29,11 @@
 
 #include <sys/vnode.h>
 #include <sys/mount.h>
+#include <sys/param.h>
 
 #include <errno.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "ramfs.h"
 
@@ -54,20 +57,58 @@ struct vfsops ramfs_vfsops = {
 	&ramfs_vnops,		/* vnops */
 };
 
+/*
+ * Get the size limit from the mount option.
+ * The option is "size=<bytes>", and the size can have a suffix
+ * 'k' or 'm'.  Returns 0 if no limit is given.
+ */
+static size_t
+ramfs_parse_size(char *opt)
+{
+	u_long size;
+	char *p;
+
+	for (p = opt; p != NULL && *p != '\0'; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		if (strncmp(p, "size=", 5) != 0)
+			continue;
+		size = strtoul(p + 5, &p, 10);
+		if (*p == 'k' || *p == 'K')
+			size *= 1024;
+		else if (*p == 'm' || *p == 'M')
+			size *= 1024 * 1024;
+		return (size_t)round_page(size);
+	}
+	return 0;
+}
+
 /*
  * Mount a file system.
  */
 static int
 ramfs_mount(mount_t mp, char *dev, int flags, void *data)
 {
+	struct ramfs_mount *rmp;
 	struct ramfs_node *np;
 
 	DPRINTF(("ramfs_mount: dev=%s\n", dev));
 
+	rmp = malloc(sizeof(struct ramfs_mount));
+	if (rmp == NULL)
+		return ENOMEM;
+	rmp->rm_maxsize = ramfs_parse_size(data);
+	rmp->rm_size = 0;
+	mutex_init(&rmp->rm_lock);
+
 	/* Create a root node */
 	np = ramfs_allocate_node("/", VDIR);
-	if (np == NULL)
+	if (np == NULL) {
+		mutex_destroy(&rmp->rm_lock);
+		free(rmp);
 		return ENOMEM;
+	}
+	mp->m_data = rmp;
 	mp->m_root->v_data = np;
 	return 0;
 }
@@ -65,12 +65,10 @@ static int ramfs_rmdir	(vnode_t, vnode_t, char *);
 #define ramfs_setattr	((vnop_setattr_t)vop_nullop)
 #define ramfs_inactive	((vnop_inactive_t)vop_nullop)
 static int ramfs_truncate(vnode_t, off_t);
+#define ramfs_getpages	((vnop_getpages_t)NULL)
+#define ramfs_putpages	((vnop_putpages_t)NULL)
 
 
-#if CONFIG_FS_THREADS > 1
-static mutex_t ramfs_lock = MUTEX_INITIALIZER;
-#endif
-
 /*
  * vnode operations
  */
@@ -93,8 +91,12 @@ struct vnops ramfs_vnops = {
 	ramfs_setattr,		/* setattr */
 	ramfs_inactive,		/* inactive */
 	ramfs_truncate,		/* truncate */
+	ramfs_getpages,		/* getpages */
+	ramfs_putpages,		/* putpages */
 };
 
+#define RAMFS_MINHASH	8		/* initial size of hash table */
+
 struct ramfs_node *
 ramfs_allocate_node(char *name, int type)
 {
@@ -113,6 +115,7 @@ ramfs_allocate_node(char *name, int type)
 	}
 	strlcpy(np->rn_name, name, np->rn_namelen + 1);
 	np->rn_type = type;
+	rw_init(&np->rn_lock);
 	return np;
 }
 
@@ -120,83 +123,194 @@ void
 ramfs_free_node(struct ramfs_node *np)
 {
 
+	rw_destroy(&np->rn_lock);
+	if (np->rn_hash != NULL)
+		free(np->rn_hash);
 	free(np->rn_name);
 	free(np);
 }
 
+static u_int
+ramfs_hash(char *name, size_t len)
+{
+	u_int val = 0;
+
+	while (len-- > 0)
+		val = ((val << 5) + val) + *name++;
+	return val;
+}
+
+/*
+ * Expand the hash table of directory, and rehash all children.
+ * The old table is kept if a new table can not be allocated.
+ */
+static int
+ramfs_grow_hash(struct ramfs_node *dnp)
+{
+	struct ramfs_node **hash, *np;
+	u_int size, h;
+
+	size = (dnp->rn_nhash == 0) ? RAMFS_MINHASH : dnp->rn_nhash * 2;
+	if ((hash = malloc(size * sizeof(struct ramfs_node *))) == NULL)
+		return ENOMEM;
+	memset(hash, 0, size * sizeof(struct ramfs_node *));
+
+	for (np = dnp->rn_child; np != NULL; np = np->rn_next) {
+		h = ramfs_hash(np->rn_name, np->rn_namelen) & (size - 1);
+		np->rn_hnext = hash[h];
+		hash[h] = np;
+	}
+	if (dnp->rn_hash != NULL)
+		free(dnp->rn_hash);
+	dnp->rn_hash = hash;
+	dnp->rn_nhash = size;
+	return 0;
+}
+
+/*
+ * Link the node to the directory.
+ * The caller must hold the write lock of directory.
+ */
+static void
+ramfs_link_node(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+	u_int h;
+
+	np->rn_next = NULL;
+	np->rn_prev = dnp->rn_last;
+	if (dnp->rn_last == NULL)
+		dnp->rn_child = np;
+	else
+		dnp->rn_last->rn_next = np;
+	dnp->rn_last = np;
+	dnp->rn_nchild++;
+
+	if (dnp->rn_nchild > dnp->rn_nhash * 2 && ramfs_grow_hash(dnp) == 0)
+		return;
+	if (dnp->rn_hash != NULL) {
+		h = ramfs_hash(np->rn_name, np->rn_namelen) &
+			(dnp->rn_nhash - 1);
+		np->rn_hnext = dnp->rn_hash[h];
+		dnp->rn_hash[h] = np;
+	}
+}
+
+/*
+ * Unlink the node from the directory.
+ * The caller must hold the write lock of directory.
+ */
+static void
+ramfs_unlink_node(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+	struct ramfs_node **pp;
+
+	if (dnp->rn_hash != NULL) {
+		pp = &dnp->rn_hash[ramfs_hash(np->rn_name, np->rn_namelen) &
+				   (dnp->rn_nhash - 1)];
+		for (; *pp != NULL; pp = &(*pp)->rn_hnext) {
+			if (*pp == np) {
+				*pp = np->rn_hnext;
+				break;
+			}
+		}
+	}
+	if (np->rn_prev == NULL)
+		dnp->rn_child = np->rn_next;
+	else
+		np->rn_prev->rn_next = np->rn_next;
+	if (np->rn_next == NULL)
+		dnp->rn_last = np->rn_prev;
+	else
+		np->rn_next->rn_prev = np->rn_prev;
+	dnp->rn_nchild--;
+
+	/* Forget the readdir position. */
+	dnp->rn_rdnode = NULL;
+}
+
+/*
+ * Find the child node by name.
+ * The directory list is searched if no hash table is allocated.
+ */
+static struct ramfs_node *
+ramfs_find_node(struct ramfs_node *dnp, char *name, size_t len)
+{
+	struct ramfs_node *np;
+
+	if (dnp->rn_hash != NULL) {
+		np = dnp->rn_hash[ramfs_hash(name, len) & (dnp->rn_nhash - 1)];
+		for (; np != NULL; np = np->rn_hnext) {
+			if (np->rn_namelen == len &&
+			    memcmp(name, np->rn_name, len) == 0)
+				return np;
+		}
+		return NULL;
+	}
+	for (np = dnp->rn_child; np != NULL; np = np->rn_next) {
+		if (np->rn_namelen == len &&
+		    memcmp(name, np->rn_name, len) == 0)
+			return np;
+	}
+	return NULL;
+}
+
 static struct ramfs_node *
 ramfs_add_node(struct ramfs_node *dnp, char *name, int type)
 {
-	struct ramfs_node *np, *prev;
+	struct ramfs_node *np;
 
 	np = ramfs_allocate_node(name, type);
 	if (np == NULL)
 		return NULL;
 
-	mutex_lock(&ramfs_lock);
-
-	/* Link to the directory list */
-	if (dnp->rn_child == NULL) {
-		dnp->rn_child = np;
-	} else {
-		prev = dnp->rn_child;
-		while (prev->rn_next != NULL)
-			prev = prev->rn_next;
-		prev->rn_next = np;
-	}
-	mutex_unlock(&ramfs_lock);
+	rw_wlock(&dnp->rn_lock);
+	ramfs_link_node(dnp, np);
+	rw_unlock(&dnp->rn_lock);
 	return np;
 }
 
 static int
 ramfs_remove_node(struct ramfs_node *dnp, struct ramfs_node *np)
 {
-	struct ramfs_node *prev;
 
-	if (dnp->rn_child == NULL)
+	rw_wlock(&dnp->rn_lock);
+	if (dnp->rn_child == NULL) {
+		rw_unlock(&dnp->rn_lock);
 		return EBUSY;
-
-	mutex_lock(&ramfs_lock);
-
-	/* Unlink from the directory list */
-	if (dnp->rn_child == np) {
-		dnp->rn_child = np->rn_next;
-	} else {
-		for (prev = dnp->rn_child; prev->rn_next != np;
-		     prev = prev->rn_next) {
-			if (prev->rn_next == NULL) {
-				mutex_unlock(&ramfs_lock);
-				return ENOENT;
-			}
-		}
-		prev->rn_next = np->rn_next;
 	}
-	ramfs_free_node(np);
+	ramfs_unlink_node(dnp, np);
+	rw_unlock(&dnp->rn_lock);
 
-	mutex_unlock(&ramfs_lock);
+	ramfs_free_node(np);
 	return 0;
 }
 
+/*
+ * Move the node to the directory with new name.
+ */
 static int
-ramfs_rename_node(struct ramfs_node *np, char *name)
+ramfs_rename_node(struct ramfs_node *dnp1, struct ramfs_node *dnp2,
+		  struct ramfs_node *np, char *name)
 {
 	size_t len;
 	char *tmp;
 
 	len = strlen(name);
-	if (len <= np->rn_namelen) {
-		/* Reuse current name buffer */
-		strlcpy(np->rn_name, name, sizeof(np->rn_name));
-	} else {
-		/* Expand name buffer */
-		tmp = malloc(len + 1);
-		if (tmp == NULL)
-			return ENOMEM;
-		strlcpy(tmp, name, len + 1);
-		free(np->rn_name);
-		np->rn_name = tmp;
-	}
+	if ((tmp = malloc(len + 1)) == NULL)
+		return ENOMEM;
+	strlcpy(tmp, name, len + 1);
+
+	rw_wlock(&dnp1->rn_lock);
+	ramfs_unlink_node(dnp1, np);
+	rw_unlock(&dnp1->rn_lock);
+
+	free(np->rn_name);
+	np->rn_name = tmp;
 	np->rn_namelen = len;
+
+	rw_wlock(&dnp2->rn_lock);
+	ramfs_link_node(dnp2, np);
+	rw_unlock(&dnp2->rn_lock);
 	return 0;
 }
 
@@ -204,26 +318,15 @@ static int
 ramfs_lookup(vnode_t dvp, char *name, vnode_t vp)
 {
 	struct ramfs_node *np, *dnp;
-	size_t len;
-	int found;
 
 	if (*name == '\0')
 		return ENOENT;
 
-	mutex_lock(&ramfs_lock);
-
-	len = strlen(name);
 	dnp = dvp->v_data;
-	found = 0;
-	for (np = dnp->rn_child; np != NULL; np = np->rn_next) {
-		if (np->rn_namelen == len &&
-		    memcmp(name, np->rn_name, len) == 0) {
-			found = 1;
-			break;
-		}
-	}
-	if (found == 0) {
-		mutex_unlock(&ramfs_lock);
+	rw_rlock(&dnp->rn_lock);
+	np = ramfs_find_node(dnp, name, strlen(name));
+	if (np == NULL) {
+		rw_unlock(&dnp->rn_lock);
 		return ENOENT;
 	}
 	vp->v_data = np;
@@ -231,7 +334,7 @@ ramfs_lookup(vnode_t dvp, char *name, vnode_t vp)
 	vp->v_type = np->rn_type;
 	vp->v_size = np->rn_size;
 
-	mutex_unlock(&ramfs_lock);
+	rw_unlock(&dnp->rn_lock);
 	return 0;
 }
 
@@ -264,17 +367,14 @@ static int
 ramfs_remove(vnode_t dvp, vnode_t vp, char *name)
 {
 	struct ramfs_node *np;
-	int error;
 
 	DPRINTF(("remove %s in %s\n", name, dvp->v_path));
-	error = ramfs_remove_node(dvp->v_data, vp->v_data);
-	if (error)
-		return error;
-
 	np = vp->v_data;
-	if (np->rn_buf != NULL)
-		vm_free(task_self(), np->rn_buf);
-	return 0;
+	rw_wlock(&np->rn_lock);
+	ramfs_page_trunc(vp->v_mount->m_data, np, 0);
+	rw_unlock(&np->rn_lock);
+
+	return ramfs_remove_node(dvp->v_data, np);
 }
 
 /* Truncate file */
@@ -282,33 +382,17 @@ static int
 ramfs_truncate(vnode_t vp, off_t length)
 {
 	struct ramfs_node *np;
-	void *new_buf;
-	size_t new_size;
-	task_t task;
 
 	DPRINTF(("truncate %s length=%d\n", vp->v_path, length));
 	np = vp->v_data;
+	rw_wlock(&np->rn_lock);
 
-	if (length == 0) {
-		if (np->rn_buf != NULL) {
-			vm_free(task_self(), np->rn_buf);
-			np->rn_buf = NULL;
-			np->rn_bufsize = 0;
-		}
-	} else if (length > np->rn_bufsize) {
-		task = task_self();
-		new_size = round_page(length);
-		if (vm_allocate(task, &new_buf, new_size, 1))
-			return EIO;
-		if (np->rn_size != 0) {
-			memcpy(new_buf, np->rn_buf, vp->v_size);
-			vm_free(task, np->rn_buf);
-		}
-		np->rn_buf = new_buf;
-		np->rn_bufsize = new_size;
-	}
+	/* The pages are allocated when they are written. */
+	if (length < (off_t)np->rn_size)
+		ramfs_page_trunc(vp->v_mount->m_data, np, length);
 	np->rn_size = length;
 	vp->v_size = length;
+	rw_unlock(&np->rn_lock);
 	return 0;
 }
 
@@ -335,6 +419,8 @@ ramfs_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
 	struct ramfs_node *np;
 	off_t off;
+	size_t pos, len, nr_read;
+	char *page;
 
 	*result = 0;
 	if (vp->v_type == VDIR)
@@ -342,15 +428,30 @@ ramfs_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 	if (vp->v_type != VREG)
 		return EINVAL;
 
+	np = vp->v_data;
+	rw_rlock(&np->rn_lock);
+
 	off = fp->f_offset;
-	if (off >= (off_t)vp->v_size)
+	if (off >= (off_t)np->rn_size) {
+		rw_unlock(&np->rn_lock);
 		return 0;
-
-	if (vp->v_size - off < size)
-		size = vp->v_size - off;
-
-	np = vp->v_data;
-	memcpy(buf, np->rn_buf + off, size);
+	}
+	if (np->rn_size - off < size)
+		size = np->rn_size - off;
+
+	/* Copy page by page.  A hole is read as zero. */
+	for (nr_read = 0; nr_read < size; nr_read += len) {
+		pos = (size_t)off % PAGE_SIZE;
+		len = MIN(PAGE_SIZE - pos, size - nr_read);
+		page = ramfs_page_find(np, (u_long)off / PAGE_SIZE);
+		if (page == NULL)
+			memset(buf, 0, len);
+		else
+			memcpy(buf, page + pos, len);
+		buf = (char *)buf + len;
+		off += len;
+	}
+	rw_unlock(&np->rn_lock);
 
 	fp->f_offset += size;
 	*result = size;
@@ -361,10 +462,10 @@ static int
 ramfs_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 {
 	struct ramfs_node *np;
-	off_t file_pos, end_pos;
-	void *new_buf;
-	size_t new_size;
-	task_t task;
+	off_t file_pos, off;
+	size_t pos, len, nr_write;
+	char *page;
+	int error;
 
 	*result = 0;
 	if (vp->v_type == VDIR)
@@ -373,37 +474,39 @@ ramfs_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *result)
 		return EINVAL;
 
 	np = vp->v_data;
-	/* Check if the file position exceeds the end of file. */
-	end_pos = vp->v_size;
-	file_pos = (fp->f_flags & O_APPEND) ? end_pos : fp->f_offset;
-	if (file_pos + size > (size_t)end_pos) {
-		/* Expand the file size before writing to it */
-		end_pos = file_pos + size;
-		if (end_pos > (off_t)np->rn_bufsize) {
-			task = task_self();
-			/*
-			 * We allocate the data buffer in page boundary.
-			 * So that we can reduce the memory allocation unless
-			 * the file size exceeds next page boundary.
-			 * This will prevent the memory fragmentation by
-			 * many malloc/free calls.
-			 */
-			new_size = round_page(end_pos);
-			if (vm_allocate(task, &new_buf, new_size, 1))
-				return EIO;
-			if (np->rn_size != 0) {
-				memcpy(new_buf, np->rn_buf, vp->v_size);
-				vm_free(task, np->rn_buf);
-			}
-			np->rn_buf = new_buf;
-			np->rn_bufsize = new_size;
-		}
-		np->rn_size = end_pos;
-		vp->v_size = end_pos;
+	rw_wlock(&np->rn_lock);
+
+	file_pos = (fp->f_flags & O_APPEND) ? (off_t)np->rn_size : fp->f_offset;
+
+	/*
+	 * Copy page by page.  Only the pages to be written are
+	 * allocated, so the file grows without copying its data.
+	 */
+	error = 0;
+	off = file_pos;
+	for (nr_write = 0; nr_write < size; nr_write += len) {
+		pos = (size_t)off % PAGE_SIZE;
+		len = MIN(PAGE_SIZE - pos, size - nr_write);
+		error = ramfs_page_alloc(vp->v_mount->m_data, np,
+					 (u_long)off / PAGE_SIZE,
+					 (void **)&page);
+		if (error)
+			break;
+		memcpy(page + pos, buf, len);
+		buf = (char *)buf + len;
+		off += len;
 	}
-	memcpy(np->rn_buf + file_pos, buf, size);
-	fp->f_offset += size;
-	*result = size;
+	if (off > (off_t)np->rn_size) {
+		np->rn_size = off;
+		vp->v_size = off;
+	}
+	rw_unlock(&np->rn_lock);
+
+	/* Report the partial write if some data were written. */
+	if (nr_write == 0)
+		return error;
+	fp->f_offset = file_pos + nr_write;
+	*result = nr_write;
 	return 0;
 }
 
@@ -411,50 +514,39 @@ static int
 ramfs_rename(vnode_t dvp1, vnode_t vp1, char *name1,
 	     vnode_t dvp2, vnode_t vp2, char *name2)
 {
-	struct ramfs_node *np, *old_np;
+	struct ramfs_node *np;
 	int error;
 
 	if (vp2) {
 		/* Remove destination file, first */
-		error = ramfs_remove_node(dvp2->v_data, vp2->v_data);
-		if (error)
-			return error;
-	}
-	/* Same directory ? */
-	if (dvp1 == dvp2) {
-		/* Change the name of existing file */
-		error = ramfs_rename_node(vp1->v_data, name2);
+		np = vp2->v_data;
+		rw_wlock(&np->rn_lock);
+		ramfs_page_trunc(vp2->v_mount->m_data, np, 0);
+		rw_unlock(&np->rn_lock);
+		error = ramfs_remove_node(dvp2->v_data, np);
 		if (error)
 			return error;
-	} else {
-		/* Create new file or directory */
-		old_np = vp1->v_data;
-		np = ramfs_add_node(dvp2->v_data, name2, VREG);
-		if (np == NULL)
-			return ENOMEM;
-
-		if (vp1->v_type == VREG) {
-			/* Copy file data */
-			np->rn_buf = old_np->rn_buf;
-			np->rn_size = old_np->rn_size;
-			np->rn_bufsize = old_np->rn_bufsize;
-		}
-		/* Remove source file */
-		ramfs_remove_node(dvp1->v_data, vp1->v_data);
 	}
-	return 0;
+	/* Move the node itself, with its data or children. */
+	return ramfs_rename_node(dvp1->v_data, dvp2->v_data, vp1->v_data,
+				 name2);
 }
 
 /*
  * @vp: vnode of the directory.
+ *
+ * The position of last readdir is kept in the directory, so a
+ * sequential scan does not walk the list from the top for each
+ * entry.
  */
 static int
 ramfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 {
 	struct ramfs_node *np, *dnp;
-	int i;
+	off_t i;
 
-	mutex_lock(&ramfs_lock);
+	dnp = vp->v_data;
+	rw_wlock(&dnp->rn_lock);
 
 	if (fp->f_offset == 0) {
 		dir->d_type = DT_DIR;
@@ -463,20 +555,23 @@ ramfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 		dir->d_type = DT_DIR;
 		strlcpy((char *)&dir->d_name, "..", sizeof(dir->d_name));
 	} else {
-		dnp = vp->v_data;
-		np = dnp->rn_child;
+		if (dnp->rn_rdnode != NULL &&
+		    dnp->rn_rdoff <= fp->f_offset) {
+			np = dnp->rn_rdnode;
+			i = dnp->rn_rdoff;
+		} else {
+			np = dnp->rn_child;
+			i = 2;
+		}
+		for (; np != NULL && i != fp->f_offset; i++)
+			np = np->rn_next;
 		if (np == NULL) {
-			mutex_unlock(&ramfs_lock);
+			rw_unlock(&dnp->rn_lock);
 			return ENOENT;
 		}
+		dnp->rn_rdnode = np;
+		dnp->rn_rdoff = i;
 
-		for (i = 0; i != (fp->f_offset - 2); i++) {
-			np = np->rn_next;
-			if (np == NULL) {
-				mutex_unlock(&ramfs_lock);
-				return ENOENT;
-			}
-		}
 		if (np->rn_type == VDIR)
 			dir->d_type = DT_DIR;
 		else
@@ -489,7 +584,7 @@ ramfs_readdir(vnode_t vp, file_t fp, struct dirent *dir)
 
 	fp->f_offset++;
 
-	mutex_unlock(&ramfs_lock);
+	rw_unlock(&dnp->rn_lock);
 	return 0;
 }
 
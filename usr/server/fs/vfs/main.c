@@ -50,12 +50,14 @@
 #include <ipc/proc.h>
 #include <ipc/exec.h>
 #include <ipc/ipc.h>
+#include <ipc/dispatch.h>
 #include <sys/list.h>
 #include <sys/stat.h>
 #include <sys/vnode.h>
 #include <sys/mount.h>
 #include <sys/buf.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 
 #include <limits.h>
 #include <unistd.h>
@@ -85,6 +87,33 @@ struct msg_map {
 /* object for file service */
 static object_t fsobj;
 
+/* dispatch table for fsmsg_map */
+static struct msg_dispatch fs_dispatch;
+
+/*
+ * Server thread pool.
+ * The server starts with FS_THREADS threads, and a thread is
+ * added when all threads are busy, up to FS_MAXTHREADS.
+ */
+#if CONFIG_FS_THREADS > 1
+#if defined(CONFIG_FS_MAXTHREADS) && CONFIG_FS_MAXTHREADS > CONFIG_FS_THREADS
+#define FS_MAXTHREADS	CONFIG_FS_MAXTHREADS
+#else
+#define FS_MAXTHREADS	CONFIG_FS_THREADS
+#endif
+static mutex_t pool_lock = MUTEX_INITIALIZER;
+static int fs_nthreads;		/* number of server threads */
+static int fs_nidle;		/* threads waiting for a request */
+
+static void pool_busy(void);
+static void pool_idle(void);
+#else
+#define pool_busy()	do {} while (0)
+#define pool_idle()	do {} while (0)
+#endif
+
+static void fs_thread(void);
+
 static int
 fs_mount(struct task *t, struct mount_msg *msg)
 {
@@ -123,6 +152,25 @@ fs_sync(struct task *t, struct msg *msg)
 	return sys_sync();
 }
 
+/*
+ * Return the handle of the character device file, or NODEV if
+ * the task can not drive the device by itself.  Only devfs
+ * creates character device vnodes, and it keeps the handle of
+ * the opened device in v_data.
+ */
+static device_t
+file_device(struct task *t, file_t fp)
+{
+	vnode_t vp;
+
+	vp = fp->f_vnode;
+	if (vp->v_type != VCHR || vp->v_data == NULL)
+		return NODEV;
+	if (task_chkcap(t->t_taskid, CAP_RAWIO) != 0)
+		return NODEV;
+	return (device_t)vp->v_data;
+}
+
 static int
 fs_open(struct task *t, struct open_msg *msg)
 {
@@ -156,6 +204,7 @@ fs_open(struct task *t, struct open_msg *msg)
 	t->t_ofile[fd] = fp;
 	t->t_nopens++;
 	msg->fd = fd;
+	msg->dev = file_device(t, fp);
 	return 0;
 }
 
@@ -250,6 +299,63 @@ fs_write(struct task *t, struct io_msg *msg)
 	return error;
 }
 
+/*
+ * Common routine for readv/writev.
+ * The transfer stops at the first short vector, and the
+ * error is reported only when nothing has been transferred.
+ */
+static int
+fs_rwv(struct task *t, struct iov_msg *msg, int write)
+{
+	file_t fp;
+	void *buf;
+	size_t size, bytes, total;
+	int i, error = 0;
+
+	if ((fp = task_getfp(t, msg->fd)) == NULL)
+		return EBADF;
+	if (msg->iovcnt < 0 || msg->iovcnt > IOV_MAX)
+		return EINVAL;
+
+	total = 0;
+	for (i = 0; i < msg->iovcnt; i++) {
+		size = msg->iov[i].iov_len;
+		if (size == 0)
+			continue;
+		if (vm_map(msg->hdr.task, msg->iov[i].iov_base, size,
+			   &buf) != 0) {
+			error = EFAULT;
+			break;
+		}
+		if (write)
+			error = sys_write(fp, buf, size, &bytes);
+		else
+			error = sys_read(fp, buf, size, &bytes);
+		vm_free(task_self(), buf);
+		if (error)
+			break;
+		total += bytes;
+		if (bytes != size)
+			break;
+	}
+	msg->size = total;
+	return (total > 0) ? 0 : error;
+}
+
+static int
+fs_readv(struct task *t, struct iov_msg *msg)
+{
+
+	return fs_rwv(t, msg, 0);
+}
+
+static int
+fs_writev(struct task *t, struct iov_msg *msg)
+{
+
+	return fs_rwv(t, msg, 1);
+}
+
 static int
 fs_ioctl(struct task *t, struct ioctl_msg *msg)
 {
@@ -261,6 +367,19 @@ fs_ioctl(struct task *t, struct ioctl_msg *msg)
 	return sys_ioctl(fp, msg->request, msg->buf);
 }
 
+static int
+fs_device(struct task *t, struct device_msg *msg)
+{
+	file_t fp;
+
+	if ((fp = task_getfp(t, msg->fd)) == NULL)
+		return EBADF;
+
+	msg->dev = file_device(t, fp);
+	msg->flags = fp->f_flags & (FREAD | FWRITE);
+	return 0;
+}
+
 static int
 fs_fsync(struct task *t, struct msg *msg)
 {
@@ -380,6 +499,86 @@ fs_telldir(struct task *t, struct msg *msg)
 	return 0;
 }
 
+static int
+fs_getdirentries(struct task *t, struct dirents_msg *msg)
+{
+	file_t fp;
+	void *buf;
+	size_t size;
+	long base;
+	int error;
+
+	if ((fp = task_getfp(t, msg->fd)) == NULL)
+		return EBADF;
+	if ((error = sys_telldir(fp, &base)) != 0)
+		return error;
+	if ((error = vm_map(msg->hdr.task, msg->buf, msg->size, &buf)) != 0)
+		return EFAULT;
+
+	error = sys_getdirentries(fp, buf, msg->size, msg->flags, &size);
+	msg->size = size;
+	msg->base = base;
+	vm_free(task_self(), buf);
+	return error;
+}
+
+static int
+fs_mmap(struct task *t, struct mmap_msg *msg)
+{
+	file_t fp;
+	task_t task;
+	void *addr;
+	int error;
+
+	if ((fp = task_getfp(t, msg->fd)) == NULL)
+		return EBADF;
+
+	/* Mapping to other task requires CAP_EXTMEM. */
+	task = msg->hdr.task;
+	if (msg->task != 0 && msg->task != task) {
+		if (task_chkcap(task, CAP_EXTMEM) != 0)
+			return EPERM;
+		task = msg->task;
+	}
+	addr = (msg->flags & MAP_FIXED) ? msg->addr : NULL;
+	error = sys_mmap(fp, task, &addr, msg->len, msg->prot,
+			 msg->flags, msg->off);
+	msg->addr = addr;
+	return error;
+}
+
+static int
+fs_munmap(struct task *t, struct mmap_msg *msg)
+{
+	task_t task;
+
+	task = msg->hdr.task;
+	if (msg->task != 0 && msg->task != task) {
+		if (task_chkcap(task, CAP_EXTMEM) != 0)
+			return EPERM;
+		task = msg->task;
+	}
+
+	/*
+	 * NULL address releases all mappings of the task.  This
+	 * is used by the exec server for the task failed to start.
+	 */
+	if (msg->addr == NULL) {
+		if (task_chkcap(msg->hdr.task, CAP_PROTSERV) != 0)
+			return EINVAL;
+		mmap_exit(task, 1);
+		return 0;
+	}
+	return sys_munmap(task, msg->addr);
+}
+
+static int
+fs_msync(struct task *t, struct mmap_msg *msg)
+{
+
+	return sys_msync(msg->hdr.task, msg->addr, msg->len, msg->flags);
+}
+
 static int
 fs_mkdir(struct task *t, struct open_msg *msg)
 {
@@ -665,6 +864,12 @@ fs_fork(struct task *t, struct msg *msg)
 	if ((error = task_alloc((task_t)msg->data[0], &newtask)) != 0)
 		return error;
 
+	/* Copy mapped files */
+	if ((error = mmap_fork(t->t_taskid, newtask->t_taskid)) != 0) {
+		task_free(newtask);
+		return error;
+	}
+
 	/*
 	 * Copy task related data
 	 */
@@ -711,6 +916,12 @@ fs_exec(struct task *t, struct msg *msg)
 	if (!(target = task_lookup(old_id)))
 		return EINVAL;
 
+	/*
+	 * The mapped files go away with the old image.  They are
+	 * kept until the exec server terminates the old task.
+	 */
+	mmap_exit(old_id, 0);
+
 	/* Update task id in the task. */
 	task_setid(target, new_id);
 
@@ -751,6 +962,7 @@ fs_exit(struct task *t, struct msg *msg)
 	}
 	if (t->t_cwdfp)
 		sys_close(t->t_cwdfp);
+	mmap_exit(t->t_taskid, 0);
 	task_free(t);
 	return 0;
 }
@@ -903,6 +1115,16 @@ fs_shutdown(struct task *t, struct msg *msg)
 	return 0;
 }
 
+/*
+ * Return message statistics.
+ */
+static int
+fs_msgstat(struct task *t, struct msgstat_msg *msg)
+{
+
+	return msg_dispatch_getstat(&fs_dispatch, msg);
+}
+
 int
 fs_noop(void)
 {
@@ -921,6 +1143,7 @@ fs_debug(struct task *t, struct msg *msg)
 	task_dump();
 	vnode_dump();
 	mount_dump();
+	msg_dispatch_dump(&fs_dispatch);
 	return 0;
 }
 #endif
@@ -936,6 +1159,7 @@ vfs_init(void)
 	 */
 	task_init();
 	bio_init();
+	page_init();
 	vnode_init();
 
 	/*
@@ -1029,14 +1253,82 @@ static const struct msg_map fsmsg_map[] = {
 	MSGMAP( FS_FTRUNCATE,	fs_ftruncate ),
 	MSGMAP( FS_FCHDIR,	fs_fchdir ),
 	MSGMAP( FS_FINDROOT,    fs_findroot ),
+	MSGMAP( FS_READV,	fs_readv ),
+	MSGMAP( FS_WRITEV,	fs_writev ),
+	MSGMAP( FS_GETDIRENTRIES, fs_getdirentries ),
+	MSGMAP( FS_MMAP,	fs_mmap ),
+	MSGMAP( FS_MUNMAP,	fs_munmap ),
+	MSGMAP( FS_MSYNC,	fs_msync ),
+	MSGMAP( FS_DEVICE,	fs_device ),
 	MSGMAP( STD_BOOT,	fs_boot ),
 	MSGMAP( STD_SHUTDOWN,	fs_shutdown ),
+	MSGMAP( STD_MSGSTAT,	fs_msgstat ),
 #ifdef DEBUG_VFS
 	MSGMAP( STD_DEBUG,	fs_debug ),
 #endif
 	MSGMAP( 0,		NULL ),
 };
 
+/*
+ * Build the dispatch table from the message map.
+ */
+static void
+dispatch_init(void)
+{
+	const struct msg_map *map;
+
+	if (msg_dispatch_init(&fs_dispatch, FS_MOUNT,
+			      MSG_NUMBER(FS_DEVICE) + 1) != 0)
+		sys_panic("VFS: no memory for dispatch table");
+
+	for (map = &fsmsg_map[0]; map->code != 0; map++) {
+		if (msg_dispatch_add(&fs_dispatch, map->code,
+				     map - fsmsg_map) != 0)
+			sys_panic("VFS: bad message code");
+	}
+}
+
+#if CONFIG_FS_THREADS > 1
+/*
+ * Called when a thread starts handling a request.  If no
+ * thread is left to receive the next request, add a new
+ * thread to the pool.
+ */
+static void
+pool_busy(void)
+{
+	int grow = 0;
+
+	mutex_lock(&pool_lock);
+	fs_nidle--;
+	if (fs_nidle == 0 && fs_nthreads < FS_MAXTHREADS) {
+		fs_nthreads++;
+		fs_nidle++;
+		grow = 1;
+	}
+	mutex_unlock(&pool_lock);
+
+	if (grow && run_thread(fs_thread) != 0) {
+		mutex_lock(&pool_lock);
+		fs_nthreads--;
+		fs_nidle--;
+		mutex_unlock(&pool_lock);
+	}
+}
+
+/*
+ * Called when a thread has replied to the request.
+ */
+static void
+pool_idle(void)
+{
+
+	mutex_lock(&pool_lock);
+	fs_nidle++;
+	mutex_unlock(&pool_lock);
+}
+#endif /* CONFIG_FS_THREADS > 1 */
+
 /*
  * File system thread.
  */
@@ -1046,7 +1338,8 @@ fs_thread(void)
 	struct msg *msg;
 	const struct msg_map *map;
 	struct task *t;
-	int error;
+	u_long sent, start;
+	int error, slot;
 
 	msg = malloc(MAX_FSMSG);
 
@@ -1059,23 +1352,26 @@ fs_thread(void)
 		 */
 		if ((error = msg_receive(fsobj, msg, MAX_FSMSG)) != 0)
 			continue;
+		pool_busy();
 
-		error = EINVAL;
-		map = &fsmsg_map[0];
-		while (map->code != 0) {
-			if (map->code == msg->hdr.code) {
-				/*
-				 * Handle messages by non-registerd tasks
-				 */
-				if (map->code == STD_BOOT) {
-					error = fs_boot(NULL, msg);
-					break;
-				}
-				if (map->code == FS_REGISTER) {
-					error = fs_register(NULL, msg);
-					break;
-				}
+		sys_time(&start);
+		sent = msg->hdr.time;
 
+		error = EINVAL;
+		slot = msg_dispatch_slot(&fs_dispatch, msg->hdr.code);
+		if (slot != -1) {
+			map = &fsmsg_map[fs_dispatch.md_index[slot]];
+
+			/*
+			 * Handle messages by non-registerd tasks
+			 */
+			switch (map->code) {
+			case STD_BOOT:
+			case STD_MSGSTAT:
+			case FS_REGISTER:
+				error = (*map->func)(NULL, msg);
+				break;
+			default:
 				/* Lookup and lock task */
 				t = task_lookup(msg->hdr.task);
 				if (t == NULL)
@@ -1087,18 +1383,20 @@ fs_thread(void)
 					task_unlock(t);
 				break;
 			}
-			map++;
+			msg_dispatch_account(&fs_dispatch, slot, sent, start,
+					     error);
 		}
 #ifdef DEBUG_VFS
 		if (error)
 			dprintf("VFS: task=%x code=%x error=%d\n",
-				msg->hdr.task, map->code, error);
+				msg->hdr.task, msg->hdr.code, error);
 #endif
 		/*
 		 * Reply to the client.
 		 */
 		msg->hdr.status = error;
 		msg_reply(fsobj, msg, MAX_FSMSG);
+		pool_idle();
 	}
 }
 
@@ -1112,8 +1410,10 @@ main(int argc, char *argv[])
 
 	sys_log("Starting file system server\n");
 
-	DPRINTF(VFSDB_CORE, ("VFS: number of fs threads: %d\n",
-			     CONFIG_FS_THREADS));
+#if CONFIG_FS_THREADS > 1
+	DPRINTF(VFSDB_CORE, ("VFS: number of fs threads: %d-%d\n",
+			     CONFIG_FS_THREADS, FS_MAXTHREADS));
+#endif
 
 	/* Set thread priority. */
 	thread_setpri(thread_self(), PRI_FS);
@@ -1124,6 +1424,9 @@ main(int argc, char *argv[])
 	/* Initialize the file systems. */
 	vfs_init();
 
+	/* Build the message dispatch table. */
+	dispatch_init();
+
 	/* Create an object to expose our service. */
 	if (object_create("!fs", &fsobj))
 		sys_panic("VFS: fail to create object");
@@ -1131,6 +1434,10 @@ main(int argc, char *argv[])
 	/*
 	 * Create new server threads.
 	 */
+#if CONFIG_FS_THREADS > 1
+	fs_nthreads = CONFIG_FS_THREADS;
+	fs_nidle = CONFIG_FS_THREADS;
+#endif
 	i = CONFIG_FS_THREADS;
 	while (--i > 0) {
 		if (run_thread(fs_thread))
@@ -107,6 +107,8 @@ int	 sys_readdir(file_t fp, struct dirent *dirent);
 int	 sys_rewinddir(file_t fp);
 int	 sys_seekdir(file_t fp, long loc);
 int	 sys_telldir(file_t fp, long *loc);
+int	 sys_getdirentries(file_t fp, char *buf, size_t size, int flags,
+			   size_t *count);
 int	 sys_fchdir(file_t fp, char *path);
 
 int	 sys_mkdir(char *path, mode_t mode);
@@ -118,6 +120,11 @@ int	 sys_access(char *path, int mode);
 int	 sys_stat(char *path, struct stat *st);
 int	 sys_truncate(char *path, off_t length);
 
+int	 sys_mmap(file_t fp, task_t task, void **addr, size_t len, int prot,
+		  int flags, off_t off);
+int	 sys_munmap(task_t task, void *addr);
+int	 sys_msync(task_t task, void *addr, size_t len, int flags);
+
 int	 sys_mount(char *dev, char *dir, char *fsname, int flags, void *data);
 int	 sys_umount(char *path);
 int	 sys_sync(void);
@@ -137,6 +144,21 @@ void	 task_delfd(struct task *t, int fd);
 int	 task_conv(struct task *t, char *path, int mode, char *full);
 void	 task_init(void);
 
+int	 mmap_fork(task_t parent, task_t child);
+void	 mmap_exit(task_t task, int unmap);
+int	 mmap_read(vnode_t vp, file_t fp, void *buf, size_t size,
+		   size_t *count);
+void	 mmap_write(vnode_t vp, off_t off, void *buf, size_t size);
+void	 mmap_truncate(vnode_t vp);
+
+int	 page_read(vnode_t vp, file_t fp, void *buf, size_t size,
+		   size_t *count);
+int	 page_write(vnode_t vp, file_t fp, void *buf, size_t size,
+		    size_t *count);
+void	 page_update(vnode_t vp, off_t off, void *buf, size_t size);
+void	 page_purge(vnode_t vp);
+void	 page_init(void);
+
 int	 sec_file_permission(task_t task, char *path, int mode);
 int	 sec_vnode_permission(char *path);
 
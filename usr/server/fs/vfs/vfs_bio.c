@@ -177,10 +177,24 @@ getblk(dev_t dev, int blkno)
 		bio_remove(bp);
 		SET(bp->b_flags, B_BUSY);
 	} else {
+		if (list_empty(&free_list)) {
+			/*
+			 * Wait for a buffer to be released without
+			 * holding the lock.
+			 */
+			BIO_UNLOCK();
+			sem_wait(&free_sem, 0);
+			sem_post(&free_sem);
+			goto start;
+		}
 		bp = bio_remove_head();
 		if (ISSET(bp->b_flags, B_DELWRI)) {
+			/* Write back the old block, first. */
+			SET(bp->b_flags, B_BUSY);
+			mutex_lock(&bp->b_lock);
 			BIO_UNLOCK();
-			bwrite(bp);
+			if (bwrite(bp) != 0)
+				brelse(bp);
 			goto start;
 		}
 		bp->b_flags = B_BUSY;
@@ -305,11 +319,13 @@ bdwrite(struct buf *bp)
 void
 bflush(struct buf *bp)
 {
+	int dirty;
 
 	BIO_LOCK();
-	if (ISSET(bp->b_flags, B_DELWRI))
-		bwrite(bp);
+	dirty = ISSET(bp->b_flags, B_DELWRI);
 	BIO_UNLOCK();
+	if (dirty)
+		bwrite(bp);
 }
 
 /*
@@ -356,8 +372,19 @@ bio_sync(void)
 			mutex_unlock(&bp->b_lock);
 			goto start;
 		}
-		if (ISSET(bp->b_flags, B_DELWRI))
-			bwrite(bp);
+		if (ISSET(bp->b_flags, B_DELWRI)) {
+			/*
+			 * Write the buffer without the lock, so
+			 * that other threads can use the cache.
+			 */
+			bio_remove(bp);
+			SET(bp->b_flags, B_BUSY);
+			mutex_lock(&bp->b_lock);
+			BIO_UNLOCK();
+			if (bwrite(bp) != 0)
+				brelse(bp);
+			goto start;
+		}
 	}
 	BIO_UNLOCK();
 }
@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vfs_mmap.c - memory mapped files
+ */
+
+/*
+ * A file is mapped by sharing the pages of a memory object in
+ * the file system server with the client task.  The object
+ * holds the whole contents of the file in one segment, and it
+ * is shared by all tasks that map the file.  So the text of a
+ * program is loaded once for all processes running it.
+ *
+ * The object is kept while the file is mapped by any task.
+ * When the file has grown past the object, the next mmap()
+ * makes a new object for it.  The older objects serve their
+ * mappings until they are released, and the writes to the
+ * file are copied to all of them.
+ * The pages are read-only in the server, except while the
+ * server updates them for write() requests.  Changes through
+ * a shared writable mapping are written back to the file by
+ * msync() and when the mapping is released.
+ *
+ * The mappings of a task which exits or execs are not released
+ * at once, because the task still runs on the mapped text until
+ * it is terminated.  They are kept until the task is gone, and
+ * released when the server handles the next exit or exec.
+ */
+
+#include <sys/prex.h>
+#include <sys/mman.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+#include <sys/list.h>
+#include <sys/param.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "vfs.h"
+
+/*
+ * Memory object for a mapped file.
+ */
+struct mmap_object {
+	struct list	o_link;		/* link for object list */
+	vnode_t		o_vnode;	/* vnode of the file */
+	char		*o_addr;	/* pages in the server */
+	size_t		o_size;		/* size of the pages */
+	struct list	o_maps;		/* mappings of this object */
+	int		o_nwrite;	/* number of shared writable maps */
+	struct mmap_object *o_older;	/* older object of the vnode */
+};
+
+/*
+ * Mapping of an object in a task.
+ */
+struct mmap_entry {
+	struct list	m_link;		/* link in object */
+	struct mmap_object *m_object;	/* mapped object */
+	task_t		m_task;		/* task mapping the object */
+	char		*m_addr;	/* mapped address in the task */
+	size_t		m_len;		/* mapped length */
+	off_t		m_off;		/* offset in the file */
+	int		m_write;	/* true if shared and writable */
+	int		m_gone;		/* task has exited or exec'd */
+};
+
+/*
+ * List of all mapped objects.
+ */
+static struct list mmap_list = LIST_INIT(mmap_list);
+
+/*
+ * Number of mappings waiting for their task to go away.
+ */
+static int mmap_ngone;
+
+/*
+ * Global lock for mappings.  This must be taken before
+ * the vnode lock.
+ */
+#if CONFIG_FS_THREADS > 1
+static mutex_t mmap_lock = MUTEX_INITIALIZER;
+#define MMAP_LOCK()	mutex_lock(&mmap_lock)
+#define MMAP_UNLOCK()	mutex_unlock(&mmap_lock)
+#else
+#define MMAP_LOCK()
+#define MMAP_UNLOCK()
+#endif
+
+/*
+ * Create the object for the vnode and read the file into it.
+ * The vnode must be locked.
+ */
+static int
+mmap_newobj(vnode_t vp, struct mmap_object **objp)
+{
+	struct mmap_object *obj;
+	struct file f;
+	void *addr;
+	size_t size, count, total;
+	int error;
+
+	if ((size = round_page(vp->v_size)) == 0)
+		return ENXIO;
+	if ((obj = malloc(sizeof(struct mmap_object))) == NULL)
+		return ENOMEM;
+	if (vm_allocate(task_self(), &addr, size, 1) != 0) {
+		free(obj);
+		return ENOMEM;
+	}
+
+	memset(&f, 0, sizeof(f));
+	f.f_flags = FREAD;
+	f.f_count = 1;
+	f.f_vnode = vp;
+	for (total = 0; total < vp->v_size; total += count) {
+		error = VOP_READ(vp, &f, (char *)addr + total,
+				 vp->v_size - total, &count);
+		if (error == 0 && count == 0)
+			error = EIO;
+		if (error) {
+			vm_free(task_self(), addr);
+			free(obj);
+			return error;
+		}
+	}
+	vm_attribute(task_self(), addr, PROT_READ);
+
+	obj->o_vnode = vp;
+	obj->o_addr = addr;
+	obj->o_size = size;
+	obj->o_nwrite = 0;
+	list_init(&obj->o_maps);
+	list_insert(&mmap_list, &obj->o_link);
+	vref(vp);
+	obj->o_older = vp->v_object;
+	vp->v_object = obj;
+	*objp = obj;
+	return 0;
+}
+
+/*
+ * Free the object which is not mapped any more.
+ * The vnode must be locked, and it is unlocked.
+ */
+static void
+mmap_freeobj(struct mmap_object *obj)
+{
+	vnode_t vp = obj->o_vnode;
+	struct mmap_object **pp;
+
+	DPRINTF(VFSDB_VNODE, ("mmap_freeobj: free object %s\n",
+			      vp->v_path));
+	for (pp = &vp->v_object; *pp != obj;
+	     pp = &(*pp)->o_older)
+		;
+	*pp = obj->o_older;
+	list_remove(&obj->o_link);
+	vm_free(task_self(), obj->o_addr);
+	free(obj);
+	vput(vp);
+}
+
+/*
+ * Copy the data written to the file to the objects of the
+ * vnode, except "skip".  The vnode must be locked.
+ */
+static void
+mmap_update(vnode_t vp, struct mmap_object *skip, off_t off, void *buf,
+	    size_t size)
+{
+	struct mmap_object *obj;
+	size_t len;
+
+	for (obj = vp->v_object; obj != NULL; obj = obj->o_older) {
+		if (obj == skip || off >= (off_t)obj->o_size)
+			continue;
+		len = size;
+		if (len > obj->o_size - off)
+			len = obj->o_size - off;
+		vm_attribute(task_self(), obj->o_addr,
+			     PROT_READ | PROT_WRITE);
+		memcpy(obj->o_addr + off, buf, len);
+		vm_attribute(task_self(), obj->o_addr, PROT_READ);
+	}
+}
+
+/*
+ * Write back the pages in the range to the file.
+ * The vnode must be locked.
+ */
+static int
+mmap_writeback(struct mmap_object *obj, off_t off, size_t len)
+{
+	vnode_t vp = obj->o_vnode;
+	struct file f;
+	size_t count;
+	int error;
+
+	if (off >= (off_t)vp->v_size)
+		return 0;
+	if (len > vp->v_size - off)
+		len = vp->v_size - off;
+
+	memset(&f, 0, sizeof(f));
+	f.f_flags = FWRITE;
+	f.f_count = 1;
+	f.f_offset = off;
+	f.f_vnode = vp;
+	error = VOP_WRITE(vp, &f, obj->o_addr + off, len, &count);
+	if (error == 0) {
+		page_update(vp, off, obj->o_addr + off, len);
+		mmap_update(vp, obj, off, obj->o_addr + off, len);
+	}
+	return error;
+}
+
+/*
+ * Release the mapping, and the object if it is not mapped
+ * any more.  If "unmap" is true, the pages are also unmapped
+ * from the task.
+ */
+static void
+mmap_release(struct mmap_entry *ent, int unmap)
+{
+	struct mmap_object *obj = ent->m_object;
+	vnode_t vp = obj->o_vnode;
+
+	vn_lock(vp);
+	if (ent->m_write) {
+		mmap_writeback(obj, ent->m_off, ent->m_len);
+		obj->o_nwrite--;
+	}
+	if (unmap)
+		vm_free(ent->m_task, ent->m_addr);
+	if (ent->m_gone)
+		mmap_ngone--;
+	list_remove(&ent->m_link);
+	free(ent);
+
+	if (!list_empty(&obj->o_maps)) {
+		vn_unlock(vp);
+		return;
+	}
+	mmap_freeobj(obj);
+}
+
+/*
+ * Find the mapping which includes the address.
+ */
+static struct mmap_entry *
+mmap_lookup(task_t task, char *addr)
+{
+	struct mmap_object *obj;
+	struct mmap_entry *ent;
+	list_t n, m;
+
+	for (n = list_first(&mmap_list); n != &mmap_list;
+	     n = list_next(n)) {
+		obj = list_entry(n, struct mmap_object, o_link);
+		for (m = list_first(&obj->o_maps); m != &obj->o_maps;
+		     m = list_next(m)) {
+			ent = list_entry(m, struct mmap_entry, m_link);
+			if (ent->m_task == task && !ent->m_gone &&
+			    addr >= ent->m_addr &&
+			    addr < ent->m_addr + ent->m_len)
+				return ent;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Map the file into the task.  If "*addr" is not NULL, the
+ * file is mapped at that address.  A private mapping is
+ * always read-only; the caller has to copy the pages to get
+ * a private writable copy.
+ */
+int
+sys_mmap(file_t fp, task_t task, void **addr, size_t len, int prot,
+	 int flags, off_t off)
+{
+	struct mmap_object *obj;
+	struct mmap_entry *ent;
+	vnode_t vp;
+	void *uaddr;
+	int error, write;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_mmap: fp=%x len=%d off=%d\n",
+				fp, len, off));
+
+	if (len == 0 || off < 0 || (off & PAGE_MASK))
+		return EINVAL;
+	if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 ||
+	    (flags & (MAP_SHARED | MAP_PRIVATE)) ==
+	    (MAP_SHARED | MAP_PRIVATE))
+		return EINVAL;
+	if ((fp->f_flags & FREAD) == 0)
+		return EACCES;
+	write = 0;
+	if ((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+		if ((fp->f_flags & FWRITE) == 0)
+			return EACCES;
+		write = 1;
+	}
+	vp = fp->f_vnode;
+	if (vp->v_type != VREG)
+		return ENODEV;
+
+	if ((ent = malloc(sizeof(struct mmap_entry))) == NULL)
+		return ENOMEM;
+
+	MMAP_LOCK();
+	vn_lock(vp);
+	obj = vp->v_object;
+	if (obj == NULL ||
+	    (off + len > obj->o_size && round_page(vp->v_size) > obj->o_size)) {
+		/*
+		 * The file has grown past the object.  Make a new
+		 * object with the changes in the old one.
+		 */
+		if (obj != NULL && obj->o_nwrite > 0)
+			mmap_writeback(obj, 0, obj->o_size);
+		if ((error = mmap_newobj(vp, &obj)) != 0)
+			goto out;
+	}
+	if (off + len > obj->o_size) {
+		error = ENXIO;
+		goto out;
+	}
+
+	/*
+	 * The pages are shared with the attribute they have
+	 * in the server.
+	 */
+	uaddr = *addr;
+	if (write)
+		vm_attribute(task_self(), obj->o_addr, PROT_READ | PROT_WRITE);
+	error = vm_share(task, obj->o_addr + off, len, &uaddr);
+	if (write)
+		vm_attribute(task_self(), obj->o_addr, PROT_READ);
+	if (error)
+		goto out;
+
+	ent->m_object = obj;
+	ent->m_task = task;
+	ent->m_addr = uaddr;
+	ent->m_len = round_page(len);
+	ent->m_off = off;
+	ent->m_write = write;
+	ent->m_gone = 0;
+	list_insert(&obj->o_maps, &ent->m_link);
+	if (write)
+		obj->o_nwrite++;
+	*addr = uaddr;
+	vn_unlock(vp);
+	MMAP_UNLOCK();
+	return 0;
+ out:
+	free(ent);
+	if (obj != NULL && list_empty(&obj->o_maps)) {
+		/* Drop the object we have just made. */
+		mmap_freeobj(obj);
+	} else
+		vn_unlock(vp);
+	MMAP_UNLOCK();
+	return error;
+}
+
+/*
+ * Unmap the mapping which starts at the address.
+ */
+int
+sys_munmap(task_t task, void *addr)
+{
+	struct mmap_entry *ent;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_munmap: task=%x addr=%x\n",
+				task, addr));
+
+	MMAP_LOCK();
+	ent = mmap_lookup(task, addr);
+	if (ent == NULL || ent->m_addr != addr) {
+		MMAP_UNLOCK();
+		return EINVAL;
+	}
+	mmap_release(ent, 1);
+	MMAP_UNLOCK();
+	return 0;
+}
+
+/*
+ * Write back the changes in the range to the file.
+ * Since the pages are shared with all mappings and the
+ * file system, MS_INVALIDATE has nothing to do.
+ */
+int
+sys_msync(task_t task, void *addr, size_t len, int flags)
+{
+	struct mmap_entry *ent;
+	struct mmap_object *obj;
+	size_t off;
+	int error = 0;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_msync: task=%x addr=%x\n",
+				task, addr));
+
+	if ((flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC))
+		return EINVAL;
+
+	MMAP_LOCK();
+	if ((ent = mmap_lookup(task, addr)) == NULL) {
+		MMAP_UNLOCK();
+		return ENOMEM;
+	}
+	if (ent->m_write) {
+		obj = ent->m_object;
+		off = (size_t)((char *)addr - ent->m_addr);
+		if (len > ent->m_len - off)
+			len = ent->m_len - off;
+		vn_lock(obj->o_vnode);
+		error = mmap_writeback(obj, ent->m_off + (off_t)off, len);
+		vn_unlock(obj->o_vnode);
+	}
+	MMAP_UNLOCK();
+	return error;
+}
+
+/*
+ * Copy the mappings to the child task.  The kernel does not
+ * copy the shared pages on fork, so they are mapped to the
+ * child here at the same address.  Without MMU, the child
+ * shares the memory of the parent and only the mappings are
+ * recorded.
+ */
+int
+mmap_fork(task_t parent, task_t child)
+{
+	struct mmap_object *obj;
+	struct mmap_entry *ent, *new;
+	list_t n, m;
+#ifdef CONFIG_MMU
+	void *addr;
+#endif
+	int error = 0;
+
+	MMAP_LOCK();
+	for (n = list_first(&mmap_list); n != &mmap_list && !error;
+	     n = list_next(n)) {
+		obj = list_entry(n, struct mmap_object, o_link);
+		vn_lock(obj->o_vnode);
+		for (m = list_first(&obj->o_maps); m != &obj->o_maps;
+		     m = list_next(m)) {
+			ent = list_entry(m, struct mmap_entry, m_link);
+			if (ent->m_task != parent || ent->m_gone)
+				continue;
+			if ((new = malloc(sizeof(*new))) == NULL) {
+				error = ENOMEM;
+				break;
+			}
+#ifdef CONFIG_MMU
+			addr = ent->m_addr;
+			if (ent->m_write)
+				vm_attribute(task_self(), obj->o_addr,
+					     PROT_READ | PROT_WRITE);
+			error = vm_share(child, obj->o_addr + ent->m_off,
+					 ent->m_len, &addr);
+			if (ent->m_write)
+				vm_attribute(task_self(), obj->o_addr,
+					     PROT_READ);
+			if (error) {
+				free(new);
+				error = ENOMEM;
+				break;
+			}
+#endif
+			*new = *ent;
+			new->m_task = child;
+			/* Insert before the current entry. */
+			list_insert(list_prev(m), &new->m_link);
+			if (new->m_write)
+				obj->o_nwrite++;
+		}
+		vn_unlock(obj->o_vnode);
+	}
+	MMAP_UNLOCK();
+
+	if (error)
+		mmap_exit(child, 1);
+	return error;
+}
+
+/*
+ * Release the mappings of the tasks which do not exist any
+ * more.  The mmap lock must be held.
+ */
+static void
+mmap_reap(void)
+{
+	struct mmap_object *obj;
+	struct mmap_entry *ent;
+	struct taskinfo ti;
+	list_t n, m;
+
+	if (mmap_ngone == 0)
+		return;
+
+	/*
+	 * Mark the entries of the tasks which are still alive.
+	 * A task id can be used again by a new task.  Then the
+	 * entries are just kept until the next time.
+	 */
+	ti.cookie = 0;
+	while (sys_info(INFO_TASK, &ti) == 0) {
+		for (n = list_first(&mmap_list); n != &mmap_list;
+		     n = list_next(n)) {
+			obj = list_entry(n, struct mmap_object, o_link);
+			for (m = list_first(&obj->o_maps);
+			     m != &obj->o_maps; m = list_next(m)) {
+				ent = list_entry(m, struct mmap_entry, m_link);
+				if (ent->m_gone && ent->m_task == ti.id)
+					ent->m_gone = 2;
+			}
+		}
+	}
+
+	n = list_first(&mmap_list);
+	while (n != &mmap_list) {
+		obj = list_entry(n, struct mmap_object, o_link);
+		n = list_next(n);
+		m = list_first(&obj->o_maps);
+		while (m != &obj->o_maps) {
+			ent = list_entry(m, struct mmap_entry, m_link);
+			m = list_next(m);
+			if (ent->m_gone == 2)
+				ent->m_gone = 1;
+			else if (ent->m_gone)
+				mmap_release(ent, 0);
+		}
+	}
+}
+
+/*
+ * Release all mappings of the task.  If "unmap" is true, the
+ * pages are unmapped from the task at once.  Otherwise, the
+ * task is exiting and the mappings are kept until it is gone.
+ */
+void
+mmap_exit(task_t task, int unmap)
+{
+	struct mmap_object *obj;
+	struct mmap_entry *ent;
+	list_t n, m;
+
+	MMAP_LOCK();
+	mmap_reap();
+	n = list_first(&mmap_list);
+	while (n != &mmap_list) {
+		obj = list_entry(n, struct mmap_object, o_link);
+		n = list_next(n);
+		m = list_first(&obj->o_maps);
+		while (m != &obj->o_maps) {
+			ent = list_entry(m, struct mmap_entry, m_link);
+			m = list_next(m);
+			if (ent->m_task != task || ent->m_gone)
+				continue;
+			if (!unmap) {
+				ent->m_gone = 1;
+				mmap_ngone++;
+				continue;
+			}
+			/*
+			 * If this is the last mapping, the object is
+			 * freed and the loop ends at the list head.
+			 */
+			mmap_release(ent, 1);
+		}
+	}
+	MMAP_UNLOCK();
+}
+
+/*
+ * Read the file.  If the file is mapped writable, the data
+ * is taken from the mapped pages which may have changes not
+ * written back yet.  The vnode must be locked.
+ */
+int
+mmap_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *count)
+{
+	struct mmap_object *obj = vp->v_object;
+	size_t len, rest;
+	int error;
+
+	if (obj->o_nwrite == 0 || fp->f_offset >= (off_t)obj->o_size)
+		return page_read(vp, fp, buf, size, count);
+
+	len = 0;
+	if (fp->f_offset < (off_t)vp->v_size) {
+		len = vp->v_size - fp->f_offset;
+		if (len > obj->o_size - fp->f_offset)
+			len = obj->o_size - fp->f_offset;
+		if (len > size)
+			len = size;
+		memcpy(buf, obj->o_addr + fp->f_offset, len);
+		fp->f_offset += len;
+	}
+	*count = len;
+
+	/* The part of the file past the object is read as usual. */
+	if (len < size && fp->f_offset < (off_t)vp->v_size) {
+		error = page_read(vp, fp, (char *)buf + len, size - len,
+				  &rest);
+		if (error)
+			return error;
+		*count += rest;
+	}
+	return 0;
+}
+
+/*
+ * Update the mapped pages with data written to the file.
+ * The vnode must be locked.
+ */
+void
+mmap_write(vnode_t vp, off_t off, void *buf, size_t size)
+{
+
+	mmap_update(vp, NULL, off, buf, size);
+}
+
+/*
+ * Clear the mapped pages of the file truncated to zero.
+ * The vnode must be locked.
+ */
+void
+mmap_truncate(vnode_t vp)
+{
+	struct mmap_object *obj;
+
+	for (obj = vp->v_object; obj != NULL; obj = obj->o_older) {
+		vm_attribute(task_self(), obj->o_addr,
+			     PROT_READ | PROT_WRITE);
+		memset(obj->o_addr, 0, obj->o_size);
+		vm_attribute(task_self(), obj->o_addr, PROT_READ);
+	}
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vfs_page.c - page cache for file data
+ */
+
+/*
+ * File data is cached per vnode in pages indexed by the file
+ * offset.  A file system fills a page with VOP_GETPAGES, and
+ * VOP_PUTPAGES writes data to the file.  The cache is written
+ * through, so a cached page never holds data which is not in
+ * the file yet.  File systems without these operations are
+ * accessed with VOP_READ/VOP_WRITE as before.
+ *
+ * A page is reclaimed in LRU order when it is not in use.
+ * The pages of one vnode are accessed with the vnode locked.
+ */
+
+#include <sys/prex.h>
+#include <sys/list.h>
+#include <sys/param.h>
+#include <sys/vnode.h>
+#include <sys/file.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "vfs.h"
+
+/* number of pages in cache */
+#ifdef CONFIG_PAGE_CACHE
+#define NPAGES		CONFIG_PAGE_CACHE
+#else
+#define NPAGES		0
+#endif
+
+/*
+ * Reads of this size or more bypass the cache, so that the file
+ * system can transfer the data into the caller's buffer directly.
+ */
+#define PAGE_DIRECT	(PAGE_SIZE * 8)
+
+#define PAGE_HASHSIZE	32
+#define PAGE_HASH(vp, off) \
+	((int)(((u_long)(vp) >> 4) + ((u_long)(off) / PAGE_SIZE)) & \
+	 (PAGE_HASHSIZE - 1))
+
+/*
+ * Page of file data
+ */
+struct page {
+	struct list	p_link;		/* link for hash list */
+	struct list	p_lru;		/* link for lru list */
+	vnode_t		p_vnode;	/* vnode, or NULL if not used */
+	off_t		p_offset;	/* file offset of page */
+	int		p_refcnt;	/* number of users */
+	char		*p_data;	/* page data */
+};
+
+/*
+ * Global lock to access all pages and lists.
+ */
+#if CONFIG_FS_THREADS > 1
+static mutex_t page_lock = MUTEX_INITIALIZER;
+#define PAGE_LOCK()	mutex_lock(&page_lock)
+#define PAGE_UNLOCK()	mutex_unlock(&page_lock)
+#else
+#define PAGE_LOCK()
+#define PAGE_UNLOCK()
+#endif
+
+#if NPAGES > 0
+/* set of pages */
+static char pages[NPAGES][PAGE_SIZE];
+
+static struct page page_table[NPAGES];
+static struct list page_hash[PAGE_HASHSIZE];
+static struct list lru_list = LIST_INIT(lru_list);
+
+/*
+ * Find the page in cache.
+ */
+static struct page *
+page_lookup(vnode_t vp, off_t off)
+{
+	struct page *pg;
+	list_t head, n;
+
+	head = &page_hash[PAGE_HASH(vp, off)];
+	for (n = list_first(head); n != head; n = list_next(n)) {
+		pg = list_entry(n, struct page, p_link);
+		if (pg->p_vnode == vp && pg->p_offset == off)
+			return pg;
+	}
+	return NULL;
+}
+
+/*
+ * Remove the page from cache.
+ */
+static void
+page_remove(struct page *pg)
+{
+
+	list_remove(&pg->p_link);
+	pg->p_vnode = NULL;
+	list_remove(&pg->p_lru);
+	list_insert(&lru_list, &pg->p_lru);
+}
+
+/*
+ * Get the page for the file offset.  If it is not in cache,
+ * the least recently used page is filled with the file data.
+ * Returns ENOMEM if all pages are in use.
+ */
+static int
+page_get(vnode_t vp, off_t off, struct page **pgp)
+{
+	struct page *pg;
+	list_t n;
+	size_t size;
+	int error;
+
+	PAGE_LOCK();
+	if ((pg = page_lookup(vp, off)) != NULL) {
+		pg->p_refcnt++;
+		list_remove(&pg->p_lru);
+		list_insert(list_last(&lru_list), &pg->p_lru);
+		PAGE_UNLOCK();
+		*pgp = pg;
+		return 0;
+	}
+	for (n = list_first(&lru_list); n != &lru_list; n = list_next(n)) {
+		pg = list_entry(n, struct page, p_lru);
+		if (pg->p_refcnt == 0)
+			break;
+	}
+	if (n == &lru_list) {
+		PAGE_UNLOCK();
+		return ENOMEM;
+	}
+	if (pg->p_vnode != NULL)
+		list_remove(&pg->p_link);
+	pg->p_vnode = vp;
+	pg->p_offset = off;
+	pg->p_refcnt = 1;
+	list_insert(&page_hash[PAGE_HASH(vp, off)], &pg->p_link);
+	list_remove(&pg->p_lru);
+	list_insert(list_last(&lru_list), &pg->p_lru);
+	PAGE_UNLOCK();
+
+	/*
+	 * Fill the page.  Other threads can not look up this
+	 * page while we hold the vnode lock.
+	 */
+	size = PAGE_SIZE;
+	if (vp->v_size - off < size)
+		size = vp->v_size - off;
+	error = VOP_GETPAGES(vp, off, pg->p_data, size);
+	if (error) {
+		PAGE_LOCK();
+		pg->p_refcnt = 0;
+		page_remove(pg);
+		PAGE_UNLOCK();
+		return error;
+	}
+	if (size < PAGE_SIZE)
+		memset(pg->p_data + size, 0, PAGE_SIZE - size);
+	*pgp = pg;
+	return 0;
+}
+
+static void
+page_release(struct page *pg)
+{
+
+	PAGE_LOCK();
+	pg->p_refcnt--;
+	PAGE_UNLOCK();
+}
+#endif /* NPAGES > 0 */
+
+/*
+ * Read file data through the page cache.
+ * The vnode must be locked.
+ */
+int
+page_read(vnode_t vp, file_t fp, void *buf, size_t size, size_t *count)
+{
+#if NPAGES > 0
+	struct page *pg;
+	off_t off;
+	size_t len, pos, total;
+	int error;
+
+	if (vp->v_op->vop_getpages == NULL || vp->v_type != VREG ||
+	    size >= PAGE_DIRECT)
+		return VOP_READ(vp, fp, buf, size, count);
+
+	off = fp->f_offset;
+	if (off >= (off_t)vp->v_size) {
+		*count = 0;
+		return 0;
+	}
+	if (size > vp->v_size - off)
+		size = vp->v_size - off;
+
+	for (total = 0; total < size; total += len) {
+		pos = (size_t)((off + total) & PAGE_MASK);
+		error = page_get(vp, off + total - pos, &pg);
+		if (error == ENOMEM && total == 0) {
+			/* All pages are busy.  Read it directly. */
+			return VOP_READ(vp, fp, buf, size, count);
+		}
+		if (error)
+			break;
+		len = PAGE_SIZE - pos;
+		if (len > size - total)
+			len = size - total;
+		memcpy((char *)buf + total, pg->p_data + pos, len);
+		page_release(pg);
+	}
+	fp->f_offset = off + total;
+	*count = total;
+	return (total > 0) ? 0 : error;
+#else
+	return VOP_READ(vp, fp, buf, size, count);
+#endif
+}
+
+/*
+ * Write file data.  The data is written to the file first,
+ * then the cached pages are updated.
+ * The vnode must be locked.
+ */
+int
+page_write(vnode_t vp, file_t fp, void *buf, size_t size, size_t *count)
+{
+#if NPAGES > 0
+	off_t off;
+	size_t len;
+	int error;
+
+	if (vp->v_op->vop_putpages == NULL || vp->v_type != VREG)
+		return VOP_WRITE(vp, fp, buf, size, count);
+
+	off = (fp->f_flags & O_APPEND) ? (off_t)vp->v_size : fp->f_offset;
+	if ((error = VOP_PUTPAGES(vp, off, buf, size, &len)) != 0) {
+		/* We do not know what has been written. */
+		page_purge(vp);
+		return error;
+	}
+	page_update(vp, off, buf, len);
+	fp->f_offset = off + len;
+	*count = len;
+	return 0;
+#else
+	return VOP_WRITE(vp, fp, buf, size, count);
+#endif
+}
+
+/*
+ * Update the cached pages with data written to the file.
+ * The vnode must be locked.
+ */
+void
+page_update(vnode_t vp, off_t off, void *buf, size_t size)
+{
+#if NPAGES > 0
+	struct page *pg;
+	size_t len, pos, total;
+
+	for (total = 0; total < size; total += len) {
+		pos = (size_t)((off + total) & PAGE_MASK);
+		len = PAGE_SIZE - pos;
+		if (len > size - total)
+			len = size - total;
+		PAGE_LOCK();
+		pg = page_lookup(vp, off + total - pos);
+		if (pg != NULL)
+			memcpy(pg->p_data + pos, (char *)buf + total, len);
+		PAGE_UNLOCK();
+	}
+#endif
+}
+
+/*
+ * Discard all cached pages of the vnode.
+ */
+void
+page_purge(vnode_t vp)
+{
+#if NPAGES > 0
+	struct page *pg;
+	int i;
+
+	PAGE_LOCK();
+	for (i = 0; i < NPAGES; i++) {
+		pg = &page_table[i];
+		if (pg->p_vnode == vp) {
+			ASSERT(pg->p_refcnt == 0);
+			page_remove(pg);
+		}
+	}
+	PAGE_UNLOCK();
+#endif
+}
+
+/*
+ * Initialize the page cache.
+ */
+void
+page_init(void)
+{
+#if NPAGES > 0
+	struct page *pg;
+	int i;
+
+	for (i = 0; i < PAGE_HASHSIZE; i++)
+		list_init(&page_hash[i]);
+	for (i = 0; i < NPAGES; i++) {
+		pg = &page_table[i];
+		pg->p_vnode = NULL;
+		pg->p_refcnt = 0;
+		pg->p_data = pages[i];
+		list_insert(&lru_list, &pg->p_lru);
+	}
+#endif
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vfs_rwlock.c - reader/writer lock for file systems
+ */
+
+/*
+ * A file system uses this lock to protect its node data.
+ * The lock is built on a mutex and a condition variable.
+ * A waiting writer blocks new readers so that writers are
+ * not starved by a stream of readers.  A writer can take
+ * the lock again, either for read or write.
+ */
+
+#include <sys/prex.h>
+#include <sys/vnode.h>
+
+#include "vfs.h"
+
+#if CONFIG_FS_THREADS > 1
+void
+rw_init(struct rwlock *rw)
+{
+
+	mutex_init(&rw->rw_mutex);
+	cond_init(&rw->rw_cond);
+	rw->rw_readers = 0;
+	rw->rw_wwait = 0;
+	rw->rw_wlocks = 0;
+	rw->rw_owner = 0;
+}
+
+void
+rw_destroy(struct rwlock *rw)
+{
+
+	ASSERT(rw->rw_readers == 0 && rw->rw_wlocks == 0);
+	cond_destroy(&rw->rw_cond);
+	mutex_destroy(&rw->rw_mutex);
+}
+
+/*
+ * Lock for read.
+ */
+void
+rw_rlock(struct rwlock *rw)
+{
+	thread_t self = thread_self();
+
+	mutex_lock(&rw->rw_mutex);
+	if (rw->rw_wlocks > 0 && rw->rw_owner == self) {
+		/* We already have the write lock. */
+		rw->rw_wlocks++;
+	} else {
+		while (rw->rw_wlocks > 0 || rw->rw_wwait > 0)
+			cond_wait(&rw->rw_cond, &rw->rw_mutex);
+		rw->rw_readers++;
+	}
+	mutex_unlock(&rw->rw_mutex);
+}
+
+/*
+ * Lock for write.
+ */
+void
+rw_wlock(struct rwlock *rw)
+{
+	thread_t self = thread_self();
+
+	mutex_lock(&rw->rw_mutex);
+	if (rw->rw_wlocks > 0 && rw->rw_owner == self) {
+		rw->rw_wlocks++;
+	} else {
+		rw->rw_wwait++;
+		while (rw->rw_wlocks > 0 || rw->rw_readers > 0)
+			cond_wait(&rw->rw_cond, &rw->rw_mutex);
+		rw->rw_wwait--;
+		rw->rw_wlocks = 1;
+		rw->rw_owner = self;
+	}
+	mutex_unlock(&rw->rw_mutex);
+}
+
+/*
+ * Release the read or write lock.
+ */
+void
+rw_unlock(struct rwlock *rw)
+{
+	int wakeup = 0;
+
+	mutex_lock(&rw->rw_mutex);
+	if (rw->rw_wlocks > 0) {
+		ASSERT(rw->rw_owner == thread_self());
+		if (--rw->rw_wlocks == 0) {
+			rw->rw_owner = 0;
+			wakeup = 1;
+		}
+	} else {
+		ASSERT(rw->rw_readers > 0);
+		if (--rw->rw_readers == 0)
+			wakeup = 1;
+	}
+	if (wakeup)
+		cond_broadcast(&rw->rw_cond);
+	mutex_unlock(&rw->rw_mutex);
+}
+#endif /* CONFIG_FS_THREADS > 1 */
@@ -40,6 +40,7 @@
 #include <sys/dirent.h>
 #include <sys/list.h>
 #include <sys/buf.h>
+#include <ipc/fs.h>
 
 #include <limits.h>
 #include <unistd.h>
@@ -122,6 +123,9 @@ sys_open(char *path, int flags, mode_t mode, file_t *pfp)
 			vput(vp);
 			return error;
 		}
+		page_purge(vp);
+		if (vp->v_object != NULL)
+			mmap_truncate(vp);
 	}
 	/* Setup file structure */
 	if (!(fp = malloc(sizeof(struct file)))) {
@@ -188,7 +192,10 @@ sys_read(file_t fp, void *buf, size_t size, size_t *count)
 	}
 	vp = fp->f_vnode;
 	vn_lock(vp);
-	error = VOP_READ(vp, fp, buf, size, count);
+	if (vp->v_object != NULL)
+		error = mmap_read(vp, fp, buf, size, count);
+	else
+		error = page_read(vp, fp, buf, size, count);
 	vn_unlock(vp);
 	return error;
 }
@@ -210,7 +217,9 @@ sys_write(file_t fp, void *buf, size_t size, size_t *count)
 	}
 	vp = fp->f_vnode;
 	vn_lock(vp);
-	error = VOP_WRITE(vp, fp, buf, size, count);
+	error = page_write(vp, fp, buf, size, count);
+	if (error == 0 && vp->v_object != NULL)
+		mmap_write(vp, fp->f_offset - (off_t)*count, buf, *count);
 	vn_unlock(vp);
 	return error;
 }
@@ -457,6 +466,135 @@ sys_telldir(file_t fp, long *loc)
 	return 0;
 }
 
+/*
+ * Get the full path name of the directory entry.
+ * "." and ".." are resolved here since not all file
+ * systems can look them up.
+ */
+static int
+dirent_path(vnode_t dvp, char *name, char *path)
+{
+	char *p;
+
+	if (strcmp(dvp->v_mount->m_path, "/"))
+		strlcpy(path, dvp->v_mount->m_path, PATH_MAX);
+	else
+		path[0] = '\0';
+	if (strcmp(dvp->v_path, "/"))
+		strlcat(path, dvp->v_path, PATH_MAX);
+
+	if (!strcmp(name, "..")) {
+		if ((p = strrchr(path, '/')) != NULL)
+			*p = '\0';
+	} else if (strcmp(name, ".")) {
+		strlcat(path, "/", PATH_MAX);
+		if (strlcat(path, name, PATH_MAX) >= PATH_MAX)
+			return ENAMETOOLONG;
+	}
+	if (path[0] == '\0')
+		strlcpy(path, "/", PATH_MAX);
+	return 0;
+}
+
+/*
+ * Read as many directory entries as fit in the buffer.
+ * The entries are packed with _DIRENT_RECLEN() and, if
+ * DIRENTS_STAT is set, each one is followed by its stat.
+ * Returns 0 with no entries at the end of the directory.
+ */
+int
+sys_getdirentries(file_t fp, char *buf, size_t size, int flags,
+		  size_t *count)
+{
+	char path[PATH_MAX];
+	struct dirent dir;
+	struct dirent *dp;
+	vnode_t dvp;
+	size_t len, pos, reclen, namoff;
+	off_t off;
+	int error, full = 0;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_getdirentries: fp=%x size=%d\n",
+				fp, size));
+
+	dvp = fp->f_vnode;
+	vn_lock(dvp);
+	if (dvp->v_type != VDIR) {
+		vn_unlock(dvp);
+		return EBADF;
+	}
+	namoff = _DIRENT_NAMEOFF;
+	len = 0;
+	for (;;) {
+		off = fp->f_offset;
+		if ((error = VOP_READDIR(dvp, fp, &dir)) != 0) {
+			if (error != ENOENT && len > 0) {
+				/*
+				 * Return the entries we have.  The failed
+				 * entry is read again, and its error is
+				 * reported, by the next request.
+				 */
+				fp->f_offset = off;
+				error = 0;
+			}
+			break;
+		}
+		reclen = _DIRENT_RECLEN(dir.d_namlen);
+		if (flags & DIRENTS_STAT)
+			reclen += sizeof(struct stat);
+		if (len + reclen > size) {
+			/* Keep this entry for the next request. */
+			fp->f_offset = off;
+			full = 1;
+			break;
+		}
+		dp = (struct dirent *)(buf + len);
+		memcpy(dp, &dir, namoff + dir.d_namlen);
+		memset(dp->d_name + dir.d_namlen, 0,
+		       _DIRENT_RECLEN(dir.d_namlen) - namoff - dir.d_namlen);
+		dp->d_reclen = (uint16_t)reclen;
+		len += reclen;
+	}
+	if (error == ENOENT)
+		error = 0;
+	if (error == 0 && len == 0 && full) {
+		/* The buffer can not hold even one entry. */
+		error = EINVAL;
+	}
+	if (error != 0 || !(flags & DIRENTS_STAT)) {
+		vn_unlock(dvp);
+		*count = len;
+		return error;
+	}
+
+	/*
+	 * Fill the stat of each entry.  The directory is
+	 * unlocked first because namei() locks vnodes from
+	 * the root downward.
+	 */
+	vref(dvp);
+	vn_unlock(dvp);
+	for (pos = 0; pos < len; pos += dp->d_reclen) {
+		dp = (struct dirent *)(buf + pos);
+		if (!strcmp(dp->d_name, ".")) {
+			vn_lock(dvp);
+			error = vn_stat(dvp, DIRENT_STAT(dp));
+			vn_unlock(dvp);
+		} else {
+			error = dirent_path(dvp, dp->d_name, path);
+			if (error == 0)
+				error = sys_stat(path, DIRENT_STAT(dp));
+		}
+		if (error) {
+			/* The entry may be removed in the meantime. */
+			memset(DIRENT_STAT(dp), 0, sizeof(struct stat));
+		}
+	}
+	vrele(dvp);
+	*count = len;
+	return 0;
+}
+
 int
 sys_mkdir(char *path, mode_t mode)
 {
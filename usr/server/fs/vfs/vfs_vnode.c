@@ -225,6 +225,7 @@ vput(vnode_t vp)
 	/*
 	 * Deallocate fs specific vnode data
 	 */
+	page_purge(vp);
 	VOP_INACTIVE(vp);
 	vfs_unbusy(vp->v_mount);
 	vp->v_nrlocks--;
@@ -277,6 +278,7 @@ vrele(vnode_t vp)
 	/*
 	 * Deallocate fs specific vnode data
 	 */
+	page_purge(vp);
 	VOP_INACTIVE(vp);
 	vfs_unbusy(vp->v_mount);
 	mutex_destroy(&vp->v_lock);
@@ -295,6 +297,7 @@ vgone(vnode_t vp)
 	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vgone: %s\n", vp->v_path));
 	list_remove(&vp->v_link);
+	page_purge(vp);
 	vfs_unbusy(vp->v_mount);
 	mutex_destroy(&vp->v_lock);
 	free(vp->v_path);
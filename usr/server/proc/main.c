@@ -53,6 +53,7 @@
 #include <ipc/proc.h>
 #include <ipc/ipc.h>
 #include <ipc/exec.h>
+#include <ipc/dispatch.h>
 #include <sys/list.h>
 
 #include <unistd.h>
@@ -83,6 +84,7 @@ static int proc_boot(struct msg *);
 static int proc_shutdown(struct msg *);
 static int proc_noop(struct msg *);
 static int proc_debug(struct msg *);
+static int proc_msgstat(struct msg *);
 
 /*
  * Message mapping
@@ -112,9 +114,20 @@ static const struct msg_map procmsg_map[] = {
 	{STD_BOOT,	proc_boot},
 	{STD_SHUTDOWN,	proc_shutdown},
 	{STD_DEBUG,	proc_debug},
+	{STD_MSGSTAT,	proc_msgstat},
 	{0,		proc_noop},
 };
 
+/*
+ * Message buffer
+ */
+union procmsg {
+	struct msg	   m;
+	struct msgstat_msg ms;
+};
+
+static struct msg_dispatch proc_dispatch;	/* dispatch table */
+
 static struct proc proc0;	/* process data of this server (pid=0) */
 static struct pgrp pgrp0;	/* process group for first process */
 static struct session session0;	/* session for first process */
@@ -464,17 +477,36 @@ proc_debug(struct msg *msg)
 			stat[p->p_stat], p->p_task);
 	}
 	dprintf("\n");
+	msg_dispatch_dump(&proc_dispatch);
 #endif
 	return 0;
 }
 
+static int
+proc_msgstat(struct msg *msg)
+{
+
+	return msg_dispatch_getstat(&proc_dispatch,
+				    (struct msgstat_msg *)msg);
+}
+
 static void
 proc_init(void)
 {
+	const struct msg_map *map;
 
 	list_init(&allproc);
 	tty_init();
 	table_init();
+
+	if (msg_dispatch_init(&proc_dispatch, PS_GETPID,
+			      MSG_NUMBER(PS_TRACE) + 1) != 0)
+		sys_panic("proc: no memory for dispatch table");
+	for (map = &procmsg_map[0]; map->code != 0; map++) {
+		if (msg_dispatch_add(&proc_dispatch, map->code,
+				     map - procmsg_map) != 0)
+			sys_panic("proc: bad message code");
+	}
 }
 
 
@@ -521,10 +553,12 @@ proc0_init(void)
 int
 main(int argc, char *argv[])
 {
-	static struct msg msg;
+	static union procmsg buf;
+	struct msg *msg = &buf.m;
 	const struct msg_map *map;
 	object_t obj;
-	int error;
+	u_long sent, start;
+	int error, slot;
 
 	sys_log("Starting process server\n");
 
@@ -548,34 +582,36 @@ main(int argc, char *argv[])
 		/*
 		 * Wait for an incoming request.
 		 */
-		error = msg_receive(obj, &msg, sizeof(msg));
+		error = msg_receive(obj, &buf, sizeof(buf));
 		if (error)
 			continue;
 
+		sys_time(&start);
+		sent = msg->hdr.time;
+
 		DPRINTF(("proc: msg code=%x task=%x\n",
-			 msg.hdr.code, msg.hdr.task));
+			 msg->hdr.code, msg->hdr.task));
 
 		error = EINVAL;
-		map = &procmsg_map[0];
-		while (map->code != 0) {
-			if (map->code == msg.hdr.code) {
-
-				/* Get current process */
-				curproc = task_to_proc(msg.hdr.task);
-				error = (*map->func)(&msg);
-				break;
-			}
-			map++;
+		slot = msg_dispatch_slot(&proc_dispatch, msg->hdr.code);
+		if (slot != -1) {
+			map = &procmsg_map[proc_dispatch.md_index[slot]];
+
+			/* Get current process */
+			curproc = task_to_proc(msg->hdr.task);
+			error = (*map->func)(msg);
+			msg_dispatch_account(&proc_dispatch, slot, sent, start,
+					     error);
 		}
 		/*
 		 * Reply to the client.
 		 */
-		msg.hdr.status = error;
-		msg_reply(obj, &msg, sizeof(msg));
+		msg->hdr.status = error;
+		msg_reply(obj, &buf, sizeof(buf));
 #ifdef DEBUG_PROC
 		if (error) {
 			DPRINTF(("proc: msg code=%x error=%d\n",
-				 map->code, error));
+				 msg->hdr.code, error));
 		}
 #endif
 	}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2009, Kohsuke Ohtani
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * random.c - test random device driver.
+ */
+
+#include <sys/prex.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BUFSZ		(256 * 1024)	/* bytes per read */
+#define TOTAL_MB	64		/* bytes to read for the benchmark */
+
+static u_long count[256];
+
+/*
+ * Check that two reads differ and the bytes look uniform.
+ */
+static int
+test_quality(device_t dev, u_char *buf)
+{
+	u_char a[16], b[16];
+	size_t len;
+	u_long expect, diff, sum;
+	int i;
+
+	len = sizeof(a);
+	if (device_read(dev, a, &len, 0) || len != sizeof(a))
+		return -1;
+	len = sizeof(b);
+	if (device_read(dev, b, &len, 0) || len != sizeof(b))
+		return -1;
+	if (memcmp(a, b, sizeof(a)) == 0) {
+		printf("two reads returned the same data\n");
+		return -1;
+	}
+
+	len = BUFSZ;
+	if (device_read(dev, buf, &len, 0) || len != BUFSZ)
+		return -1;
+	for (i = 0; i < BUFSZ; i++)
+		count[buf[i]]++;
+
+	/*
+	 * Chi-square with 255 degrees of freedom.  A value over
+	 * 330 happens with a probability of less than 0.1%.
+	 */
+	expect = BUFSZ / 256;
+	sum = 0;
+	for (i = 0; i < 256; i++) {
+		diff = (count[i] > expect) ? count[i] - expect :
+		    expect - count[i];
+		sum += diff * diff;
+	}
+	printf("chi-square: %d\n", (int)(sum / expect));
+	if (sum / expect > 330) {
+		printf("distribution is not uniform\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Measure the throughput of bulk reads.
+ */
+static int
+test_throughput(device_t dev, u_char *buf)
+{
+	struct timerinfo info;
+	u_long start, end, msec;
+	size_t len;
+	int i;
+
+	sys_info(INFO_TIMER, &info);
+	if (info.hz == 0)
+		return -1;
+
+	sys_time(&start);
+	for (i = 0; i < TOTAL_MB * (1024 * 1024 / BUFSZ); i++) {
+		len = BUFSZ;
+		if (device_read(dev, buf, &len, 0) || len != BUFSZ)
+			return -1;
+	}
+	sys_time(&end);
+
+	msec = (end - start) * 1000 / info.hz;
+	if (msec == 0)
+		msec = 1;
+	printf("read %d MB in %d msec: %d KB/s\n", TOTAL_MB, (int)msec,
+	       (int)(TOTAL_MB * 1024UL * 1000 / msec));
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	device_t dev;
+	u_char *buf;
+	int error;
+
+	printf("random test\n");
+
+	error = vm_allocate(task_self(), (void **)&buf, BUFSZ, 1);
+	if (error)
+		panic("vm_allocate is failed");
+
+	/* /dev/random blocks until it is seeded */
+	error = device_open("random", 0, &dev);
+	if (error) {
+		printf("device open error!\n");
+		return 0;
+	}
+	if (test_quality(dev, buf))
+		printf("random: test failed\n");
+	device_close(dev);
+
+	error = device_open("urandom", 0, &dev);
+	if (error) {
+		printf("device open error!\n");
+		return 0;
+	}
+	if (test_throughput(dev, buf))
+		printf("urandom: read failed\n");
+	device_close(dev);
+
+	vm_free(task_self(), buf);
+	printf("test completed\n");
+	return 0;
+}